@@ -0,0 +1,943 @@
+#include "BlockCompression.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+const char* BlockFormatName(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    case BlockFormat::BC7: return "BC7";
+    }
+    return "unknown";
+}
+
+const char* BlockQualityName(BlockQuality quality)
+{
+    return quality == BlockQuality::Quality ? "quality" : "fast";
+}
+
+unsigned BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+namespace
+{
+    const int REFINE_ITERATIONS = 2;                //Least-squares endpoint refits in quality mode
+    const unsigned BAND_BLOCK_ROWS = 8;             //Block rows per job
+    const uint32_t CACHE_VERSION = 1;               //Bump when the encoder output changes, old cache files then miss
+
+    typedef uint8_t Block[16][4];                   //4x4 RGBA8 pixels, row by row
+
+    void FetchBlock(const SoftwareTexture& texture, unsigned blockX, unsigned blockY, Block pixels)
+    {
+        for (unsigned y = 0; y < 4; ++y)
+        {
+            unsigned row = std::min(blockY * 4 + y, texture.height - 1);
+            for (unsigned x = 0; x < 4; ++x)
+            {
+                unsigned column = std::min(blockX * 4 + x, texture.width - 1);
+                uint32_t texel = texture.texels[size_t(row) * texture.width + column];
+                for (int c = 0; c < 4; ++c)
+                    pixels[y * 4 + x][c] = static_cast<uint8_t>(texel >> (c * 8));
+            }
+        }
+    }
+
+    class BitWriter                 //Little-endian bit stream, as BC7 blocks are laid out
+    {
+    public:
+        explicit BitWriter(uint8_t* output) : output(output) { std::memset(output, 0, 16); }
+
+        void Write(uint32_t value, unsigned bits)
+        {
+            for (unsigned i = 0; i < bits; ++i, ++position)
+                output[position >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (position & 7));
+        }
+
+    private:
+        uint8_t* output;
+        unsigned position = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        explicit BitReader(const uint8_t* input) : input(input) {}
+
+        uint32_t Read(unsigned bits)
+        {
+            uint32_t value = 0;
+            for (unsigned i = 0; i < bits; ++i, ++position)
+                value |= static_cast<uint32_t>((input[position >> 3] >> (position & 7)) & 1) << i;
+            return value;
+        }
+
+    private:
+        const uint8_t* input;
+        unsigned position = 0;
+    };
+
+    //Line through the points that the endpoints are taken from: the bounding box diagonal with its signs fixed up by the
+    //covariance (fast) or the principal axis from power iteration (quality). Endpoints are the extreme projections.
+    template<int CHANNELS>
+    void FitEndpoints(const float (*points)[4], int count, BlockQuality quality, float endpoints[2][4])
+    {
+        float mean[4] = {}, low[4], high[4];
+        for (int c = 0; c < CHANNELS; ++c)
+        {
+            low[c] = high[c] = points[0][c];
+            for (int i = 0; i < count; ++i)
+            {
+                mean[c] += points[i][c];
+                low[c] = std::min(low[c], points[i][c]);
+                high[c] = std::max(high[c], points[i][c]);
+            }
+            mean[c] /= count;
+        }
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < count; ++i)
+            for (int a = 0; a < CHANNELS; ++a)
+                for (int b = 0; b < CHANNELS; ++b)
+                    covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+
+        float axis[4];
+        int widest = 0;
+        for (int c = 0; c < CHANNELS; ++c)
+        {
+            axis[c] = high[c] - low[c];
+            if (axis[c] > axis[widest])
+                widest = c;
+        }
+        for (int c = 0; c < CHANNELS; ++c)
+            if (covariance[c][widest] < 0.0f)
+                axis[c] = -axis[c];
+
+        if (quality == BlockQuality::Quality)
+            for (int iteration = 0; iteration < 8; ++iteration)
+            {
+                float next[4] = {}, length = 0.0f;
+                for (int a = 0; a < CHANNELS; ++a)
+                {
+                    for (int b = 0; b < CHANNELS; ++b)
+                        next[a] += covariance[a][b] * axis[b];
+                    length = std::max(length, std::fabs(next[a]));
+                }
+                if (length == 0.0f)
+                    break;
+                for (int c = 0; c < CHANNELS; ++c)
+                    axis[c] = next[c] / length;
+            }
+
+        float lengthSquared = 0.0f;
+        for (int c = 0; c < CHANNELS; ++c)
+            lengthSquared += axis[c] * axis[c];
+
+        float tMin = 0.0f, tMax = 0.0f;
+        if (lengthSquared > 0.0f)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                float t = 0.0f;
+                for (int c = 0; c < CHANNELS; ++c)
+                    t += (points[i][c] - mean[c]) * axis[c];
+                t /= lengthSquared;
+                tMin = std::min(tMin, t);
+                tMax = std::max(tMax, t);
+            }
+        }
+
+        for (int c = 0; c < CHANNELS; ++c)
+        {
+            endpoints[0][c] = std::min(std::max(mean[c] + tMin * axis[c], 0.0f), 255.0f);
+            endpoints[1][c] = std::min(std::max(mean[c] + tMax * axis[c], 0.0f), 255.0f);
+        }
+    }
+
+    //Endpoints minimising the squared error for fixed interpolation weights (0 = first endpoint, 1 = second)
+    template<int CHANNELS>
+    bool RefitEndpoints(const float (*points)[4], const float* weights, int count, float endpoints[2][4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[4] = {}, bx[4] = {};
+        for (int i = 0; i < count; ++i)
+        {
+            float b = weights[i], a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < CHANNELS; ++c)
+            {
+                ax[c] += a * points[i][c];
+                bx[c] += b * points[i][c];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            return false;
+
+        for (int c = 0; c < CHANNELS; ++c)
+        {
+            endpoints[0][c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+            endpoints[1][c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    //BC1 colour block
+
+    uint16_t Pack565(const float color[4])
+    {
+        unsigned r = static_cast<unsigned>(color[0] * 31.0f / 255.0f + 0.5f);
+        unsigned g = static_cast<unsigned>(color[1] * 63.0f / 255.0f + 0.5f);
+        unsigned b = static_cast<unsigned>(color[2] * 31.0f / 255.0f + 0.5f);
+        return static_cast<uint16_t>(r << 11 | g << 5 | b);
+    }
+
+    void Unpack565(uint16_t packed, int color[3])
+    {
+        int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = r << 3 | r >> 2;
+        color[1] = g << 2 | g >> 4;
+        color[2] = b << 3 | b >> 2;
+    }
+
+    //Palette of a colour block; entry 3 is transparent black in the 3-colour mode
+    void ColorPalette(uint16_t color0, uint16_t color1, bool fourColor, int palette[4][4])
+    {
+        Unpack565(color0, palette[0]);
+        Unpack565(color1, palette[1]);
+        palette[0][3] = palette[1][3] = 255;
+        for (int c = 0; c < 3; ++c)
+        {
+            if (fourColor)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+        palette[2][3] = 255;
+        palette[3][3] = fourColor ? 255 : 0;
+    }
+
+    struct ColorBlock
+    {
+        uint16_t color0, color1;
+        uint32_t indices;
+        int error;
+    };
+
+    ColorBlock SelectColorIndices(const Block pixels, const bool* transparent, uint16_t color0, uint16_t color1, bool fourColor)
+    {
+        ColorBlock block = { color0, color1, 0, 0 };
+        int palette[4][4];
+        ColorPalette(color0, color1, fourColor, palette);
+        int choices = fourColor ? 4 : 3;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            if (transparent[i])
+            {
+                block.indices |= 3u << (i * 2);
+                continue;
+            }
+
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < choices; ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; ++c)
+                    error += (pixels[i][c] - palette[p][c]) * (pixels[i][c] - palette[p][c]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            block.indices |= static_cast<uint32_t>(best) << (i * 2);
+            block.error += bestError;
+        }
+        return block;
+    }
+
+    //Orders the endpoints for the mode (color0 > color1 selects four colours) and picks the indices
+    ColorBlock QuantizeColorBlock(const Block pixels, const bool* transparent, const float endpoints[2][4], bool fourColor)
+    {
+        uint16_t color0 = Pack565(endpoints[0]), color1 = Pack565(endpoints[1]);
+        if (fourColor ? color0 < color1 : color0 > color1)
+            std::swap(color0, color1);
+        return SelectColorIndices(pixels, transparent, color0, color1, fourColor && color0 != color1);
+    }
+
+    //punchThrough: BC1, where texels with alpha below 128 become transparent; otherwise BC3's colour half, opaque throughout
+    void EncodeColorBlock(const Block pixels, BlockQuality quality, bool punchThrough, uint8_t* output)
+    {
+        bool transparent[16];
+        float points[16][4];
+        int count = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            transparent[i] = punchThrough && pixels[i][3] < 128;
+            if (!transparent[i])
+            {
+                for (int c = 0; c < 4; ++c)
+                    points[count][c] = pixels[i][c];
+                ++count;
+            }
+        }
+
+        ColorBlock block = { 0, 0, 0xFFFFFFFF, 0 };         //Fully transparent: 3-colour mode, every index transparent
+        if (count > 0)
+        {
+            bool fourColor = count == 16;
+            float endpoints[2][4];
+            FitEndpoints<3>(points, count, BlockQuality::Fast, endpoints);
+            block = QuantizeColorBlock(pixels, transparent, endpoints, fourColor);
+
+            if (quality == BlockQuality::Quality && block.error > 0)       //The principal axis usually wins, but not always
+            {
+                FitEndpoints<3>(points, count, quality, endpoints);
+                ColorBlock candidate = QuantizeColorBlock(pixels, transparent, endpoints, fourColor);
+                if (candidate.error < block.error)
+                    block = candidate;
+            }
+
+            for (int iteration = 0; quality == BlockQuality::Quality && iteration < REFINE_ITERATIONS && block.error > 0; ++iteration)
+            {
+                //Weights of the opaque pixels along color0 -> color1 for the current indices
+                const float FOUR_COLOR_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+                const float THREE_COLOR_WEIGHTS[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+                bool blockFourColor = block.color0 > block.color1;
+                float weights[16];
+                for (int i = 0, n = 0; i < 16; ++i)
+                    if (!transparent[i])
+                    {
+                        unsigned index = (block.indices >> (i * 2)) & 3;
+                        weights[n++] = blockFourColor ? FOUR_COLOR_WEIGHTS[index] : THREE_COLOR_WEIGHTS[index];
+                    }
+
+                float refined[2][4];
+                if (!RefitEndpoints<3>(points, weights, count, refined))
+                    break;
+
+                ColorBlock candidate = QuantizeColorBlock(pixels, transparent, refined, fourColor);
+                if (candidate.error >= block.error)
+                    break;
+                block = candidate;
+            }
+        }
+
+        output[0] = static_cast<uint8_t>(block.color0);
+        output[1] = static_cast<uint8_t>(block.color0 >> 8);
+        output[2] = static_cast<uint8_t>(block.color1);
+        output[3] = static_cast<uint8_t>(block.color1 >> 8);
+        for (int i = 0; i < 4; ++i)
+            output[4 + i] = static_cast<uint8_t>(block.indices >> (i * 8));
+    }
+
+    //BC3 alpha block: two 8-bit endpoints, 3-bit indices. alpha0 > alpha1 interpolates 8 values, otherwise 6 plus 0 and 255.
+
+    void AlphaPalette(int alpha0, int alpha1, int palette[8])
+    {
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+        if (alpha0 > alpha1)
+            for (int i = 1; i < 7; ++i)
+                palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+        else
+        {
+            for (int i = 1; i < 5; ++i)
+                palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    int EncodeAlphaCandidate(const Block pixels, int alpha0, int alpha1, uint64_t& bits)
+    {
+        int palette[8];
+        AlphaPalette(alpha0, alpha1, palette);
+
+        bits = static_cast<uint64_t>(alpha0) | static_cast<uint64_t>(alpha1) << 8;
+        int total = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 8; ++p)
+            {
+                int error = (pixels[i][3] - palette[p]) * (pixels[i][3] - palette[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            bits |= static_cast<uint64_t>(best) << (16 + i * 3);
+            total += bestError;
+        }
+        return total;
+    }
+
+    void EncodeAlphaBlock(const Block pixels, BlockQuality quality, uint8_t* output)
+    {
+        int low = 255, high = 0, innerLow = 255, innerHigh = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int alpha = pixels[i][3];
+            low = std::min(low, alpha);
+            high = std::max(high, alpha);
+            if (alpha != 0 && alpha != 255)
+            {
+                innerLow = std::min(innerLow, alpha);
+                innerHigh = std::max(innerHigh, alpha);
+            }
+        }
+
+        uint64_t bits;
+        int error = EncodeAlphaCandidate(pixels, high, low, bits);
+
+        //The 6-value mode spends its interpolants on the range between the exact 0 and 255 texels
+        if (quality == BlockQuality::Quality && error > 0 && innerLow <= innerHigh)
+        {
+            uint64_t candidateBits;
+            if (EncodeAlphaCandidate(pixels, innerLow, innerHigh, candidateBits) < error)
+                bits = candidateBits;
+        }
+
+        for (int i = 0; i < 8; ++i)
+            output[i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+
+    //BC7 mode 6
+
+    const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    struct Bc7Block
+    {
+        int endpoints[2][4];        //7-bit
+        int pBits[2];
+        uint8_t indices[16];
+        int error;
+    };
+
+    void Bc7Palette(const int endpoints[2][4], const int pBits[2], int palette[16][4])
+    {
+        int expanded[2][4];
+        for (int e = 0; e < 2; ++e)
+            for (int c = 0; c < 4; ++c)
+                expanded[e][c] = endpoints[e][c] << 1 | pBits[e];
+
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+                palette[i][c] = ((64 - BC7_WEIGHTS[i]) * expanded[0][c] + BC7_WEIGHTS[i] * expanded[1][c] + 32) >> 6;
+    }
+
+    Bc7Block QuantizeBc7Block(const Block pixels, const float endpoints[2][4], int pBit0, int pBit1)
+    {
+        Bc7Block block;
+        block.pBits[0] = pBit0;
+        block.pBits[1] = pBit1;
+        for (int e = 0; e < 2; ++e)
+            for (int c = 0; c < 4; ++c)
+                block.endpoints[e][c] = std::min(std::max(static_cast<int>((endpoints[e][c] - block.pBits[e]) * 0.5f + 0.5f), 0), 127);
+
+        int palette[16][4];
+        Bc7Palette(block.endpoints, block.pBits, palette);
+
+        //The projection onto the endpoint line lands within one index of the nearest entry, only those three are compared
+        int axis[4], axisLengthSquared = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            axis[c] = palette[15][c] - palette[0][c];
+            axisLengthSquared += axis[c] * axis[c];
+        }
+
+        block.error = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int guess = 0;
+            if (axisLengthSquared > 0)
+            {
+                int dot = 0;
+                for (int c = 0; c < 4; ++c)
+                    dot += (pixels[i][c] - palette[0][c]) * axis[c];
+                int weight = std::min(std::max((dot * 64 + axisLengthSquared / 2) / axisLengthSquared, 0), 64);
+                while (guess < 15 && BC7_WEIGHTS[guess + 1] - weight < weight - BC7_WEIGHTS[guess])
+                    ++guess;
+            }
+
+            int best = 0, bestError = INT32_MAX;
+            for (int p = std::max(guess - 1, 0); p <= std::min(guess + 1, 15); ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; ++c)
+                    error += (pixels[i][c] - palette[p][c]) * (pixels[i][c] - palette[p][c]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            block.indices[i] = static_cast<uint8_t>(best);
+            block.error += bestError;
+        }
+        return block;
+    }
+
+    //Fast picks each p-bit from the parity of its endpoint's channels, quality tries all four combinations
+    Bc7Block QuantizeBc7Block(const Block pixels, const float endpoints[2][4], BlockQuality quality)
+    {
+        if (quality == BlockQuality::Fast)
+        {
+            int pBits[2];
+            for (int e = 0; e < 2; ++e)
+            {
+                float odd = 0.0f;
+                for (int c = 0; c < 4; ++c)
+                    odd += endpoints[e][c] - 2.0f * std::floor(endpoints[e][c] * 0.5f);
+                pBits[e] = odd > 2.0f ? 1 : 0;
+            }
+            return QuantizeBc7Block(pixels, endpoints, pBits[0], pBits[1]);
+        }
+
+        Bc7Block best = QuantizeBc7Block(pixels, endpoints, 0, 0);
+        for (int combination = 1; combination < 4 && best.error > 0; ++combination)
+        {
+            Bc7Block candidate = QuantizeBc7Block(pixels, endpoints, combination & 1, combination >> 1);
+            if (candidate.error < best.error)
+                best = candidate;
+        }
+        return best;
+    }
+
+    void EncodeBc7Block(const Block pixels, BlockQuality quality, uint8_t* output)
+    {
+        float points[16][4];
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+                points[i][c] = pixels[i][c];
+
+        float endpoints[2][4];
+        FitEndpoints<4>(points, 16, BlockQuality::Fast, endpoints);
+        Bc7Block block = QuantizeBc7Block(pixels, endpoints, quality);
+
+        if (quality == BlockQuality::Quality && block.error > 0)
+        {
+            FitEndpoints<4>(points, 16, quality, endpoints);
+            Bc7Block candidate = QuantizeBc7Block(pixels, endpoints, quality);
+            if (candidate.error < block.error)
+                block = candidate;
+        }
+
+        for (int iteration = 0; quality == BlockQuality::Quality && iteration < REFINE_ITERATIONS && block.error > 0; ++iteration)
+        {
+            float weights[16];
+            for (int i = 0; i < 16; ++i)
+                weights[i] = BC7_WEIGHTS[block.indices[i]] / 64.0f;
+
+            float refined[2][4];
+            if (!RefitEndpoints<4>(points, weights, 16, refined))
+                break;
+
+            Bc7Block candidate = QuantizeBc7Block(pixels, refined, quality);
+            if (candidate.error >= block.error)
+                break;
+            block = candidate;
+        }
+
+        //The first index is stored without its top bit, which must therefore be 0
+        if (block.indices[0] & 8)
+        {
+            for (int c = 0; c < 4; ++c)
+                std::swap(block.endpoints[0][c], block.endpoints[1][c]);
+            std::swap(block.pBits[0], block.pBits[1]);
+            for (uint8_t& index : block.indices)
+                index = static_cast<uint8_t>(15 - index);
+        }
+
+        BitWriter writer(output);
+        writer.Write(1u << 6, 7);       //Mode 6
+        for (int c = 0; c < 4; ++c)
+        {
+            writer.Write(block.endpoints[0][c], 7);
+            writer.Write(block.endpoints[1][c], 7);
+        }
+        writer.Write(block.pBits[0], 1);
+        writer.Write(block.pBits[1], 1);
+        writer.Write(block.indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+            writer.Write(block.indices[i], 4);
+    }
+
+    void EncodeBlock(const Block pixels, BlockFormat format, BlockQuality quality, uint8_t* output)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1:
+            EncodeColorBlock(pixels, quality, true, output);
+            break;
+        case BlockFormat::BC3:
+            EncodeAlphaBlock(pixels, quality, output);
+            EncodeColorBlock(pixels, quality, false, output + 8);
+            break;
+        case BlockFormat::BC7:
+            EncodeBc7Block(pixels, quality, output);
+            break;
+        }
+    }
+
+    void DecodeColorBlock(const uint8_t* input, bool alwaysFourColor, Block pixels)
+    {
+        uint16_t color0 = static_cast<uint16_t>(input[0] | input[1] << 8);
+        uint16_t color1 = static_cast<uint16_t>(input[2] | input[3] << 8);
+        uint32_t indices = input[4] | input[5] << 8 | input[6] << 16 | static_cast<uint32_t>(input[7]) << 24;
+
+        int palette[4][4];
+        ColorPalette(color0, color1, alwaysFourColor || color0 > color1, palette);
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+                pixels[i][c] = static_cast<uint8_t>(palette[(indices >> (i * 2)) & 3][c]);
+    }
+
+    void DecodeBlock(const uint8_t* input, BlockFormat format, Block pixels)
+    {
+        if (format == BlockFormat::BC1)
+        {
+            DecodeColorBlock(input, false, pixels);
+            return;
+        }
+
+        if (format == BlockFormat::BC3)
+        {
+            DecodeColorBlock(input + 8, true, pixels);
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; ++i)
+                bits |= static_cast<uint64_t>(input[i]) << (i * 8);
+
+            int palette[8];
+            AlphaPalette(input[0], input[1], palette);
+            for (int i = 0; i < 16; ++i)
+                pixels[i][3] = static_cast<uint8_t>(palette[(bits >> (16 + i * 3)) & 7]);
+            return;
+        }
+
+        std::memset(pixels, 0, sizeof(Block));
+        BitReader reader(input);
+        if (reader.Read(7) != 1u << 6)
+            return;
+
+        Bc7Block block;
+        for (int c = 0; c < 4; ++c)
+        {
+            block.endpoints[0][c] = static_cast<int>(reader.Read(7));
+            block.endpoints[1][c] = static_cast<int>(reader.Read(7));
+        }
+        block.pBits[0] = static_cast<int>(reader.Read(1));
+        block.pBits[1] = static_cast<int>(reader.Read(1));
+
+        int palette[16][4];
+        Bc7Palette(block.endpoints, block.pBits, palette);
+        for (int i = 0; i < 16; ++i)
+        {
+            uint32_t index = reader.Read(i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; ++c)
+                pixels[i][c] = static_cast<uint8_t>(palette[index][c]);
+        }
+    }
+}
+
+CompressedTexture CompressTexture(const SoftwareTexture& texture, BlockFormat format, BlockQuality quality, ThreadPool* threadPool)
+{
+    CompressedTexture compressed;
+    compressed.format = format;
+    compressed.width = texture.width;
+    compressed.height = texture.height;
+    compressed.blocks.resize(size_t(compressed.RowPitch()) * compressed.BlocksHigh());
+
+    unsigned blocksHigh = compressed.BlocksHigh();
+    unsigned bands = (blocksHigh + BAND_BLOCK_ROWS - 1) / BAND_BLOCK_ROWS;
+    auto band = [&](unsigned index)
+    {
+        unsigned end = std::min((index + 1) * BAND_BLOCK_ROWS, blocksHigh);
+        for (unsigned blockY = index * BAND_BLOCK_ROWS; blockY < end; ++blockY)
+        {
+            uint8_t* output = &compressed.blocks[size_t(blockY) * compressed.RowPitch()];
+            for (unsigned blockX = 0; blockX < compressed.BlocksWide(); ++blockX, output += BlockBytes(format))
+            {
+                Block pixels;
+                FetchBlock(texture, blockX, blockY, pixels);
+                EncodeBlock(pixels, format, quality, output);
+            }
+        }
+    };
+
+    if (threadPool != nullptr && bands > 1)
+        threadPool->ParallelFor(bands, band);
+    else
+        for (unsigned index = 0; index < bands; ++index)
+            band(index);
+
+    return compressed;
+}
+
+SoftwareTexture DecompressTexture(const CompressedTexture& texture)
+{
+    SoftwareTexture output;
+    output.width = texture.width;
+    output.height = texture.height;
+    output.texels.resize(size_t(texture.width) * texture.height);
+
+    for (unsigned blockY = 0; blockY < texture.BlocksHigh(); ++blockY)
+        for (unsigned blockX = 0; blockX < texture.BlocksWide(); ++blockX)
+        {
+            Block pixels;
+            DecodeBlock(&texture.blocks[size_t(blockY) * texture.RowPitch() + blockX * BlockBytes(texture.format)], texture.format, pixels);
+
+            for (unsigned y = 0; y < 4 && blockY * 4 + y < texture.height; ++y)
+                for (unsigned x = 0; x < 4 && blockX * 4 + x < texture.width; ++x)
+                {
+                    const uint8_t* pixel = pixels[y * 4 + x];
+                    output.texels[size_t(blockY * 4 + y) * texture.width + blockX * 4 + x] =
+                        pixel[0] | pixel[1] << 8 | pixel[2] << 16 | static_cast<uint32_t>(pixel[3]) << 24;
+                }
+        }
+
+    return output;
+}
+
+uint64_t HashTexels(const SoftwareTexture& texture)
+{
+    //64-bit multiply-rotate mix per texel pair, fast enough that hashing an 8K image costs far less than loading it
+    const uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = (static_cast<uint64_t>(texture.width) << 32 | texture.height) * MULTIPLIER;
+
+    size_t count = texture.texels.size();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        uint64_t value = texture.texels[i] | static_cast<uint64_t>(texture.texels[i + 1]) << 32;
+        value *= MULTIPLIER;
+        value ^= value >> 29;
+        hash = (hash ^ value) * MULTIPLIER;
+        hash = hash << 31 | hash >> 33;
+    }
+    if (i < count)
+        hash = (hash ^ texture.texels[i]) * MULTIPLIER;
+
+    hash ^= hash >> 32;
+    hash *= MULTIPLIER;
+    return hash ^ (hash >> 29);
+}
+
+namespace
+{
+    //Cache file: header, then per level its width, height, byte count and blocks
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;
+        uint32_t levelCount;
+    };
+
+    struct CacheLevel
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t size;
+    };
+
+    const char CACHE_MAGIC[4] = { 'B', 'C', 'T', 'X' };
+
+    bool ReadCacheFile(const std::string& path, uint64_t key, BlockFormat format, std::vector<CompressedTexture>& levels)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        CacheHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, CACHE_MAGIC, 4) != 0 ||
+            header.version != CACHE_VERSION || header.key != key || header.format != static_cast<uint32_t>(format))
+            return false;
+
+        levels.resize(header.levelCount);
+        for (CompressedTexture& level : levels)
+        {
+            CacheLevel description;
+            if (!file.read(reinterpret_cast<char*>(&description), sizeof(description)))
+                return false;
+
+            level.format = format;
+            level.width = description.width;
+            level.height = description.height;
+            if (description.size != size_t(level.RowPitch()) * level.BlocksHigh())
+                return false;
+
+            level.blocks.resize(description.size);
+            if (!file.read(reinterpret_cast<char*>(level.blocks.data()), description.size))
+                return false;
+        }
+        return true;
+    }
+
+    bool WriteCacheFile(const std::string& path, uint64_t key, BlockFormat format, const std::vector<CompressedTexture>& levels)
+    {
+        //Streaming workers may encode the same image at once, each through its own temporary
+        return WriteFileAtomically(path, [&](std::ostream& file)
+        {
+            CacheHeader header = { { CACHE_MAGIC[0], CACHE_MAGIC[1], CACHE_MAGIC[2], CACHE_MAGIC[3] }, CACHE_VERSION, key,
+                                   static_cast<uint32_t>(format), static_cast<uint32_t>(levels.size()) };
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            for (const CompressedTexture& level : levels)
+            {
+                CacheLevel description = { level.width, level.height, level.blocks.size() };
+                file.write(reinterpret_cast<const char*>(&description), sizeof(description));
+                file.write(reinterpret_cast<const char*>(level.blocks.data()), level.blocks.size());
+            }
+        });
+    }
+}
+
+std::vector<CompressedTexture> CompressMipChainCached(const SoftwareTexture& texture, BlockFormat format, BlockQuality quality,
+                                                      const MipOptions& mipOptions, const std::string& cacheDirectory, ThreadPool* threadPool)
+{
+    //Everything that changes the output goes into the key
+    uint64_t key = HashTexels(texture);
+    const uint64_t settings[] = { static_cast<uint64_t>(format), static_cast<uint64_t>(quality), static_cast<uint64_t>(mipOptions.filter),
+                                  static_cast<uint64_t>(mipOptions.sRGB) };
+    for (uint64_t setting : settings)
+        key = (key ^ (setting + 1)) * 0x9E3779B97F4A7C15ull;
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bctx", static_cast<unsigned long long>(key));
+    std::string path = (std::filesystem::path(cacheDirectory) / name).string();
+
+    std::vector<CompressedTexture> levels;
+    if (ReadCacheFile(path, key, format, levels))
+        return levels;
+
+    std::vector<SoftwareTexture> mips = GenerateMipChain(texture, mipOptions, threadPool);
+    levels.clear();
+    for (const SoftwareTexture& mip : mips)
+        levels.push_back(CompressTexture(mip, format, quality, threadPool));
+
+    if (!WriteCacheFile(path, key, format, levels))
+        std::cerr << "Failed to write texture cache file " << path << std::endl;
+
+    return levels;
+}
+
+#ifndef _WIN32
+
+void RunBlockCompressionBenchmark()
+{
+    const unsigned SIZE = 2048;
+    const double secondsPerRun = 0.5;
+
+    std::vector<unsigned> threadCounts;
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    //Smooth gradients, hard edges and a radial alpha ramp, roughly what a texture atlas holds
+    SoftwareTexture source;
+    source.width = source.height = SIZE;
+    source.texels.resize(size_t(SIZE) * SIZE);
+    for (unsigned y = 0; y < SIZE; ++y)
+        for (unsigned x = 0; x < SIZE; ++x)
+        {
+            float dx = x - SIZE * 0.5f, dy = y - SIZE * 0.5f;
+            uint32_t r = x * 255 / SIZE;
+            uint32_t g = static_cast<uint32_t>(127.5f + 127.5f * std::sin(x * 0.02f) * std::cos(y * 0.03f));
+            uint32_t b = ((x / 64) + (y / 64)) & 1 ? 200 : 40;
+            uint32_t a = static_cast<uint32_t>(std::min(255.0f, std::sqrt(dx * dx + dy * dy) * 255.0f / (SIZE * 0.5f)));
+            source.texels[size_t(y) * SIZE + x] = r | g << 8 | b << 16 | a << 24;
+        }
+
+    const BlockFormat formats[] = { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC7 };
+    const BlockQuality qualities[] = { BlockQuality::Fast, BlockQuality::Quality };
+
+    //BC1 runs on an opaque copy, as CreateTexture only picks it for opaque images; punch-through would zero the faded texels
+    SoftwareTexture opaque = source;
+    for (uint32_t& texel : opaque.texels)
+        texel |= 0xFF000000u;
+
+    for (BlockFormat format : formats)
+        for (BlockQuality quality : qualities)
+        {
+            const SoftwareTexture& input = format == BlockFormat::BC1 ? opaque : source;
+            CompressedTexture compressed;
+            for (unsigned threads : threadCounts)
+            {
+                ThreadPool pool(threads);
+                unsigned runs = 0;
+                auto start = std::chrono::steady_clock::now();
+                double elapsed = 0;
+
+                while (elapsed < secondsPerRun)
+                {
+                    compressed = CompressTexture(input, format, quality, &pool);
+                    ++runs;
+                    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+
+                //PSNR over the colour channels, plus alpha where the format interpolates it
+                SoftwareTexture decoded = DecompressTexture(compressed);
+                int channels = format == BlockFormat::BC1 ? 3 : 4;
+                double squaredError = 0;
+                for (size_t i = 0; i < input.texels.size(); ++i)
+                    for (int c = 0; c < channels; ++c)
+                    {
+                        int difference = static_cast<int>((input.texels[i] >> (c * 8)) & 0xFF) - static_cast<int>((decoded.texels[i] >> (c * 8)) & 0xFF);
+                        squaredError += difference * difference;
+                    }
+                double mse = squaredError / (double(source.texels.size()) * channels);
+                double psnr = mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+
+                double megapixelsPerSecond = runs * double(source.texels.size()) / elapsed / 1e6;
+                std::printf("%ux%u  %s %-7s  threads %3u  %8.2f ms  %7.2f Mpixels/s  %6.2f Mpixels/s/thread  %5.2f dB  %zu -> %zu KB\n",
+                            SIZE, SIZE, BlockFormatName(format), BlockQualityName(quality), threads, elapsed * 1e3 / runs,
+                            megapixelsPerSecond, megapixelsPerSecond / threads, psnr,
+                            source.texels.size() * 4 / 1024, compressed.blocks.size() / 1024);
+            }
+        }
+
+    //Cold encode of the whole chain against reading it back from the cache
+    std::filesystem::path cacheDirectory = std::filesystem::temp_directory_path() / "bc-cache-benchmark";
+    std::filesystem::remove_all(cacheDirectory);
+
+    ThreadPool pool;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<CompressedTexture> levels = CompressMipChainCached(source, BlockFormat::BC7, BlockQuality::Quality, MipOptions(), cacheDirectory.string(), &pool);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%ux%u  BC7 quality mip chain  %s  %zu levels  %8.2f ms\n", SIZE, SIZE, pass == 0 ? "cache miss" : "cache hit ", levels.size(), elapsed * 1e3);
+    }
+
+    std::filesystem::remove_all(cacheDirectory);
+}
+
+#endif
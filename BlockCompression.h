@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MipChain.h"
+#include "SoftwareTexture.h"
+#include "ThreadPool.h"
+
+//Block compression of RGBA8 textures into the 4x4 BC formats, encoded across the thread pool in bands of block rows.
+//Blocks past the right or bottom edge repeat the last column and row.
+//BC1: 565 endpoints and 2-bit indices, 8 bytes per block; blocks with alpha below 128 use the 3-colour punch-through mode.
+//BC3: BC1 colour plus an interpolated alpha block, 16 bytes.
+//BC7: mode 6 only (one subset, RGBA 7-bit endpoints with p-bits, 4-bit indices), 16 bytes.
+
+enum class BlockFormat { BC1, BC3, BC7 };
+enum class BlockQuality { Fast, Quality };		//Fast fits endpoints to the bounding box, Quality to the principal axis plus least-squares refinement
+
+const char* BlockFormatName(BlockFormat format);
+const char* BlockQualityName(BlockQuality quality);
+unsigned BlockBytes(BlockFormat format);
+
+struct CompressedTexture
+{
+	BlockFormat format = BlockFormat::BC1;
+	unsigned width = 0;
+	unsigned height = 0;
+	std::vector<uint8_t> blocks;		//Rows of blocks, top to bottom
+
+	unsigned BlocksWide() const { return (width + 3) / 4; }
+	unsigned BlocksHigh() const { return (height + 3) / 4; }
+	unsigned RowPitch() const { return BlocksWide() * BlockBytes(format); }
+};
+
+CompressedTexture CompressTexture(const SoftwareTexture& texture, BlockFormat format, BlockQuality quality, ThreadPool* threadPool = nullptr);
+SoftwareTexture DecompressTexture(const CompressedTexture& texture);		//For error measurement; BC7 modes other than 6 decode to zero
+
+//The mip chain of texture, compressed level by level, through a disk cache keyed by a hash of the source texels and the settings.
+//The first call for an image generates, encodes and writes the chain; later calls only read the file.
+std::vector<CompressedTexture> CompressMipChainCached(const SoftwareTexture& texture, BlockFormat format, BlockQuality quality,
+	const MipOptions& mipOptions, const std::string& cacheDirectory, ThreadPool* threadPool = nullptr);
+
+uint64_t HashTexels(const SoftwareTexture& texture);
+
+#ifndef _WIN32
+void RunBlockCompressionBenchmark();
+#endif
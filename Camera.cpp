@@ -0,0 +1,175 @@
+#include "Camera.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+Camera::Camera()
+{
+    const float defaultEye[3] = { 0.0f, 0.0f, -2.0f };
+    const float defaultFocus[3] = { 0.0f, 0.0f, 1.0f };
+    const float defaultUp[3] = { 0.0f, 1.0f, 0.0f };
+
+    std::copy(defaultEye, defaultEye + 3, eye);
+    std::copy(defaultFocus, defaultFocus + 3, focus);
+    std::copy(defaultUp, defaultUp + 3, up);
+
+    fovY = PI * 0.25f;
+    aspectRatio = (float)1024 / 576;
+    nearZ = 0.1f;
+    farZ = 100.0f;
+}
+
+void Camera::SetLookAt(const float* eye, const float* focus, const float* up)
+{
+    if (std::equal(eye, eye + 3, this->eye) && std::equal(focus, focus + 3, this->focus) && std::equal(up, up + 3, this->up))
+        return;
+
+    std::copy(eye, eye + 3, this->eye);
+    std::copy(focus, focus + 3, this->focus);
+    std::copy(up, up + 3, this->up);
+    viewDirty = true;
+}
+
+void Camera::SetPerspective(float fovY, float aspectRatio, float nearZ, float farZ)
+{
+    if (fovY == this->fovY && aspectRatio == this->aspectRatio && nearZ == this->nearZ && farZ == this->farZ)
+        return;
+
+    this->fovY = fovY;
+    this->aspectRatio = aspectRatio;
+    this->nearZ = nearZ;
+    this->farZ = farZ;
+    projectionDirty = true;
+}
+
+void Camera::SetAspectRatio(float aspectRatio)
+{
+    SetPerspective(fovY, aspectRatio, nearZ, farZ);
+}
+
+void Camera::Update()
+{
+    if (!viewDirty && !projectionDirty)
+        return;
+
+    if (viewDirty)
+        view = LookAtLH(eye, focus, up);
+    if (projectionDirty)
+        projection = PerspectiveFovLH(fovY, aspectRatio, nearZ, farZ);
+
+    viewProjection = Multiply(view, projection);
+    viewDirty = projectionDirty = false;
+    ++rebuilds;
+}
+
+const Matrix& Camera::View()
+{
+    Update();
+    return view;
+}
+
+const Matrix& Camera::Projection()
+{
+    Update();
+    return projection;
+}
+
+const Matrix& Camera::ViewProjection()
+{
+    Update();
+    return viewProjection;
+}
+
+void Camera::FillConstantBuffer(const Matrix& world, ConstantBuffer& cBuffer)
+{
+    StoreTransposed(Multiply(world, ViewProjection()), cBuffer.worldViewPerspective);
+    StoreTransposed(world, cBuffer.world);
+}
+
+void RunCameraBenchmark()
+{
+    const unsigned OBJECTS = 1000;
+    const double secondsPerRun = 1.0;
+    const float pivot[3] = { 0.0f, 0.0f, 1.0f };
+
+    std::vector<ConstantBuffer> buffers(OBJECTS);
+    std::vector<ConstantBuffer> reference(OBJECTS);
+
+    auto angleOf = [](unsigned object) { return object * 0.01f; };
+
+    //What UpdateConstantbuffer did for every object each frame before the camera existed
+    auto rebuildEverything = [&](unsigned object, ConstantBuffer& cBuffer)
+    {
+        Matrix scale = Scaling(1.0f, 1.0f, 1.0f);
+        Matrix rotY = RotationY(angleOf(object));
+        Matrix trans = Translation(0, 0, 1.0f);
+        Matrix backTrans = Translation(0, 0, -1.0f);
+        Matrix world = Multiply(Multiply(Multiply(scale, backTrans), rotY), trans);
+
+        float eyePos[3] = { 0.0f, 0.0f, -2.0f };
+        float focus[3] = { 0.0f, 0.0f, 1.0f };
+        float up[3] = { 0.0f, 1.0f, 0.0f };
+
+        Matrix viewMatrix = LookAtLH(eyePos, focus, up);
+        Matrix projectionMatrix = PerspectiveFovLH(PI * 0.25f, (float)1024 / 576, 0.1f, 100.0f);
+        Matrix WVP = Multiply(Multiply(world, viewMatrix), projectionMatrix);
+
+        StoreTransposed(WVP, cBuffer.worldViewPerspective);
+        StoreTransposed(world, cBuffer.world);
+    };
+
+    for (unsigned object = 0; object < OBJECTS; ++object)
+        rebuildEverything(object, reference[object]);
+
+    auto run = [&](const char* name, auto&& frame)
+    {
+        unsigned frames = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while (elapsed < secondsPerRun)
+        {
+            frame(frames++);
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        float maxError = 0;
+        for (unsigned object = 0; object < OBJECTS; ++object)
+        {
+            const float* a = &buffers[object].worldViewPerspective[0][0];
+            const float* b = &reference[object].worldViewPerspective[0][0];
+            for (int i = 0; i < 32; ++i)
+                maxError = std::max(maxError, std::abs(a[i] - b[i]));
+        }
+
+        std::printf("%-28s %8.2f Mmatrices/s  max error %g\n", name, static_cast<double>(frames) * OBJECTS / elapsed / 1e6, maxError);
+    };
+
+    run("rebuild per object", [&](unsigned)
+    {
+        for (unsigned object = 0; object < OBJECTS; ++object)
+            rebuildEverything(object, buffers[object]);
+    });
+
+    Camera camera;
+    run("cached camera", [&](unsigned)
+    {
+        for (unsigned object = 0; object < OBJECTS; ++object)
+            camera.FillConstantBuffer(RotationYAround(angleOf(object), pivot), buffers[object]);
+    });
+
+    //Parameters change every frame (the up vector length, so the result stays the same), one rebuild is shared by all objects
+    Camera movingCamera;
+    run("cached camera, rebuilt/frame", [&](unsigned frame)
+    {
+        float eye[3] = { 0.0f, 0.0f, -2.0f };
+        float focus[3] = { 0.0f, 0.0f, 1.0f };
+        float up[3] = { 0.0f, 1.0f + (frame & 1), 0.0f };
+        movingCamera.SetLookAt(eye, focus, up);
+
+        for (unsigned object = 0; object < OBJECTS; ++object)
+            movingCamera.FillConstantBuffer(RotationYAround(angleOf(object), pivot), buffers[object]);
+    });
+}
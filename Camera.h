@@ -0,0 +1,39 @@
+#pragma once
+
+#include "MatrixMath.h"
+#include "PipelineData.h"
+
+//Owns the view and projection matrices and rebuilds them only when a parameter changes,
+//so per-object constant buffer updates are one world * viewProjection multiply
+
+class Camera
+{
+public:
+	Camera();		//Eye at (0, 0, -2) looking at (0, 0, 1), 45 degree fov, 1024 / 576
+
+	void SetLookAt(const float* eye, const float* focus, const float* up);
+	void SetPerspective(float fovY, float aspectRatio, float nearZ, float farZ);
+	void SetAspectRatio(float aspectRatio);
+
+	const Matrix& View();
+	const Matrix& Projection();
+	const Matrix& ViewProjection();
+	const float* EyePosition() const { return eye; }
+
+	void FillConstantBuffer(const Matrix& world, ConstantBuffer& cBuffer);
+
+	unsigned Rebuilds() const { return rebuilds; }		//View or projection recomputations so far
+
+private:
+	void Update();
+
+	float eye[3], focus[3], up[3];
+	float fovY, aspectRatio, nearZ, farZ;
+
+	Matrix view, projection, viewProjection;
+	bool viewDirty = true;
+	bool projectionDirty = true;
+	unsigned rebuilds = 0;
+};
+
+void RunCameraBenchmark();
@@ -0,0 +1,372 @@
+#include "CommandBuffer.h"
+#include "Camera.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+uint64_t MakeSortKey(unsigned shader, unsigned material, float depth)
+{
+    depth = std::min(std::max(depth, 0.0f), 1.0f);
+    uint64_t quantizedDepth = static_cast<uint64_t>(depth * 16777215.0f);      //24 bits
+
+    return (static_cast<uint64_t>(shader & 0xFF) << 56) | (static_cast<uint64_t>(material & 0xFFFF) << 40) | (quantizedDepth << 16);
+}
+
+namespace
+{
+    void RunBlocks(unsigned blocks, ThreadPool* threadPool, const std::function<void(unsigned)>& job)
+    {
+        if (threadPool != nullptr && blocks > 1)
+        {
+            threadPool->ParallelFor(blocks, job);
+            return;
+        }
+
+        for (unsigned block = 0; block < blocks; ++block)
+            job(block);
+    }
+
+    double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+void RadixSortPairs(uint64_t* keys, uint32_t* values, uint64_t* keyScratch, uint32_t* valueScratch, size_t count, ThreadPool* threadPool)
+{
+    const size_t MIN_BLOCK_SIZE = 16384;        //Below this the histogram merge costs more than the extra threads save
+
+    if (count < 2)
+        return;
+
+    unsigned blocks = 1;
+    if (threadPool != nullptr)
+        blocks = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadPool->ThreadCount(), count / MIN_BLOCK_SIZE)));
+    size_t blockSize = (count + blocks - 1) / blocks;
+
+    //Digit counts of all eight bytes in one read. Bytes equal in every key would not move anything, their passes are skipped.
+    std::vector<std::array<std::array<size_t, 256>, 8>> histograms(blocks);
+    RunBlocks(blocks, threadPool, [&](unsigned block)
+    {
+        std::array<std::array<size_t, 256>, 8>& histogram = histograms[block];
+        for (std::array<size_t, 256>& digits : histogram)
+            digits.fill(0);
+
+        size_t end = std::min(count, (block + 1) * blockSize);
+        for (size_t i = block * blockSize; i < end; ++i)
+        {
+            uint64_t key = keys[i];
+            for (unsigned byte = 0; byte < 8; ++byte)
+                ++histogram[byte][(key >> (byte * 8)) & 0xFF];
+        }
+    });
+
+    uint64_t* keySource = keys;
+    uint64_t* keyTarget = keyScratch;
+    uint32_t* valueSource = values;
+    uint32_t* valueTarget = valueScratch;
+
+    for (unsigned byte = 0; byte < 8; ++byte)
+    {
+        unsigned shift = byte * 8;
+
+        bool skip = false;
+        for (unsigned digit = 0; digit < 256 && !skip; ++digit)
+        {
+            size_t digitCount = 0;
+            for (unsigned block = 0; block < blocks; ++block)
+                digitCount += histograms[block][byte][digit];
+            skip = digitCount == count;
+        }
+
+        if (skip)
+            continue;
+
+        //Digit-major, then block order, keeps the sort stable
+        size_t offset = 0;
+        for (unsigned digit = 0; digit < 256; ++digit)
+        {
+            for (unsigned block = 0; block < blocks; ++block)
+            {
+                size_t digitCount = histograms[block][byte][digit];
+                histograms[block][byte][digit] = offset;
+                offset += digitCount;
+            }
+        }
+
+        RunBlocks(blocks, threadPool, [&](unsigned block)
+        {
+            std::array<size_t, 256>& position = histograms[block][byte];
+
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; ++i)
+            {
+                size_t target = position[(keySource[i] >> shift) & 0xFF]++;
+                keyTarget[target] = keySource[i];
+                valueTarget[target] = valueSource[i];
+            }
+        });
+
+        std::swap(keySource, keyTarget);
+        std::swap(valueSource, valueTarget);
+    }
+
+    if (keySource != keys)
+    {
+        std::memcpy(keys, keySource, count * sizeof(uint64_t));
+        std::memcpy(values, valueSource, count * sizeof(uint32_t));
+    }
+}
+
+CommandQueue::CommandQueue(unsigned listCount)
+    : lists(std::max(1u, listCount))
+{
+}
+
+void CommandQueue::Reset()
+{
+    for (CommandList& list : lists)
+        list.Clear();
+
+    sortedKeys.clear();
+    order.clear();
+    commands.clear();
+    sortedCommands.clear();
+}
+
+void CommandQueue::Sort(ThreadPool* threadPool)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<size_t> listOffsets(lists.size());
+    size_t total = 0;
+    for (size_t i = 0; i < lists.size(); ++i)
+    {
+        listOffsets[i] = total;
+        total += lists[i].Size();
+    }
+
+    sortedKeys.resize(total);
+    keyScratch.resize(total);
+    order.resize(total);
+    orderScratch.resize(total);
+    commands.resize(total);
+
+    RunBlocks(static_cast<unsigned>(lists.size()), threadPool, [&](unsigned list)
+    {
+        const CommandList& source = lists[list];
+        size_t offset = listOffsets[list];
+
+        std::copy(source.keys.begin(), source.keys.end(), sortedKeys.begin() + offset);
+        std::copy(source.commands.begin(), source.commands.end(), commands.begin() + offset);
+        for (size_t i = 0; i < source.Size(); ++i)
+            order[offset + i] = static_cast<uint32_t>(offset + i);
+    });
+
+    timings.merge = SecondsSince(start);
+    start = std::chrono::steady_clock::now();
+
+    RadixSortPairs(sortedKeys.data(), order.data(), keyScratch.data(), orderScratch.data(), total, threadPool);
+
+    //Payloads in key order, so Submit streams through memory instead of chasing order[] on one thread
+    sortedCommands.resize(total);
+    unsigned blocks = threadPool != nullptr ? threadPool->ThreadCount() : 1;
+    RunBlocks(blocks, threadPool, [&](unsigned block)
+    {
+        size_t end = total * (block + 1) / blocks;
+        for (size_t i = total * block / blocks; i < end; ++i)
+            sortedCommands[i] = commands[order[i]];
+    });
+
+    timings.sort = SecondsSince(start);
+}
+
+void CommandQueue::Submit(StateCache& stateCache)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (const DrawCommand& command : sortedCommands)
+    {
+        stateCache.SetVertexShader(command.vShader);
+        stateCache.SetPixelShader(command.pShader);
+        stateCache.SetPSShaderResources(0, 1, &command.texture);
+        stateCache.SetVSConstantBuffers1(0, 1, &command.constants.buffer, &command.constants.firstConstant, &command.constants.numConstants);
+        stateCache.Draw(command.vertexCount, command.startVertex);      //Only what changed since the previous draw reaches the context
+    }
+
+    timings.submit = SecondsSince(start);
+}
+
+#ifndef _WIN32
+
+void RunCommandBufferBenchmark()
+{
+    const UINT OBJECTS = 100000;
+    const unsigned SHADERS = 8;
+    const unsigned MATERIALS = 256;
+    const unsigned JOBS = 64;               //One CommandList per recording job
+    const double secondsPerRun = 0.5;
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    std::vector<ID3D11VertexShader*> vertexShaders;
+    std::vector<ID3D11PixelShader*> pixelShaders;
+    std::vector<ID3D11ShaderResourceView*> textures;
+    for (unsigned i = 0; i < SHADERS; ++i)
+    {
+        vertexShaders.push_back(new ID3D11VertexShader());
+        pixelShaders.push_back(new ID3D11PixelShader());
+    }
+    for (unsigned i = 0; i < MATERIALS; ++i)
+        textures.push_back(new ID3D11ShaderResourceView());
+    ID3D11Buffer* cBuffer = new ID3D11Buffer();
+
+    struct Object { unsigned shader, material; float position[3]; };
+    std::vector<Object> objects(OBJECTS);
+    std::srand(1);
+    for (Object& object : objects)
+    {
+        object.shader = std::rand() % SHADERS;
+        object.material = std::rand() % MATERIALS;
+        for (float& coordinate : object.position)
+            coordinate = (std::rand() / static_cast<float>(RAND_MAX) * 2.0f - 1.0f) * 50.0f;
+    }
+
+    Camera camera;
+    const Matrix& view = camera.View();
+
+    auto commandFor = [&](UINT i)
+    {
+        const Object& object = objects[i];
+        DrawCommand command;
+        command.vShader = vertexShaders[object.shader];
+        command.pShader = pixelShaders[object.shader];
+        command.texture = textures[object.material];
+        command.constants = { cBuffer, (i % 256) * 16, 16 };
+        command.vertexCount = 4;
+        command.startVertex = 0;
+        return command;
+    };
+
+    auto depthOf = [&](const Object& object)        //View space z over the far plane
+    {
+        float z = object.position[0] * view.m[0][2] + object.position[1] * view.m[1][2] + object.position[2] * view.m[2][2] + view.m[3][2];
+        return z / 100.0f;
+    };
+
+    //Immediate submission in scene order, still filtered by the StateCache
+    {
+        StateCache cache(context);
+        unsigned frames = 0;
+        UINT64 callsBefore = context->counters.stateCalls;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+
+        while (elapsed < secondsPerRun)
+        {
+            for (UINT i = 0; i < OBJECTS; ++i)
+            {
+                DrawCommand command = commandFor(i);
+                cache.SetVertexShader(command.vShader);
+                cache.SetPixelShader(command.pShader);
+                cache.SetPSShaderResources(0, 1, &command.texture);
+                cache.SetVSConstantBuffers1(0, 1, &command.constants.buffer, &command.constants.firstConstant, &command.constants.numConstants);
+                cache.Draw(command.vertexCount, command.startVertex);
+            }
+            ++frames;
+            elapsed = SecondsSince(start);
+        }
+
+        std::printf("immediate, scene order   %6u draws  threads   1  %7.3f ms/frame                                            %8.0f state calls/frame\n",
+                    OBJECTS, elapsed * 1e3 / frames, static_cast<double>(context->counters.stateCalls - callsBefore) / frames);
+    }
+
+    //Sort correctness against a stable comparison sort
+    {
+        std::vector<uint64_t> keys(OBJECTS), keyScratch(OBJECTS);
+        std::vector<uint32_t> values(OBJECTS), valueScratch(OBJECTS);
+        for (UINT i = 0; i < OBJECTS; ++i)
+        {
+            keys[i] = MakeSortKey(objects[i].shader, objects[i].material, depthOf(objects[i]));
+            values[i] = i;
+        }
+
+        std::vector<uint32_t> expected = values;
+        std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+        ThreadPool pool;
+        RadixSortPairs(keys.data(), values.data(), keyScratch.data(), valueScratch.data(), OBJECTS, &pool);
+        std::printf("radix sort %s std::stable_sort\n", values == expected ? "matches" : "DOES NOT MATCH");
+    }
+
+    std::vector<unsigned> threadCounts;
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    for (unsigned threads : threadCounts)
+    {
+        ThreadPool pool(threads);
+        CommandQueue queue(JOBS);
+        StateCache cache(context);
+
+        unsigned frames = 0;
+        double record = 0, merge = 0, sort = 0, submit = 0;
+        UINT64 callsBefore = context->counters.stateCalls;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+
+        while (elapsed < secondsPerRun)
+        {
+            queue.Reset();
+
+            auto recordStart = std::chrono::steady_clock::now();
+            pool.ParallelFor(JOBS, [&](unsigned job)
+            {
+                CommandList& list = queue.List(job);
+                UINT first = job * OBJECTS / JOBS;
+                UINT end = (job + 1) * OBJECTS / JOBS;
+                for (UINT i = first; i < end; ++i)
+                    list.Record(MakeSortKey(objects[i].shader, objects[i].material, depthOf(objects[i])), commandFor(i));
+            });
+            record += SecondsSince(recordStart);
+
+            queue.Sort(&pool);
+            queue.Submit(cache);
+
+            merge += queue.Timings().merge;
+            sort += queue.Timings().sort;
+            submit += queue.Timings().submit;
+            ++frames;
+            elapsed = SecondsSince(start);
+        }
+
+        std::printf("recorded, sorted         %6u draws  threads %3u  %7.3f ms/frame (record %.3f, merge %.3f, sort %.3f, submit %.3f)  %8.0f state calls/frame\n",
+                    OBJECTS, threads, elapsed * 1e3 / frames, record * 1e3 / frames, merge * 1e3 / frames, sort * 1e3 / frames,
+                    submit * 1e3 / frames, static_cast<double>(context->counters.stateCalls - callsBefore) / frames);
+    }
+
+    for (ID3D11VertexShader* shader : vertexShaders)
+        shader->Release();
+    for (ID3D11PixelShader* shader : pixelShaders)
+        shader->Release();
+    for (ID3D11ShaderResourceView* texture : textures)
+        texture->Release();
+    cBuffer->Release();
+    context->Release();
+    device->Release();
+}
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ConstantBufferRing.h"
+#include "D3D11Compat.h"
+#include "StateCache.h"
+#include "ThreadPool.h"
+
+//Deferred draw submission. Draws are recorded from any number of jobs into their own CommandLists as a 64-bit sort key
+//plus a payload, the CommandQueue merges and radix sorts the keys across the thread pool and replays the payloads
+//through a StateCache in key order, so draws sharing a shader and texture end up next to each other.
+
+//Sort key layout, most significant first: shader (8 bits) | material (16 bits) | depth (24 bits) | unused (16 bits).
+//Depth is in [0, 1], front to back within a shader and material.
+uint64_t MakeSortKey(unsigned shader, unsigned material, float depth);
+
+struct DrawCommand
+{
+	ID3D11VertexShader* vShader;
+	ID3D11PixelShader* pShader;
+	ID3D11ShaderResourceView* texture;		//Pixel shader slot 0
+	ConstantBufferAllocation constants;		//Vertex shader slot 0
+	UINT vertexCount;
+	UINT startVertex;
+};
+
+class CommandList				//Written by one job at a time, no locking
+{
+public:
+	void Record(uint64_t key, const DrawCommand& command)
+	{
+		keys.push_back(key);
+		commands.push_back(command);
+	}
+
+	size_t Size() const { return keys.size(); }
+	void Clear() { keys.clear(); commands.clear(); }
+
+private:
+	friend class CommandQueue;
+
+	std::vector<uint64_t> keys;
+	std::vector<DrawCommand> commands;
+};
+
+struct CommandQueueTimings		//Seconds spent in the last Sort() and Submit()
+{
+	double merge = 0;
+	double sort = 0;
+	double submit = 0;
+};
+
+class CommandQueue
+{
+public:
+	explicit CommandQueue(unsigned listCount = 1);
+
+	unsigned ListCount() const { return static_cast<unsigned>(lists.size()); }
+	CommandList& List(unsigned index) { return lists[index]; }
+
+	void Reset();		//Clears every list, keeps their memory for the next frame
+
+	//Merges the lists and sorts all draws by key. Equal keys keep their list order, then their recording order.
+	void Sort(ThreadPool* threadPool = nullptr);
+	//Replays the sorted draws, Sort() must have been called since the last Reset()
+	void Submit(StateCache& stateCache);
+
+	size_t Size() const { return sortedKeys.size(); }
+	const std::vector<uint64_t>& SortedKeys() const { return sortedKeys; }
+	const CommandQueueTimings& Timings() const { return timings; }
+
+private:
+	std::vector<CommandList> lists;
+
+	std::vector<uint64_t> sortedKeys, keyScratch;
+	std::vector<uint32_t> order, orderScratch;		//Index into the merged payloads, sorted along with the keys
+	std::vector<DrawCommand> commands, sortedCommands;
+
+	CommandQueueTimings timings;
+};
+
+//LSD radix sort of key/value pairs, 8 bits per pass, skipping bytes that are equal in every key.
+//One read counts the digits of every pass, each pass after that only scatters.
+//The scratch arrays must hold count elements; the result ends up in keys and values.
+void RadixSortPairs(uint64_t* keys, uint32_t* values, uint64_t* keyScratch, uint32_t* valueScratch, size_t count, ThreadPool* threadPool = nullptr);
+
+#ifndef _WIN32
+void RunCommandBufferBenchmark();
+#endif
@@ -0,0 +1,377 @@
+#include "ConstantBufferRing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const UINT BYTES_PER_CONSTANT = 16;
+    const UINT MAX_BOUND_BYTES = 4096 * BYTES_PER_CONSTANT;      //Largest range one binding can expose to a shader
+
+    UINT AlignUp(UINT size)
+    {
+        return (size + ConstantBufferRing::ALIGNMENT - 1) & ~(ConstantBufferRing::ALIGNMENT - 1);
+    }
+}
+
+bool ConstantBufferRing::Create(ID3D11Device* device, ID3D11DeviceContext1* context, UINT sizeInBytes)
+{
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+    if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) || !options.ConstantBufferOffsetting)
+    {
+        std::cerr << "Constant buffer offsets are not supported" << std::endl;
+        return false;
+    }
+
+    //Without no-overwrite maps every upload discards and starts at offset 0, the driver renames the buffer
+    offsetting = options.MapNoOverwriteOnDynamicConstantBuffer != 0;
+
+    D3D11_BUFFER_DESC desc = {};
+    desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    desc.Usage = D3D11_USAGE_DYNAMIC;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    desc.MiscFlags = 0;
+    desc.ByteWidth = AlignUp(sizeInBytes);
+
+    if (FAILED(device->CreateBuffer(&desc, nullptr, &buffer)))
+    {
+        std::cerr << "Failed to create constant buffer ring" << std::endl;
+        return false;
+    }
+
+    D3D11_QUERY_DESC queryDesc = {};
+    queryDesc.Query = D3D11_QUERY_EVENT;
+
+    for (ID3D11Query*& fence : fences)
+    {
+        if (FAILED(device->CreateQuery(&queryDesc, &fence)))
+        {
+            std::cerr << "Failed to create constant buffer ring fence" << std::endl;
+            return false;
+        }
+    }
+
+    this->context = context;
+    capacity = desc.ByteWidth;
+    head = tail = 0;
+    position = 0;
+    oldestFrame = framesInFlight = 0;
+    firstMap = true;
+    stats = {};
+    return true;
+}
+
+void ConstantBufferRing::Release()
+{
+    for (ID3D11Query*& fence : fences)
+    {
+        if (fence != nullptr)
+            fence->Release();
+        fence = nullptr;
+    }
+
+    if (buffer != nullptr)
+        buffer->Release();
+    buffer = nullptr;
+    context = nullptr;
+}
+
+bool ConstantBufferRing::RetireOldestFrame(bool wait)
+{
+    BOOL done = false;
+    UINT flags = wait ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH;
+    bool stalled = false;
+
+    HRESULT hr;
+    while ((hr = context->GetData(fences[oldestFrame], &done, sizeof(done), flags)) == S_FALSE)
+    {
+        if (!wait)
+            return false;
+
+        if (!stalled)
+            ++stats.stalls;
+        stalled = true;
+        std::this_thread::yield();
+    }
+
+    //A failed query (device removed) has nothing left to protect either
+    tail = frameEnd[oldestFrame];
+    oldestFrame = (oldestFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    --framesInFlight;
+    return true;
+}
+
+void ConstantBufferRing::BeginFrame()
+{
+    while (framesInFlight > 0 && RetireOldestFrame(false));
+}
+
+void ConstantBufferRing::EndFrame()
+{
+    if (framesInFlight == MAX_FRAMES_IN_FLIGHT)
+        RetireOldestFrame(true);
+
+    unsigned frame = (oldestFrame + framesInFlight) % MAX_FRAMES_IN_FLIGHT;
+    context->End(fences[frame]);
+    frameEnd[frame] = head;
+    ++framesInFlight;
+}
+
+bool ConstantBufferRing::Reserve(UINT size, UINT& offset)
+{
+    if (size > capacity)
+    {
+        std::cerr << "Constant buffer allocation of " << size << " bytes does not fit the ring" << std::endl;
+        return false;
+    }
+
+    if (!offsetting)
+    {
+        offset = 0;
+        return true;
+    }
+
+    if (position + size > capacity)     //Allocations never straddle the end, skip the remainder
+    {
+        head += capacity - position;
+        position = 0;
+    }
+    if (position == 0 && head != 0)
+        ++stats.wraps;
+
+    while (head + size - tail > capacity)
+    {
+        if (framesInFlight == 0)
+        {
+            std::cerr << "Constant buffer ring is too small for one frame" << std::endl;
+            return false;
+        }
+
+        RetireOldestFrame(true);
+    }
+
+    offset = position;
+    position += size;
+    head += size;
+    return true;
+}
+
+unsigned char* ConstantBufferRing::Map(UINT offset)
+{
+    D3D11_MAP mapType = firstMap || !offsetting ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+
+    if (FAILED(context->Map(buffer, 0, mapType, 0, &mapped)))
+    {
+        std::cerr << "Failed to map constant buffer ring" << std::endl;
+        return nullptr;
+    }
+
+    firstMap = false;
+    ++stats.maps;
+    return static_cast<unsigned char*>(mapped.pData) + offset;
+}
+
+ConstantBufferAllocation ConstantBufferRing::Upload(const void* data, UINT size)
+{
+    ConstantBufferAllocation allocation;
+    UINT alignedSize = AlignUp(size);
+    UINT offset;
+
+    if (alignedSize > MAX_BOUND_BYTES)
+    {
+        std::cerr << "Constant buffer allocation exceeds 4096 constants" << std::endl;
+        return allocation;
+    }
+
+    if (!Reserve(alignedSize, offset))
+        return allocation;
+
+    unsigned char* destination = Map(offset);
+    if (destination == nullptr)
+        return allocation;
+
+    std::memcpy(destination, data, size);
+    context->Unmap(buffer, 0);
+
+    ++stats.allocations;
+    stats.bytes += alignedSize;
+
+    allocation.buffer = buffer;
+    allocation.firstConstant = offset / BYTES_PER_CONSTANT;
+    allocation.numConstants = alignedSize / BYTES_PER_CONSTANT;
+    return allocation;
+}
+
+bool ConstantBufferRing::UploadArray(const void* data, UINT stride, UINT count, ConstantBufferAllocation* allocations)
+{
+    UINT alignedStride = AlignUp(stride);
+    UINT offset;
+
+    if (count == 0)
+        return true;
+
+    if (alignedStride > MAX_BOUND_BYTES || static_cast<UINT64>(alignedStride) * count > capacity)
+    {
+        std::cerr << "Constant buffer array of " << count << " elements does not fit the ring" << std::endl;
+        return false;
+    }
+
+    if (!Reserve(alignedStride * count, offset))
+        return false;
+
+    unsigned char* destination = Map(offset);
+    if (destination == nullptr)
+        return false;
+
+    const unsigned char* source = static_cast<const unsigned char*>(data);
+    for (UINT i = 0; i < count; ++i)
+    {
+        std::memcpy(destination + i * alignedStride, source + i * stride, stride);
+
+        allocations[i].buffer = buffer;
+        allocations[i].firstConstant = (offset + i * alignedStride) / BYTES_PER_CONSTANT;
+        allocations[i].numConstants = alignedStride / BYTES_PER_CONSTANT;
+    }
+    context->Unmap(buffer, 0);
+
+    stats.allocations += count;
+    stats.bytes += static_cast<UINT64>(alignedStride) * count;
+    return true;
+}
+
+void ConstantBufferRing::BindVS(UINT slot, const ConstantBufferAllocation& allocation)
+{
+    context->VSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+}
+
+void ConstantBufferRing::BindPS(UINT slot, const ConstantBufferAllocation& allocation)
+{
+    context->PSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+}
+
+#ifndef _WIN32
+
+void RunConstantBufferRingBenchmark()
+{
+    const UINT CONSTANT_BYTES = 128;        //Two 4x4 matrices, as in VertexShader.hlsl
+    const UINT FRAMES = 200;
+    const UINT objectCounts[] = { 1, 1000, 10000 };
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    std::printf("stand-in GPU finishes each frame %u frames after it is submitted\n", context->gpuLatency);
+    std::printf("%-18s %8s %12s %10s %10s %8s %8s\n", "method", "objects", "Mallocs/s", "discards", "no-ovw", "wraps", "stalls");
+
+    for (UINT objects : objectCounts)
+    {
+        std::vector<unsigned char> constants(static_cast<size_t>(objects) * CONSTANT_BYTES);
+        for (size_t i = 0; i < constants.size(); ++i)
+            constants[i] = static_cast<unsigned char>(i * 31);
+
+        auto report = [&](const char* method, double elapsed, const ConstantBufferRingStats* stats)
+        {
+            std::printf("%-18s %8u %12.2f %10llu %10llu %8llu %8llu\n", method, objects,
+                        static_cast<double>(objects) * FRAMES / elapsed / 1e6,
+                        static_cast<unsigned long long>(context->counters.discardMaps),
+                        static_cast<unsigned long long>(context->counters.noOverwriteMaps),
+                        static_cast<unsigned long long>(stats ? stats->wraps : 0),
+                        static_cast<unsigned long long>(stats ? stats->stalls : 0));
+            context->counters = {};
+        };
+
+        //Previous scheme: one small dynamic buffer, discarded for every draw
+        {
+            ID3D11Buffer* cBuffer;
+            D3D11_BUFFER_DESC desc = {};
+            desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            desc.Usage = D3D11_USAGE_DYNAMIC;
+            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            desc.ByteWidth = CONSTANT_BYTES;
+            device->CreateBuffer(&desc, nullptr, &cBuffer);
+
+            auto start = std::chrono::steady_clock::now();
+            for (UINT frame = 0; frame < FRAMES; ++frame)
+            {
+                for (UINT i = 0; i < objects; ++i)
+                {
+                    D3D11_MAPPED_SUBRESOURCE mapped = {};
+                    context->Map(cBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+                    std::memcpy(mapped.pData, &constants[static_cast<size_t>(i) * CONSTANT_BYTES], CONSTANT_BYTES);
+                    context->Unmap(cBuffer, 0);
+                    context->VSSetConstantBuffers(0, 1, &cBuffer);
+                }
+            }
+            report("discard per draw", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), nullptr);
+            cBuffer->Release();
+        }
+
+        //The ring, once with one Map per draw and once with one Map per frame, sized for the frames in flight
+        UINT frameBytes = objects * ConstantBufferRing::ALIGNMENT;
+        for (int batched = 0; batched < 2; ++batched)
+        {
+            ConstantBufferRing ring;
+            ring.Create(device, context, frameBytes * (ConstantBufferRing::MAX_FRAMES_IN_FLIGHT + 1));
+            std::vector<ConstantBufferAllocation> allocations(objects);
+
+            auto start = std::chrono::steady_clock::now();
+            for (UINT frame = 0; frame < FRAMES; ++frame)
+            {
+                ring.BeginFrame();
+                if (batched)
+                    ring.UploadArray(constants.data(), CONSTANT_BYTES, objects, allocations.data());
+                for (UINT i = 0; i < objects; ++i)
+                {
+                    if (!batched)
+                        allocations[i] = ring.Upload(&constants[static_cast<size_t>(i) * CONSTANT_BYTES], CONSTANT_BYTES);
+                    ring.BindVS(0, allocations[i]);
+                }
+                ring.EndFrame();
+            }
+            report(batched ? "ring, array" : "ring, per draw", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), &ring.Stats());
+            ring.Release();
+        }
+    }
+
+    //Wrap and fence behavior: the same load with rings from one to four frames of data
+    const UINT OBJECTS = 1000;
+    std::vector<unsigned char> constants(OBJECTS * CONSTANT_BYTES, 0x5A);
+    std::printf("\n%-18s %8s %10s %8s %8s %12s\n", "ring size", "frames", "maps", "wraps", "stalls", "fence polls");
+
+    for (UINT framesOfData = 1; framesOfData <= 4; ++framesOfData)
+    {
+        ConstantBufferRing ring;
+        ring.Create(device, context, OBJECTS * ConstantBufferRing::ALIGNMENT * framesOfData + ConstantBufferRing::ALIGNMENT * 100);
+        std::vector<ConstantBufferAllocation> allocations(OBJECTS);
+
+        for (UINT frame = 0; frame < FRAMES; ++frame)
+        {
+            ring.BeginFrame();
+            for (UINT i = 0; i < OBJECTS; i += 100)     //Ten draw batches per frame
+                ring.UploadArray(&constants[static_cast<size_t>(i) * CONSTANT_BYTES], CONSTANT_BYTES, 100, &allocations[i]);
+            ring.EndFrame();
+        }
+
+        const ConstantBufferRingStats& stats = ring.Stats();
+        std::printf("%8u KB (%u fr) %8u %10llu %8llu %8llu %12llu\n", ring.Size() / 1024, framesOfData, FRAMES,
+                    static_cast<unsigned long long>(stats.maps), static_cast<unsigned long long>(stats.wraps),
+                    static_cast<unsigned long long>(stats.stalls), static_cast<unsigned long long>(context->counters.fencePolls));
+        context->counters = {};
+        ring.Release();
+    }
+
+    context->Release();
+    device->Release();
+}
+
+#endif
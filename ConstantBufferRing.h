@@ -0,0 +1,71 @@
+#pragma once
+
+#include "D3D11Compat.h"
+
+//Per-frame linear upload ring for constant data. One large dynamic buffer is sub-allocated with 256-byte aligned
+//offsets and bound with VSSetConstantBuffers1/PSSetConstantBuffers1, replacing a Map(WRITE_DISCARD) per draw.
+//Writes use WRITE_NO_OVERWRITE; an event query per frame tells when the GPU is done with that frame's range.
+
+struct ConstantBufferAllocation
+{
+	ID3D11Buffer* buffer = nullptr;		//nullptr if the allocation failed
+	UINT firstConstant = 0;				//In 16-byte shader constants, always a multiple of 16
+	UINT numConstants = 0;
+};
+
+struct ConstantBufferRingStats
+{
+	UINT64 allocations = 0;
+	UINT64 bytes = 0;			//Including alignment padding
+	UINT64 maps = 0;
+	UINT64 wraps = 0;
+	UINT64 stalls = 0;			//Times the CPU waited for the GPU to release ring space
+};
+
+class ConstantBufferRing
+{
+public:
+	static const UINT ALIGNMENT = 256;
+	static const UINT MAX_FRAMES_IN_FLIGHT = 3;
+
+	bool Create(ID3D11Device* device, ID3D11DeviceContext1* context, UINT sizeInBytes);
+	void Release();
+
+	void BeginFrame();		//Reclaims the ranges of frames the GPU has finished
+	void EndFrame();		//Fences everything allocated since BeginFrame
+
+	ConstantBufferAllocation Upload(const void* data, UINT size);
+	//count elements of stride bytes each get their own aligned allocation, written with a single Map
+	bool UploadArray(const void* data, UINT stride, UINT count, ConstantBufferAllocation* allocations);
+
+	void BindVS(UINT slot, const ConstantBufferAllocation& allocation);
+	void BindPS(UINT slot, const ConstantBufferAllocation& allocation);
+
+	UINT Size() const { return capacity; }
+	const ConstantBufferRingStats& Stats() const { return stats; }
+
+private:
+	bool Reserve(UINT size, UINT& offset);
+	bool RetireOldestFrame(bool wait);
+	unsigned char* Map(UINT offset);
+
+	ID3D11DeviceContext1* context = nullptr;
+	ID3D11Buffer* buffer = nullptr;
+	ID3D11Query* fences[MAX_FRAMES_IN_FLIGHT] = {};
+	UINT64 frameEnd[MAX_FRAMES_IN_FLIGHT] = {};		//head when each in-flight frame ended
+
+	UINT capacity = 0;
+	UINT64 head = 0;			//Total bytes handed out, including the skipped tails of wraps
+	UINT position = 0;			//head % capacity
+	UINT64 tail = 0;			//Start of the oldest range the GPU may still read
+	unsigned oldestFrame = 0;
+	unsigned framesInFlight = 0;
+	bool firstMap = true;		//The first Map of a dynamic buffer has to discard
+	bool offsetting = true;		//Without D3D11.1 offsets every upload falls back to WRITE_DISCARD at offset 0
+
+	ConstantBufferRingStats stats;
+};
+
+#ifndef _WIN32
+void RunConstantBufferRingBenchmark();
+#endif
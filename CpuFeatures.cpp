@@ -0,0 +1,51 @@
+#include "CpuFeatures.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features;
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    features.sse2 = (info[3] & (1 << 26)) != 0;
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    //The OS has to save the wider registers on context switches, not just the CPU support them
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymmState = (xcr0 & 0x6) == 0x6;
+    bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        features.avx2 = ymmState && fma && (info[1] & (1 << 5)) != 0;
+        features.avx512 = zmmState && features.avx2 && (info[1] & (1 << 16)) != 0;
+    }
+#elif defined(SIMD_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    features.sse2 = __builtin_cpu_supports("sse2");
+    features.sse41 = __builtin_cpu_supports("sse4.1");
+    features.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    features.avx512 = features.avx2 && __builtin_cpu_supports("avx512f");
+#elif defined(SIMD_NEON)
+    features.neon = true;
+#endif
+
+    return features;
+}
+
+const CpuFeatures& GetCpuFeatures()
+{
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+//Runtime instruction set detection and helpers for compiling per-ISA code paths in one translation unit
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#define SIMD_NEON 1		//Always present on AArch64, no runtime check needed
+#endif
+
+//Code between SIMD_BEGIN_TARGET_* and SIMD_END_TARGET may use that instruction set's intrinsics.
+//Only call it after checking GetCpuFeatures(). MSVC allows the intrinsics anywhere, so the macros are empty there.
+#if defined(__clang__)
+#define SIMD_BEGIN_TARGET_SSE41 _Pragma("clang attribute push (__attribute__((target(\"sse4.1\"))), apply_to = function)")
+#define SIMD_BEGIN_TARGET_AVX2 _Pragma("clang attribute push (__attribute__((target(\"avx2,fma\"))), apply_to = function)")
+#define SIMD_BEGIN_TARGET_AVX512 _Pragma("clang attribute push (__attribute__((target(\"avx512f,avx2,fma\"))), apply_to = function)")
+#define SIMD_END_TARGET _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#define SIMD_BEGIN_TARGET_SSE41 _Pragma("GCC push_options") _Pragma("GCC target(\"sse4.1\")")
+#define SIMD_BEGIN_TARGET_AVX2 _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,fma\")")
+#define SIMD_BEGIN_TARGET_AVX512 _Pragma("GCC push_options") _Pragma("GCC target(\"avx512f,avx2,fma\")")
+#define SIMD_END_TARGET _Pragma("GCC pop_options")
+#else
+#define SIMD_BEGIN_TARGET_SSE41
+#define SIMD_BEGIN_TARGET_AVX2
+#define SIMD_BEGIN_TARGET_AVX512
+#define SIMD_END_TARGET
+#endif
+
+struct CpuFeatures
+{
+	bool sse2 = false;
+	bool sse41 = false;
+	bool avx2 = false;		//Includes FMA
+	bool avx512 = false;	//AVX-512F
+	bool neon = false;
+};
+
+const CpuFeatures& GetCpuFeatures();
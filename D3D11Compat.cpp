@@ -0,0 +1,283 @@
+#ifndef _WIN32      //Stand-in device, Windows builds use the real runtime
+
+#include "D3D11Compat.h"
+
+#include <algorithm>
+#include <cstring>
+
+HRESULT ID3D11Device::CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer)
+{
+    if (desc == nullptr || buffer == nullptr || desc->ByteWidth == 0)
+        return E_INVALIDARG;
+
+    if (desc->Usage == D3D11_USAGE_IMMUTABLE && initialData == nullptr)
+        return E_INVALIDARG;
+
+    ID3D11Buffer* created = new ID3D11Buffer();
+    created->desc = *desc;
+    created->memory.resize(desc->ByteWidth);
+
+    if (initialData != nullptr)
+        std::memcpy(created->memory.data(), initialData->pSysMem, desc->ByteWidth);
+
+    *buffer = created;
+    return S_OK;
+}
+
+namespace
+{
+    //Bytes in one row of texels, or of 4x4 blocks for the BC formats, and the number of such rows
+    bool TextureRowLayout(DXGI_FORMAT format, UINT width, UINT height, UINT& rowBytes, UINT& rows)
+    {
+        UINT blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+        switch (format)
+        {
+        case DXGI_FORMAT_R8G8B8A8_UNORM: rowBytes = width * 4; rows = height; return true;
+        case DXGI_FORMAT_R8G8_UNORM:     rowBytes = width * 2; rows = height; return true;
+        case DXGI_FORMAT_R8_UNORM:       rowBytes = width;     rows = height; return true;
+        case DXGI_FORMAT_BC1_UNORM:      rowBytes = blocksWide * 8;  rows = blocksHigh; return true;
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC7_UNORM:      rowBytes = blocksWide * 16; rows = blocksHigh; return true;
+        default:                         return false;
+        }
+    }
+}
+
+HRESULT ID3D11Device::CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture2D)
+{
+    UINT rowBytes, rows;
+    if (desc == nullptr || texture2D == nullptr || desc->Width == 0 || desc->Height == 0 || desc->MipLevels == 0 || desc->ArraySize != 1 ||
+        !TextureRowLayout(desc->Format, desc->Width, desc->Height, rowBytes, rows))
+        return E_INVALIDARG;
+
+    bool blockCompressed = desc->Format == DXGI_FORMAT_BC1_UNORM || desc->Format == DXGI_FORMAT_BC3_UNORM || desc->Format == DXGI_FORMAT_BC7_UNORM;
+    if ((blockCompressed && (desc->Width % 4 != 0 || desc->Height % 4 != 0)) || (desc->Usage == D3D11_USAGE_IMMUTABLE && initialData == nullptr))
+        return E_INVALIDARG;
+
+    ID3D11Texture2D* created = new ID3D11Texture2D();
+    created->desc = *desc;
+    created->subresources.resize(desc->MipLevels);
+
+    for (UINT level = 0; level < desc->MipLevels; ++level)
+    {
+        UINT width = desc->Width >> level, height = desc->Height >> level;
+        TextureRowLayout(desc->Format, width > 0 ? width : 1, height > 0 ? height : 1, rowBytes, rows);
+        created->subresources[level].resize(size_t(rowBytes) * rows);
+
+        if (initialData == nullptr)
+            continue;
+
+        const D3D11_SUBRESOURCE_DATA& data = initialData[level];
+        if (data.pSysMem == nullptr || data.SysMemPitch < rowBytes)
+        {
+            created->Release();
+            return E_INVALIDARG;
+        }
+        for (UINT row = 0; row < rows; ++row)
+            std::memcpy(&created->subresources[level][size_t(row) * rowBytes], static_cast<const unsigned char*>(data.pSysMem) + size_t(row) * data.SysMemPitch, rowBytes);
+    }
+
+    *texture2D = created;
+    return S_OK;
+}
+
+HRESULT ID3D11Device::CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view)
+{
+    if (resource == nullptr || desc != nullptr || view == nullptr)
+        return E_INVALIDARG;
+
+    ID3D11ShaderResourceView* created = new ID3D11ShaderResourceView();
+    resource->AddRef();
+    created->resource = resource;
+    *view = created;
+    return S_OK;
+}
+
+HRESULT ID3D11Device::CreateQuery(const D3D11_QUERY_DESC* desc, ID3D11Query** query)
+{
+    if (desc == nullptr || query == nullptr || desc->Query != D3D11_QUERY_EVENT)
+        return E_INVALIDARG;
+
+    *query = new ID3D11Query();
+    return S_OK;
+}
+
+HRESULT ID3D11Device::CheckFeatureSupport(D3D11_FEATURE feature, void* featureSupportData, UINT featureSupportDataSize)
+{
+    if (feature != D3D11_FEATURE_D3D11_OPTIONS || featureSupportDataSize != sizeof(D3D11_FEATURE_DATA_D3D11_OPTIONS))
+        return E_INVALIDARG;
+
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+    options.ConstantBufferPartialUpdate = true;
+    options.ConstantBufferOffsetting = true;
+    options.MapNoOverwriteOnDynamicConstantBuffer = true;
+    std::memcpy(featureSupportData, &options, sizeof(options));
+    return S_OK;
+}
+
+HRESULT ID3D11DeviceContext::Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT, D3D11_MAPPED_SUBRESOURCE* mappedResource)
+{
+    ID3D11Buffer* buffer = static_cast<ID3D11Buffer*>(resource);
+
+    if (buffer == nullptr || mappedResource == nullptr || subresource != 0 || buffer->mapped)
+        return E_INVALIDARG;
+
+    bool dynamic = buffer->desc.Usage == D3D11_USAGE_DYNAMIC;
+    if ((mapType == D3D11_MAP_WRITE_DISCARD || mapType == D3D11_MAP_WRITE_NO_OVERWRITE) && !dynamic)
+        return E_INVALIDARG;
+
+    if (mapType == D3D11_MAP_WRITE_DISCARD)
+        ++counters.discardMaps;
+    else if (mapType == D3D11_MAP_WRITE_NO_OVERWRITE)
+        ++counters.noOverwriteMaps;
+    else
+        ++counters.otherMaps;
+
+    buffer->mapped = true;
+    mappedResource->pData = buffer->memory.data();
+    mappedResource->RowPitch = buffer->desc.ByteWidth;
+    mappedResource->DepthPitch = buffer->desc.ByteWidth;
+    return S_OK;
+}
+
+void ID3D11DeviceContext::Unmap(ID3D11Resource* resource, UINT)
+{
+    static_cast<ID3D11Buffer*>(resource)->mapped = false;
+}
+
+void ID3D11DeviceContext::CopySubresourceRegion(ID3D11Resource* dstResource, UINT dstSubresource, UINT dstX, UINT dstY, UINT dstZ,
+                                                ID3D11Resource* srcResource, UINT srcSubresource, const D3D11_BOX* srcBox)
+{
+    ID3D11Texture2D* destination = static_cast<ID3D11Texture2D*>(dstResource);
+    ID3D11Texture2D* source = static_cast<ID3D11Texture2D*>(srcResource);
+
+    //Invalid copies are dropped, as the debug layer reports and the runtime ignores them
+    if (destination == nullptr || source == nullptr || srcBox != nullptr || dstX != 0 || dstY != 0 || dstZ != 0 ||
+        destination->desc.Usage == D3D11_USAGE_IMMUTABLE || destination->desc.Format != source->desc.Format ||
+        dstSubresource >= destination->subresources.size() || srcSubresource >= source->subresources.size() ||
+        destination->subresources[dstSubresource].size() != source->subresources[srcSubresource].size())
+        return;
+
+    destination->subresources[dstSubresource] = source->subresources[srcSubresource];
+    counters.copiedBytes += source->subresources[srcSubresource].size();
+}
+
+void ID3D11DeviceContext::IASetVertexBuffers(UINT, UINT numBuffers, ID3D11Buffer* const*, const UINT*, const UINT*)
+{
+    counters.vertexBufferBinds += numBuffers;
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::IASetInputLayout(ID3D11InputLayout*)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::VSSetShader(ID3D11VertexShader*, ID3D11ClassInstance* const*, UINT)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::PSSetShader(ID3D11PixelShader*, ID3D11ClassInstance* const*, UINT)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::PSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::PSSetSamplers(UINT, UINT, ID3D11SamplerState* const*)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::RSSetViewports(UINT, const D3D11_VIEWPORT*)
+{
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::Draw(UINT, UINT)
+{
+    ++counters.drawCalls;
+    ++counters.instancesDrawn;
+}
+
+void ID3D11DeviceContext::DrawInstanced(UINT, UINT instanceCount, UINT, UINT)
+{
+    ++counters.drawCalls;
+    counters.instancesDrawn += instanceCount;
+}
+
+void ID3D11DeviceContext::VSSetConstantBuffers(UINT, UINT numBuffers, ID3D11Buffer* const*)
+{
+    counters.constantBufferBinds += numBuffers;
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::PSSetConstantBuffers(UINT, UINT numBuffers, ID3D11Buffer* const*)
+{
+    counters.constantBufferBinds += numBuffers;
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext::End(ID3D11Asynchronous* async)
+{
+    ID3D11Query* query = static_cast<ID3D11Query*>(async);
+    query->fence = ++submittedFence;
+    ++counters.fencesIssued;
+
+    if (submittedFence > gpuLatency)
+        completedFence = std::max(completedFence, submittedFence - gpuLatency);
+}
+
+HRESULT ID3D11DeviceContext::GetData(ID3D11Asynchronous* async, void* data, UINT dataSize, UINT getDataFlags)
+{
+    ID3D11Query* query = static_cast<ID3D11Query*>(async);
+    ++counters.fencePolls;
+
+    if (query->fence > completedFence)
+    {
+        if (!(getDataFlags & D3D11_ASYNC_GETDATA_DONOTFLUSH))
+            ++completedFence;       //Time passes while the CPU waits
+        return S_FALSE;
+    }
+
+    if (data != nullptr && dataSize >= sizeof(BOOL))
+        *static_cast<BOOL*>(data) = true;
+    return S_OK;
+}
+
+void ID3D11DeviceContext::Flush()
+{
+}
+
+void ID3D11DeviceContext1::VSSetConstantBuffers1(UINT, UINT numBuffers, ID3D11Buffer* const*, const UINT*, const UINT*)
+{
+    counters.constantBufferBinds += numBuffers;
+    ++counters.stateCalls;
+}
+
+void ID3D11DeviceContext1::PSSetConstantBuffers1(UINT, UINT numBuffers, ID3D11Buffer* const*, const UINT*, const UINT*)
+{
+    counters.constantBufferBinds += numBuffers;
+    ++counters.stateCalls;
+}
+
+HRESULT CreateHeadlessDevice(ID3D11Device** device, ID3D11DeviceContext1** context)
+{
+    if (device == nullptr || context == nullptr)
+        return E_INVALIDARG;
+
+    *device = new ID3D11Device();
+    *context = new ID3D11DeviceContext1();
+    return S_OK;
+}
+
+#endif
@@ -0,0 +1,314 @@
+#pragma once
+
+//The real D3D11.1 headers on Windows. Everywhere else a stand-in for the subset of the API this project uses,
+//backed by system memory, so pipeline code can be built and benchmarked on hosts without a GPU.
+
+#ifdef _WIN32
+
+#include <d3d11_1.h>
+
+#else
+
+#include <cstdint>
+#include <vector>
+
+typedef unsigned int UINT;
+typedef int BOOL;
+typedef int32_t HRESULT;
+typedef uint64_t UINT64;
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+
+enum D3D11_USAGE
+{
+	D3D11_USAGE_DEFAULT = 0,
+	D3D11_USAGE_IMMUTABLE = 1,
+	D3D11_USAGE_DYNAMIC = 2,
+	D3D11_USAGE_STAGING = 3
+};
+
+enum D3D11_BIND_FLAG
+{
+	D3D11_BIND_VERTEX_BUFFER = 0x1,
+	D3D11_BIND_INDEX_BUFFER = 0x2,
+	D3D11_BIND_CONSTANT_BUFFER = 0x4,
+	D3D11_BIND_SHADER_RESOURCE = 0x8
+};
+
+enum D3D11_CPU_ACCESS_FLAG
+{
+	D3D11_CPU_ACCESS_WRITE = 0x10000,
+	D3D11_CPU_ACCESS_READ = 0x20000
+};
+
+enum D3D11_MAP
+{
+	D3D11_MAP_READ = 1,
+	D3D11_MAP_WRITE = 2,
+	D3D11_MAP_READ_WRITE = 3,
+	D3D11_MAP_WRITE_DISCARD = 4,
+	D3D11_MAP_WRITE_NO_OVERWRITE = 5
+};
+
+enum D3D11_QUERY
+{
+	D3D11_QUERY_EVENT = 0
+};
+
+enum D3D11_ASYNC_GETDATA_FLAG
+{
+	D3D11_ASYNC_GETDATA_DONOTFLUSH = 0x1
+};
+
+enum D3D11_FEATURE
+{
+	D3D11_FEATURE_D3D11_OPTIONS = 7
+};
+
+enum D3D11_PRIMITIVE_TOPOLOGY
+{
+	D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED = 0,
+	D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST = 4,
+	D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP = 5
+};
+
+enum DXGI_FORMAT		//Only the texture formats this project creates
+{
+	DXGI_FORMAT_UNKNOWN = 0,
+	DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+	DXGI_FORMAT_R8G8_UNORM = 49,
+	DXGI_FORMAT_R8_UNORM = 61,
+	DXGI_FORMAT_BC1_UNORM = 71,
+	DXGI_FORMAT_BC3_UNORM = 77,
+	DXGI_FORMAT_BC7_UNORM = 98
+};
+
+struct DXGI_SAMPLE_DESC
+{
+	UINT Count;
+	UINT Quality;
+};
+
+struct D3D11_TEXTURE2D_DESC
+{
+	UINT Width;
+	UINT Height;
+	UINT MipLevels;
+	UINT ArraySize;
+	DXGI_FORMAT Format;
+	DXGI_SAMPLE_DESC SampleDesc;
+	D3D11_USAGE Usage;
+	UINT BindFlags;
+	UINT CPUAccessFlags;
+	UINT MiscFlags;
+};
+
+struct D3D11_SHADER_RESOURCE_VIEW_DESC;		//Only nullptr, a view of the whole resource, is supported
+struct D3D11_BOX;								//Only nullptr, the whole source subresource, is supported
+
+struct D3D11_BUFFER_DESC
+{
+	UINT ByteWidth;
+	D3D11_USAGE Usage;
+	UINT BindFlags;
+	UINT CPUAccessFlags;
+	UINT MiscFlags;
+	UINT StructureByteStride;
+};
+
+struct D3D11_SUBRESOURCE_DATA
+{
+	const void* pSysMem;
+	UINT SysMemPitch;
+	UINT SysMemSlicePitch;
+};
+
+struct D3D11_MAPPED_SUBRESOURCE
+{
+	void* pData;
+	UINT RowPitch;
+	UINT DepthPitch;
+};
+
+struct D3D11_QUERY_DESC
+{
+	D3D11_QUERY Query;
+	UINT MiscFlags;
+};
+
+struct D3D11_VIEWPORT
+{
+	float TopLeftX;
+	float TopLeftY;
+	float Width;
+	float Height;
+	float MinDepth;
+	float MaxDepth;
+};
+
+inline bool operator==(const D3D11_VIEWPORT& a, const D3D11_VIEWPORT& b)		//As d3d11.h defines them
+{
+	return a.TopLeftX == b.TopLeftX && a.TopLeftY == b.TopLeftY && a.Width == b.Width && a.Height == b.Height &&
+		a.MinDepth == b.MinDepth && a.MaxDepth == b.MaxDepth;
+}
+
+inline bool operator!=(const D3D11_VIEWPORT& a, const D3D11_VIEWPORT& b)
+{
+	return !(a == b);
+}
+
+struct D3D11_FEATURE_DATA_D3D11_OPTIONS
+{
+	BOOL OutputMergerLogicOp;
+	BOOL UAVOnlyRenderingForcedSampleCount;
+	BOOL DiscardAPIsSeenByDriver;
+	BOOL FlagsForUpdateAndCopySeenByDriver;
+	BOOL ClearView;
+	BOOL CopyWithOverlap;
+	BOOL ConstantBufferPartialUpdate;
+	BOOL ConstantBufferOffsetting;
+	BOOL MapNoOverwriteOnDynamicConstantBuffer;
+	BOOL MapNoOverwriteOnDynamicBufferSRV;
+	BOOL MultisampleRTVWithForcedSampleCountOne;
+	BOOL SAD4ShaderInstructions;
+	BOOL ExtendedDoublesShaderInstructions;
+	BOOL ExtendedResourceSharing;
+};
+
+class HeadlessUnknown		//Reference counting in place of IUnknown
+{
+public:
+	virtual ~HeadlessUnknown() = default;
+
+	UINT AddRef() { return ++refCount; }
+	UINT Release()
+	{
+		UINT count = --refCount;
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+private:
+	UINT refCount = 1;
+};
+
+class ID3D11DeviceChild : public HeadlessUnknown {};
+class ID3D11Resource : public ID3D11DeviceChild {};
+class ID3D11Asynchronous : public ID3D11DeviceChild {};
+class ID3D11View : public ID3D11DeviceChild {};
+class ID3D11ShaderResourceView : public ID3D11View
+{
+public:
+	~ID3D11ShaderResourceView() { if (resource != nullptr) resource->Release(); }
+
+	ID3D11Resource* resource = nullptr;		//Holds a reference, as a real view does
+};
+class ID3D11SamplerState : public ID3D11DeviceChild {};
+class ID3D11InputLayout : public ID3D11DeviceChild {};
+class ID3D11VertexShader : public ID3D11DeviceChild {};
+class ID3D11PixelShader : public ID3D11DeviceChild {};
+class ID3D11ClassInstance : public ID3D11DeviceChild {};
+
+class ID3D11Buffer : public ID3D11Resource
+{
+public:
+	void GetDesc(D3D11_BUFFER_DESC* desc) const { *desc = this->desc; }
+
+	D3D11_BUFFER_DESC desc = {};
+	std::vector<unsigned char> memory;
+	bool mapped = false;
+};
+
+class ID3D11Texture2D : public ID3D11Resource
+{
+public:
+	void GetDesc(D3D11_TEXTURE2D_DESC* desc) const { *desc = this->desc; }
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	std::vector<std::vector<unsigned char>> subresources;		//One per mip level, rows packed without padding
+};
+
+class ID3D11Query : public ID3D11Asynchronous
+{
+public:
+	UINT64 fence = 0;
+};
+
+class ID3D11Device : public HeadlessUnknown
+{
+public:
+	HRESULT CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer);
+	HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture2D);
+	HRESULT CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view);
+	HRESULT CreateQuery(const D3D11_QUERY_DESC* desc, ID3D11Query** query);
+	HRESULT CheckFeatureSupport(D3D11_FEATURE feature, void* featureSupportData, UINT featureSupportDataSize);
+};
+
+struct HeadlessCounters		//API calls seen by the stand-in context
+{
+	UINT64 discardMaps = 0;
+	UINT64 noOverwriteMaps = 0;
+	UINT64 otherMaps = 0;
+	UINT64 constantBufferBinds = 0;
+	UINT64 vertexBufferBinds = 0;
+	UINT64 drawCalls = 0;
+	UINT64 instancesDrawn = 0;
+	UINT64 fencesIssued = 0;
+	UINT64 fencePolls = 0;
+	UINT64 stateCalls = 0;		//Every IA/VS/PS/RS Set* call, whatever its kind
+	UINT64 copiedBytes = 0;		//CopySubresourceRegion
+};
+
+class ID3D11DeviceContext : public HeadlessUnknown
+{
+public:
+	HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT mapFlags, D3D11_MAPPED_SUBRESOURCE* mappedResource);
+	void Unmap(ID3D11Resource* resource, UINT subresource);
+	void CopySubresourceRegion(ID3D11Resource* dstResource, UINT dstSubresource, UINT dstX, UINT dstY, UINT dstZ,
+		ID3D11Resource* srcResource, UINT srcSubresource, const D3D11_BOX* srcBox);		//Texture2D mip levels of equal size only
+
+	void IASetVertexBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* vertexBuffers, const UINT* strides, const UINT* offsets);
+	void IASetInputLayout(ID3D11InputLayout* inputLayout);
+	void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void VSSetShader(ID3D11VertexShader* vertexShader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances);
+	void PSSetShader(ID3D11PixelShader* pixelShader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances);
+	void PSSetShaderResources(UINT startSlot, UINT numViews, ID3D11ShaderResourceView* const* shaderResourceViews);
+	void PSSetSamplers(UINT startSlot, UINT numSamplers, ID3D11SamplerState* const* samplers);
+	void RSSetViewports(UINT numViewports, const D3D11_VIEWPORT* viewports);
+	void Draw(UINT vertexCount, UINT startVertexLocation);
+	void DrawInstanced(UINT vertexCountPerInstance, UINT instanceCount, UINT startVertexLocation, UINT startInstanceLocation);
+
+	void VSSetConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers);
+	void PSSetConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers);
+
+	void End(ID3D11Asynchronous* async);
+	HRESULT GetData(ID3D11Asynchronous* async, void* data, UINT dataSize, UINT getDataFlags);
+	void Flush();
+
+	//Stand-in only: the simulated GPU finishes a fence this many fences after it was issued,
+	//or earlier while the CPU waits on an unfinished one without D3D11_ASYNC_GETDATA_DONOTFLUSH
+	UINT gpuLatency = 2;
+	HeadlessCounters counters;
+
+protected:
+	UINT64 submittedFence = 0;
+	UINT64 completedFence = 0;
+};
+
+class ID3D11DeviceContext1 : public ID3D11DeviceContext
+{
+public:
+	void VSSetConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers, const UINT* firstConstant, const UINT* numConstants);
+	void PSSetConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers, const UINT* firstConstant, const UINT* numConstants);
+};
+
+HRESULT CreateHeadlessDevice(ID3D11Device** device, ID3D11DeviceContext1** context);
+
+#endif
@@ -1,6 +1,6 @@
 #include "D3D11Handler.h"
 
-bool CreateInterface(UINT winWidth, UINT winHeight, HWND window, ID3D11Device*& device, ID3D11DeviceContext*& context, IDXGISwapChain*& swapChain) 
+bool CreateInterface(UINT winWidth, UINT winHeight, HWND window, ID3D11Device*& device, ID3D11DeviceContext1*& context, IDXGISwapChain*& swapChain) 
 {
     DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
 
@@ -27,9 +27,17 @@ bool CreateInterface(UINT winWidth, UINT winHeight, HWND window, ID3D11Device*&
 
     D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_0 };     //Minimum hardware requirement
 
+    ID3D11DeviceContext* baseContext;
+
     HRESULT hr = D3D11CreateDeviceAndSwapChain(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, flags, featureLevels, 1,                 //Adapter null, default adapter
-                                               D3D11_SDK_VERSION, &swapChainDesc, &swapChain, &device, nullptr, &context);          //Software null because we are using driver type hardware
+                                               D3D11_SDK_VERSION, &swapChainDesc, &swapChain, &device, nullptr, &baseContext);      //Software null because we are using driver type hardware
                                                                                                                                     //Last null, we dont need to know which feature level is supported (assuming)
+    if (FAILED(hr))
+        return false;
+
+    hr = baseContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&context));     //D3D11.1 runtime, binds constant buffers by offset
+    baseContext->Release();
+
     return !FAILED(hr);
 }
 
@@ -83,7 +91,7 @@ void SetViewPort(D3D11_VIEWPORT& viewPort, UINT winWidth, UINT winHeight)
     viewPort.MaxDepth = 1;
 }
 
-bool SetupD3D11(UINT winWidth, UINT winHeight, HWND window, ID3D11Device*& device, ID3D11DeviceContext*& context, IDXGISwapChain*& swapChain, 
+bool SetupD3D11(UINT winWidth, UINT winHeight, HWND window, ID3D11Device*& device, ID3D11DeviceContext1*& context, IDXGISwapChain*& swapChain, 
                 ID3D11RenderTargetView*& rtv, ID3D11Texture2D*& dsTexture, ID3D11DepthStencilView*& dsView, D3D11_VIEWPORT& viewPort)
 {
     if (!CreateInterface(winWidth, winHeight, window, device, context, swapChain)) {
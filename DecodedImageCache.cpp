@@ -0,0 +1,533 @@
+#include "DecodedImageCache.h"
+#include "CpuFeatures.h"
+#include "MappedFile.h"
+#include "PngEncoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    const uint64_t PRIME32_1 = 0x9E3779B1ull;
+    const uint64_t PRIME32_2 = 0x85EBCA77ull;
+    const uint64_t PRIME32_3 = 0xC2B2AE3Dull;
+    const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+    const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+    const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+    const size_t STRIPE_BYTES = 64;
+    const size_t STRIPES_PER_BLOCK = 16;
+
+    //Splitmix64 output, one word per lane for input mixing, then one per lane for scrambling
+    alignas(32) const uint64_t LANE_KEYS[8] = { 0x2CB0F69F4ABEA221ull, 0x9417034723148989ull, 0xDD555950609DFE03ull, 0xDBAFB150DEB12800ull,
+                                                0x7E789B2E6C442CB6ull, 0xF41E5636C7E4F8C4ull, 0x0959D150F8FBA7E4ull, 0xA97316F13CDB9EEAull };
+    alignas(32) const uint64_t SCRAMBLE_KEYS[8] = { 0x74CD8258F9520068ull, 0x55C74A62E116868Bull, 0xD2F4C799A2023CBDull, 0xDF98CB79A37B51B9ull,
+                                                    0x396F5885524F3905ull, 0xAF1D56386CA3B276ull, 0xA9FFBE6B5104E85Aull, 0x6BD0C51B9FD533B3ull };
+
+    uint64_t RotateLeft(uint64_t value, int bits)
+    {
+        return value << bits | value >> (64 - bits);
+    }
+
+    void InitAccumulators(uint64_t* acc)
+    {
+        const uint64_t initial[8] = { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+        std::memcpy(acc, initial, sizeof(initial));
+    }
+
+    //The stripes both ISAs hash are the same: whole 64-byte stripes, then the rest zero-padded to one more
+    uint64_t Finalize(const uint64_t* acc, size_t size)
+    {
+        uint64_t hash = size * PRIME64_1;
+        for (int i = 0; i < 8; ++i)
+        {
+            hash ^= RotateLeft(acc[i] * PRIME64_2, 31) * PRIME64_1;
+            hash = RotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+        }
+        hash ^= hash >> 33;
+        hash *= PRIME64_2;
+        hash ^= hash >> 29;
+        hash *= PRIME64_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    void AccumulateScalar(uint64_t* acc, const uint8_t* stripe)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            uint64_t data;
+            std::memcpy(&data, stripe + i * 8, 8);
+            uint64_t keyed = data ^ LANE_KEYS[i];
+            acc[i ^ 1] += data;             //Raw input crosses lanes, so a product of zero cannot erase it
+            acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        }
+    }
+
+    void ScrambleScalar(uint64_t* acc)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            acc[i] ^= acc[i] >> 47;
+            acc[i] ^= SCRAMBLE_KEYS[i];
+            acc[i] *= PRIME32_1;
+        }
+    }
+
+    uint64_t HashScalar(const uint8_t* data, size_t size)
+    {
+        uint64_t acc[8];
+        InitAccumulators(acc);
+
+        size_t stripes = size / STRIPE_BYTES;
+        for (size_t s = 0; s < stripes; ++s)
+        {
+            AccumulateScalar(acc, data + s * STRIPE_BYTES);
+            if (s % STRIPES_PER_BLOCK == STRIPES_PER_BLOCK - 1)
+                ScrambleScalar(acc);
+        }
+        if (size % STRIPE_BYTES != 0)
+        {
+            uint8_t last[STRIPE_BYTES] = {};
+            std::memcpy(last, data + stripes * STRIPE_BYTES, size % STRIPE_BYTES);
+            AccumulateScalar(acc, last);
+        }
+        return Finalize(acc, size);
+    }
+}
+
+#ifdef SIMD_X86
+
+SIMD_BEGIN_TARGET_AVX2
+namespace
+{
+    //Lanes 0-3 in low, 4-7 in high. Swapping the 64-bit halves of each 128-bit pair is the i ^ 1 of the scalar code.
+    inline void AccumulateAvx2(__m256i& low, __m256i& high, const uint8_t* stripe, __m256i keyLow, __m256i keyHigh)
+    {
+        __m256i dataLow = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe));
+        __m256i dataHigh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe + 32));
+        __m256i keyedLow = _mm256_xor_si256(dataLow, keyLow);
+        __m256i keyedHigh = _mm256_xor_si256(dataHigh, keyHigh);
+        __m256i productLow = _mm256_mul_epu32(keyedLow, _mm256_srli_epi64(keyedLow, 32));
+        __m256i productHigh = _mm256_mul_epu32(keyedHigh, _mm256_srli_epi64(keyedHigh, 32));
+        low = _mm256_add_epi64(low, _mm256_add_epi64(productLow, _mm256_shuffle_epi32(dataLow, _MM_SHUFFLE(1, 0, 3, 2))));
+        high = _mm256_add_epi64(high, _mm256_add_epi64(productHigh, _mm256_shuffle_epi32(dataHigh, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+
+    //acc * PRIME32_1 from two 32x32 products: the low half of acc times the prime, plus the high half times it shifted up
+    inline __m256i ScrambleAvx2(__m256i acc, __m256i key)
+    {
+        const __m256i prime = _mm256_set1_epi64x(PRIME32_1);
+        acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47));
+        acc = _mm256_xor_si256(acc, key);
+        __m256i low = _mm256_mul_epu32(acc, prime);
+        __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(acc, 32), prime);
+        return _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+    }
+
+    uint64_t HashAvx2(const uint8_t* data, size_t size)
+    {
+        alignas(32) uint64_t acc[8];
+        InitAccumulators(acc);
+        __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc));
+        __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + 4));
+        const __m256i keyLow = _mm256_load_si256(reinterpret_cast<const __m256i*>(LANE_KEYS));
+        const __m256i keyHigh = _mm256_load_si256(reinterpret_cast<const __m256i*>(LANE_KEYS + 4));
+        const __m256i scrambleLow = _mm256_load_si256(reinterpret_cast<const __m256i*>(SCRAMBLE_KEYS));
+        const __m256i scrambleHigh = _mm256_load_si256(reinterpret_cast<const __m256i*>(SCRAMBLE_KEYS + 4));
+
+        size_t stripes = size / STRIPE_BYTES;
+        size_t s = 0;
+        for (; s + STRIPES_PER_BLOCK <= stripes; s += STRIPES_PER_BLOCK)
+        {
+            const uint8_t* block = data + s * STRIPE_BYTES;
+            for (size_t i = 0; i < STRIPES_PER_BLOCK; ++i)
+                AccumulateAvx2(low, high, block + i * STRIPE_BYTES, keyLow, keyHigh);
+            low = ScrambleAvx2(low, scrambleLow);
+            high = ScrambleAvx2(high, scrambleHigh);
+        }
+        for (; s < stripes; ++s)
+            AccumulateAvx2(low, high, data + s * STRIPE_BYTES, keyLow, keyHigh);
+        if (size % STRIPE_BYTES != 0)
+        {
+            uint8_t last[STRIPE_BYTES] = {};
+            std::memcpy(last, data + stripes * STRIPE_BYTES, size % STRIPE_BYTES);
+            AccumulateAvx2(low, high, last, keyLow, keyHigh);
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc), low);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc + 4), high);
+        return Finalize(acc, size);
+    }
+}
+SIMD_END_TARGET
+
+#endif
+
+const char* HashIsaName(HashIsa isa)
+{
+    switch (isa)
+    {
+    case HashIsa::AVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+bool IsHashIsaSupported(HashIsa isa)
+{
+    switch (isa)
+    {
+    case HashIsa::AVX2: return GetCpuFeatures().avx2;
+    default: return true;
+    }
+}
+
+HashIsa BestHashIsa()
+{
+    static const HashIsa best = IsHashIsaSupported(HashIsa::AVX2) ? HashIsa::AVX2 : HashIsa::Scalar;
+    return best;
+}
+
+uint64_t HashBytes(HashIsa isa, const uint8_t* data, size_t size)
+{
+#ifdef SIMD_X86
+    if (isa == HashIsa::AVX2)
+        return HashAvx2(data, size);
+#endif
+    return HashScalar(data, size);
+}
+
+uint64_t HashBytes(const uint8_t* data, size_t size)
+{
+    return HashBytes(BestHashIsa(), data, size);
+}
+
+namespace
+{
+    const char ENTRY_MAGIC[4] = { 'D', 'I', 'M', 'G' };
+    const uint32_t ENTRY_VERSION = 1;
+    const char* ENTRY_EXTENSION = ".dimg";
+    const size_t PIXEL_OFFSET = 64;         //Texels start on a cache line
+
+    struct EntryHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint64_t sourceSize;                //Encoded file, a second check against hash collisions
+        uint32_t format;                    //TexelFormat
+        uint32_t width;
+        uint32_t height;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(EntryHeader) <= PIXEL_OFFSET, "Entry header overlaps the texels");
+}
+
+bool DecodedImageCache::Create(const std::string& directory, uint64_t maxBytes)
+{
+    Release();
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (!std::filesystem::is_directory(directory, error))
+    {
+        std::cerr << "Could not create decoded image cache " << directory << std::endl;
+        return false;
+    }
+    this->directory = directory;
+    this->maxBytes = maxBytes;
+
+    //Oldest file first, so the logical clock keeps the order of earlier runs
+    struct Found
+    {
+        uint64_t key;
+        uint64_t bytes;
+        std::filesystem::file_time_type time;
+    };
+    std::vector<Found> found;
+    for (const std::filesystem::directory_entry& file : std::filesystem::directory_iterator(directory, error))
+    {
+        std::string name = file.path().filename().string();
+        if (file.path().extension() != ENTRY_EXTENSION || name.size() != 16 + std::strlen(ENTRY_EXTENSION))
+            continue;
+        char* end;
+        uint64_t key = std::strtoull(name.c_str(), &end, 16);
+        if (end != name.c_str() + 16)
+            continue;
+        found.push_back({ key, file.file_size(error), file.last_write_time(error) });
+    }
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.time < b.time; });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Found& file : found)
+    {
+        entries[file.key] = { file.bytes, ++clock };
+        counters.bytes += file.bytes;
+    }
+    EvictLocked();
+    return true;
+}
+
+void DecodedImageCache::Release()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    directory.clear();
+    entries.clear();
+    clock = 0;
+    counters = Counters();
+}
+
+DecodedImageCache::Counters DecodedImageCache::GetCounters() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+std::string DecodedImageCache::EntryPath(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx%s", static_cast<unsigned long long>(key), ENTRY_EXTENSION);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+bool DecodedImageCache::Load(const uint8_t* file, size_t size, TextureImage& image)
+{
+    uint64_t key = HashBytes(file, size);
+
+    bool indexed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = entries.find(key);
+        indexed = entry != entries.end();
+        if (indexed)
+            entry->second.lastUsed = ++clock;
+    }
+
+    if (indexed && Read(key, size, image))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++counters.hits;
+        return true;
+    }
+
+    if (!LoadTextureImageFromMemory(file, size, image))
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++counters.misses;
+    }
+    Store(key, size, image);
+    return true;
+}
+
+bool DecodedImageCache::Read(uint64_t key, uint64_t fileSize, TextureImage& image)
+{
+    std::string path = EntryPath(key);
+    MappedFile mapped;
+    if (!mapped.Open(path) || mapped.Size() < PIXEL_OFFSET)
+        return false;
+
+    EntryHeader header;
+    std::memcpy(&header, mapped.Data(), sizeof(header));
+    TexelFormat format = static_cast<TexelFormat>(header.format);
+    bool valid = std::memcmp(header.magic, ENTRY_MAGIC, 4) == 0 && header.version == ENTRY_VERSION && header.key == key &&
+                 header.sourceSize == fileSize && header.format <= static_cast<uint32_t>(TexelFormat::RGBA8) &&
+                 mapped.Size() == PIXEL_OFFSET + uint64_t(header.width) * header.height * TexelBytes(format);
+    if (!valid)
+        return false;
+
+    image.format = format;
+    image.width = header.width;
+    image.height = header.height;
+    image.bytes.assign(mapped.Data() + PIXEL_OFFSET, mapped.Data() + mapped.Size());
+
+    //The file time is the use time a later run's Create sees
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    return true;
+}
+
+void DecodedImageCache::Store(uint64_t key, uint64_t fileSize, const TextureImage& image)
+{
+    EntryHeader header = {};
+    std::memcpy(header.magic, ENTRY_MAGIC, 4);
+    header.version = ENTRY_VERSION;
+    header.key = key;
+    header.sourceSize = fileSize;
+    header.format = static_cast<uint32_t>(image.format);
+    header.width = image.width;
+    header.height = image.height;
+    bool written = WriteFileAtomically(EntryPath(key), [&](std::ostream& file)
+    {
+        char prefix[PIXEL_OFFSET] = {};
+        std::memcpy(prefix, &header, sizeof(header));
+        file.write(prefix, sizeof(prefix));
+        file.write(reinterpret_cast<const char*>(image.bytes.data()), image.bytes.size());
+    });
+    if (!written)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = entries[key];
+    counters.bytes -= entry.bytes;          //Zero unless another thread stored the same image first
+    entry.bytes = PIXEL_OFFSET + image.bytes.size();
+    entry.lastUsed = ++clock;
+    counters.bytes += entry.bytes;
+    EvictLocked();
+}
+
+void DecodedImageCache::EvictLocked()
+{
+    if (counters.bytes <= maxBytes)
+        return;
+
+    std::vector<std::pair<uint64_t, uint64_t>> byAge;        //Last use, key
+    byAge.reserve(entries.size());
+    for (const auto& entry : entries)
+        byAge.emplace_back(entry.second.lastUsed, entry.first);
+    std::sort(byAge.begin(), byAge.end());
+
+    for (size_t i = 0; i < byAge.size() && counters.bytes > maxBytes; ++i)
+    {
+        auto entry = entries.find(byAge[i].second);
+        std::error_code error;
+        std::filesystem::remove(EntryPath(entry->first), error);
+        counters.bytes -= entry->second.bytes;
+        ++counters.evictions;
+        entries.erase(entry);
+    }
+}
+
+#ifndef _WIN32
+
+void RunDecodedImageCacheBenchmark()
+{
+    const unsigned SIZE = 1024;
+    const unsigned COUNT = 16;
+    const size_t HASH_BYTES = size_t(64) << 20;
+
+    //Hash throughput, and the same value from every ISA for lengths around the stripe and block edges
+    std::vector<uint8_t> bytes(HASH_BYTES + 1);
+    std::srand(1);
+    for (uint8_t& byte : bytes)
+        byte = static_cast<uint8_t>(std::rand());
+
+    for (size_t length = 0; length <= 3000; ++length)
+    {
+        if (HashBytes(HashIsa::Scalar, bytes.data() + 1, length) != HashBytes(BestHashIsa(), bytes.data() + 1, length))
+        {
+            std::printf("hash mismatch between scalar and %s at %zu bytes\n", HashIsaName(BestHashIsa()), length);
+            return;
+        }
+    }
+
+    const HashIsa isas[] = { HashIsa::Scalar, HashIsa::AVX2 };
+    for (HashIsa isa : isas)
+    {
+        if (!IsHashIsaSupported(isa))
+        {
+            std::printf("hash %-6s  not supported\n", HashIsaName(isa));
+            continue;
+        }
+        uint64_t hash = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int repeat = 0; repeat < 4; ++repeat)
+            hash += HashBytes(isa, bytes.data() + 1, HASH_BYTES);       //Unaligned on purpose
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("hash %-6s  %6.2f GB/s  %016llx\n", HashIsaName(isa), 4.0 * HASH_BYTES / seconds / 1e9, static_cast<unsigned long long>(hash));
+    }
+    bytes = std::vector<uint8_t>();
+
+    //Photo-like sources: smooth gradients with mild noise, RGBA so every file decodes to 4 MB
+    std::vector<std::vector<uint8_t>> files;
+    uint64_t encodedBytes = 0;
+    for (unsigned i = 0; i < COUNT; ++i)
+    {
+        TextureImage image;
+        image.width = image.height = SIZE;
+        image.bytes.resize(size_t(SIZE) * SIZE * 4);
+        for (unsigned y = 0; y < SIZE; ++y)
+        {
+            for (unsigned x = 0; x < SIZE; ++x)
+            {
+                uint8_t* texel = &image.bytes[(size_t(y) * SIZE + x) * 4];
+                texel[0] = static_cast<uint8_t>((x + i * 16) / 4 + (std::rand() & 7));
+                texel[1] = static_cast<uint8_t>(y / 4 + (std::rand() & 7));
+                texel[2] = static_cast<uint8_t>((x + y) / 8 + i * 8);
+                texel[3] = 255;
+            }
+        }
+        files.push_back(EncodePng(image));
+        encodedBytes += files.back().size();
+    }
+    std::printf("%u %ux%u PNG sources, %.2f MB encoded, %.2f MB decoded\n", COUNT, SIZE, SIZE, encodedBytes / (1024.0 * 1024.0),
+                COUNT * SIZE * SIZE * 4 / (1024.0 * 1024.0));
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "decoded-cache-benchmark";
+    std::filesystem::remove_all(directory);
+
+    auto timePass = [&files](const std::function<bool(const std::vector<uint8_t>&, TextureImage&)>& load)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (const std::vector<uint8_t>& file : files)
+        {
+            TextureImage image;
+            if (!load(file, image))
+                return -1.0;
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    DecodedImageCache cache;
+    if (!cache.Create(directory.string()))
+        return;
+    auto decode = [](const std::vector<uint8_t>& file, TextureImage& image) { return LoadTextureImageFromMemory(file.data(), file.size(), image); };
+    auto cached = [&cache](const std::vector<uint8_t>& file, TextureImage& image) { return cache.Load(file.data(), file.size(), image); };
+    double stbMs = timePass(decode);
+    double missMs = timePass(cached);
+    double hitMs = timePass(cached);
+    DecodedImageCache::Counters counters = cache.GetCounters();
+    std::printf("stb_image             %9.2f ms\n", stbMs);
+    std::printf("cache miss (+ store)  %9.2f ms\n", missMs);
+    std::printf("cache hit             %9.2f ms  %6.1fx faster than decoding  (%u hits, %u misses)\n", hitMs, stbMs / hitMs, counters.hits, counters.misses);
+
+    //A later run indexes what the last one left
+    DecodedImageCache reopened;
+    reopened.Create(directory.string());
+    auto reopenedLoad = [&reopened](const std::vector<uint8_t>& file, TextureImage& image) { return reopened.Load(file.data(), file.size(), image); };
+    double reopenedMs = timePass(reopenedLoad);
+    std::printf("reopened cache        %9.2f ms  (%u hits)\n", reopenedMs, reopened.GetCounters().hits);
+
+    //Room for 6 entries: 3 hot images, each used again within 6 loads, stay while a stream of cold ones cycles through
+    uint64_t entryBytes = PIXEL_OFFSET + size_t(SIZE) * SIZE * 4;
+    DecodedImageCache bounded;
+    bounded.Create((directory / "bounded").string(), 6 * entryBytes);
+    for (int round = 0; round < 3; ++round)
+    {
+        for (unsigned i = 3; i < COUNT; ++i)
+        {
+            TextureImage image;
+            bounded.Load(files[i % 3].data(), files[i % 3].size(), image);
+            bounded.Load(files[i].data(), files[i].size(), image);
+        }
+    }
+    counters = bounded.GetCounters();
+    std::printf("limit %6.2f MB       %u hits, %u misses, %u evictions, %.2f MB on disk\n", 6 * entryBytes / (1024.0 * 1024.0), counters.hits,
+                counters.misses, counters.evictions, counters.bytes / (1024.0 * 1024.0));
+
+    std::filesystem::remove_all(directory);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "TextureImage.h"
+
+//Content-addressed disk cache of decoded images. The key is a 64-bit hash of the encoded file's bytes, so a renamed or
+//copied file still hits and an edited one misses. An entry holds the pixels exactly as stbi_load returned them,
+//behind a small header, and is read back through a mapping: a hit costs a hash of the file and a copy out of the
+//page cache instead of a decode.
+//
+//The cache keeps its total size under a limit by deleting the least recently used entries; a hit counts as a use.
+//Entries are written under a temporary name and renamed, so concurrent loaders and crashes never leave torn files.
+
+enum class HashIsa { Scalar, AVX2 };
+
+const char* HashIsaName(HashIsa isa);
+bool IsHashIsaSupported(HashIsa isa);
+HashIsa BestHashIsa();
+
+//xxHash3-style: eight 64-bit lanes, each adding the 32x32 product of its key-mixed input halves, scrambled every
+//1 KB; every ISA returns the same value
+uint64_t HashBytes(HashIsa isa, const uint8_t* data, size_t size);
+uint64_t HashBytes(const uint8_t* data, size_t size);
+
+class DecodedImageCache
+{
+public:
+	static const uint64_t DEFAULT_MAX_BYTES = 4ull << 30;
+
+	struct Counters
+	{
+		unsigned hits = 0;
+		unsigned misses = 0;
+		unsigned evictions = 0;
+		uint64_t bytes = 0;				//On disk, all entries
+	};
+
+	//Indexes the entries already in directory, then evicts down to maxBytes
+	bool Create(const std::string& directory, uint64_t maxBytes = DEFAULT_MAX_BYTES);
+	void Release();
+	bool IsCreated() const { return !directory.empty(); }
+
+	//The decoded image of the encoded file in memory: from its cache entry when there is one, otherwise decoded with
+	//stb_image and stored. Safe to call from several threads.
+	bool Load(const uint8_t* file, size_t size, TextureImage& image);
+
+	Counters GetCounters() const;
+
+private:
+	struct Entry
+	{
+		uint64_t bytes;
+		uint64_t lastUsed;				//Logical clock, seeded from file times when indexed
+	};
+
+	std::string EntryPath(uint64_t key) const;
+	bool Read(uint64_t key, uint64_t fileSize, TextureImage& image);
+	void Store(uint64_t key, uint64_t fileSize, const TextureImage& image);
+	void EvictLocked();
+
+	std::string directory;
+	uint64_t maxBytes = DEFAULT_MAX_BYTES;
+
+	mutable std::mutex mutex;			//Guards everything below
+	std::unordered_map<uint64_t, Entry> entries;
+	uint64_t clock = 0;
+	Counters counters;
+};
+
+#ifndef _WIN32
+void RunDecodedImageCacheBenchmark();
+#endif
\ No newline at end of file
@@ -0,0 +1,269 @@
+#include "FrustumCulling.h"
+#include "Camera.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+Frustum ExtractFrustum(const Matrix& viewProjection)
+{
+    const float (*m)[4] = viewProjection.m;
+    auto column = [&](int c, int r) { return m[r][c]; };
+
+    Frustum frustum;
+    for (int r = 0; r < 4; ++r)
+    {
+        frustum.planes[0][r] = column(3, r) + column(0, r);     //Left:   -w <= x
+        frustum.planes[1][r] = column(3, r) - column(0, r);     //Right:   x <= w
+        frustum.planes[2][r] = column(3, r) + column(1, r);     //Bottom: -w <= y
+        frustum.planes[3][r] = column(3, r) - column(1, r);     //Top:     y <= w
+        frustum.planes[4][r] = column(2, r);                    //Near:    0 <= z
+        frustum.planes[5][r] = column(3, r) - column(2, r);     //Far:     z <= w
+    }
+
+    for (float* plane : frustum.planes)     //Unit normals, so distances compare directly against radii
+    {
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        for (int i = 0; i < 4; ++i)
+            plane[i] /= length;
+    }
+
+    return frustum;
+}
+
+void BoundingSpheres::Resize(size_t count)
+{
+    centerX.resize(count);
+    centerY.resize(count);
+    centerZ.resize(count);
+    radius.resize(count);
+}
+
+namespace
+{
+    size_t CullScalar(const Frustum& frustum, const BoundingSpheres& spheres, size_t first, size_t count, uint32_t* visible)
+    {
+        size_t written = 0;
+        for (size_t i = first; i < first + count; ++i)
+        {
+            bool inside = true;
+            for (const float* plane : frustum.planes)
+            {
+                float distance = plane[0] * spheres.centerX[i] + plane[1] * spheres.centerY[i] + plane[2] * spheres.centerZ[i] + plane[3];
+                inside &= distance >= -spheres.radius[i];
+            }
+
+            visible[written] = static_cast<uint32_t>(i);
+            written += inside;      //Branchless, the slot is overwritten by the next candidate when culled
+        }
+        return written;
+    }
+
+    struct CompactionTable          //Lane numbers of the set bits of every 8-bit mask, packed to the front
+    {
+        alignas(32) uint32_t lanes[256][8];
+
+        CompactionTable()
+        {
+            for (int mask = 0; mask < 256; ++mask)
+            {
+                int n = 0;
+                for (int lane = 0; lane < 8; ++lane)
+                    if (mask & (1 << lane))
+                        lanes[mask][n++] = lane;
+                while (n < 8)
+                    lanes[mask][n++] = 0;
+            }
+        }
+    };
+
+    const CompactionTable COMPACTION;
+}
+
+#ifdef SIMD_X86
+
+SIMD_BEGIN_TARGET_AVX2
+namespace
+{
+    size_t CullAvx2(const Frustum& frustum, const BoundingSpheres& spheres, size_t first, size_t count, uint32_t* visible)
+    {
+        __m256 planes[6][4];
+        for (int p = 0; p < 6; ++p)
+            for (int c = 0; c < 4; ++c)
+                planes[p][c] = _mm256_set1_ps(frustum.planes[p][c]);
+
+        size_t end = first + (count & ~size_t(7));
+        size_t written = 0;
+
+        for (size_t i = first; i < end; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(&spheres.centerX[i]);
+            __m256 y = _mm256_loadu_ps(&spheres.centerY[i]);
+            __m256 z = _mm256_loadu_ps(&spheres.centerZ[i]);
+            __m256 radius = _mm256_loadu_ps(&spheres.radius[i]);
+
+            //distance + radius >= 0 for every plane, the sign bits of the running minimum hold the culled lanes
+            __m256 nearest = _mm256_set1_ps(INFINITY);
+            for (int p = 0; p < 6; ++p)
+            {
+                __m256 distance = _mm256_fmadd_ps(planes[p][0], x, _mm256_fmadd_ps(planes[p][1], y, _mm256_fmadd_ps(planes[p][2], z, planes[p][3])));
+                nearest = _mm256_min_ps(nearest, _mm256_add_ps(distance, radius));
+            }
+
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(nearest, _mm256_setzero_ps(), _CMP_GE_OQ)));
+
+            //Writes 8 slots but advances by the visible count; written <= i - first keeps it inside the caller's count
+            __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(COMPACTION.lanes[mask]));
+            __m256i indices = _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int>(i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + written), indices);
+            written += _mm_popcnt_u32(mask);
+        }
+
+        return written + CullScalar(frustum, spheres, end, first + count - end, visible + written);
+    }
+}
+SIMD_END_TARGET
+
+#endif
+
+const char* CullIsaName(CullIsa isa)
+{
+    return isa == CullIsa::AVX2 ? "AVX2" : "scalar";
+}
+
+bool IsCullIsaSupported(CullIsa isa)
+{
+    return isa == CullIsa::AVX2 ? GetCpuFeatures().avx2 : true;
+}
+
+CullIsa BestCullIsa()
+{
+    static const CullIsa best = IsCullIsaSupported(CullIsa::AVX2) ? CullIsa::AVX2 : CullIsa::Scalar;
+    return best;
+}
+
+size_t CullSpheres(CullIsa isa, const Frustum& frustum, const BoundingSpheres& spheres, size_t first, size_t count, uint32_t* visible)
+{
+#ifdef SIMD_X86
+    if (isa == CullIsa::AVX2)
+        return CullAvx2(frustum, spheres, first, count, visible);
+#endif
+    return CullScalar(frustum, spheres, first, count, visible);
+}
+
+size_t CullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, std::vector<uint32_t>& visible, ThreadPool* threadPool)
+{
+    const size_t CHUNK_SIZE = 16384;        //Multiple of 8, 256 KB of spheres per chunk
+
+    size_t count = spheres.Count();
+    CullIsa isa = BestCullIsa();
+
+    if (visible.size() < count)
+        visible.resize(count);
+
+    if (threadPool == nullptr || count <= CHUNK_SIZE)
+        return CullSpheres(isa, frustum, spheres, 0, count, visible.data());
+
+    //Every chunk compacts into its own slice of visible, then the slices are packed together in order.
+    //Packing moves data down only, and chunk k's destination ends before chunk k + 1's slice begins.
+    unsigned chunks = static_cast<unsigned>((count + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    std::vector<size_t> chunkVisible(chunks);
+
+    threadPool->ParallelFor(chunks, [&](unsigned chunk)
+    {
+        size_t first = chunk * CHUNK_SIZE;
+        chunkVisible[chunk] = CullSpheres(isa, frustum, spheres, first, std::min(CHUNK_SIZE, count - first), visible.data() + first);
+    });
+
+    size_t total = chunkVisible[0];
+    for (unsigned chunk = 1; chunk < chunks; ++chunk)
+    {
+        std::memmove(visible.data() + total, visible.data() + chunk * CHUNK_SIZE, chunkVisible[chunk] * sizeof(uint32_t));
+        total += chunkVisible[chunk];
+    }
+
+    return total;
+}
+
+#ifndef _WIN32
+
+void RunCullingBenchmark()
+{
+    const size_t sphereCounts[] = { 100000, 1000000 };
+    const double secondsPerRun = 0.5;
+
+    Camera camera;
+    Frustum frustum = ExtractFrustum(camera.ViewProjection());
+
+    std::vector<unsigned> threadCounts;
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    for (size_t count : sphereCounts)
+    {
+        //A cube around the camera, about one sphere in sixteen survives the 45 degree frustum
+        BoundingSpheres spheres;
+        spheres.Resize(count);
+        std::srand(1);
+        auto random = [] { return std::rand() / static_cast<float>(RAND_MAX); };
+        for (size_t i = 0; i < count; ++i)
+        {
+            spheres.centerX[i] = (random() * 2.0f - 1.0f) * 60.0f;
+            spheres.centerY[i] = (random() * 2.0f - 1.0f) * 60.0f;
+            spheres.centerZ[i] = (random() * 2.0f - 1.0f) * 60.0f;
+            spheres.radius[i] = 0.1f + random();
+        }
+
+        std::vector<uint32_t> reference(count);
+        size_t referenceVisible = CullSpheres(CullIsa::Scalar, frustum, spheres, 0, count, reference.data());
+
+        for (int isa = 0; isa < 2; ++isa)
+        {
+            if (!IsCullIsaSupported(static_cast<CullIsa>(isa)))
+                continue;
+
+            std::vector<uint32_t> visible(count);
+            size_t visibleCount = CullSpheres(static_cast<CullIsa>(isa), frustum, spheres, 0, count, visible.data());
+            bool matches = visibleCount == referenceVisible && std::equal(reference.begin(), reference.begin() + visibleCount, visible.begin());
+
+            //The threaded entry point always uses the best ISA, so the scalar rows run single threaded
+            for (unsigned threads : threadCounts)
+            {
+                if (static_cast<CullIsa>(isa) != BestCullIsa() && threads > 1)
+                    break;
+
+                ThreadPool pool(threads);
+                unsigned runs = 0;
+                auto start = std::chrono::steady_clock::now();
+                double elapsed = 0;
+
+                while (elapsed < secondsPerRun)
+                {
+                    if (static_cast<CullIsa>(isa) == BestCullIsa())
+                        visibleCount = CullSpheres(frustum, spheres, visible, &pool);
+                    else
+                        visibleCount = CullSpheres(static_cast<CullIsa>(isa), frustum, spheres, 0, count, visible.data());
+                    ++runs;
+                    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+
+                matches &= visibleCount == referenceVisible && std::equal(reference.begin(), reference.begin() + visibleCount, visible.begin());
+                std::printf("%8zu spheres  %-6s  threads %3u  %8.3f ms/cull  %8.1f Mspheres/s  visible %zu  %s\n",
+                            count, CullIsaName(static_cast<CullIsa>(isa)), threads, elapsed * 1e3 / runs,
+                            runs * static_cast<double>(count) / elapsed / 1e6, visibleCount, matches ? "matches scalar" : "MISMATCH");
+            }
+        }
+    }
+}
+
+#endif
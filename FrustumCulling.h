@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "MatrixMath.h"
+#include "ThreadPool.h"
+
+//Visibility test before drawing: bounding spheres in SoA arrays against the six planes of the camera frustum,
+//8 spheres per AVX2 iteration, producing a compact list of visible indices
+
+struct Frustum
+{
+	float planes[6][4];		//(a, b, c, d), normalized, a point is inside when a*x + b*y + c*z + d >= 0 for all six
+};
+
+//Gribb-Hartmann extraction from a row-vector view * projection matrix with D3D clip depth [0, w]
+Frustum ExtractFrustum(const Matrix& viewProjection);
+
+struct BoundingSpheres			//World space, SoA
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> radius;
+
+	size_t Count() const { return radius.size(); }
+	void Resize(size_t count);
+};
+
+enum class CullIsa { Scalar, AVX2 };
+
+const char* CullIsaName(CullIsa isa);
+bool IsCullIsaSupported(CullIsa isa);
+CullIsa BestCullIsa();
+
+//Writes the indices in [first, first + count) whose sphere touches the frustum to visible, returns how many.
+//visible must have room for count entries even if fewer are written.
+size_t CullSpheres(CullIsa isa, const Frustum& frustum, const BoundingSpheres& spheres, size_t first, size_t count, uint32_t* visible);
+
+//Culls every sphere, in chunks across the pool when given one. Returns the visible count N, the first N entries of
+//visible (grown to spheres.Count(), never shrunk so the next frame does not reallocate) hold their indices in ascending order.
+size_t CullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, std::vector<uint32_t>& visible, ThreadPool* threadPool = nullptr);
+
+#ifndef _WIN32
+void RunCullingBenchmark();
+#endif
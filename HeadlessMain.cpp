@@ -0,0 +1,172 @@
+#ifndef _WIN32      //Entry point for GPU-less hosts, Windows builds use wWinMain in main.cpp
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "BlockCompression.h"
+#include "Camera.h"
+#include "CommandBuffer.h"
+#include "ConstantBufferRing.h"
+#include "DecodedImageCache.h"
+#include "FrustumCulling.h"
+#include "InstancedQuads.h"
+#include "MatrixMath.h"
+#include "MipChain.h"
+#include "PhongShading.h"
+#include "SoftwareRenderer.h"
+#include "StateCache.h"
+#include "TexelLayout.h"
+#include "TextureAtlas.h"
+#include "TextureCooking.h"
+#include "TextureImage.h"
+#include "TextureSampler.h"
+#include "TextureStreaming.h"
+#include "VertexProcessing.h"
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)();
+};
+
+static const Benchmark BENCHMARKS[] =
+{
+    { "raster", RunRasterizerBenchmark },
+    { "shading", RunShadingBenchmark },
+    { "vertex", RunVertexBenchmark },
+    { "cbuffer", RunConstantBufferRingBenchmark },
+    { "camera", RunCameraBenchmark },
+    { "math", RunMathBenchmark },
+    { "instancing", RunInstancingBenchmark },
+    { "culling", RunCullingBenchmark },
+    { "statecache", RunStateCacheBenchmark },
+    { "commands", RunCommandBufferBenchmark },
+    { "mips", RunMipChainBenchmark },
+    { "bc", RunBlockCompressionBenchmark },
+    { "formats", RunTextureFormatBenchmark },
+    { "streaming", RunTextureStreamingBenchmark },
+    { "residency", RunTextureResidencyBenchmark },
+    { "layout", RunTexelLayoutBenchmark },
+    { "sampler", RunTextureSamplerBenchmark },
+    { "cooking", RunTextureCookingBenchmark },
+    { "atlas", RunTextureAtlasBenchmark },
+    { "decodecache", RunDecodedImageCacheBenchmark },
+    { "jpeg", RunJpegDecodeBenchmark },
+    { "jpegthreads", RunJpegParallelBenchmark },
+    { "png", RunPngDecodeBenchmark },
+    { "pngfilter", RunPngUnfilterBenchmark },
+};
+
+static void PrintUsage()
+{
+    std::cerr << "usage: HelloTriangle [--angle <radians>] [--output <file.ppm>] [--texture <image>] [--layout linear|tiled|morton]" << std::endl;
+    std::cerr << "       HelloTriangle --cook <image> <output.ctex> [--uncompressed]" << std::endl;
+    std::cerr << "       HelloTriangle --benchmark [name]" << std::endl;
+    std::cerr << "benchmarks:";
+    for (const Benchmark& benchmark : BENCHMARKS)
+        std::cerr << " " << benchmark.name;
+    std::cerr << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned WIDTH = 1024;
+    const unsigned HEIGHT = 576;
+
+    float angle = 0;
+    std::string outputPath = "frame.ppm";
+    const char* texturePath = nullptr;
+    TexelLayout layout = TexelLayout::Linear;
+    const char* cookSource = nullptr;
+    const char* cookOutput = nullptr;
+    bool uncompressed = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--benchmark") == 0)
+        {
+            const char* name = i + 1 < argc ? argv[i + 1] : nullptr;
+            bool found = false;
+
+            for (const Benchmark& benchmark : BENCHMARKS)
+            {
+                if (name == nullptr || std::strcmp(name, benchmark.name) == 0)
+                {
+                    std::cout << "== " << benchmark.name << " ==" << std::endl;
+                    benchmark.run();
+                    found = true;
+                }
+            }
+
+            if (!found)
+            {
+                PrintUsage();
+                return -1;
+            }
+            return 0;
+        }
+        else if (std::strcmp(argv[i], "--angle") == 0 && i + 1 < argc)
+            angle = std::stof(argv[++i]);
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputPath = argv[++i];
+        else if (std::strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+            texturePath = argv[++i];
+        else if (std::strcmp(argv[i], "--layout") == 0 && i + 1 < argc && ParseTexelLayout(argv[i + 1], layout))
+            ++i;
+        else if (std::strcmp(argv[i], "--cook") == 0 && i + 2 < argc)
+        {
+            cookSource = argv[++i];
+            cookOutput = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--uncompressed") == 0)
+            uncompressed = true;
+        else
+        {
+            PrintUsage();
+            return -1;
+        }
+    }
+
+    if (cookSource != nullptr)
+    {
+        //Block compression goes through the same cache as the game's, so unchanged sources cook again instantly
+        ThreadPool threadPool;
+        return CookTexture(cookSource, cookOutput, uncompressed ? "" : "TextureCache", &threadPool) ? 0 : -1;
+    }
+
+    float backgroundColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    std::array<VertexData, 4> vertices = QuadVertices();
+
+    ThreadPool threadPool;
+    Framebuffer framebuffer;
+    framebuffer.Resize(WIDTH, HEIGHT);
+
+    SoftwareContext context;
+    context.threadPool = &threadPool;
+    context.renderTarget = &framebuffer;
+    context.vertexBuffer = vertices.data();
+
+    SoftwareTexture texture;
+    if (texturePath != nullptr)
+    {
+        if (!LoadSoftwareTexture(texturePath, layout, texture))
+            return -1;
+        context.texture = &texture;
+    }
+
+    Camera camera;
+    camera.SetAspectRatio(static_cast<float>(WIDTH) / HEIGHT);
+
+    Render(backgroundColor, context, camera, angle);
+
+    if (!SaveFramebuffer(framebuffer, outputPath))
+    {
+        std::cerr << "Could not save frame" << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,434 @@
+#include "InstancedQuads.h"
+#include "CpuFeatures.h"
+#include "MatrixMath.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(InstanceData) == 64, "InstancedVertexShader.hlsl reads four float4 per instance");
+
+void InstanceTransforms::Resize(size_t count)
+{
+    positionX.resize(count);
+    positionY.resize(count);
+    positionZ.resize(count);
+    rotation.resize(count);
+    scale.resize(count);
+    uvOffsetU.resize(count, 0.0f);
+    uvOffsetV.resize(count, 0.0f);
+    uvScaleU.resize(count, 1.0f);
+    uvScaleV.resize(count, 1.0f);
+}
+
+InstanceTransforms ScatterInstances(size_t count, unsigned seed)
+{
+    InstanceTransforms transforms;
+    transforms.Resize(count);
+
+    std::srand(seed);
+    auto random = [] { return std::rand() / static_cast<float>(RAND_MAX); };
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        float depth = 1.0f + random() * 49.0f;      //Inside the 45 degree frustum of the camera at z = -2
+        float halfHeight = (depth + 2.0f) * 0.4f;
+        transforms.positionX[i] = (random() * 2.0f - 1.0f) * halfHeight * (16.0f / 9.0f);
+        transforms.positionY[i] = (random() * 2.0f - 1.0f) * halfHeight;
+        transforms.positionZ[i] = depth;
+        transforms.rotation[i] = random() * 2.0f * PI;
+        transforms.scale[i] = 0.1f + random() * 0.4f;
+    }
+
+    return transforms;
+}
+
+namespace
+{
+    void BuildScalar(const InstanceTransforms& transforms, float angle, const uint32_t* indices, size_t first, size_t count, InstanceData* output)
+    {
+        for (size_t i = first; i < first + count; ++i)
+        {
+            size_t source = indices != nullptr ? indices[i] : i;
+            float scale = transforms.scale[source];
+            float scaledCos = scale * std::cos(transforms.rotation[source] + angle);
+            float scaledSin = scale * std::sin(transforms.rotation[source] + angle);
+
+            InstanceData& instance = output[i];
+            instance.worldColumns[0][0] = scaledCos;
+            instance.worldColumns[0][1] = 0;
+            instance.worldColumns[0][2] = scaledSin;
+            instance.worldColumns[0][3] = transforms.positionX[source];
+            instance.worldColumns[1][0] = 0;
+            instance.worldColumns[1][1] = scale;
+            instance.worldColumns[1][2] = 0;
+            instance.worldColumns[1][3] = transforms.positionY[source];
+            instance.worldColumns[2][0] = -scaledSin;
+            instance.worldColumns[2][1] = 0;
+            instance.worldColumns[2][2] = scaledCos;
+            instance.worldColumns[2][3] = transforms.positionZ[source];
+            instance.uvRect[0] = transforms.uvOffsetU[source];
+            instance.uvRect[1] = transforms.uvOffsetV[source];
+            instance.uvRect[2] = transforms.uvScaleU[source];
+            instance.uvRect[3] = transforms.uvScaleV[source];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+
+SIMD_BEGIN_TARGET_AVX2
+namespace
+{
+    //Cephes sinf/cosf: reduce to [-pi/4, pi/4] around the nearest multiple of pi/2, then pick and negate by quadrant
+    inline void SinCos(__m256 x, __m256& sine, __m256& cosine)
+    {
+        __m256 quadrant = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(0.63661977f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(quadrant, _mm256_set1_ps(1.5703125f), x);
+        r = _mm256_fnmadd_ps(quadrant, _mm256_set1_ps(4.837512969970703125e-4f), r);
+        r = _mm256_fnmadd_ps(quadrant, _mm256_set1_ps(7.549789954891882e-8f), r);
+        __m256 z = _mm256_mul_ps(r, r);
+
+        __m256 s = _mm256_fmadd_ps(_mm256_set1_ps(-1.9515295891e-4f), z, _mm256_set1_ps(8.3321608736e-3f));
+        s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(-1.6666654611e-1f));
+        s = _mm256_fmadd_ps(_mm256_mul_ps(s, z), r, r);
+
+        __m256 c = _mm256_fmadd_ps(_mm256_set1_ps(2.443315711809948e-5f), z, _mm256_set1_ps(-1.388731625493765e-3f));
+        c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(4.166664568298827e-2f));
+        c = _mm256_fmadd_ps(_mm256_mul_ps(c, z), z, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, _mm256_set1_ps(1.0f)));
+
+        __m256i q = _mm256_cvtps_epi32(quadrant);
+        __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+        __m256 sineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+        __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+
+        sine = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sineSign);
+        cosine = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cosineSign);
+    }
+
+    inline void Transpose8x8(__m256* r)
+    {
+        __m256 t[8], u[8];
+        for (int i = 0; i < 8; i += 2)
+        {
+            t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+            t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+        }
+        for (int i = 0; i < 8; i += 4)
+        {
+            u[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+        }
+        for (int i = 0; i < 4; ++i)
+        {
+            r[i] = _mm256_permute2f128_ps(u[i], u[i + 4], 0x20);
+            r[i + 4] = _mm256_permute2f128_ps(u[i], u[i + 4], 0x31);
+        }
+    }
+
+    inline __m256 Load8(const std::vector<float>& values, const uint32_t* indices, size_t i)
+    {
+        if (indices == nullptr)
+            return _mm256_loadu_ps(&values[i]);
+        return _mm256_i32gather_ps(values.data(), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i)), 4);
+    }
+
+    void BuildAvx2(const InstanceTransforms& transforms, float angle, const uint32_t* indices, size_t first, size_t count, InstanceData* output)
+    {
+        size_t end = first + (count & ~size_t(7));
+        __m256 zero = _mm256_setzero_ps();
+
+        for (size_t i = first; i < end; i += 8)
+        {
+            __m256 scale = Load8(transforms.scale, indices, i);
+            __m256 sine, cosine;
+            SinCos(_mm256_add_ps(Load8(transforms.rotation, indices, i), _mm256_set1_ps(angle)), sine, cosine);
+            __m256 scaledCos = _mm256_mul_ps(scale, cosine);
+            __m256 scaledSin = _mm256_mul_ps(scale, sine);
+
+            //Each instance is 16 floats: the first eight and the last eight go through one 8x8 transpose each
+            __m256 head[8] = { scaledCos, zero, scaledSin, Load8(transforms.positionX, indices, i),
+                               zero, scale, zero, Load8(transforms.positionY, indices, i) };
+            Transpose8x8(head);
+
+            __m256 tail[8] = { _mm256_sub_ps(zero, scaledSin), zero, scaledCos, Load8(transforms.positionZ, indices, i),
+                               Load8(transforms.uvOffsetU, indices, i), Load8(transforms.uvOffsetV, indices, i),
+                               Load8(transforms.uvScaleU, indices, i), Load8(transforms.uvScaleV, indices, i) };
+            Transpose8x8(tail);
+
+            float* out = &output[i].worldColumns[0][0];
+            for (int k = 0; k < 8; ++k)
+            {
+                _mm256_storeu_ps(out + 16 * k, head[k]);
+                _mm256_storeu_ps(out + 16 * k + 8, tail[k]);
+            }
+        }
+
+        BuildScalar(transforms, angle, indices, end, first + count - end, output);
+    }
+}
+SIMD_END_TARGET
+
+#endif
+
+const char* InstanceIsaName(InstanceIsa isa)
+{
+    return isa == InstanceIsa::AVX2 ? "AVX2" : "scalar";
+}
+
+bool IsInstanceIsaSupported(InstanceIsa isa)
+{
+    return isa == InstanceIsa::AVX2 ? GetCpuFeatures().avx2 : true;
+}
+
+InstanceIsa BestInstanceIsa()
+{
+    static const InstanceIsa best = IsInstanceIsaSupported(InstanceIsa::AVX2) ? InstanceIsa::AVX2 : InstanceIsa::Scalar;
+    return best;
+}
+
+void BuildInstances(InstanceIsa isa, const InstanceTransforms& transforms, float angle, const uint32_t* indices, size_t first, size_t count, InstanceData* output)
+{
+#ifdef SIMD_X86
+    if (isa == InstanceIsa::AVX2)
+    {
+        BuildAvx2(transforms, angle, indices, first, count, output);
+        return;
+    }
+#endif
+    BuildScalar(transforms, angle, indices, first, count, output);
+}
+
+void BuildInstances(const InstanceTransforms& transforms, float angle, const uint32_t* indices, size_t count, InstanceData* output, ThreadPool* threadPool)
+{
+    const size_t CHUNK_SIZE = 4096;     //Multiple of 8, 192 KB of output per chunk
+
+    InstanceIsa isa = BestInstanceIsa();
+
+    if (threadPool == nullptr || count <= CHUNK_SIZE)
+    {
+        BuildInstances(isa, transforms, angle, indices, 0, count, output);
+        return;
+    }
+
+    unsigned chunks = static_cast<unsigned>((count + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    threadPool->ParallelFor(chunks, [&](unsigned chunk)
+    {
+        size_t first = chunk * CHUNK_SIZE;
+        BuildInstances(isa, transforms, angle, indices, first, std::min(CHUNK_SIZE, count - first), output);
+    });
+}
+
+void InstanceBounds(const InstanceTransforms& transforms, BoundingSpheres& bounds)
+{
+    const float QUAD_RADIUS = 0.70710678f;      //Corners of QuadVertices() at (+-0.5, +-0.5, 0)
+
+    bounds.Resize(transforms.Count());
+    for (size_t i = 0; i < transforms.Count(); ++i)
+    {
+        bounds.centerX[i] = transforms.positionX[i];
+        bounds.centerY[i] = transforms.positionY[i];
+        bounds.centerZ[i] = transforms.positionZ[i];
+        bounds.radius[i] = transforms.scale[i] * QUAD_RADIUS;       //Rotation about the center does not move the sphere
+    }
+}
+
+bool CreateInstanceBuffer(ID3D11Device* device, UINT maxInstances, ID3D11Buffer*& instanceBuffer)
+{
+    D3D11_BUFFER_DESC desc = {};
+    desc.ByteWidth = maxInstances * sizeof(InstanceData);
+    desc.Usage = D3D11_USAGE_DYNAMIC;               //Rewritten every frame
+    desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    desc.MiscFlags = 0;
+
+    HRESULT hr = device->CreateBuffer(&desc, nullptr, &instanceBuffer);
+    return !FAILED(hr);
+}
+
+bool DrawInstancedQuads(ID3D11DeviceContext* context, ID3D11Buffer* vBuffer, ID3D11Buffer* instanceBuffer,
+                        const InstanceTransforms& transforms, float angle, ThreadPool* threadPool)
+{
+    return DrawInstancedQuads(context, vBuffer, instanceBuffer, transforms, nullptr, transforms.Count(), angle, threadPool);
+}
+
+bool UpdateInstanceBuffer(ID3D11DeviceContext* context, ID3D11Buffer* instanceBuffer, const InstanceTransforms& transforms,
+                          const uint32_t* indices, size_t count, float angle, ThreadPool* threadPool)
+{
+    D3D11_BUFFER_DESC desc;
+    instanceBuffer->GetDesc(&desc);
+
+    if (count > desc.ByteWidth / sizeof(InstanceData))
+    {
+        std::cerr << "Instance buffer holds " << desc.ByteWidth / sizeof(InstanceData) << " instances, " << count << " requested" << std::endl;
+        return false;
+    }
+
+    if (count == 0)
+        return true;
+
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    if (FAILED(context->Map(instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+    {
+        std::cerr << "Failed to map instance buffer" << std::endl;
+        return false;
+    }
+
+    BuildInstances(transforms, angle, indices, count, static_cast<InstanceData*>(mapped.pData), threadPool);
+    context->Unmap(instanceBuffer, 0);
+    return true;
+}
+
+bool DrawInstancedQuads(ID3D11DeviceContext* context, ID3D11Buffer* vBuffer, ID3D11Buffer* instanceBuffer,
+                        const InstanceTransforms& transforms, const uint32_t* indices, size_t count, float angle, ThreadPool* threadPool)
+{
+    if (!UpdateInstanceBuffer(context, instanceBuffer, transforms, indices, count, angle, threadPool))
+        return false;
+
+    if (count == 0)
+        return true;
+
+    ID3D11Buffer* buffers[2] = { vBuffer, instanceBuffer };
+    UINT strides[2] = { sizeof(VertexData), sizeof(InstanceData) };
+    UINT offsets[2] = { 0, 0 };
+    context->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+
+    context->DrawInstanced(4, static_cast<UINT>(count), 0, 0);
+    return true;
+}
+
+#ifndef _WIN32
+
+void RunInstancingBenchmark()
+{
+    const size_t instanceCounts[] = { 10000, 50000, 250000 };
+    const double secondsPerRun = 0.5;
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    std::vector<unsigned> threadCounts;
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    ID3D11Buffer* vBuffer;
+    std::array<VertexData, 4> vertices = QuadVertices();
+    D3D11_BUFFER_DESC vertexDesc = {};
+    vertexDesc.ByteWidth = sizeof(vertices);
+    vertexDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    vertexDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    D3D11_SUBRESOURCE_DATA vertexData = { vertices.data(), 0, 0 };
+    device->CreateBuffer(&vertexDesc, &vertexData, &vBuffer);
+
+    for (size_t instances : instanceCounts)
+    {
+        InstanceTransforms transforms = ScatterInstances(instances);
+
+        ID3D11Buffer* instanceBuffer;
+        CreateInstanceBuffer(device, static_cast<UINT>(instances), instanceBuffer);
+
+        //Kernel accuracy against the composed matrices
+        std::vector<InstanceData> built(instances);
+        float maxError[2] = {};
+        for (int isa = 0; isa < 2; ++isa)
+        {
+            if (!IsInstanceIsaSupported(static_cast<InstanceIsa>(isa)))
+                continue;
+
+            BuildInstances(static_cast<InstanceIsa>(isa), transforms, 0.25f, nullptr, 0, instances, built.data());
+            for (size_t i = 0; i < instances; i += 97)
+            {
+                Matrix world = Multiply(Multiply(Scaling(transforms.scale[i], transforms.scale[i], transforms.scale[i]),
+                                                 RotationY(transforms.rotation[i] + 0.25f)),
+                                        Translation(transforms.positionX[i], transforms.positionY[i], transforms.positionZ[i]));
+                for (int column = 0; column < 3; ++column)
+                    for (int row = 0; row < 4; ++row)
+                        maxError[isa] = std::max(maxError[isa], std::abs(built[i].worldColumns[column][row] - world.m[row][column]));
+            }
+
+            //The gathered path used after culling, its scalar tail may land on different instances than above
+            std::vector<uint32_t> indices;
+            for (size_t i = 0; i < instances; i += 3)
+                indices.push_back(static_cast<uint32_t>(i));
+            std::vector<InstanceData> gathered(indices.size());
+            BuildInstances(static_cast<InstanceIsa>(isa), transforms, 0.25f, indices.data(), 0, indices.size(), gathered.data());
+            for (size_t i = 0; i < indices.size(); ++i)
+                for (int column = 0; column < 3; ++column)
+                    for (int row = 0; row < 4; ++row)
+                        maxError[isa] = std::max(maxError[isa], std::abs(gathered[i].worldColumns[column][row] - built[indices[i]].worldColumns[column][row]));
+            for (size_t i = 0; i < instances; ++i)
+                for (int k = 0; k < 4; ++k)
+                    maxError[isa] = std::max(maxError[isa], std::abs(built[i].uvRect[k] - (k == 0 ? transforms.uvOffsetU[i] : k == 1 ? transforms.uvOffsetV[i] :
+                                                                                         k == 2 ? transforms.uvScaleU[i] : transforms.uvScaleV[i])));
+        }
+
+        for (int isa = 0; isa < 2; ++isa)
+        {
+            if (!IsInstanceIsaSupported(static_cast<InstanceIsa>(isa)))
+                continue;
+
+            //BuildInstances(transforms, ...) always uses the best ISA, so the scalar rows call the kernel directly
+            for (unsigned threads : threadCounts)
+            {
+                ThreadPool pool(threads);
+                unsigned frames = 0;
+                auto start = std::chrono::steady_clock::now();
+                double elapsed = 0;
+
+                while (elapsed < secondsPerRun)
+                {
+                    float angle = frames * 0.01f;
+                    if (static_cast<InstanceIsa>(isa) == BestInstanceIsa())
+                        DrawInstancedQuads(context, vBuffer, instanceBuffer, transforms, angle, &pool);
+                    else
+                    {
+                        D3D11_MAPPED_SUBRESOURCE mapped = {};
+                        context->Map(instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+                        pool.ParallelFor(static_cast<unsigned>((instances + 4095) / 4096), [&](unsigned chunk)
+                        {
+                            size_t first = chunk * size_t(4096);
+                            BuildInstances(InstanceIsa::Scalar, transforms, angle, nullptr, first, std::min<size_t>(4096, instances - first),
+                                           static_cast<InstanceData*>(mapped.pData));
+                        });
+                        context->Unmap(instanceBuffer, 0);
+                    }
+                    ++frames;
+                    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+
+                double instancesPerSecond = frames * static_cast<double>(instances) / elapsed;
+                std::printf("%7zu instances  %-6s  threads %3u  %8.1f Minstances/s  %6.2f GB/s  %8.1f frames/s  max error %g\n",
+                            instances, InstanceIsaName(static_cast<InstanceIsa>(isa)), threads, instancesPerSecond / 1e6,
+                            instancesPerSecond * sizeof(InstanceData) / 1e9, frames / elapsed, maxError[isa]);
+            }
+        }
+
+        instanceBuffer->Release();
+    }
+
+    std::printf("draw calls %llu, instances drawn %llu\n", static_cast<unsigned long long>(context->counters.drawCalls),
+                static_cast<unsigned long long>(context->counters.instancesDrawn));
+
+    vBuffer->Release();
+    context->Release();
+    device->Release();
+}
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "D3D11Compat.h"
+#include "FrustumCulling.h"
+#include "PipelineData.h"
+#include "ThreadPool.h"
+
+//Many textured quads in one DrawInstanced call. Transforms live in SoA arrays and are expanded into
+//the per-instance vertex buffer (InstanceData, slot 1) in parallel every frame.
+
+struct InstanceTransforms		//Per-instance parameters in SoA form
+{
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotation;		//Radians around Y
+	std::vector<float> scale;			//Uniform
+	std::vector<float> uvOffsetU, uvOffsetV, uvScaleU, uvScaleV;		//Atlas rectangle, the whole texture after Resize
+
+	size_t Count() const { return scale.size(); }
+	void Resize(size_t count);
+};
+
+//Quads scattered in front of the default camera, deterministic for a given seed
+InstanceTransforms ScatterInstances(size_t count, unsigned seed = 1);
+
+enum class InstanceIsa { Scalar, AVX2 };
+
+const char* InstanceIsaName(InstanceIsa isa);
+bool IsInstanceIsaSupported(InstanceIsa isa);
+InstanceIsa BestInstanceIsa();
+
+//output[i] = Scaling(scale) * RotationY(rotation + angle) * Translation(position) and the atlas rectangle of instance
+//indices[i], or of instance i when indices is null, for i in [first, first + count)
+void BuildInstances(InstanceIsa isa, const InstanceTransforms& transforms, float angle, const uint32_t* indices, size_t first, size_t count, InstanceData* output);
+void BuildInstances(const InstanceTransforms& transforms, float angle, const uint32_t* indices, size_t count, InstanceData* output, ThreadPool* threadPool = nullptr);
+
+//One sphere per quad for CullSpheres, valid for any angle since quads only rotate about their center
+void InstanceBounds(const InstanceTransforms& transforms, BoundingSpheres& bounds);
+
+bool CreateInstanceBuffer(ID3D11Device* device, UINT maxInstances, ID3D11Buffer*& instanceBuffer);
+
+//Builds the count instances listed in indices (all of them when null) straight into the mapped instanceBuffer
+bool UpdateInstanceBuffer(ID3D11DeviceContext* context, ID3D11Buffer* instanceBuffer, const InstanceTransforms& transforms,
+						  const uint32_t* indices, size_t count, float angle, ThreadPool* threadPool = nullptr);
+
+//UpdateInstanceBuffer, then binds it next to vBuffer and draws every instance of the quad
+bool DrawInstancedQuads(ID3D11DeviceContext* context, ID3D11Buffer* vBuffer, ID3D11Buffer* instanceBuffer,
+						const InstanceTransforms& transforms, float angle, ThreadPool* threadPool = nullptr);
+//Only the count instances listed in indices, e.g. the visible ones from CullSpheres
+bool DrawInstancedQuads(ID3D11DeviceContext* context, ID3D11Buffer* vBuffer, ID3D11Buffer* instanceBuffer,
+						const InstanceTransforms& transforms, const uint32_t* indices, size_t count, float angle, ThreadPool* threadPool = nullptr);
+
+#ifndef _WIN32
+void RunInstancingBenchmark();
+#endif
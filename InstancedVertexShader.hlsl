@@ -0,0 +1,42 @@
+struct VertexInput 
+{
+	float3 pos : POSITION;
+	float3 normal : NORMAL;
+	float2 uv : UV;
+	float4 worldColumn0 : WORLD0;		//Per instance (slot 1), columns of the world matrix
+	float4 worldColumn1 : WORLD1;
+	float4 worldColumn2 : WORLD2;
+	float4 uvRect : UVRECT;				//Per instance: offset and scale of its image in the texture atlas
+};
+
+struct VertexOutput
+{
+	float4 pos : SV_POSITION;
+	float3 normal : NORMAL;
+	float2 uv : UV;
+	float4 worldPosition: WORLDPOSITION;
+};
+
+cbuffer CBuf
+{
+	float4x4 viewPerspective;
+};
+
+VertexOutput main(VertexInput input)
+{
+	VertexOutput output;
+
+	//Rebuild the row-major world matrix from the three columns, the fourth is always (0, 0, 0, 1)
+	float4x4 world = transpose(float4x4(input.worldColumn0, input.worldColumn1, input.worldColumn2, float4(0, 0, 0, 1)));
+
+	//will output the world position of pixel (interpolation)
+	output.worldPosition = mul(float4(input.pos, 1), world);
+
+	output.pos = mul(output.worldPosition, viewPerspective);
+
+	output.normal = normalize(mul(input.normal, (float3x3)world));
+
+	output.uv = input.uv * input.uvRect.zw + input.uvRect.xy;
+	
+	return output;
+}
\ No newline at end of file
@@ -0,0 +1,509 @@
+#include "JpegEncoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace
+{
+    //Annex K.1, natural order
+    const uint8_t LUMINANCE_QUANT[64] = {
+        16, 11, 10, 16, 24, 40, 51, 61,
+        12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56,
+        14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77,
+        24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99 };
+    const uint8_t CHROMINANCE_QUANT[64] = {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99 };
+
+    struct Tables
+    {
+        uint8_t zigZag[64];             //Natural index of the k-th coefficient in zig-zag order
+        float cosines[8][8];            //[u][x] = C(u) / 2 * cos((2x + 1) u pi / 16)
+
+        Tables()
+        {
+            int k = 0;
+            for (int sum = 0; sum < 15; ++sum)
+            {
+                int first = std::max(0, sum - 7);
+                int last = std::min(sum, 7);
+                for (int i = 0; i <= last - first; ++i)
+                {
+                    int y = sum % 2 == 0 ? last - i : first + i;        //Even diagonals run up and to the right
+                    zigZag[k++] = static_cast<uint8_t>(y * 8 + sum - y);
+                }
+            }
+            for (int u = 0; u < 8; ++u)
+                for (int x = 0; x < 8; ++x)
+                    cosines[u][x] = static_cast<float>((u == 0 ? std::sqrt(0.5) : 1.0) / 2.0 * std::cos((2 * x + 1) * u * 3.14159265358979 / 16.0));
+        }
+    };
+
+    const Tables& GetTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    struct HuffmanTable
+    {
+        uint8_t counts[17] = {};        //Codes per length, 1 - 16
+        std::vector<uint8_t> symbols;   //By code length
+        uint16_t codes[256] = {};
+        uint8_t lengths[256] = {};
+    };
+
+    //Annex K.2 and K.3 (libjpeg jpeg_gen_optimal_table): Huffman code lengths from the counts, then lengths over 16
+    //moved up the tree. A reserved symbol with a count of 1 keeps any code from being all ones.
+    void BuildHuffmanTable(const uint32_t* frequencies, HuffmanTable& table)
+    {
+        uint64_t frequency[257];
+        int codeSize[257] = {};
+        int others[257];
+        for (int i = 0; i < 256; ++i)
+            frequency[i] = frequencies[i];
+        frequency[256] = 1;
+        std::fill(others, others + 257, -1);
+
+        for (;;)
+        {
+            //The two least frequent, larger symbol first on ties
+            int c1 = -1;
+            int c2 = -1;
+            for (int i = 0; i <= 256; ++i)
+            {
+                if (frequency[i] == 0)
+                    continue;
+                if (c1 < 0 || frequency[i] <= frequency[c1])
+                {
+                    c2 = c1;
+                    c1 = i;
+                }
+                else if (c2 < 0 || frequency[i] <= frequency[c2])
+                    c2 = i;
+            }
+            if (c2 < 0)
+                break;
+
+            frequency[c1] += frequency[c2];
+            frequency[c2] = 0;
+            ++codeSize[c1];
+            while (others[c1] >= 0)
+            {
+                c1 = others[c1];
+                ++codeSize[c1];
+            }
+            others[c1] = c2;
+            ++codeSize[c2];
+            while (others[c2] >= 0)
+            {
+                c2 = others[c2];
+                ++codeSize[c2];
+            }
+        }
+
+        int bits[33] = {};
+        for (int i = 0; i <= 256; ++i)
+            if (codeSize[i] > 0)
+                ++bits[std::min(codeSize[i], 32)];
+        for (int i = 32; i > 16; --i)
+        {
+            while (bits[i] > 0)
+            {
+                int j = i - 2;
+                while (bits[j] == 0)
+                    --j;
+                bits[i] -= 2;
+                ++bits[i - 1];
+                bits[j + 1] += 2;
+                --bits[j];
+            }
+        }
+        int longest = 16;
+        while (longest > 0 && bits[longest] == 0)
+            --longest;
+        if (longest > 0)
+            --bits[longest];            //The reserved symbol
+
+        for (int length = 1; length <= 16; ++length)
+            table.counts[length] = static_cast<uint8_t>(bits[length]);
+        table.symbols.clear();
+        for (int length = 1; length <= 32; ++length)
+            for (int symbol = 0; symbol < 256; ++symbol)
+                if (codeSize[symbol] == length)
+                    table.symbols.push_back(static_cast<uint8_t>(symbol));
+
+        //Canonical codes, Annex C
+        unsigned code = 0;
+        size_t next = 0;
+        for (int length = 1; length <= 16; ++length)
+        {
+            for (int i = 0; i < bits[length]; ++i)
+            {
+                uint8_t symbol = table.symbols[next++];
+                table.codes[symbol] = static_cast<uint16_t>(code++);
+                table.lengths[symbol] = static_cast<uint8_t>(length);
+            }
+            code <<= 1;
+        }
+    }
+
+    //Most significant bit first, a zero byte stuffed after every 0xFF
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& output) : output(output) {}
+
+        void Put(uint32_t bits, int count)
+        {
+            buffer = buffer << count | (bits & ((1u << count) - 1));
+            used += count;
+            while (used >= 8)
+            {
+                uint8_t byte = static_cast<uint8_t>(buffer >> (used - 8));
+                output.push_back(byte);
+                if (byte == 0xFF)
+                    output.push_back(0);
+                used -= 8;
+            }
+            buffer &= (1u << used) - 1;
+        }
+
+        void Flush()                    //Pads with one bits
+        {
+            if (used > 0)
+                Put((1u << (8 - used)) - 1, 8 - used);
+        }
+
+    private:
+        std::vector<uint8_t>& output;
+        uint32_t buffer = 0;
+        int used = 0;
+    };
+
+    int Magnitude(int value)            //Bits in |value|, the JPEG size category
+    {
+        int bits = 0;
+        for (unsigned magnitude = static_cast<unsigned>(std::abs(value)); magnitude != 0; magnitude >>= 1)
+            ++bits;
+        return bits;
+    }
+
+    struct Component
+    {
+        int h;                          //Blocks per MCU
+        int v;
+        int table;                      //0 luminance, 1 chrominance
+        int width;                      //Of plane, a whole number of MCUs
+        std::vector<uint8_t> plane;
+    };
+
+    //Padded to whole MCUs by repeating the last column and row
+    void BuildPlanes(const TextureImage& image, bool colour, bool subsample, int paddedWidth, int paddedHeight, std::vector<Component>& components)
+    {
+        const unsigned bpp = TexelBytes(image.format);
+        components.clear();
+        components.push_back({ colour && subsample ? 2 : 1, colour && subsample ? 2 : 1, 0, paddedWidth, {} });
+        if (colour)
+        {
+            components.push_back({ 1, 1, 1, subsample ? paddedWidth / 2 : paddedWidth, {} });
+            components.push_back({ 1, 1, 1, subsample ? paddedWidth / 2 : paddedWidth, {} });
+        }
+
+        std::vector<float> chroma[2];
+        components[0].plane.resize(size_t(paddedWidth) * paddedHeight);
+        if (colour)
+            for (std::vector<float>& plane : chroma)
+                plane.resize(size_t(paddedWidth) * paddedHeight);
+
+        for (int y = 0; y < paddedHeight; ++y)
+        {
+            const uint8_t* row = &image.bytes[size_t(std::min<unsigned>(y, image.height - 1)) * image.RowPitch()];
+            for (int x = 0; x < paddedWidth; ++x)
+            {
+                const uint8_t* texel = row + std::min<unsigned>(x, image.width - 1) * bpp;
+                size_t index = size_t(y) * paddedWidth + x;
+                if (!colour)
+                {
+                    components[0].plane[index] = texel[0];
+                    continue;
+                }
+                float r = texel[0];
+                float g = texel[1];
+                float b = texel[2];
+                float luma = 0.299f * r + 0.587f * g + 0.114f * b;
+                components[0].plane[index] = static_cast<uint8_t>(std::min(255.0f, luma + 0.5f));
+                chroma[0][index] = -0.168736f * r - 0.331264f * g + 0.5f * b + 128.0f;
+                chroma[1][index] = 0.5f * r - 0.418688f * g - 0.081312f * b + 128.0f;
+            }
+        }
+
+        if (!colour)
+            return;
+        for (int c = 0; c < 2; ++c)
+        {
+            Component& component = components[c + 1];
+            int height = subsample ? paddedHeight / 2 : paddedHeight;
+            component.plane.resize(size_t(component.width) * height);
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < component.width; ++x)
+                {
+                    float value;
+                    if (subsample)
+                    {
+                        const float* source = &chroma[c][size_t(y * 2) * paddedWidth + x * 2];
+                        value = (source[0] + source[1] + source[paddedWidth] + source[paddedWidth + 1]) * 0.25f;
+                    }
+                    else
+                        value = chroma[c][size_t(y) * paddedWidth + x];
+                    component.plane[size_t(y) * component.width + x] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, value + 0.5f)));
+                }
+            }
+        }
+    }
+
+    //Separable float DCT of one level-shifted block, quantized, in zig-zag order
+    void TransformBlock(const uint8_t* source, int pitch, const uint8_t* quant, int16_t* out)
+    {
+        const Tables& tables = GetTables();
+        float rows[8][8];
+        for (int y = 0; y < 8; ++y)
+        {
+            for (int u = 0; u < 8; ++u)
+            {
+                float sum = 0.0f;
+                for (int x = 0; x < 8; ++x)
+                    sum += tables.cosines[u][x] * (source[y * pitch + x] - 128.0f);
+                rows[y][u] = sum;
+            }
+        }
+        for (int k = 0; k < 64; ++k)
+        {
+            int natural = tables.zigZag[k];
+            int v = natural / 8;
+            int u = natural % 8;
+            float sum = 0.0f;
+            for (int y = 0; y < 8; ++y)
+                sum += tables.cosines[v][y] * rows[y][u];
+            out[k] = static_cast<int16_t>(std::lround(sum / quant[natural]));
+        }
+    }
+
+    void PutMarker(std::vector<uint8_t>& output, uint8_t marker, unsigned length)
+    {
+        output.push_back(0xFF);
+        output.push_back(marker);
+        if (length > 0)
+        {
+            output.push_back(static_cast<uint8_t>(length >> 8));
+            output.push_back(static_cast<uint8_t>(length));
+        }
+    }
+}
+
+std::vector<uint8_t> EncodeJpeg(const TextureImage& image, const JpegOptions& options)
+{
+    const Tables& tables = GetTables();
+    const bool colour = image.format == TexelFormat::RGBA8;
+    const bool subsample = colour && options.subsampleChroma;
+    const int mcuSize = subsample ? 16 : 8;
+    const int mcuColumns = (image.width + mcuSize - 1) / mcuSize;
+    const int mcuRows = (image.height + mcuSize - 1) / mcuSize;
+
+    std::vector<Component> components;
+    BuildPlanes(image, colour, subsample, mcuColumns * mcuSize, mcuRows * mcuSize, components);
+
+    //libjpeg's quality scaling of the Annex K tables
+    int quality = std::min(100, std::max(1, options.quality));
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    uint8_t quant[2][64];
+    for (int i = 0; i < 64; ++i)
+    {
+        quant[0][i] = static_cast<uint8_t>(std::min(255, std::max(1, (LUMINANCE_QUANT[i] * scale + 50) / 100)));
+        quant[1][i] = static_cast<uint8_t>(std::min(255, std::max(1, (CHROMINANCE_QUANT[i] * scale + 50) / 100)));
+    }
+
+    //Every block in stream order, kept for the second pass that writes them with the tables the first pass counted
+    std::vector<int16_t> coefficients;
+    std::vector<uint8_t> blockComponents;
+    for (int my = 0; my < mcuRows; ++my)
+    {
+        for (int mx = 0; mx < mcuColumns; ++mx)
+        {
+            for (size_t c = 0; c < components.size(); ++c)
+            {
+                const Component& component = components[c];
+                for (int by = 0; by < component.v; ++by)
+                {
+                    for (int bx = 0; bx < component.h; ++bx)
+                    {
+                        int x = (mx * component.h + bx) * 8;
+                        int y = (my * component.v + by) * 8;
+                        coefficients.resize(coefficients.size() + 64);
+                        TransformBlock(&component.plane[size_t(y) * component.width + x], component.width, quant[component.table],
+                                       &coefficients[coefficients.size() - 64]);
+                        blockComponents.push_back(static_cast<uint8_t>(c));
+                    }
+                }
+            }
+        }
+    }
+
+    //Blocks between restart markers, which also reset the DC predictions
+    const unsigned restartInterval = std::min(options.restartInterval, 65535u);
+    size_t blocksPerMcu = 0;
+    for (const Component& component : components)
+        blocksPerMcu += size_t(component.h) * component.v;
+    const size_t restartBlocks = restartInterval * blocksPerMcu;
+
+    //Visits the symbols of every block: DC size categories, AC run / size pairs, ZRL and EOB; restart(n) before interval n + 1
+    auto forEachSymbol = [&](auto&& dc, auto&& ac, auto&& restart)
+    {
+        int predictions[3] = {};
+        for (size_t block = 0; block < blockComponents.size(); ++block)
+        {
+            if (restartBlocks > 0 && block > 0 && block % restartBlocks == 0)
+            {
+                restart(static_cast<unsigned>(block / restartBlocks - 1));
+                predictions[0] = predictions[1] = predictions[2] = 0;
+            }
+
+            const int16_t* data = &coefficients[block * 64];
+            int c = blockComponents[block];
+            int table = components[c].table;
+            int difference = data[0] - predictions[c];
+            predictions[c] = data[0];
+            dc(table, difference);
+
+            int run = 0;
+            for (int k = 1; k < 64; ++k)
+            {
+                if (data[k] == 0)
+                {
+                    ++run;
+                    continue;
+                }
+                for (; run > 15; run -= 16)
+                    ac(table, 0xF0, 0);
+                ac(table, run << 4 | Magnitude(data[k]), data[k]);
+                run = 0;
+            }
+            if (run > 0)
+                ac(table, 0x00, 0);
+        }
+    };
+
+    uint32_t dcFrequencies[2][256] = {};
+    uint32_t acFrequencies[2][256] = {};
+    forEachSymbol([&](int table, int difference) { ++dcFrequencies[table][Magnitude(difference)]; },
+                  [&](int table, int symbol, int) { ++acFrequencies[table][symbol]; },
+                  [](unsigned) {});
+
+    const int tableCount = colour ? 2 : 1;
+    HuffmanTable dcTables[2];
+    HuffmanTable acTables[2];
+    for (int t = 0; t < tableCount; ++t)
+    {
+        BuildHuffmanTable(dcFrequencies[t], dcTables[t]);
+        BuildHuffmanTable(acFrequencies[t], acTables[t]);
+    }
+
+    std::vector<uint8_t> output;
+    output.reserve(coefficients.size() / 4);
+    PutMarker(output, 0xD8, 0);                         //SOI
+
+    PutMarker(output, 0xE0, 16);                        //APP0, JFIF 1.1, no density, no thumbnail
+    const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    output.insert(output.end(), jfif, jfif + sizeof(jfif));
+
+    PutMarker(output, 0xDB, 2 + 65 * tableCount);       //DQT, 8-bit entries in zig-zag order
+    for (int t = 0; t < tableCount; ++t)
+    {
+        output.push_back(static_cast<uint8_t>(t));
+        for (int k = 0; k < 64; ++k)
+            output.push_back(quant[t][tables.zigZag[k]]);
+    }
+
+    PutMarker(output, 0xC0, 8 + 3 * static_cast<unsigned>(components.size()));     //SOF0
+    output.push_back(8);
+    output.push_back(static_cast<uint8_t>(image.height >> 8));
+    output.push_back(static_cast<uint8_t>(image.height));
+    output.push_back(static_cast<uint8_t>(image.width >> 8));
+    output.push_back(static_cast<uint8_t>(image.width));
+    output.push_back(static_cast<uint8_t>(components.size()));
+    for (size_t c = 0; c < components.size(); ++c)
+    {
+        output.push_back(static_cast<uint8_t>(c + 1));
+        output.push_back(static_cast<uint8_t>(components[c].h << 4 | components[c].v));
+        output.push_back(static_cast<uint8_t>(components[c].table));
+    }
+
+    for (int t = 0; t < tableCount; ++t)
+    {
+        const HuffmanTable* pair[2] = { &dcTables[t], &acTables[t] };
+        for (int tableClass = 0; tableClass < 2; ++tableClass)
+        {
+            const HuffmanTable& table = *pair[tableClass];
+            PutMarker(output, 0xC4, 2 + 17 + static_cast<unsigned>(table.symbols.size()));     //DHT
+            output.push_back(static_cast<uint8_t>(tableClass << 4 | t));
+            output.insert(output.end(), table.counts + 1, table.counts + 17);
+            output.insert(output.end(), table.symbols.begin(), table.symbols.end());
+        }
+    }
+
+    if (restartBlocks > 0)
+    {
+        PutMarker(output, 0xDD, 4);                     //DRI
+        output.push_back(static_cast<uint8_t>(restartInterval >> 8));
+        output.push_back(static_cast<uint8_t>(restartInterval));
+    }
+
+    PutMarker(output, 0xDA, 6 + 2 * static_cast<unsigned>(components.size()));     //SOS, one scan with every component
+    output.push_back(static_cast<uint8_t>(components.size()));
+    for (size_t c = 0; c < components.size(); ++c)
+    {
+        output.push_back(static_cast<uint8_t>(c + 1));
+        output.push_back(static_cast<uint8_t>(components[c].table << 4 | components[c].table));
+    }
+    output.push_back(0);                                //Spectral selection 0 - 63, no successive approximation
+    output.push_back(63);
+    output.push_back(0);
+
+    BitWriter writer(output);
+    forEachSymbol(
+        [&](int table, int difference)
+        {
+            int size = Magnitude(difference);
+            writer.Put(dcTables[table].codes[size], dcTables[table].lengths[size]);
+            if (size > 0)
+                writer.Put(static_cast<uint32_t>(difference < 0 ? difference - 1 : difference), size);
+        },
+        [&](int table, int symbol, int value)
+        {
+            writer.Put(acTables[table].codes[symbol], acTables[table].lengths[symbol]);
+            int size = symbol & 15;
+            if (size > 0)
+                writer.Put(static_cast<uint32_t>(value < 0 ? value - 1 : value), size);
+        },
+        [&](unsigned index)
+        {
+            writer.Flush();
+            PutMarker(output, static_cast<uint8_t>(0xD0 + (index & 7)), 0);        //RSTn
+        });
+    writer.Flush();
+
+    PutMarker(output, 0xD9, 0);                         //EOI
+    return output;
+}
\ No newline at end of file
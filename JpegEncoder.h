@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "TextureImage.h"
+
+//Writes baseline JPEGs, for benchmark sources. Blocks go through a float DCT and the Annex K quantization tables scaled
+//by quality as libjpeg does, and the Huffman tables are built per image from its own symbol counts (libjpeg's
+//-optimize), so the streams look like what photo tools write.
+
+struct JpegOptions
+{
+	int quality = 85;					//1 - 100
+	bool subsampleChroma = true;		//4:2:0 when true, 4:4:4 otherwise
+	unsigned restartInterval = 0;		//MCUs between RSTn markers, 0 for none; up to 65535
+};
+
+//RGBA8 -> YCbCr, alpha dropped; R8 and R8G8 -> greyscale from the first channel
+std::vector<uint8_t> EncodeJpeg(const TextureImage& image, const JpegOptions& options = JpegOptions());
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandle, &fileSize))
+    {
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    file = fileHandle;
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    mapping = size > 0 ? CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    data = mapping != nullptr ? static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0)
+    {
+        if (descriptor >= 0)
+            close(descriptor);
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+    size = static_cast<size_t>(status.st_size);
+
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+    close(descriptor);          //The mapping keeps the file referenced
+    data = mapped != MAP_FAILED ? static_cast<const uint8_t*>(mapped) : nullptr;
+#endif
+
+    if (data == nullptr)
+    {
+        std::cerr << "Could not map " << path << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != nullptr)
+        CloseHandle(file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (data != nullptr)
+        munmap(const_cast<uint8_t*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+bool WriteFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& writer)
+{
+    std::error_code error;
+    if (std::filesystem::path(path).has_parent_path())
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+#ifdef _WIN32
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+    std::string temporary = path + "." + std::to_string(processId) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (file)
+            writer(file);
+        if (!file)
+        {
+            std::cerr << "Failed to write " << temporary << std::endl;
+            file.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        std::cerr << "Failed to rename " << temporary << " to " << path << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
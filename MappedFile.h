@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+//A whole file mapped read-only: mmap on POSIX, CreateFileMapping / MapViewOfFile on Windows. Pages come straight from
+//the OS page cache, nothing is read or copied up front.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);		//false with a message on std::cerr; empty files fail too
+	void Close();
+
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr;			//HANDLE
+	void* mapping = nullptr;		//HANDLE
+#endif
+};
+
+//Runs writer on a temporary file named after path, this process and this thread, then renames it over path, so a crash
+//never leaves a truncated file behind the real name and two writers, threads or processes, never share a temporary.
+//Creates the parent directory. false with a message on std::cerr when writing or renaming fails; the temporary is removed.
+bool WriteFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& writer);
\ No newline at end of file
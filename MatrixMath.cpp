@@ -0,0 +1,514 @@
+#include "MatrixMath.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#if defined(SIMD_X86)
+#include <immintrin.h>
+#elif defined(SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+//SSE2 is part of x64 and can be used without a runtime check; 32-bit x86 builds need it enabled explicitly
+#if defined(SIMD_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MATH_SSE2 1
+#endif
+
+static_assert(sizeof(Matrix) == 64, "Matrices are loaded as four 16-byte rows");
+
+namespace
+{
+    void Normalize3(float* v)
+    {
+        float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        float inv = length > 0 ? 1.0f / length : 0.0f;
+        v[0] *= inv;
+        v[1] *= inv;
+        v[2] *= inv;
+    }
+
+    void Cross(const float* a, const float* b, float* out)
+    {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    float Dot3(const float* a, const float* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    //The SIMD versions add the four products in the same order, so every backend without FMA gives identical results
+    void MultiplyScalar(const Matrix& a, const Matrix& b, Matrix& out)
+    {
+        Matrix result = {};
+        for (int row = 0; row < 4; ++row)
+            for (int col = 0; col < 4; ++col)
+                for (int k = 0; k < 4; ++k)
+                    result.m[row][col] += a.m[row][k] * b.m[k][col];
+        out = result;
+    }
+
+    void TransposeScalar(const Matrix& in, Matrix& out)
+    {
+        Matrix result;
+        for (int row = 0; row < 4; ++row)
+            for (int col = 0; col < 4; ++col)
+                result.m[col][row] = in.m[row][col];
+        out = result;
+    }
+
+    void MultiplyBatchScalar(const Matrix* a, const Matrix* b, size_t bStride, Matrix* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            MultiplyScalar(a[i], b[i * bStride], out[i]);
+    }
+
+    void TransposeBatchScalar(const Matrix* in, Matrix* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            TransposeScalar(in[i], out[i]);
+    }
+}
+
+#ifdef MATH_SSE2
+
+namespace
+{
+    inline void MultiplySse2(const Matrix& a, const __m128* b, Matrix& out)
+    {
+        __m128 rows[4];
+        for (int row = 0; row < 4; ++row)
+        {
+            __m128 result = _mm_mul_ps(_mm_set1_ps(a.m[row][0]), b[0]);
+            result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(a.m[row][1]), b[1]));
+            result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(a.m[row][2]), b[2]));
+            rows[row] = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(a.m[row][3]), b[3]));
+        }
+        for (int row = 0; row < 4; ++row)
+            _mm_store_ps(out.m[row], rows[row]);
+    }
+
+    inline void TransposeSse2(const Matrix& in, Matrix& out)
+    {
+        __m128 r0 = _mm_load_ps(in.m[0]), r1 = _mm_load_ps(in.m[1]), r2 = _mm_load_ps(in.m[2]), r3 = _mm_load_ps(in.m[3]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_store_ps(out.m[0], r0);
+        _mm_store_ps(out.m[1], r1);
+        _mm_store_ps(out.m[2], r2);
+        _mm_store_ps(out.m[3], r3);
+    }
+
+    void MultiplyBatchSse2(const Matrix* a, const Matrix* b, size_t bStride, Matrix* out, size_t count)
+    {
+        __m128 rows[4];
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i == 0 || bStride != 0)
+                for (int k = 0; k < 4; ++k)
+                    rows[k] = _mm_load_ps(b[i * bStride].m[k]);
+            MultiplySse2(a[i], rows, out[i]);
+        }
+    }
+
+    void TransposeBatchSse2(const Matrix* in, Matrix* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            TransposeSse2(in[i], out[i]);
+    }
+}
+
+#endif
+
+#ifdef SIMD_X86
+
+SIMD_BEGIN_TARGET_AVX2
+namespace
+{
+    //Two rows per register: shuffling a row pair broadcasts element k of each row within its own 128-bit lane
+    template<int K>
+    inline __m256 Broadcast2(__m256 rowPair)
+    {
+        return _mm256_shuffle_ps(rowPair, rowPair, K * 0x55);
+    }
+
+    void MultiplyBatchAvx2(const Matrix* a, const Matrix* b, size_t bStride, Matrix* out, size_t count)
+    {
+        __m256 rows[4];
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i == 0 || bStride != 0)
+                for (int k = 0; k < 4; ++k)
+                    rows[k] = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b[i * bStride].m[k]));
+
+            __m256 pair01 = _mm256_loadu_ps(a[i].m[0]);
+            __m256 pair23 = _mm256_loadu_ps(a[i].m[2]);
+
+            __m256 result01 = _mm256_mul_ps(Broadcast2<0>(pair01), rows[0]);
+            __m256 result23 = _mm256_mul_ps(Broadcast2<0>(pair23), rows[0]);
+            result01 = _mm256_fmadd_ps(Broadcast2<1>(pair01), rows[1], result01);
+            result23 = _mm256_fmadd_ps(Broadcast2<1>(pair23), rows[1], result23);
+            result01 = _mm256_fmadd_ps(Broadcast2<2>(pair01), rows[2], result01);
+            result23 = _mm256_fmadd_ps(Broadcast2<2>(pair23), rows[2], result23);
+            result01 = _mm256_fmadd_ps(Broadcast2<3>(pair01), rows[3], result01);
+            result23 = _mm256_fmadd_ps(Broadcast2<3>(pair23), rows[3], result23);
+
+            _mm256_storeu_ps(out[i].m[0], result01);
+            _mm256_storeu_ps(out[i].m[2], result23);
+        }
+    }
+
+    void TransposeBatchAvx2(const Matrix* in, Matrix* out, size_t count)
+    {
+        const __m256i interleave = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            //(r0.x r1.x r0.y r1.y | r0.z r1.z r0.w r1.w) and the same for rows 2 and 3
+            __m256 rows01 = _mm256_permutevar8x32_ps(_mm256_loadu_ps(in[i].m[0]), interleave);
+            __m256 rows23 = _mm256_permutevar8x32_ps(_mm256_loadu_ps(in[i].m[2]), interleave);
+
+            __m256 columns02 = _mm256_shuffle_ps(rows01, rows23, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 columns13 = _mm256_shuffle_ps(rows01, rows23, _MM_SHUFFLE(3, 2, 3, 2));
+
+            _mm256_storeu_ps(out[i].m[0], _mm256_permute2f128_ps(columns02, columns13, 0x20));
+            _mm256_storeu_ps(out[i].m[2], _mm256_permute2f128_ps(columns02, columns13, 0x31));
+        }
+    }
+}
+SIMD_END_TARGET
+
+#endif
+
+#ifdef SIMD_NEON
+
+namespace
+{
+    inline void MultiplyNeon(const Matrix& a, const float32x4_t* b, Matrix& out)
+    {
+        float32x4_t rows[4];
+        for (int row = 0; row < 4; ++row)
+        {
+            float32x4_t result = vmulq_n_f32(b[0], a.m[row][0]);
+            result = vmlaq_n_f32(result, b[1], a.m[row][1]);
+            result = vmlaq_n_f32(result, b[2], a.m[row][2]);
+            rows[row] = vmlaq_n_f32(result, b[3], a.m[row][3]);
+        }
+        for (int row = 0; row < 4; ++row)
+            vst1q_f32(out.m[row], rows[row]);
+    }
+
+    inline void TransposeNeon(const Matrix& in, Matrix& out)
+    {
+        float32x4x4_t columns = vld4q_f32(&in.m[0][0]);     //De-interleaving load, val[k] is column k
+        vst1q_f32(out.m[0], columns.val[0]);
+        vst1q_f32(out.m[1], columns.val[1]);
+        vst1q_f32(out.m[2], columns.val[2]);
+        vst1q_f32(out.m[3], columns.val[3]);
+    }
+
+    void MultiplyBatchNeon(const Matrix* a, const Matrix* b, size_t bStride, Matrix* out, size_t count)
+    {
+        float32x4_t rows[4];
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i == 0 || bStride != 0)
+                for (int k = 0; k < 4; ++k)
+                    rows[k] = vld1q_f32(b[i * bStride].m[k]);
+            MultiplyNeon(a[i], rows, out[i]);
+        }
+    }
+
+    void TransposeBatchNeon(const Matrix* in, Matrix* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            TransposeNeon(in[i], out[i]);
+    }
+}
+
+#endif
+
+Matrix Multiply(const Matrix& a, const Matrix& b)
+{
+    Matrix result;
+#if defined(MATH_SSE2)
+    __m128 rows[4] = { _mm_load_ps(b.m[0]), _mm_load_ps(b.m[1]), _mm_load_ps(b.m[2]), _mm_load_ps(b.m[3]) };
+    MultiplySse2(a, rows, result);
+#elif defined(SIMD_NEON)
+    float32x4_t rows[4] = { vld1q_f32(b.m[0]), vld1q_f32(b.m[1]), vld1q_f32(b.m[2]), vld1q_f32(b.m[3]) };
+    MultiplyNeon(a, rows, result);
+#else
+    MultiplyScalar(a, b, result);
+#endif
+    return result;
+}
+
+Matrix Transpose(const Matrix& matrix)
+{
+    Matrix result;
+#if defined(MATH_SSE2)
+    TransposeSse2(matrix, result);
+#elif defined(SIMD_NEON)
+    TransposeNeon(matrix, result);
+#else
+    TransposeScalar(matrix, result);
+#endif
+    return result;
+}
+
+Matrix Identity()
+{
+    return { { {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1} } };
+}
+
+Matrix Scaling(float x, float y, float z)
+{
+    Matrix result = Identity();
+    result.m[0][0] = x;
+    result.m[1][1] = y;
+    result.m[2][2] = z;
+    return result;
+}
+
+Matrix Translation(float x, float y, float z)
+{
+    Matrix result = Identity();
+    result.m[3][0] = x;
+    result.m[3][1] = y;
+    result.m[3][2] = z;
+    return result;
+}
+
+Matrix RotationY(float angle)
+{
+    float s = std::sin(angle);
+    float c = std::cos(angle);
+    return { { {c, 0, -s, 0}, {0, 1, 0, 0}, {s, 0, c, 0}, {0, 0, 0, 1} } };
+}
+
+Matrix RotationYAround(float angle, const float* pivot)
+{
+    //v' = (v - p) * R + p, so the translation row is p - p * R
+    Matrix result = RotationY(angle);
+    for (int col = 0; col < 3; ++col)
+        result.m[3][col] = pivot[col] - (pivot[0] * result.m[0][col] + pivot[1] * result.m[1][col] + pivot[2] * result.m[2][col]);
+    return result;
+}
+
+Matrix LookAtLH(const float* eye, const float* focus, const float* up)
+{
+    float zAxis[3] = { focus[0] - eye[0], focus[1] - eye[1], focus[2] - eye[2] };
+    Normalize3(zAxis);
+    float xAxis[3];
+    Cross(up, zAxis, xAxis);
+    Normalize3(xAxis);
+    float yAxis[3];
+    Cross(zAxis, xAxis, yAxis);
+
+    return { {
+        {xAxis[0], yAxis[0], zAxis[0], 0},
+        {xAxis[1], yAxis[1], zAxis[1], 0},
+        {xAxis[2], yAxis[2], zAxis[2], 0},
+        {-Dot3(xAxis, eye), -Dot3(yAxis, eye), -Dot3(zAxis, eye), 1}
+    } };
+}
+
+Matrix PerspectiveFovLH(float fovY, float aspectRatio, float nearZ, float farZ)
+{
+    float height = 1.0f / std::tan(fovY * 0.5f);
+    float width = height / aspectRatio;
+    float range = farZ / (farZ - nearZ);
+
+    return { {
+        {width, 0, 0, 0},
+        {0, height, 0, 0},
+        {0, 0, range, 1},
+        {0, 0, -range * nearZ, 0}
+    } };
+}
+
+void StoreTransposed(const Matrix& matrix, float out[4][4])
+{
+    Matrix transposed = Transpose(matrix);
+    std::copy(&transposed.m[0][0], &transposed.m[0][0] + 16, &out[0][0]);
+}
+
+const char* MathIsaName(MathIsa isa)
+{
+    switch (isa)
+    {
+    case MathIsa::SSE2: return "SSE2";
+    case MathIsa::AVX2: return "AVX2";
+    case MathIsa::NEON: return "NEON";
+    default: return "scalar";
+    }
+}
+
+bool IsMathIsaSupported(MathIsa isa)
+{
+    switch (isa)
+    {
+#ifdef MATH_SSE2
+    case MathIsa::SSE2: return true;
+#endif
+#ifdef SIMD_X86
+    case MathIsa::AVX2: return GetCpuFeatures().avx2;
+#endif
+#ifdef SIMD_NEON
+    case MathIsa::NEON: return true;
+#endif
+    case MathIsa::Scalar: return true;
+    default: return false;
+    }
+}
+
+MathIsa BestMathIsa()
+{
+    static const MathIsa best = IsMathIsaSupported(MathIsa::AVX2) ? MathIsa::AVX2 :
+                                IsMathIsaSupported(MathIsa::NEON) ? MathIsa::NEON :
+                                IsMathIsaSupported(MathIsa::SSE2) ? MathIsa::SSE2 : MathIsa::Scalar;
+    return best;
+}
+
+namespace
+{
+    void MultiplyBatch(MathIsa isa, const Matrix* a, const Matrix* b, size_t bStride, Matrix* out, size_t count)
+    {
+        switch (isa)
+        {
+#ifdef SIMD_X86
+        case MathIsa::AVX2: MultiplyBatchAvx2(a, b, bStride, out, count); break;
+#endif
+#ifdef MATH_SSE2
+        case MathIsa::SSE2: MultiplyBatchSse2(a, b, bStride, out, count); break;
+#endif
+#ifdef SIMD_NEON
+        case MathIsa::NEON: MultiplyBatchNeon(a, b, bStride, out, count); break;
+#endif
+        default: MultiplyBatchScalar(a, b, bStride, out, count); break;
+        }
+    }
+}
+
+void MultiplyBatch(MathIsa isa, const Matrix* a, const Matrix& b, Matrix* out, size_t count)
+{
+    MultiplyBatch(isa, a, &b, 0, out, count);
+}
+
+void MultiplyBatch(MathIsa isa, const Matrix* a, const Matrix* b, Matrix* out, size_t count)
+{
+    MultiplyBatch(isa, a, b, 1, out, count);
+}
+
+void TransposeBatch(MathIsa isa, const Matrix* in, Matrix* out, size_t count)
+{
+    switch (isa)
+    {
+#ifdef SIMD_X86
+    case MathIsa::AVX2: TransposeBatchAvx2(in, out, count); break;
+#endif
+#ifdef MATH_SSE2
+    case MathIsa::SSE2: TransposeBatchSse2(in, out, count); break;
+#endif
+#ifdef SIMD_NEON
+    case MathIsa::NEON: TransposeBatchNeon(in, out, count); break;
+#endif
+    default: TransposeBatchScalar(in, out, count); break;
+    }
+}
+
+void MultiplyBatch(const Matrix* a, const Matrix& b, Matrix* out, size_t count)
+{
+    MultiplyBatch(BestMathIsa(), a, &b, 0, out, count);
+}
+
+void MultiplyBatch(const Matrix* a, const Matrix* b, Matrix* out, size_t count)
+{
+    MultiplyBatch(BestMathIsa(), a, b, 1, out, count);
+}
+
+void TransposeBatch(const Matrix* in, Matrix* out, size_t count)
+{
+    TransposeBatch(BestMathIsa(), in, out, count);
+}
+
+void RunMathBenchmark()
+{
+    const size_t COUNT = 1024;      //64 KB per array, stays in L2
+    const double secondsPerRun = 0.5;
+
+    std::vector<Matrix> a(COUNT), b(COUNT), out(COUNT), reference(COUNT);
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        const float pivot[3] = { 0.0f, 0.0f, 1.0f };
+        const float eye[3] = { i * 0.01f, 1.0f, -2.0f };
+        const float focus[3] = { 0.0f, 0.0f, 1.0f };
+        const float up[3] = { 0.0f, 1.0f, 0.0f };
+        a[i] = RotationYAround(i * 0.001f, pivot);
+        b[i] = Multiply(LookAtLH(eye, focus, up), PerspectiveFovLH(PI * 0.25f, 16.0f / 9.0f, 0.1f, 100.0f));
+    }
+
+    auto run = [&](const char* name, const char* isaName, auto&& pass)
+    {
+        unsigned passes = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while (elapsed < secondsPerRun)
+        {
+            pass();
+            ++passes;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        float maxError = 0;
+        for (size_t i = 0; i < COUNT; ++i)
+            for (int k = 0; k < 16; ++k)
+                maxError = std::max(maxError, std::abs(out[i].m[k / 4][k % 4] - reference[i].m[k / 4][k % 4]));
+
+        std::printf("%-22s %-7s %8.1f Mmatrices/s  max error %g\n", name, isaName, passes * static_cast<double>(COUNT) / elapsed / 1e6, maxError);
+    };
+
+    const MathIsa isas[] = { MathIsa::Scalar, MathIsa::SSE2, MathIsa::AVX2, MathIsa::NEON };
+
+    //world * viewProjection, the per-object constant buffer product
+    for (size_t i = 0; i < COUNT; ++i)
+        MultiplyScalar(a[i], b[0], reference[i]);
+
+    run("multiply, shared b", "single", [&]
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+            out[i] = Multiply(a[i], b[0]);
+    });
+    for (MathIsa isa : isas)
+        if (IsMathIsaSupported(isa))
+            run("multiply, shared b", MathIsaName(isa), [&] { MultiplyBatch(isa, a.data(), b[0], out.data(), COUNT); });
+
+    for (size_t i = 0; i < COUNT; ++i)
+        MultiplyScalar(a[i], b[i], reference[i]);
+
+    run("multiply, per-item b", "single", [&]
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+            out[i] = Multiply(a[i], b[i]);
+    });
+    for (MathIsa isa : isas)
+        if (IsMathIsaSupported(isa))
+            run("multiply, per-item b", MathIsaName(isa), [&] { MultiplyBatch(isa, a.data(), b.data(), out.data(), COUNT); });
+
+    for (size_t i = 0; i < COUNT; ++i)
+        TransposeScalar(b[i], reference[i]);
+
+    run("transpose", "single", [&]
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+            out[i] = Transpose(b[i]);
+    });
+    for (MathIsa isa : isas)
+        if (IsMathIsaSupported(isa))
+            run("transpose", MathIsaName(isa), [&] { TransposeBatch(isa, b.data(), out.data(), COUNT); });
+}
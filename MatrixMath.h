@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+//Portable replacement for the DirectXMath subset this project uses. Row-major 4x4 matrices for row vectors (v * M),
+//with the same conventions and results as the DirectXMath functions named below.
+//Single-matrix products use 128-bit SIMD where the platform guarantees it (SSE2 on x64, NEON on AArch64),
+//the batched entry points pick the widest instruction set at runtime.
+
+const float PI = 3.14159265f;
+
+struct alignas(16) Matrix
+{
+	float m[4][4];
+};
+
+Matrix Multiply(const Matrix& a, const Matrix& b);		//XMMatrixMultiply
+Matrix Transpose(const Matrix& matrix);					//XMMatrixTranspose
+Matrix Identity();										//XMMatrixIdentity
+Matrix Scaling(float x, float y, float z);				//XMMatrixScaling
+Matrix Translation(float x, float y, float z);			//XMMatrixTranslation
+Matrix RotationY(float angle);							//XMMatrixRotationY
+Matrix RotationYAround(float angle, const float* pivot);		//Translation(-pivot) * RotationY(angle) * Translation(pivot)
+Matrix LookAtLH(const float* eye, const float* focus, const float* up);		//XMMatrixLookAtLH
+Matrix PerspectiveFovLH(float fovY, float aspectRatio, float nearZ, float farZ);	//XMMatrixPerspectiveFovLH
+
+void StoreTransposed(const Matrix& matrix, float out[4][4]);		//XMStoreFloat4x4(XMMatrixTranspose), as the shaders read constant buffers
+
+enum class MathIsa { Scalar, SSE2, AVX2, NEON };
+
+const char* MathIsaName(MathIsa isa);
+bool IsMathIsaSupported(MathIsa isa);
+MathIsa BestMathIsa();
+
+//N matrices per call. out may be the same array as a (or in), but not b.
+void MultiplyBatch(MathIsa isa, const Matrix* a, const Matrix& b, Matrix* out, size_t count);		//out[i] = a[i] * b
+void MultiplyBatch(MathIsa isa, const Matrix* a, const Matrix* b, Matrix* out, size_t count);		//out[i] = a[i] * b[i]
+void TransposeBatch(MathIsa isa, const Matrix* in, Matrix* out, size_t count);
+
+void MultiplyBatch(const Matrix* a, const Matrix& b, Matrix* out, size_t count);
+void MultiplyBatch(const Matrix* a, const Matrix* b, Matrix* out, size_t count);
+void TransposeBatch(const Matrix* in, Matrix* out, size_t count);
+
+void RunMathBenchmark();
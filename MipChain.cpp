@@ -0,0 +1,512 @@
+#include "MipChain.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+const char* MipFilterName(MipFilter filter)
+{
+    switch (filter)
+    {
+    case MipFilter::Box:     return "box";
+    case MipFilter::Kaiser:  return "kaiser";
+    case MipFilter::Lanczos: return "lanczos";
+    }
+    return "unknown";
+}
+
+unsigned MipLevelCount(unsigned width, unsigned height)
+{
+    unsigned levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        ++levels;
+    }
+    return levels;
+}
+
+namespace
+{
+    const unsigned ENCODE_STEPS = 8192;     //Linear values are quantized to this many steps before the table lookup
+    const unsigned BAND_ROWS = 16;          //Destination rows per job
+
+    struct TransferTables
+    {
+        float decode[2][256];                       //[0] sRGB to linear, [1] unorm to float
+        int32_t encode[2][ENCODE_STEPS];            //[0] linear to sRGB, [1] float to unorm
+
+        TransferTables()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                double value = i / 255.0;
+                decode[0][i] = static_cast<float>(value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4));
+                decode[1][i] = static_cast<float>(value);
+            }
+
+            for (unsigned i = 0; i < ENCODE_STEPS; ++i)
+            {
+                double value = i / double(ENCODE_STEPS - 1);
+                double sRGB = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+                encode[0][i] = static_cast<int32_t>(sRGB * 255.0 + 0.5);
+                encode[1][i] = static_cast<int32_t>(value * 255.0 + 0.5);
+            }
+        }
+    };
+
+    const TransferTables TRANSFER;
+
+    double Sinc(double x)
+    {
+        if (x == 0.0)
+            return 1.0;
+        x *= 3.14159265358979323846;
+        return std::sin(x) / x;
+    }
+
+    double BesselI0(double x)        //Power series, converges quickly for the alpha used below
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    double FilterSupport(MipFilter filter)      //Radius in destination pixels
+    {
+        return filter == MipFilter::Box ? 0.5 : 3.0;
+    }
+
+    double FilterWeight(MipFilter filter, double x)
+    {
+        const double KAISER_ALPHA = 4.0;
+        double support = FilterSupport(filter);
+        if (std::fabs(x) >= support)
+            return 0.0;
+
+        switch (filter)
+        {
+        case MipFilter::Box:
+            return 1.0;
+        case MipFilter::Kaiser:
+        {
+            double t = x / support;
+            return Sinc(x) * BesselI0(KAISER_ALPHA * std::sqrt(1.0 - t * t)) / BesselI0(KAISER_ALPHA);
+        }
+        case MipFilter::Lanczos:
+            return Sinc(x) * Sinc(x / support);
+        }
+        return 0.0;
+    }
+
+    //Source pixel and weight for every tap of every destination pixel, [destination * taps + tap].
+    //Destinations with fewer taps are padded with zero weights so every pixel runs the same loop.
+    struct FilterTaps
+    {
+        unsigned taps = 0;
+        std::vector<uint32_t> index;
+        std::vector<float> weight;
+    };
+
+    FilterTaps BuildTaps(MipFilter filter, unsigned sourceSize, unsigned destinationSize)
+    {
+        double scale = double(sourceSize) / destinationSize;
+        double support = FilterSupport(filter) * scale;
+
+        std::vector<std::vector<std::pair<uint32_t, double>>> pixels(destinationSize);
+        size_t taps = 0;
+
+        for (unsigned x = 0; x < destinationSize; ++x)
+        {
+            double center = (x + 0.5) * scale;
+            long first = static_cast<long>(std::floor(center - support));
+            long last = static_cast<long>(std::ceil(center + support));
+
+            double sum = 0.0;
+            for (long j = first; j <= last; ++j)
+            {
+                double weight = FilterWeight(filter, (j + 0.5 - center) / scale);
+                if (std::fabs(weight) < 1e-8)
+                    continue;
+
+                long wrapped = ((j % long(sourceSize)) + long(sourceSize)) % long(sourceSize);       //WRAP addressing
+                pixels[x].emplace_back(static_cast<uint32_t>(wrapped), weight);
+                sum += weight;
+            }
+
+            for (auto& tap : pixels[x])
+                tap.second /= sum;
+            taps = std::max(taps, pixels[x].size());
+        }
+
+        FilterTaps result;
+        result.taps = static_cast<unsigned>(taps);
+        result.index.assign(destinationSize * taps, 0);
+        result.weight.assign(destinationSize * taps, 0.0f);
+
+        for (unsigned x = 0; x < destinationSize; ++x)
+            for (size_t k = 0; k < pixels[x].size(); ++k)
+            {
+                result.index[x * taps + k] = pixels[x][k].first;
+                result.weight[x * taps + k] = static_cast<float>(pixels[x][k].second);
+            }
+
+        return result;
+    }
+
+    void DecodeRow(const uint32_t* texels, unsigned width, bool sRGB, float* output)
+    {
+        const float* color = TRANSFER.decode[sRGB ? 0 : 1];
+        const float* alpha = TRANSFER.decode[1];
+
+        for (unsigned x = 0; x < width; ++x)
+        {
+            uint32_t texel = texels[x];
+            output[x * 4 + 0] = color[texel & 0xFF];
+            output[x * 4 + 1] = color[(texel >> 8) & 0xFF];
+            output[x * 4 + 2] = color[(texel >> 16) & 0xFF];
+            output[x * 4 + 3] = alpha[texel >> 24];
+        }
+    }
+
+    void FilterRowScalar(const float* source, const FilterTaps& taps, unsigned first, unsigned end, float* output)
+    {
+        for (unsigned x = first; x < end; ++x)
+        {
+            const uint32_t* index = &taps.index[x * taps.taps];
+            const float* weight = &taps.weight[x * taps.taps];
+
+            float sum[4] = {};
+            for (unsigned k = 0; k < taps.taps; ++k)
+                for (int c = 0; c < 4; ++c)
+                    sum[c] += weight[k] * source[index[k] * 4 + c];
+
+            for (int c = 0; c < 4; ++c)
+                output[x * 4 + c] = sum[c];
+        }
+    }
+
+    void BlendRowsScalar(const float* const* rows, const float* weights, unsigned taps, size_t count, float* output)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            float sum = 0.0f;
+            for (unsigned k = 0; k < taps; ++k)
+                sum += weights[k] * rows[k][i];
+            output[i] = sum;
+        }
+    }
+
+    void EncodeRowScalar(const float* source, unsigned width, bool sRGB, uint32_t* texels)
+    {
+        const int32_t* color = TRANSFER.encode[sRGB ? 0 : 1];
+        const int32_t* alpha = TRANSFER.encode[1];
+
+        auto quantize = [](float value)     //Negative lobes can overshoot either end
+        {
+            value = std::min(std::max(value, 0.0f), 1.0f);
+            return static_cast<unsigned>(value * (ENCODE_STEPS - 1) + 0.5f);
+        };
+
+        for (unsigned x = 0; x < width; ++x)
+        {
+            const float* pixel = source + x * 4;
+            texels[x] = static_cast<uint32_t>(color[quantize(pixel[0])]) | static_cast<uint32_t>(color[quantize(pixel[1])]) << 8 |
+                        static_cast<uint32_t>(color[quantize(pixel[2])]) << 16 | static_cast<uint32_t>(alpha[quantize(pixel[3])]) << 24;
+        }
+    }
+}
+
+#ifdef SIMD_X86
+
+SIMD_BEGIN_TARGET_AVX2
+namespace
+{
+    //Two destination pixels per iteration, one in each 128-bit half
+    void FilterRowAvx2(const float* source, const FilterTaps& taps, unsigned width, float* output)
+    {
+        unsigned x = 0;
+        for (; x + 2 <= width; x += 2)
+        {
+            const uint32_t* index0 = &taps.index[x * taps.taps];
+            const uint32_t* index1 = index0 + taps.taps;
+            const float* weight0 = &taps.weight[x * taps.taps];
+            const float* weight1 = weight0 + taps.taps;
+
+            __m256 sum = _mm256_setzero_ps();
+            for (unsigned k = 0; k < taps.taps; ++k)
+            {
+                __m256 pixels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(source + index0[k] * 4)), _mm_loadu_ps(source + index1[k] * 4), 1);
+                __m256 weights = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_broadcast_ss(weight0 + k)), _mm_broadcast_ss(weight1 + k), 1);
+                sum = _mm256_fmadd_ps(pixels, weights, sum);
+            }
+            _mm256_storeu_ps(output + x * 4, sum);
+        }
+
+        FilterRowScalar(source, taps, x, width, output);
+    }
+
+    void BlendRowsAvx2(const float* const* rows, const float* weights, unsigned taps, size_t count, float* output)
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (unsigned k = 0; k < taps; ++k)
+                sum = _mm256_fmadd_ps(_mm256_broadcast_ss(weights + k), _mm256_loadu_ps(rows[k] + i), sum);
+            _mm256_storeu_ps(output + i, sum);
+        }
+
+        for (; i < count; ++i)
+        {
+            float sum = 0.0f;
+            for (unsigned k = 0; k < taps; ++k)
+                sum = std::fma(weights[k], rows[k][i], sum);
+            output[i] = sum;
+        }
+    }
+
+    //Four pixels per iteration: one gather from the encode tables, alpha lanes offset into the unorm table
+    void EncodeRowAvx2(const float* source, unsigned width, bool sRGB, uint32_t* texels)
+    {
+        const int32_t* table = &TRANSFER.encode[0][0];
+        const __m256i offsets = sRGB ? _mm256_setr_epi32(0, 0, 0, ENCODE_STEPS, 0, 0, 0, ENCODE_STEPS) : _mm256_set1_epi32(ENCODE_STEPS);
+        const __m256 steps = _mm256_set1_ps(float(ENCODE_STEPS - 1));
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        auto lookup = [&](const float* pixels)
+        {
+            __m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(pixels), zero), one);
+            __m256i index = _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(value, steps)), offsets);
+            return _mm256_i32gather_epi32(table, index, 4);
+        };
+
+        unsigned x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            __m256i first = lookup(source + x * 4);             //Pixels x, x + 1
+            __m256i second = lookup(source + x * 4 + 8);        //Pixels x + 2, x + 3
+            __m256i words = _mm256_packus_epi32(first, second);
+            __m256i bytes = _mm256_packus_epi16(words, words);      //Per half: x | x + 2, then x + 1 | x + 3
+            bytes = _mm256_permutevar8x32_epi32(bytes, order);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(texels + x), _mm256_castsi256_si128(bytes));
+        }
+
+        EncodeRowScalar(source + x * 4, width - x, sRGB, texels + x);
+    }
+}
+SIMD_END_TARGET
+
+#endif
+
+const char* MipIsaName(MipIsa isa)
+{
+    return isa == MipIsa::AVX2 ? "AVX2" : "scalar";
+}
+
+bool IsMipIsaSupported(MipIsa isa)
+{
+    return isa == MipIsa::AVX2 ? GetCpuFeatures().avx2 : true;
+}
+
+MipIsa BestMipIsa()
+{
+    static const MipIsa best = IsMipIsaSupported(MipIsa::AVX2) ? MipIsa::AVX2 : MipIsa::Scalar;
+    return best;
+}
+
+namespace
+{
+    //Filters the source rows the band needs horizontally once each, then every destination row blends its vertical taps
+    void DownsampleBand(MipIsa isa, const SoftwareTexture& source, SoftwareTexture& destination, const FilterTaps& horizontal,
+                        const FilterTaps& vertical, bool sRGB, unsigned firstRow, unsigned rowCount)
+    {
+        thread_local std::vector<float> decoded, filtered, blended;
+        thread_local std::vector<int> slots;
+        thread_local std::vector<const float*> rows;
+
+        size_t rowFloats = size_t(destination.width) * 4;
+        decoded.resize(size_t(source.width) * 4);
+        blended.resize(rowFloats);
+        slots.assign(source.height, -1);
+        rows.resize(vertical.taps);
+
+        std::vector<uint32_t> sourceRows;
+        for (unsigned y = firstRow; y < firstRow + rowCount; ++y)
+            for (unsigned k = 0; k < vertical.taps; ++k)
+            {
+                uint32_t row = vertical.index[y * vertical.taps + k];
+                if (slots[row] < 0)
+                {
+                    slots[row] = static_cast<int>(sourceRows.size());
+                    sourceRows.push_back(row);
+                }
+            }
+
+        filtered.resize(sourceRows.size() * rowFloats);
+        for (size_t i = 0; i < sourceRows.size(); ++i)
+        {
+            DecodeRow(&source.texels[size_t(sourceRows[i]) * source.width], source.width, sRGB, decoded.data());
+#ifdef SIMD_X86
+            if (isa == MipIsa::AVX2)
+                FilterRowAvx2(decoded.data(), horizontal, destination.width, &filtered[i * rowFloats]);
+            else
+#endif
+                FilterRowScalar(decoded.data(), horizontal, 0, destination.width, &filtered[i * rowFloats]);
+        }
+
+        for (unsigned y = firstRow; y < firstRow + rowCount; ++y)
+        {
+            for (unsigned k = 0; k < vertical.taps; ++k)
+                rows[k] = &filtered[slots[vertical.index[y * vertical.taps + k]] * rowFloats];
+
+            const float* weights = &vertical.weight[y * vertical.taps];
+            uint32_t* texels = &destination.texels[size_t(y) * destination.width];
+#ifdef SIMD_X86
+            if (isa == MipIsa::AVX2)
+            {
+                BlendRowsAvx2(rows.data(), weights, vertical.taps, rowFloats, blended.data());
+                EncodeRowAvx2(blended.data(), destination.width, sRGB, texels);
+                continue;
+            }
+#endif
+            BlendRowsScalar(rows.data(), weights, vertical.taps, rowFloats, blended.data());
+            EncodeRowScalar(blended.data(), destination.width, sRGB, texels);
+        }
+    }
+}
+
+std::vector<SoftwareTexture> GenerateMipChain(MipIsa isa, const SoftwareTexture& base, const MipOptions& options, ThreadPool* threadPool)
+{
+    std::vector<SoftwareTexture> levels(MipLevelCount(base.width, base.height));
+    levels[0] = base;
+
+    for (size_t level = 1; level < levels.size(); ++level)
+    {
+        const SoftwareTexture& source = levels[level - 1];
+        SoftwareTexture& destination = levels[level];
+        destination.width = std::max(1u, source.width / 2);
+        destination.height = std::max(1u, source.height / 2);
+        destination.texels.resize(size_t(destination.width) * destination.height);
+
+        FilterTaps horizontal = BuildTaps(options.filter, source.width, destination.width);
+        FilterTaps vertical = BuildTaps(options.filter, source.height, destination.height);
+
+        unsigned bands = (destination.height + BAND_ROWS - 1) / BAND_ROWS;
+        auto band = [&](unsigned index)
+        {
+            unsigned firstRow = index * BAND_ROWS;
+            DownsampleBand(isa, source, destination, horizontal, vertical, options.sRGB, firstRow, std::min(BAND_ROWS, destination.height - firstRow));
+        };
+
+        if (threadPool != nullptr && bands > 1)
+            threadPool->ParallelFor(bands, band);
+        else
+            for (unsigned index = 0; index < bands; ++index)
+                band(index);
+    }
+
+    return levels;
+}
+
+std::vector<SoftwareTexture> GenerateMipChain(const SoftwareTexture& base, const MipOptions& options, ThreadPool* threadPool)
+{
+    return GenerateMipChain(BestMipIsa(), base, options, threadPool);
+}
+
+#ifndef _WIN32
+
+void RunMipChainBenchmark()
+{
+    struct Size { unsigned width, height; const char* name; };
+    const Size sizes[] = { { 3840, 2160, "4K" }, { 7680, 4320, "8K" } };
+    const MipFilter filters[] = { MipFilter::Box, MipFilter::Kaiser, MipFilter::Lanczos };
+    const double secondsPerRun = 0.5;
+
+    std::vector<unsigned> threadCounts;
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    for (const Size& size : sizes)
+    {
+        //Fine detail plus noise, so every filter tap reads something different
+        SoftwareTexture base;
+        base.width = size.width;
+        base.height = size.height;
+        base.texels.resize(size_t(size.width) * size.height);
+        std::srand(1);
+        for (unsigned y = 0; y < size.height; ++y)
+            for (unsigned x = 0; x < size.width; ++x)
+            {
+                uint32_t r = (x ^ y) & 0xFF;
+                uint32_t g = ((x >> 3) + (y >> 3)) & 1 ? 0xE0 : 0x20;
+                uint32_t b = std::rand() & 0xFF;
+                base.texels[size_t(y) * size.width + x] = r | g << 8 | b << 16 | 0xFF000000u;
+            }
+
+        for (MipFilter filter : filters)
+        {
+            MipOptions options;
+            options.filter = filter;
+            std::vector<SoftwareTexture> reference = GenerateMipChain(MipIsa::Scalar, base, options);
+
+            for (int isa = 0; isa < 2; ++isa)
+            {
+                if (!IsMipIsaSupported(static_cast<MipIsa>(isa)))
+                    continue;
+
+                for (unsigned threads : threadCounts)
+                {
+                    if (static_cast<MipIsa>(isa) != BestMipIsa() && threads > 1)
+                        break;
+
+                    ThreadPool pool(threads);
+                    std::vector<SoftwareTexture> chain;
+                    unsigned runs = 0;
+                    auto start = std::chrono::steady_clock::now();
+                    double elapsed = 0;
+
+                    while (elapsed < secondsPerRun)
+                    {
+                        chain = GenerateMipChain(static_cast<MipIsa>(isa), base, options, &pool);
+                        ++runs;
+                        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    }
+
+                    //FMA and the vector rounding mode can move a channel by one step
+                    int maxDifference = 0;
+                    for (size_t level = 0; level < chain.size(); ++level)
+                        for (size_t i = 0; i < chain[level].texels.size(); ++i)
+                            for (int shift = 0; shift < 32; shift += 8)
+                            {
+                                int a = (chain[level].texels[i] >> shift) & 0xFF;
+                                int b = (reference[level].texels[i] >> shift) & 0xFF;
+                                maxDifference = std::max(maxDifference, std::abs(a - b));
+                            }
+
+                    std::printf("%s %5ux%-5u  %-7s  %-6s  threads %3u  %2zu levels  %9.2f ms/chain  %7.1f Mpixels/s  max diff %d\n",
+                                size.name, size.width, size.height, MipFilterName(filter), MipIsaName(static_cast<MipIsa>(isa)), threads,
+                                chain.size(), elapsed * 1e3 / runs, runs * double(base.texels.size()) / elapsed / 1e6, maxDifference);
+                }
+            }
+        }
+    }
+}
+
+#endif
\ No newline at end of file
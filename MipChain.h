@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "SoftwareTexture.h"
+#include "ThreadPool.h"
+
+//Load-time mipmap generation. Every level is filtered down from the previous one with a separable polyphase filter
+//in linear light, in bands of rows across the thread pool. Sizes follow D3D: max(1, size / 2) per level, down to 1x1.
+//Edges wrap, matching the WRAP sampler the textures are used with.
+
+enum class MipFilter { Box, Kaiser, Lanczos };
+
+const char* MipFilterName(MipFilter filter);
+
+struct MipOptions
+{
+	MipFilter filter = MipFilter::Kaiser;
+	bool sRGB = true;			//Colour channels are sRGB encoded and averaged in linear light, alpha is always linear
+};
+
+enum class MipIsa { Scalar, AVX2 };
+
+const char* MipIsaName(MipIsa isa);
+bool IsMipIsaSupported(MipIsa isa);
+MipIsa BestMipIsa();
+
+//levels[0] is a copy of base, so the result can be uploaded as one full chain
+std::vector<SoftwareTexture> GenerateMipChain(MipIsa isa, const SoftwareTexture& base, const MipOptions& options = MipOptions(), ThreadPool* threadPool = nullptr);
+std::vector<SoftwareTexture> GenerateMipChain(const SoftwareTexture& base, const MipOptions& options = MipOptions(), ThreadPool* threadPool = nullptr);
+
+unsigned MipLevelCount(unsigned width, unsigned height);
+
+#ifndef _WIN32
+void RunMipChainBenchmark();
+#endif
\ No newline at end of file
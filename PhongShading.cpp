@@ -0,0 +1,312 @@
+#include "PhongShading.h"
+#include "CpuFeatures.h"
+#include "SimdLanes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+void SampleBilinearWrap(const SoftwareTexture& texture, float u, float v, float* out)
+{
+    float width = static_cast<float>(texture.width);
+    float height = static_cast<float>(texture.height);
+
+    float x = u * width - 0.5f;
+    float y = v * height - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    //Wrapped in float like the SIMD kernels, so huge uvs cannot overflow an int
+    float x0 = fx - width * std::floor(fx * (1.0f / texture.width));
+    float y0 = fy - height * std::floor(fy * (1.0f / texture.height));
+    if (x0 > width - 0.5f) x0 -= width;
+    if (x0 < 0) x0 += width;
+    if (y0 > height - 0.5f) y0 -= height;
+    if (y0 < 0) y0 += height;
+    float x1 = x0 + 1 > width - 0.5f ? 0 : x0 + 1;
+    float y1 = y0 + 1 > height - 0.5f ? 0 : y0 + 1;
+
+    unsigned ix0 = static_cast<unsigned>(x0), iy0 = static_cast<unsigned>(y0);
+    unsigned ix1 = static_cast<unsigned>(x1), iy1 = static_cast<unsigned>(y1);
+    uint32_t texels[4] =
+    {
+        texture.texels[texture.TexelIndex(ix0, iy0)], texture.texels[texture.TexelIndex(ix1, iy0)],
+        texture.texels[texture.TexelIndex(ix0, iy1)], texture.texels[texture.TexelIndex(ix1, iy1)]
+    };
+    float weights[4] = { (1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty };
+
+    for (int c = 0; c < 4; ++c)
+    {
+        float sum = 0;
+        for (int i = 0; i < 4; ++i)
+            sum += weights[i] * ((texels[i] >> (8 * c)) & 0xFF);
+        out[c] = sum * (1.0f / 255.0f);
+    }
+}
+
+namespace
+{
+    float Dot3(const float* a, const float* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    float Saturate(float x)
+    {
+        return std::min(std::max(x, 0.0f), 1.0f);
+    }
+}
+
+void ShadePixelReference(const float* normal, const float* uv, const float* worldPosition,
+                         const LightMaterialProperties& properties, const SoftwareTexture& texture, float* finalColor)
+{
+    float texColor[4];
+    SampleBilinearWrap(texture, uv[0], uv[1], texColor);
+
+    const float* P = worldPosition;
+    const float* N = normal;
+    const Light& light = properties.light;
+
+    //normalize() runs on the float4 difference before .xyz is taken, as in the shader
+    float L[4], E[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        L[i] = light.position[i] - P[i];
+        E[i] = properties.eyePosition[i] - P[i];
+    }
+    float lLength = std::sqrt(L[0] * L[0] + L[1] * L[1] + L[2] * L[2] + L[3] * L[3]);
+    float eLength = std::sqrt(E[0] * E[0] + E[1] * E[1] + E[2] * E[2] + E[3] * E[3]);
+    for (int i = 0; i < 3; ++i)
+    {
+        L[i] /= lLength;
+        E[i] /= eLength;
+    }
+
+    float NdotL = Dot3(N, L);
+    float R[3];
+    for (int i = 0; i < 3; ++i)
+        R[i] = -L[i] + 2.0f * NdotL * N[i];
+    float rLength = std::sqrt(Dot3(R, R));
+    for (int i = 0; i < 3; ++i)
+        R[i] /= rLength;
+    float D = std::sqrt(Dot3(L, L));
+
+    float ambient = 0.1f;
+
+    if (D > light.range)
+    {
+        for (int i = 0; i < 3; ++i)
+            finalColor[i] = texColor[i] * ambient;
+        finalColor[3] = 1;
+        return;
+    }
+
+    float diffusePower = Saturate(NdotL);
+    float diffuse = diffusePower * 0.8f;
+
+    if (diffusePower > 0.0f)
+        diffuse /= (light.attenuation[0] + light.attenuation[1] * D + light.attenuation[2] * D * D);
+
+    float specIntensity = 1.12f;
+    float specular = std::pow(Saturate(Dot3(R, E) * specIntensity), properties.material.specularPower);
+
+    for (int i = 0; i < 3; ++i)
+        finalColor[i] = texColor[i] * (diffuse + ambient) + specular * light.color[i];
+    finalColor[3] = 1;
+}
+
+uint32_t PackColor(const float* color)
+{
+    uint32_t packed = 0;
+    for (int i = 0; i < 4; ++i)
+        packed |= static_cast<uint32_t>(Saturate(color[i]) * 255.0f + 0.5f) << (8 * i);
+    return packed;
+}
+
+#ifdef SIMD_X86
+
+namespace Sse2
+{
+#include "PhongShadingKernel.inl"
+}
+
+SIMD_BEGIN_TARGET_AVX2
+namespace Avx2
+{
+#include "PhongShadingKernel.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+namespace Avx512
+{
+#include "PhongShadingKernel.inl"
+}
+SIMD_END_TARGET
+
+#endif
+
+const char* ShadingIsaName(ShadingIsa isa)
+{
+    switch (isa)
+    {
+    case ShadingIsa::SSE2: return "SSE2";
+    case ShadingIsa::AVX2: return "AVX2";
+    case ShadingIsa::AVX512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+bool IsShadingIsaSupported(ShadingIsa isa)
+{
+    const CpuFeatures& features = GetCpuFeatures();
+
+    switch (isa)
+    {
+    case ShadingIsa::SSE2: return features.sse2;
+    case ShadingIsa::AVX2: return features.avx2;
+    case ShadingIsa::AVX512: return features.avx512;
+    default: return true;
+    }
+}
+
+ShadingIsa BestShadingIsa()
+{
+    static const ShadingIsa best = IsShadingIsaSupported(ShadingIsa::AVX512) ? ShadingIsa::AVX512 :
+                                   IsShadingIsaSupported(ShadingIsa::AVX2) ? ShadingIsa::AVX2 :
+                                   IsShadingIsaSupported(ShadingIsa::SSE2) ? ShadingIsa::SSE2 : ShadingIsa::Scalar;
+    return best;
+}
+
+void ShadeFragments(ShadingIsa isa, const FragmentBlock& block, unsigned count, const LightMaterialProperties& properties,
+                    const SoftwareTexture& texture, uint32_t* colors)
+{
+    if (count == 0)
+        return;
+
+    if (isa == ShadingIsa::Scalar)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            float normal[3] = { block.normal[0][i], block.normal[1][i], block.normal[2][i] };
+            float uv[2] = { block.uv[0][i], block.uv[1][i] };
+            float worldPosition[4] = { block.worldPosition[0][i], block.worldPosition[1][i], block.worldPosition[2][i], block.worldPosition[3][i] };
+            float color[4];
+            ShadePixelReference(normal, uv, worldPosition, properties, texture, color);
+            colors[i] = PackColor(color);
+        }
+        return;
+    }
+
+#ifdef SIMD_X86
+    //Kernels always shade full blocks, so unused lanes repeat the first fragment and nothing is read out of bounds
+    const FragmentBlock* input = &block;
+    FragmentBlock padded;
+    if (count < FragmentBlock::SIZE)
+    {
+        padded = block;
+        for (unsigned i = count; i < FragmentBlock::SIZE; ++i)
+        {
+            for (int k = 0; k < 3; ++k) padded.normal[k][i] = block.normal[k][0];
+            for (int k = 0; k < 2; ++k) padded.uv[k][i] = block.uv[k][0];
+            for (int k = 0; k < 4; ++k) padded.worldPosition[k][i] = block.worldPosition[k][0];
+        }
+        input = &padded;
+    }
+
+    uint32_t blockColors[FragmentBlock::SIZE];
+    uint32_t* output = count == FragmentBlock::SIZE ? colors : blockColors;
+
+    switch (isa)
+    {
+    case ShadingIsa::AVX512: Avx512::ShadeBlock(*input, properties, texture, output); break;
+    case ShadingIsa::AVX2: Avx2::ShadeBlock(*input, properties, texture, output); break;
+    default: Sse2::ShadeBlock(*input, properties, texture, output); break;
+    }
+
+    if (output != colors)
+        std::memcpy(colors, blockColors, count * sizeof(uint32_t));
+#endif
+}
+
+void ShadeFragments(const FragmentBlock& block, unsigned count, const LightMaterialProperties& properties,
+                    const SoftwareTexture& texture, uint32_t* colors)
+{
+    ShadeFragments(BestShadingIsa(), block, count, properties, texture, colors);
+}
+
+void RunShadingBenchmark()
+{
+    const unsigned BLOCK_COUNT = 4096;
+    const double secondsPerRun = 0.5;
+
+    SoftwareTexture checker;
+    checker.width = checker.height = 256;
+    checker.texels.resize(256 * 256);
+    for (unsigned y = 0; y < 256; ++y)
+        for (unsigned x = 0; x < 256; ++x)
+            checker.texels[y * 256 + x] = ((x / 32 + y / 32) % 2) ? 0xFFFFFFFF : 0xFF404040;
+
+    //Fragments spread over the rotating quad, some of them turned away from the light
+    std::vector<FragmentBlock> blocks(BLOCK_COUNT);
+    std::srand(1);
+    auto random = [](float low, float high) { return low + (high - low) * (std::rand() / static_cast<float>(RAND_MAX)); };
+    for (FragmentBlock& block : blocks)
+    {
+        for (unsigned i = 0; i < FragmentBlock::SIZE; ++i)
+        {
+            float angle = random(-1.5f, 1.5f);
+            block.normal[0][i] = std::sin(angle);
+            block.normal[1][i] = 0;
+            block.normal[2][i] = -std::cos(angle);
+            block.uv[0][i] = random(-0.5f, 1.5f);
+            block.uv[1][i] = random(-0.5f, 1.5f);
+            block.worldPosition[0][i] = random(-0.5f, 0.5f);
+            block.worldPosition[1][i] = random(-0.5f, 0.5f);
+            block.worldPosition[2][i] = random(-0.5f, 0.5f);
+            block.worldPosition[3][i] = 0;
+        }
+    }
+
+    LightMaterialProperties properties = DefaultLightMaterialProperties();
+    std::vector<uint32_t> reference(BLOCK_COUNT * FragmentBlock::SIZE);
+    std::vector<uint32_t> colors(BLOCK_COUNT * FragmentBlock::SIZE);
+
+    for (unsigned b = 0; b < BLOCK_COUNT; ++b)
+        ShadeFragments(ShadingIsa::Scalar, blocks[b], FragmentBlock::SIZE, properties, checker, &reference[b * FragmentBlock::SIZE]);
+
+    const ShadingIsa isas[] = { ShadingIsa::Scalar, ShadingIsa::SSE2, ShadingIsa::AVX2, ShadingIsa::AVX512 };
+    for (ShadingIsa isa : isas)
+    {
+        if (!IsShadingIsaSupported(isa))
+        {
+            std::printf("%-8s  not supported\n", ShadingIsaName(isa));
+            continue;
+        }
+
+        unsigned passes = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while (elapsed < secondsPerRun)
+        {
+            for (unsigned b = 0; b < BLOCK_COUNT; ++b)
+                ShadeFragments(isa, blocks[b], FragmentBlock::SIZE, properties, checker, &colors[b * FragmentBlock::SIZE]);
+            ++passes;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        int maxError = 0;
+        for (size_t i = 0; i < colors.size(); ++i)
+            for (int c = 0; c < 32; c += 8)
+                maxError = std::max(maxError, std::abs(static_cast<int>((colors[i] >> c) & 0xFF) - static_cast<int>((reference[i] >> c) & 0xFF)));
+
+        double pixelsPerSecond = static_cast<double>(passes) * colors.size() / elapsed;
+        std::printf("%-8s  %8.1f Mpixels/s per core  max error vs scalar %d/255\n", ShadingIsaName(isa), pixelsPerSecond / 1e6, maxError);
+    }
+}
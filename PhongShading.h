@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "PipelineData.h"
+#include "SoftwareTexture.h"
+
+//PixelShader.hlsl on the CPU: a scalar reference and SIMD kernels that shade a block of fragments per call
+
+struct FragmentBlock		//Pixel shader inputs in SoA form
+{
+	static const unsigned SIZE = 16;
+
+	alignas(64) float normal[3][SIZE];
+	alignas(64) float uv[2][SIZE];
+	alignas(64) float worldPosition[4][SIZE];
+};
+
+enum class ShadingIsa { Scalar, SSE2, AVX2, AVX512 };
+
+const char* ShadingIsaName(ShadingIsa isa);
+bool IsShadingIsaSupported(ShadingIsa isa);
+ShadingIsa BestShadingIsa();
+
+//Bilinear sample with wrap addressing as the pixel shader's sampler does it, in any TexelLayout
+void SampleBilinearWrap(const SoftwareTexture& texture, float u, float v, float* color);
+
+//Scalar reference, follows PixelShader.hlsl line by line
+void ShadePixelReference(const float* normal, const float* uv, const float* worldPosition,
+						 const LightMaterialProperties& properties, const SoftwareTexture& texture, float* finalColor);
+
+uint32_t PackColor(const float* color);		//Saturated RGBA8
+
+//Shades the first count fragments of the block and writes packed RGBA8 colors
+void ShadeFragments(const FragmentBlock& block, unsigned count, const LightMaterialProperties& properties,
+					const SoftwareTexture& texture, uint32_t* colors);
+void ShadeFragments(ShadingIsa isa, const FragmentBlock& block, unsigned count, const LightMaterialProperties& properties,
+					const SoftwareTexture& texture, uint32_t* colors);
+
+void RunShadingBenchmark();
@@ -0,0 +1,138 @@
+//PixelShader.hlsl for WIDTH fragments at a time. Included once per instruction set by PhongShading.cpp,
+//inside the namespaces of SimdLanes.h that provide Float, Int, Mask, WIDTH and the operations used below.
+
+template<int SHIFT>
+inline Float Channel(Int texels)
+{
+    return IntToFloat(ShiftRight<SHIFT>(texels) & IntBroadcast(0xFF));
+}
+
+inline Int MortonBits(Int v)        //SoftwareTexture::MortonBits per lane
+{
+    v = (v | ShiftLeft<4>(v)) & IntBroadcast(0x0F0F);
+    v = (v | ShiftLeft<2>(v)) & IntBroadcast(0x3333);
+    return (v | ShiftLeft<1>(v)) & IntBroadcast(0x5555);
+}
+
+//SoftwareTexture::TexelIndex for wrapped texel coordinates. Products go through float, SSE2 has no 32-bit multiply;
+//indices and block numbers stay below 2^24, so the float math is exact.
+inline Int TexelIndex(const SoftwareTexture& texture, Float x, Float y)
+{
+    switch (texture.layout)
+    {
+    case TexelLayout::Tiled4x4:
+    {
+        Int ix = FloatToInt(x), iy = FloatToInt(y);
+        Float tilesWide = Broadcast(static_cast<float>((texture.width + 3) >> 2));
+        Int tile = FloatToInt(IntToFloat(ShiftRight<2>(iy)) * tilesWide + IntToFloat(ShiftRight<2>(ix)));
+        return ShiftLeft<4>(tile) | ShiftLeft<2>(iy & IntBroadcast(3)) | (ix & IntBroadcast(3));
+    }
+    case TexelLayout::Morton:
+    {
+        Int ix = FloatToInt(x), iy = FloatToInt(y);
+        Float blocksWide = Broadcast(static_cast<float>((texture.width + 31) >> 5));
+        Int block = FloatToInt(IntToFloat(ShiftRight<5>(iy)) * blocksWide + IntToFloat(ShiftRight<5>(ix)));
+        return ShiftLeft<10>(block) | MortonBits(ix & IntBroadcast(31)) | ShiftLeft<1>(MortonBits(iy & IntBroadcast(31)));
+    }
+    default:
+        return FloatToInt(y * Broadcast(static_cast<float>(texture.width)) + x);
+    }
+}
+
+inline void SampleBilinearWrap(const SoftwareTexture& texture, Float u, Float v, Float* color)
+{
+    Float width = Broadcast(static_cast<float>(texture.width));
+    Float height = Broadcast(static_cast<float>(texture.height));
+
+    Float x = u * width - Broadcast(0.5f);
+    Float y = v * height - Broadcast(0.5f);
+    Float fx = Floor(x);
+    Float fy = Floor(y);
+    Float tx = x - fx;
+    Float ty = y - fy;
+
+    Float x0 = WrapCoordinate(fx, width, Broadcast(1.0f / texture.width));
+    Float y0 = WrapCoordinate(fy, height, Broadcast(1.0f / texture.height));
+    Float x1 = x0 + Broadcast(1.0f);
+    Float y1 = y0 + Broadcast(1.0f);
+    x1 = Select(x1 > width - Broadcast(0.5f), Broadcast(0.0f), x1);
+    y1 = Select(y1 > height - Broadcast(0.5f), Broadcast(0.0f), y1);
+
+    Int texels[4] =
+    {
+        Gather(texture.texels.data(), TexelIndex(texture, x0, y0)),
+        Gather(texture.texels.data(), TexelIndex(texture, x1, y0)),
+        Gather(texture.texels.data(), TexelIndex(texture, x0, y1)),
+        Gather(texture.texels.data(), TexelIndex(texture, x1, y1))
+    };
+
+    Float one = Broadcast(1.0f);
+    Float weights[4] = { (one - tx) * (one - ty), tx * (one - ty), (one - tx) * ty, tx * ty };
+    Float scale = Broadcast(1.0f / 255.0f);
+
+    color[0] = (weights[0] * Channel<0>(texels[0]) + weights[1] * Channel<0>(texels[1]) + weights[2] * Channel<0>(texels[2]) + weights[3] * Channel<0>(texels[3])) * scale;
+    color[1] = (weights[0] * Channel<8>(texels[0]) + weights[1] * Channel<8>(texels[1]) + weights[2] * Channel<8>(texels[2]) + weights[3] * Channel<8>(texels[3])) * scale;
+    color[2] = (weights[0] * Channel<16>(texels[0]) + weights[1] * Channel<16>(texels[1]) + weights[2] * Channel<16>(texels[2]) + weights[3] * Channel<16>(texels[3])) * scale;
+}
+
+inline Int PackChannel(Float channel)
+{
+    return FloatToInt(Saturate(channel) * Broadcast(255.0f) + Broadcast(0.5f));
+}
+
+void ShadeBlock(const FragmentBlock& block, const LightMaterialProperties& properties, const SoftwareTexture& texture, uint32_t* colors)
+{
+    const Light& light = properties.light;
+
+    for (unsigned i = 0; i < FragmentBlock::SIZE; i += WIDTH)
+    {
+        Float texColor[3];
+        SampleBilinearWrap(texture, Load(&block.uv[0][i]), Load(&block.uv[1][i]), texColor);
+
+        Float N[3] = { Load(&block.normal[0][i]), Load(&block.normal[1][i]), Load(&block.normal[2][i]) };
+
+        //normalize() runs on the float4 difference before .xyz is taken, as in the shader
+        Float L[4], E[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            Float P = Load(&block.worldPosition[k][i]);
+            L[k] = Broadcast(light.position[k]) - P;
+            E[k] = Broadcast(properties.eyePosition[k]) - P;
+        }
+        Float invLengthL = RcpSqrt(L[0] * L[0] + L[1] * L[1] + L[2] * L[2] + L[3] * L[3]);
+        Float invLengthE = RcpSqrt(E[0] * E[0] + E[1] * E[1] + E[2] * E[2] + E[3] * E[3]);
+        for (int k = 0; k < 3; ++k)
+        {
+            L[k] = L[k] * invLengthL;
+            E[k] = E[k] * invLengthE;
+        }
+
+        Float NdotL = N[0] * L[0] + N[1] * L[1] + N[2] * L[2];
+        Float twoNdotL = NdotL + NdotL;
+        Float R[3];
+        for (int k = 0; k < 3; ++k)
+            R[k] = twoNdotL * N[k] - L[k];
+        Float invLengthR = RcpSqrt(R[0] * R[0] + R[1] * R[1] + R[2] * R[2]);
+        Float D = Sqrt(L[0] * L[0] + L[1] * L[1] + L[2] * L[2]);
+
+        Float ambient = Broadcast(0.1f);
+
+        Float diffusePower = Saturate(NdotL);
+        Float diffuse = diffusePower * Broadcast(0.8f);
+        Float attenuation = Broadcast(light.attenuation[0]) + Broadcast(light.attenuation[1]) * D + Broadcast(light.attenuation[2]) * D * D;
+        diffuse = Select(diffusePower > Broadcast(0.0f), diffuse / attenuation, diffuse);
+
+        Float RdotE = (R[0] * E[0] + R[1] * E[1] + R[2] * E[2]) * invLengthR;
+        Float specular = Exp2(Broadcast(properties.material.specularPower) * Log2(Saturate(RdotE * Broadcast(1.12f))));
+
+        //Range early-out becomes a select between the ambient and the lit color
+        Mask outOfRange = D > Broadcast(light.range);
+        Int packed = IntBroadcast(static_cast<int>(0xFF000000));
+        Float lit[3];
+        for (int k = 0; k < 3; ++k)
+            lit[k] = Select(outOfRange, texColor[k] * ambient, texColor[k] * (diffuse + ambient) + specular * Broadcast(light.color[k]));
+
+        packed = packed | PackChannel(lit[0]) | ShiftLeft<8>(PackChannel(lit[1])) | ShiftLeft<16>(PackChannel(lit[2]));
+        Store(colors + i, packed);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+
+//CPU-side layouts of the data the shaders consume, shared by the D3D11 pipeline and the software renderer
+
+struct VertexData
+{
+	float pos[3];
+	float nor[3];
+	float uv[2];
+
+	VertexData() = default;
+
+	VertexData(const std::array<float, 3>& position, const std::array<float, 3>& normal, const std::array<float, 2>& uvCoords)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			pos[i] = position[i];
+			nor[i] = normal[i];
+
+		}
+
+		uv[0] = uvCoords[0];
+		uv[1] = uvCoords[1];
+	}
+};
+
+struct ConstantBuffer			//cbuffer CBuf in VertexShader.hlsl, matrices stored transposed
+{
+	float worldViewPerspective[4][4];
+	float world[4][4];
+};
+
+struct InstanceData				//Per-instance input of InstancedVertexShader.hlsl, world matrix columns 0-2
+{
+	float worldColumns[3][4];		//Column 3 of an affine world matrix is always (0, 0, 0, 1)
+	float uvRect[4];				//Offset u, offset v, scale u, scale v of the instance's image in a texture atlas
+};
+
+struct InstancedConstantBuffer	//cbuffer CBuf in InstancedVertexShader.hlsl, stored transposed
+{
+	float viewPerspective[4][4];
+};
+
+struct Material
+{
+	float specularPower;
+	float padding[3];
+};
+
+struct Light
+{
+	float position[4];
+	float color[4];
+	float attenuation[3];
+	float range;
+};
+
+struct LightMaterialProperties	//cbuffer LightMaterialProperties in PixelShader.hlsl
+{
+	Material material;
+	Light light;
+	float eyePosition[4];
+};
+
+//The quad drawn as a triangle strip with Draw(4, 0)
+inline std::array<VertexData, 4> QuadVertices()
+{
+	return
+	{ {
+		{ {-0.5f, -0.5f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 1.0f}},
+		{ {-0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 0.0f}},
+		{ {0.5, -0.5f, 0.0f} , {0.0f, 0.0f, -1.0f}, {1.0f, 1.0f}},
+
+		{ {0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, -1.0f}, {1.0f, 0.0f}}
+	} };
+}
+
+inline LightMaterialProperties DefaultLightMaterialProperties()
+{
+	return
+	{
+		//Material
+		{
+			150.0f,                     //Specular power
+			{0,0,0}                     //Padding
+		},
+
+		//Light
+		{
+			{0.0f, 0.0f, -2.0f, 1.0f},  //Position
+			{1.0f, 1.0f, 1.0f, 1.0f},   //Color
+			{1.0f, 2/3, 1/9},           //Attenuation
+			3.0f                        //Range
+		},
+
+		{0.0f, 0.0f, -2.0f, 1.0f}       //Eye position
+	};
+}
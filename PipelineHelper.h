@@ -1,36 +1,26 @@
 #pragma once
 
-#include <DirectXMath.h>
 #include <d3d11.h>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <array>
 
-struct VertexData 
-{
-	float pos[3];
-	float nor[3];
-	float uv[2];
+#include "Camera.h"
+#include "ConstantBufferRing.h"
+#include "InstancedQuads.h"
+#include "PipelineData.h"
+#include "StateCache.h"
 
-	VertexData(const std::array<float, 3>& position, const std::array<float, 3>& normal, const std::array<float, 2>& uvCoords) 
-	{
-		for (int i = 0; i < 3; ++i) 
-		{
-			pos[i] = position[i];
-			nor[i] = normal[i];
-			
-		}
+ConstantBufferAllocation UpdateConstantbuffer(ConstantBufferRing& cBufferRing, Camera& camera, float angle);
+ConstantBufferAllocation UpdateInstancedConstantbuffer(ConstantBufferRing& cBufferRing, Camera& camera);
 
-		uv[0] = uvCoords[0];
-		uv[1] = uvCoords[1];
-	}
-};
+void BindResourcesToPipeline(StateCache& stateCache, D3D11_VIEWPORT& viewPort, ID3D11PixelShader* pShader, ID3D11VertexShader* vShader, ID3D11InputLayout* inputLayout, ID3D11ShaderResourceView* srv, ID3D11SamplerState* sampler, ID3D11Buffer* vBuffer, ID3D11Buffer* lBuffer);
 
-void UpdateConstantbuffer(ID3D11Buffer* cBuffer, ID3D11DeviceContext* context, float angle);
+bool SetupPipeline(ID3D11Device* device, ID3D11DeviceContext1* context, ID3D11Buffer*& vBuffer, ID3D11VertexShader*& vShader,
+	ID3D11PixelShader*& pShader, ID3D11InputLayout*& inputLayout, ConstantBufferRing& cBufferRing,
+	ID3D11SamplerState*& sampler, ID3D11Buffer*& lBuffer);
 
-void BindResourcesToPipeline(ID3D11DeviceContext* context, D3D11_VIEWPORT& viewPort, ID3D11PixelShader* pShader, ID3D11VertexShader* vShader, ID3D11InputLayout* inputLayout, ID3D11ShaderResourceView* srv, ID3D11SamplerState* sampler, ID3D11Buffer* vBuffer, ID3D11Buffer* lBuffer);
-
-bool SetupPipeline(ID3D11Device* device, ID3D11Buffer*& vBuffer, ID3D11VertexShader*& vShader,
-	ID3D11PixelShader*& pShader, ID3D11InputLayout*& inputLayout, ID3D11Buffer*& cBuffer, ID3D11Texture2D*& texture,
-	ID3D11ShaderResourceView*& srv, ID3D11SamplerState*& sampler, ID3D11Buffer*& lBuffer);
\ No newline at end of file
+//InstancedVertexShader.cso, its input layout (quad in slot 0, InstanceData in slot 1) and a dynamic instance buffer
+bool SetupInstancing(ID3D11Device* device, UINT maxInstances, ID3D11VertexShader*& vShader, ID3D11InputLayout*& inputLayout,
+	ID3D11Buffer*& instanceBuffer);
\ No newline at end of file
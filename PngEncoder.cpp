@@ -0,0 +1,525 @@
+#include "PngEncoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+namespace
+{
+    const unsigned WINDOW = 32768;
+    const unsigned HASH_BITS = 15;
+    const unsigned MIN_MATCH = 3;
+    const unsigned MAX_MATCH = 258;
+    const unsigned MAX_CHAIN = 32;          //Candidates tried per position
+    const unsigned NICE_MATCH = 128;        //Long enough to stop looking
+    const size_t BLOCK_TOKENS = 1 << 16;    //Literals and matches per deflate block, each with its own Huffman codes
+    const unsigned MAX_CODE_LENGTH = 15;
+    const unsigned MAX_CODE_LENGTH_CODE_LENGTH = 7;
+    const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+                                         4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    //Deflate packs bits from the least significant end; Huffman codes go in most significant bit first
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& output) : output(output) {}
+
+        void Put(uint32_t bits, unsigned count)
+        {
+            buffer |= static_cast<uint64_t>(bits) << used;
+            used += count;
+            while (used >= 8)
+            {
+                output.push_back(static_cast<uint8_t>(buffer));
+                buffer >>= 8;
+                used -= 8;
+            }
+        }
+
+        void PutCode(uint32_t code, unsigned length)
+        {
+            uint32_t reversed = 0;
+            for (unsigned i = 0; i < length; ++i)
+                reversed |= ((code >> i) & 1) << (length - 1 - i);
+            Put(reversed, length);
+        }
+
+        void Flush()
+        {
+            if (used > 0)
+                output.push_back(static_cast<uint8_t>(buffer));
+            buffer = 0;
+            used = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& output;
+        uint64_t buffer = 0;
+        unsigned used = 0;
+    };
+
+    unsigned LengthCode(unsigned length)
+    {
+        unsigned code = 28;
+        while (LENGTH_BASE[code] > length)
+            --code;
+        return code;
+    }
+
+    unsigned DistanceCode(unsigned distance)
+    {
+        unsigned code = 29;
+        while (DISTANCE_BASE[code] > distance)
+            --code;
+        return code;
+    }
+
+    //Huffman code lengths for the counts, those over maxLength moved up the tree as in JPEG Annex K.3
+    void BuildCodeLengths(const uint32_t* frequencies, unsigned count, unsigned maxLength, uint8_t* lengths)
+    {
+        std::fill(lengths, lengths + count, 0);
+
+        //Leaves are the symbols, internal nodes are numbered from count up, so parents come after their children
+        typedef std::pair<uint64_t, unsigned> Node;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        for (unsigned i = 0; i < count; ++i)
+            if (frequencies[i] > 0)
+                queue.push(Node(frequencies[i], i));
+        if (queue.empty())
+            return;
+        if (queue.size() == 1)
+        {
+            //Two one-bit codes, since zlib rejects a lone code in some of the tables
+            lengths[queue.top().second] = 1;
+            lengths[queue.top().second == 0 ? 1 : 0] = 1;
+            return;
+        }
+
+        std::vector<unsigned> parents(count * 2, 0);
+        unsigned next = count;
+        while (queue.size() > 1)
+        {
+            Node a = queue.top();
+            queue.pop();
+            Node b = queue.top();
+            queue.pop();
+            parents[a.second] = parents[b.second] = next;
+            queue.push(Node(a.first + b.first, next++));
+        }
+
+        std::vector<unsigned> depths(next, 0);
+        for (unsigned node = next - 1; node-- > count;)
+            depths[node] = depths[parents[node]] + 1;
+        std::vector<unsigned> symbols;
+        unsigned bits[2 * 288] = {};
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (frequencies[i] == 0)
+                continue;
+            depths[i] = depths[parents[i]] + 1;
+            ++bits[depths[i]];
+            symbols.push_back(i);
+        }
+
+        for (unsigned i = count * 2 - 1; i > maxLength; --i)
+        {
+            while (bits[i] > 0)
+            {
+                unsigned j = i - 2;
+                while (bits[j] == 0)
+                    --j;
+                bits[i] -= 2;
+                ++bits[i - 1];
+                bits[j + 1] += 2;
+                --bits[j];
+            }
+        }
+
+        //Most frequent first, as they sat highest in the tree
+        std::stable_sort(symbols.begin(), symbols.end(), [&](unsigned a, unsigned b) { return depths[a] < depths[b]; });
+        size_t nextSymbol = 0;
+        for (unsigned length = 1; length <= maxLength; ++length)
+            for (unsigned i = 0; i < bits[length]; ++i)
+                lengths[symbols[nextSymbol++]] = static_cast<uint8_t>(length);
+    }
+
+    //Canonical codes, RFC 1951 3.2.2
+    void BuildCodes(const uint8_t* lengths, unsigned count, uint16_t* codes)
+    {
+        unsigned lengthCounts[MAX_CODE_LENGTH + 1] = {};
+        for (unsigned i = 0; i < count; ++i)
+            ++lengthCounts[lengths[i]];
+        lengthCounts[0] = 0;
+
+        unsigned nextCode[MAX_CODE_LENGTH + 1] = {};
+        unsigned code = 0;
+        for (unsigned length = 1; length <= MAX_CODE_LENGTH; ++length)
+        {
+            code = (code + lengthCounts[length - 1]) << 1;
+            nextCode[length] = code;
+        }
+        for (unsigned i = 0; i < count; ++i)
+            if (lengths[i] > 0)
+                codes[i] = static_cast<uint16_t>(nextCode[lengths[i]]++);
+    }
+
+    //Tokens are literals, or length << 16 | distance for matches
+    void PutDynamicBlock(BitWriter& writer, const uint32_t* tokens, size_t count, bool final)
+    {
+        uint32_t literalFrequencies[286] = {};
+        uint32_t distanceFrequencies[30] = {};
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (tokens[i] >> 16)
+            {
+                ++literalFrequencies[257 + LengthCode(tokens[i] >> 16)];
+                ++distanceFrequencies[DistanceCode(tokens[i] & 0xFFFF)];
+            }
+            else
+                ++literalFrequencies[tokens[i]];
+        }
+        literalFrequencies[256] = 1;                //End of block
+
+        uint8_t lengths[286 + 30];
+        uint8_t* distanceLengths = lengths + 286;
+        BuildCodeLengths(literalFrequencies, 286, MAX_CODE_LENGTH, lengths);
+        BuildCodeLengths(distanceFrequencies, 30, MAX_CODE_LENGTH, distanceLengths);
+        if (std::count(distanceLengths, distanceLengths + 30, 0) == 30)
+            distanceLengths[0] = 1;                 //One unused code, as zlib writes for blocks without matches
+
+        unsigned literalCount = 286;
+        while (lengths[literalCount - 1] == 0)
+            --literalCount;
+        unsigned distanceCount = 30;
+        while (distanceLengths[distanceCount - 1] == 0)
+            --distanceCount;
+
+        //Both length lists as one sequence, run-length coded: 16 repeats the previous length 3 - 6 times, 17 and 18
+        //write 3 - 10 and 11 - 138 zeros
+        std::vector<uint8_t> sequence(lengths, lengths + literalCount);
+        sequence.insert(sequence.end(), distanceLengths, distanceLengths + distanceCount);
+        std::vector<uint16_t> runs;                 //Symbol | extra bits value << 5
+        uint32_t codeLengthFrequencies[19] = {};
+        for (size_t i = 0; i < sequence.size();)
+        {
+            uint8_t length = sequence[i];
+            size_t run = 1;
+            while (i + run < sequence.size() && sequence[i + run] == length)
+                ++run;
+            i += run;
+
+            if (length == 0)
+            {
+                for (; run >= 11; run -= std::min<size_t>(run, 138))
+                    runs.push_back(static_cast<uint16_t>(18 | (std::min<size_t>(run, 138) - 11) << 5));
+                if (run >= 3)
+                {
+                    runs.push_back(static_cast<uint16_t>(17 | (run - 3) << 5));
+                    run = 0;
+                }
+            }
+            else
+            {
+                runs.push_back(length);
+                for (--run; run >= 3; run -= std::min<size_t>(run, 6))
+                    runs.push_back(static_cast<uint16_t>(16 | (std::min<size_t>(run, 6) - 3) << 5));
+            }
+            for (; run > 0; --run)
+                runs.push_back(length);
+        }
+        for (uint16_t run : runs)
+            ++codeLengthFrequencies[run & 31];
+
+        uint8_t codeLengthLengths[19];
+        uint16_t codeLengthCodes[19] = {};
+        BuildCodeLengths(codeLengthFrequencies, 19, MAX_CODE_LENGTH_CODE_LENGTH, codeLengthLengths);
+        BuildCodes(codeLengthLengths, 19, codeLengthCodes);
+        unsigned codeLengthCount = 19;
+        while (codeLengthCount > 4 && codeLengthLengths[CODE_LENGTH_ORDER[codeLengthCount - 1]] == 0)
+            --codeLengthCount;
+
+        uint16_t literalCodes[286] = {};
+        uint16_t distanceCodes[30] = {};
+        BuildCodes(lengths, 286, literalCodes);
+        BuildCodes(distanceLengths, 30, distanceCodes);
+
+        writer.Put(final ? 1 : 0, 1);
+        writer.Put(2, 2);                           //Dynamic Huffman codes
+        writer.Put(literalCount - 257, 5);
+        writer.Put(distanceCount - 1, 5);
+        writer.Put(codeLengthCount - 4, 4);
+        for (unsigned i = 0; i < codeLengthCount; ++i)
+            writer.Put(codeLengthLengths[CODE_LENGTH_ORDER[i]], 3);
+        static const unsigned RUN_EXTRA[3] = { 2, 3, 7 };
+        for (uint16_t run : runs)
+        {
+            unsigned symbol = run & 31;
+            writer.PutCode(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+            if (symbol >= 16)
+                writer.Put(run >> 5, RUN_EXTRA[symbol - 16]);
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t token = tokens[i];
+            if (token >> 16)
+            {
+                unsigned length = token >> 16;
+                unsigned distance = token & 0xFFFF;
+                unsigned lengthCode = LengthCode(length);
+                writer.PutCode(literalCodes[257 + lengthCode], lengths[257 + lengthCode]);
+                writer.Put(length - LENGTH_BASE[lengthCode], LENGTH_EXTRA[lengthCode]);
+                unsigned distanceCode = DistanceCode(distance);
+                writer.PutCode(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+                writer.Put(distance - DISTANCE_BASE[distanceCode], DISTANCE_EXTRA[distanceCode]);
+            }
+            else
+                writer.PutCode(literalCodes[token], lengths[token]);
+        }
+        writer.PutCode(literalCodes[256], lengths[256]);
+    }
+
+    uint32_t Hash3(const uint8_t* bytes)
+    {
+        return ((bytes[0] << 10) ^ (bytes[1] << 5) ^ bytes[2]) & ((1u << HASH_BITS) - 1);
+    }
+
+    uint32_t Adler32(const uint8_t* data, size_t size)
+    {
+        uint32_t a = 1;
+        uint32_t b = 0;
+        while (size > 0)
+        {
+            size_t run = size < 5552 ? size : 5552;         //Longest run before b can overflow 32 bits
+            for (size_t i = 0; i < run; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += run;
+            size -= run;
+        }
+        return b << 16 | a;
+    }
+
+    uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+    {
+        static const struct Table
+        {
+            uint32_t entries[256];
+            Table()
+            {
+                for (uint32_t n = 0; n < 256; ++n)
+                {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; ++k)
+                        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    entries[n] = c;
+                }
+            }
+        } table;
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    void PutBigEndian(std::vector<uint8_t>& output, uint32_t value)
+    {
+        output.push_back(static_cast<uint8_t>(value >> 24));
+        output.push_back(static_cast<uint8_t>(value >> 16));
+        output.push_back(static_cast<uint8_t>(value >> 8));
+        output.push_back(static_cast<uint8_t>(value));
+    }
+
+    void PutChunk(std::vector<uint8_t>& output, const char* type, const uint8_t* data, size_t size)
+    {
+        PutBigEndian(output, static_cast<uint32_t>(size));
+        size_t start = output.size();
+        output.insert(output.end(), type, type + 4);
+        output.insert(output.end(), data, data + size);
+        PutBigEndian(output, Crc32(&output[start], size + 4));
+    }
+
+    uint8_t Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return static_cast<uint8_t>(a);
+        return static_cast<uint8_t>(pb <= pc ? b : c);
+    }
+}
+
+std::vector<uint8_t> DeflateZlib(const uint8_t* data, size_t size)
+{
+    std::vector<uint8_t> output;
+    output.reserve(size / 2 + 64);
+    output.push_back(0x78);         //32 KB window, deflate
+    output.push_back(0x01);         //Fastest compression level, header check bits
+
+    BitWriter writer(output);
+    std::vector<uint32_t> tokens;
+    tokens.reserve(BLOCK_TOKENS);
+
+    std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+    std::vector<int32_t> previous(WINDOW, -1);
+    auto insert = [&](size_t position)
+    {
+        uint32_t hash = Hash3(data + position);
+        previous[position % WINDOW] = head[hash];
+        head[hash] = static_cast<int32_t>(position);
+    };
+
+    size_t position = 0;
+    while (position < size)
+    {
+        unsigned bestLength = 0;
+        unsigned bestDistance = 0;
+        if (position + MIN_MATCH <= size)
+        {
+            unsigned limit = static_cast<unsigned>(size - position < MAX_MATCH ? size - position : MAX_MATCH);
+            int32_t candidate = head[Hash3(data + position)];
+            for (unsigned chain = 0; chain < MAX_CHAIN && candidate >= 0 && position - candidate <= WINDOW; ++chain)
+            {
+                const uint8_t* a = data + candidate;
+                const uint8_t* b = data + position;
+                if (a[bestLength] == b[bestLength])
+                {
+                    unsigned length = 0;
+                    while (length < limit && a[length] == b[length])
+                        ++length;
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = static_cast<unsigned>(position - candidate);
+                        if (length >= NICE_MATCH || length == limit)
+                            break;
+                    }
+                }
+                candidate = previous[candidate % WINDOW];
+            }
+            insert(position);
+        }
+
+        if (bestLength >= MIN_MATCH)
+        {
+            tokens.push_back(bestLength << 16 | bestDistance);
+            for (size_t i = position + 1; i < position + bestLength && i + MIN_MATCH <= size; ++i)
+                insert(i);
+            position += bestLength;
+        }
+        else
+        {
+            tokens.push_back(data[position]);
+            ++position;
+        }
+
+        if (tokens.size() == BLOCK_TOKENS)
+        {
+            PutDynamicBlock(writer, tokens.data(), tokens.size(), position == size);
+            tokens.clear();
+        }
+    }
+    if (!tokens.empty() || size == 0)
+        PutDynamicBlock(writer, tokens.data(), tokens.size(), true);
+    writer.Flush();
+
+    PutBigEndian(output, Adler32(data, size));
+    return output;
+}
+
+std::vector<uint8_t> FilterPngRows(const uint8_t* pixels, size_t rowBytes, unsigned height, unsigned bytesPerPixel, int filter)
+{
+    const size_t bpp = bytesPerPixel;
+
+    //Filter byte, then the filtered row, for every row
+    std::vector<uint8_t> filtered((rowBytes + 1) * height);
+    std::vector<uint8_t> candidates[5];
+    for (std::vector<uint8_t>& candidate : candidates)
+        candidate.resize(rowBytes);
+    std::vector<uint8_t> zeroRow(rowBytes, 0);
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const uint8_t* row = &pixels[y * rowBytes];
+        const uint8_t* above = y > 0 ? row - rowBytes : zeroRow.data();
+        for (size_t i = 0; i < rowBytes; ++i)
+        {
+            int left = i >= bpp ? row[i - bpp] : 0;
+            int upperLeft = i >= bpp ? above[i - bpp] : 0;
+            candidates[0][i] = row[i];
+            candidates[1][i] = static_cast<uint8_t>(row[i] - left);
+            candidates[2][i] = static_cast<uint8_t>(row[i] - above[i]);
+            candidates[3][i] = static_cast<uint8_t>(row[i] - ((left + above[i]) >> 1));
+            candidates[4][i] = static_cast<uint8_t>(row[i] - Paeth(left, above[i], upperLeft));
+        }
+
+        //Smallest sum of the bytes read as signed: rows closest to zero compress best
+        unsigned best = filter >= 0 ? static_cast<unsigned>(filter) : 0;
+        uint64_t bestSum = ~0ull;
+        for (unsigned candidate = 0; candidate < 5 && filter == PNG_FILTER_ADAPTIVE; ++candidate)
+        {
+            uint64_t sum = 0;
+            for (uint8_t value : candidates[candidate])
+                sum += std::abs(static_cast<int8_t>(value));
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                best = candidate;
+            }
+        }
+        uint8_t* out = &filtered[y * (rowBytes + 1)];
+        out[0] = static_cast<uint8_t>(best);
+        std::memcpy(out + 1, candidates[best].data(), rowBytes);
+    }
+    return filtered;
+}
+
+std::vector<uint8_t> WrapPng(unsigned width, unsigned height, unsigned bitDepth, unsigned colourType, bool interlaced,
+                             const std::vector<uint8_t>& filtered)
+{
+    uint8_t header[13];
+    header[0] = static_cast<uint8_t>(width >> 24);
+    header[1] = static_cast<uint8_t>(width >> 16);
+    header[2] = static_cast<uint8_t>(width >> 8);
+    header[3] = static_cast<uint8_t>(width);
+    header[4] = static_cast<uint8_t>(height >> 24);
+    header[5] = static_cast<uint8_t>(height >> 16);
+    header[6] = static_cast<uint8_t>(height >> 8);
+    header[7] = static_cast<uint8_t>(height);
+    header[8] = static_cast<uint8_t>(bitDepth);
+    header[9] = static_cast<uint8_t>(colourType);
+    header[10] = 0;                 //Deflate
+    header[11] = 0;                 //Adaptive filtering
+    header[12] = interlaced ? 1 : 0;    //Adam7
+
+    std::vector<uint8_t> compressed = DeflateZlib(filtered.data(), filtered.size());
+
+    static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<uint8_t> png(SIGNATURE, SIGNATURE + 8);
+    PutChunk(png, "IHDR", header, sizeof(header));
+    PutChunk(png, "IDAT", compressed.data(), compressed.size());
+    PutChunk(png, "IEND", nullptr, 0);
+    return png;
+}
+
+std::vector<uint8_t> EncodePng(const TextureImage& image)
+{
+    static const uint8_t COLOUR_TYPES[] = { 0, 4, 6 };     //By TexelFormat
+    std::vector<uint8_t> filtered = FilterPngRows(image.bytes.data(), image.RowPitch(), image.height, TexelBytes(image.format),
+                                                  PNG_FILTER_ADAPTIVE);
+    return WrapPng(image.width, image.height, 8, COLOUR_TYPES[static_cast<int>(image.format)], false, filtered);
+}
\ No newline at end of file
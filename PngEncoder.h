@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "TextureImage.h"
+
+//Writes images as PNG, for benchmark sources and saved captures. Each row is filtered with whichever of the five PNG
+//filters gives the smallest sum of absolute byte values, the libpng heuristic, and the zlib stream is hash-chain LZ77
+//matches in deflate blocks of 64K symbols, each with Huffman codes built from its own counts as zlib does. Files come
+//out a little larger than zlib level 6 makes, but decoders do the same work per byte: Huffman decoding, match copies
+//and unfiltering.
+
+const int PNG_FILTER_ADAPTIVE = -1;
+
+//R8 -> greyscale, R8G8 -> greyscale + alpha, RGBA8 -> truecolour + alpha; 8 bits per channel
+std::vector<uint8_t> EncodePng(const TextureImage& image);
+
+//Just the zlib stream of data, as PNG puts in IDAT
+std::vector<uint8_t> DeflateZlib(const uint8_t* data, size_t size);
+
+//Rows of rowBytes bytes, each written as its filter byte then the filtered bytes: filter 0 - 4 (none, sub, up, average,
+//Paeth) for every row, or PNG_FILTER_ADAPTIVE for the smallest sum per row as EncodePng does
+std::vector<uint8_t> FilterPngRows(const uint8_t* pixels, size_t rowBytes, unsigned height, unsigned bytesPerPixel, int filter);
+
+//A PNG around rows already filtered, in any layout but palette: bitDepth 1 - 16 and colourType 0, 2, 4 or 6. Interlaced
+//images take the rows of the seven Adam7 passes in turn. Nothing is checked; for making decoder test inputs.
+std::vector<uint8_t> WrapPng(unsigned width, unsigned height, unsigned bitDepth, unsigned colourType, bool interlaced,
+	const std::vector<uint8_t>& filtered);
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstdint>
+
+#include "CpuFeatures.h"
+
+//Fixed-width float and int lanes, one namespace per instruction set with the same types and operations, so a kernel
+//written once in a .inl compiles for each width by being included inside the namespace (PhongShadingKernel.inl,
+//TextureSamplerKernel.inl). SimdLanesMath.inl adds the functions built from these operations.
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+
+namespace Sse2
+{
+	const unsigned WIDTH = 4;
+
+	struct Float { __m128 v; };
+	struct Int { __m128i v; };
+	struct Mask { __m128 v; };
+
+	inline Float Broadcast(float x) { return { _mm_set1_ps(x) }; }
+	inline Int IntBroadcast(int x) { return { _mm_set1_epi32(x) }; }
+	inline Float Load(const float* p) { return { _mm_load_ps(p) }; }
+	inline Float LoadUnaligned(const float* p) { return { _mm_loadu_ps(p) }; }
+	inline void Store(float* p, Float x) { _mm_storeu_ps(p, x.v); }
+	inline void Store(uint32_t* p, Int x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x.v); }
+
+	inline Float operator+(Float a, Float b) { return { _mm_add_ps(a.v, b.v) }; }
+	inline Float operator-(Float a, Float b) { return { _mm_sub_ps(a.v, b.v) }; }
+	inline Float operator*(Float a, Float b) { return { _mm_mul_ps(a.v, b.v) }; }
+	inline Float operator/(Float a, Float b) { return { _mm_div_ps(a.v, b.v) }; }
+	inline Float Min(Float a, Float b) { return { _mm_min_ps(a.v, b.v) }; }
+	inline Float Max(Float a, Float b) { return { _mm_max_ps(a.v, b.v) }; }
+	inline Float Sqrt(Float x) { return { _mm_sqrt_ps(x.v) }; }
+
+	inline Float RcpSqrt(Float x)       //Estimate refined with one Newton-Raphson step
+	{
+		__m128 r = _mm_rsqrt_ps(x.v);
+		__m128 halfX = _mm_mul_ps(x.v, _mm_set1_ps(0.5f));
+		return { _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfX, _mm_mul_ps(r, r)))) };
+	}
+
+	inline Float Floor(Float x)         //No roundps before SSE4.1
+	{
+		__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x.v));
+		return { _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x.v), _mm_set1_ps(1.0f))) };
+	}
+
+	inline Mask operator>(Float a, Float b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline Mask operator<(Float a, Float b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline Float Select(Mask m, Float a, Float b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+
+	inline Int FloatToInt(Float x) { return { _mm_cvttps_epi32(x.v) }; }
+	inline Float IntToFloat(Int x) { return { _mm_cvtepi32_ps(x.v) }; }
+	inline Int AsInt(Float x) { return { _mm_castps_si128(x.v) }; }
+	inline Float AsFloat(Int x) { return { _mm_castsi128_ps(x.v) }; }
+
+	inline Int operator+(Int a, Int b) { return { _mm_add_epi32(a.v, b.v) }; }
+	inline Int operator-(Int a, Int b) { return { _mm_sub_epi32(a.v, b.v) }; }
+	inline Int operator&(Int a, Int b) { return { _mm_and_si128(a.v, b.v) }; }
+	inline Int operator|(Int a, Int b) { return { _mm_or_si128(a.v, b.v) }; }
+	template<int N> inline Int ShiftLeft(Int x) { return { _mm_slli_epi32(x.v, N) }; }
+	template<int N> inline Int ShiftRight(Int x) { return { _mm_srli_epi32(x.v, N) }; }
+
+	inline Int MulLo(Int a, Int b)      //No pmulld before SSE4.1: even and odd lanes through pmuludq
+	{
+		__m128i even = _mm_mul_epu32(a.v, b.v);
+		__m128i odd = _mm_mul_epu32(_mm_srli_si128(a.v, 4), _mm_srli_si128(b.v, 4));
+		return { _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0))) };
+	}
+
+	template<int LANE> inline Float QuadBroadcast(Float x) { return { _mm_shuffle_ps(x.v, x.v, _MM_SHUFFLE(LANE, LANE, LANE, LANE)) }; }
+
+	inline float ReduceMax(Float x)
+	{
+		__m128 high = _mm_max_ps(x.v, _mm_movehl_ps(x.v, x.v));
+		return _mm_cvtss_f32(_mm_max_ss(high, _mm_shuffle_ps(high, high, 1)));
+	}
+
+	inline Int Gather(const uint32_t* base, Int index)
+	{
+		alignas(16) int32_t indices[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), index.v);
+		return { _mm_set_epi32(base[indices[3]], base[indices[2]], base[indices[1]], base[indices[0]]) };
+	}
+
+#include "SimdLanesMath.inl"
+}
+
+SIMD_BEGIN_TARGET_AVX2
+namespace Avx2
+{
+	const unsigned WIDTH = 8;
+
+	struct Float { __m256 v; };
+	struct Int { __m256i v; };
+	struct Mask { __m256 v; };
+
+	inline Float Broadcast(float x) { return { _mm256_set1_ps(x) }; }
+	inline Int IntBroadcast(int x) { return { _mm256_set1_epi32(x) }; }
+	inline Float Load(const float* p) { return { _mm256_load_ps(p) }; }
+	inline Float LoadUnaligned(const float* p) { return { _mm256_loadu_ps(p) }; }
+	inline void Store(float* p, Float x) { _mm256_storeu_ps(p, x.v); }
+	inline void Store(uint32_t* p, Int x) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x.v); }
+
+	inline Float operator+(Float a, Float b) { return { _mm256_add_ps(a.v, b.v) }; }
+	inline Float operator-(Float a, Float b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	inline Float operator*(Float a, Float b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	inline Float operator/(Float a, Float b) { return { _mm256_div_ps(a.v, b.v) }; }
+	inline Float Min(Float a, Float b) { return { _mm256_min_ps(a.v, b.v) }; }
+	inline Float Max(Float a, Float b) { return { _mm256_max_ps(a.v, b.v) }; }
+	inline Float Sqrt(Float x) { return { _mm256_sqrt_ps(x.v) }; }
+
+	inline Float RcpSqrt(Float x)
+	{
+		__m256 r = _mm256_rsqrt_ps(x.v);
+		__m256 halfX = _mm256_mul_ps(x.v, _mm256_set1_ps(0.5f));
+		return { _mm256_mul_ps(r, _mm256_fnmadd_ps(halfX, _mm256_mul_ps(r, r), _mm256_set1_ps(1.5f))) };
+	}
+
+	inline Float Floor(Float x) { return { _mm256_floor_ps(x.v) }; }
+
+	inline Mask operator>(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator<(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Float Select(Mask m, Float a, Float b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+
+	inline Int FloatToInt(Float x) { return { _mm256_cvttps_epi32(x.v) }; }
+	inline Float IntToFloat(Int x) { return { _mm256_cvtepi32_ps(x.v) }; }
+	inline Int AsInt(Float x) { return { _mm256_castps_si256(x.v) }; }
+	inline Float AsFloat(Int x) { return { _mm256_castsi256_ps(x.v) }; }
+
+	inline Int operator+(Int a, Int b) { return { _mm256_add_epi32(a.v, b.v) }; }
+	inline Int operator-(Int a, Int b) { return { _mm256_sub_epi32(a.v, b.v) }; }
+	inline Int operator&(Int a, Int b) { return { _mm256_and_si256(a.v, b.v) }; }
+	inline Int operator|(Int a, Int b) { return { _mm256_or_si256(a.v, b.v) }; }
+	template<int N> inline Int ShiftLeft(Int x) { return { _mm256_slli_epi32(x.v, N) }; }
+	template<int N> inline Int ShiftRight(Int x) { return { _mm256_srli_epi32(x.v, N) }; }
+
+	inline Int MulLo(Int a, Int b) { return { _mm256_mullo_epi32(a.v, b.v) }; }
+
+	template<int LANE> inline Float QuadBroadcast(Float x) { return { _mm256_permute_ps(x.v, _MM_SHUFFLE(LANE, LANE, LANE, LANE)) }; }
+
+	inline float ReduceMax(Float x)
+	{
+		__m128 quad = _mm_max_ps(_mm256_castps256_ps128(x.v), _mm256_extractf128_ps(x.v, 1));
+		__m128 high = _mm_max_ps(quad, _mm_movehl_ps(quad, quad));
+		return _mm_cvtss_f32(_mm_max_ss(high, _mm_shuffle_ps(high, high, 1)));
+	}
+
+	inline Int Gather(const uint32_t* base, Int index)
+	{
+		return { _mm256_i32gather_epi32(reinterpret_cast<const int*>(base), index.v, 4) };
+	}
+
+#include "SimdLanesMath.inl"
+}
+SIMD_END_TARGET
+
+SIMD_BEGIN_TARGET_AVX512
+namespace Avx512
+{
+	const unsigned WIDTH = 16;
+
+	struct Float { __m512 v; };
+	struct Int { __m512i v; };
+	struct Mask { __mmask16 v; };
+
+	inline Float Broadcast(float x) { return { _mm512_set1_ps(x) }; }
+	inline Int IntBroadcast(int x) { return { _mm512_set1_epi32(x) }; }
+	inline Float Load(const float* p) { return { _mm512_load_ps(p) }; }
+	inline Float LoadUnaligned(const float* p) { return { _mm512_loadu_ps(p) }; }
+	inline void Store(float* p, Float x) { _mm512_storeu_ps(p, x.v); }
+	inline void Store(uint32_t* p, Int x) { _mm512_storeu_si512(p, x.v); }
+
+	inline Float operator+(Float a, Float b) { return { _mm512_add_ps(a.v, b.v) }; }
+	inline Float operator-(Float a, Float b) { return { _mm512_sub_ps(a.v, b.v) }; }
+	inline Float operator*(Float a, Float b) { return { _mm512_mul_ps(a.v, b.v) }; }
+	inline Float operator/(Float a, Float b) { return { _mm512_div_ps(a.v, b.v) }; }
+	inline Float Min(Float a, Float b) { return { _mm512_min_ps(a.v, b.v) }; }
+	inline Float Max(Float a, Float b) { return { _mm512_max_ps(a.v, b.v) }; }
+	inline Float Sqrt(Float x) { return { _mm512_sqrt_ps(x.v) }; }
+
+	inline Float RcpSqrt(Float x)
+	{
+		__m512 r = _mm512_rsqrt14_ps(x.v);
+		__m512 halfX = _mm512_mul_ps(x.v, _mm512_set1_ps(0.5f));
+		return { _mm512_mul_ps(r, _mm512_fnmadd_ps(halfX, _mm512_mul_ps(r, r), _mm512_set1_ps(1.5f))) };
+	}
+
+	inline Float Floor(Float x) { return { _mm512_roundscale_ps(x.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC) }; }
+
+	inline Mask operator>(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator<(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Float Select(Mask m, Float a, Float b) { return { _mm512_mask_blend_ps(m.v, b.v, a.v) }; }
+
+	inline Int FloatToInt(Float x) { return { _mm512_cvttps_epi32(x.v) }; }
+	inline Float IntToFloat(Int x) { return { _mm512_cvtepi32_ps(x.v) }; }
+	inline Int AsInt(Float x) { return { _mm512_castps_si512(x.v) }; }
+	inline Float AsFloat(Int x) { return { _mm512_castsi512_ps(x.v) }; }
+
+	inline Int operator+(Int a, Int b) { return { _mm512_add_epi32(a.v, b.v) }; }
+	inline Int operator-(Int a, Int b) { return { _mm512_sub_epi32(a.v, b.v) }; }
+	inline Int operator&(Int a, Int b) { return { _mm512_and_si512(a.v, b.v) }; }
+	inline Int operator|(Int a, Int b) { return { _mm512_or_si512(a.v, b.v) }; }
+	template<int N> inline Int ShiftLeft(Int x) { return { _mm512_slli_epi32(x.v, N) }; }
+	template<int N> inline Int ShiftRight(Int x) { return { _mm512_srli_epi32(x.v, N) }; }
+
+	inline Int MulLo(Int a, Int b) { return { _mm512_mullo_epi32(a.v, b.v) }; }
+
+	template<int LANE> inline Float QuadBroadcast(Float x) { return { _mm512_permute_ps(x.v, _MM_SHUFFLE(LANE, LANE, LANE, LANE)) }; }
+
+	inline float ReduceMax(Float x) { return _mm512_reduce_max_ps(x.v); }
+
+	inline Int Gather(const uint32_t* base, Int index)
+	{
+		return { _mm512_i32gather_epi32(index.v, base, 4) };
+	}
+
+#include "SimdLanesMath.inl"
+}
+SIMD_END_TARGET
+
+#endif
\ No newline at end of file
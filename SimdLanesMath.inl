@@ -0,0 +1,56 @@
+//Math on the lanes of SimdLanes.h. Included at the end of each instruction set's namespace there.
+
+inline Float Saturate(Float x)
+{
+    return Min(Max(x, Broadcast(0.0f)), Broadcast(1.0f));
+}
+
+inline Float Log2(Float x)      //Cephes logf polynomial, x > 0
+{
+    Int bits = AsInt(x);
+    Float exponent = IntToFloat((ShiftRight<23>(bits) & IntBroadcast(0xFF)) - IntBroadcast(127));
+    Float mantissa = AsFloat((bits & IntBroadcast(0x007FFFFF)) | IntBroadcast(0x3F800000));     //[1, 2)
+
+    Mask high = mantissa > Broadcast(1.41421356f);
+    mantissa = Select(high, mantissa * Broadcast(0.5f), mantissa);
+    exponent = Select(high, exponent + Broadcast(1.0f), exponent);
+
+    Float f = mantissa - Broadcast(1.0f);
+    Float z = f * f;
+    Float y = Broadcast(7.0376836292E-2f);
+    y = y * f + Broadcast(-1.1514610310E-1f);
+    y = y * f + Broadcast(1.1676998740E-1f);
+    y = y * f + Broadcast(-1.2420140846E-1f);
+    y = y * f + Broadcast(1.4249322787E-1f);
+    y = y * f + Broadcast(-1.6668057665E-1f);
+    y = y * f + Broadcast(2.0000714765E-1f);
+    y = y * f + Broadcast(-2.4999993993E-1f);
+    y = y * f + Broadcast(3.3333331174E-1f);
+    y = y * f * z - Broadcast(0.5f) * z;
+
+    return (f + y) * Broadcast(1.44269504f) + exponent;
+}
+
+inline Float Exp2(Float x)      //Cephes exp2f polynomial, flushes to zero below 2^-126
+{
+    x = Min(Max(x, Broadcast(-126.0f)), Broadcast(126.0f));
+    Float whole = Floor(x + Broadcast(0.5f));
+    Float f = x - whole;
+
+    Float p = Broadcast(1.535336188319500E-4f);
+    p = p * f + Broadcast(1.339887440266574E-3f);
+    p = p * f + Broadcast(9.618437357674640E-3f);
+    p = p * f + Broadcast(5.550332471162809E-2f);
+    p = p * f + Broadcast(2.402264791363012E-1f);
+    p = p * f + Broadcast(6.931472028550421E-1f);
+    p = p * f + Broadcast(1.0f);
+
+    return p * AsFloat(ShiftLeft<23>(FloatToInt(whole) + IntBroadcast(127)));
+}
+
+inline Float WrapCoordinate(Float texel, Float size, Float invSize)
+{
+    Float wrapped = texel - size * Floor(texel * invSize);
+    wrapped = Select(wrapped > size - Broadcast(0.5f), wrapped - size, wrapped);
+    return Select(wrapped < Broadcast(0.0f), wrapped + size, wrapped);
+}
\ No newline at end of file
@@ -0,0 +1,445 @@
+#include "SoftwareRenderer.h"
+#include "MatrixMath.h"
+#include "PhongShading.h"
+#include "VertexProcessing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    const int SUBPIXEL_BITS = 8;                //Same precision as D3D11 rasterization
+    const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+    const float GUARD_BAND = 4.0f;              //Triangles are only clipped in x/y once they leave this many NDC units
+
+    //Interpolated vertex shader outputs, premultiplied by 1/w after setup
+    enum Attribute { NORMAL = 0, UV = 3, WORLD_POSITION = 5, ATTRIBUTE_COUNT = RasterTriangle::ATTRIBUTE_COUNT };
+
+    struct ClipVertex
+    {
+        float pos[4];                           //SV_POSITION
+        float attributes[ATTRIBUTE_COUNT];
+    };
+
+    ClipVertex FetchVertex(const TransformedVertices& vertices, size_t index)
+    {
+        ClipVertex vertex;
+        for (int i = 0; i < 4; ++i)
+            vertex.pos[i] = vertices.position[i][index];
+        for (int i = 0; i < 3; ++i)
+            vertex.attributes[NORMAL + i] = vertices.normal[i][index];
+        for (int i = 0; i < 2; ++i)
+            vertex.attributes[UV + i] = vertices.uv[i][index];
+        for (int i = 0; i < 4; ++i)
+            vertex.attributes[WORLD_POSITION + i] = vertices.worldPosition[i][index];
+        return vertex;
+    }
+
+    //Sutherland-Hodgman against near/far and the guard band, returns the vertex count of the clipped polygon
+    int ClipTriangle(const ClipVertex* triangle, ClipVertex* polygon)
+    {
+        const float planes[6][4] =
+        {
+            {0, 0, 1, 0},                   //z >= 0
+            {0, 0, -1, 1},                  //z <= w
+            {1, 0, 0, GUARD_BAND},
+            {-1, 0, 0, GUARD_BAND},
+            {0, 1, 0, GUARD_BAND},
+            {0, -1, 0, GUARD_BAND}
+        };
+
+        ClipVertex buffer[9];
+        ClipVertex* input = polygon;
+        ClipVertex* output = buffer;
+        int count = 3;
+        std::copy(triangle, triangle + 3, input);
+
+        for (const float* plane : planes)
+        {
+            int outCount = 0;
+            for (int i = 0; i < count; ++i)
+            {
+                const ClipVertex& a = input[i];
+                const ClipVertex& b = input[(i + 1) % count];
+                float da = plane[0] * a.pos[0] + plane[1] * a.pos[1] + plane[2] * a.pos[2] + plane[3] * a.pos[3];
+                float db = plane[0] * b.pos[0] + plane[1] * b.pos[1] + plane[2] * b.pos[2] + plane[3] * b.pos[3];
+
+                if (da >= 0)
+                    output[outCount++] = a;
+
+                if ((da >= 0) != (db >= 0))
+                {
+                    float t = da / (da - db);
+                    ClipVertex& v = output[outCount++];
+                    for (int j = 0; j < 4; ++j)
+                        v.pos[j] = a.pos[j] + t * (b.pos[j] - a.pos[j]);
+                    for (int j = 0; j < ATTRIBUTE_COUNT; ++j)
+                        v.attributes[j] = a.attributes[j] + t * (b.attributes[j] - a.attributes[j]);
+                }
+            }
+
+            std::swap(input, output);
+            count = outCount;
+            if (count < 3)
+                return 0;
+        }
+
+        if (input != polygon)
+            std::copy(input, input + count, polygon);
+
+        return count;
+    }
+
+    void SetupTriangle(const ClipVertex* v, unsigned width, unsigned height, std::vector<RasterTriangle>& triangles)
+    {
+        //Viewport transform, TopLeft (0, 0), depth range [0, 1]
+        float halfWidth = width * 0.5f;
+        float halfHeight = height * 0.5f;
+
+        int64_t x[3], y[3];
+        float invW[3];
+        RasterTriangle triangle;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            invW[i] = 1.0f / v[i].pos[3];
+            float screenX = (v[i].pos[0] * invW[i] + 1.0f) * halfWidth;
+            float screenY = (1.0f - v[i].pos[1] * invW[i]) * halfHeight;
+            x[i] = static_cast<int64_t>(std::lround(screenX * SUBPIXEL_ONE));
+            y[i] = static_cast<int64_t>(std::lround(screenY * SUBPIXEL_ONE));
+            triangle.z[i] = v[i].pos[2] * invW[i];
+            triangle.invW[i] = invW[i];
+            for (int j = 0; j < ATTRIBUTE_COUNT; ++j)
+                triangle.attributes[i][j] = v[i].attributes[j] * invW[i];
+        }
+
+        //Clockwise triangles are front facing, the default rasterizer state culls the rest
+        int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area <= 0)
+            return;
+
+        for (int edge = 0; edge < 3; ++edge)
+        {
+            int from = (edge + 1) % 3;
+            int to = (edge + 2) % 3;
+            int64_t dx = x[to] - x[from];
+            int64_t dy = y[to] - y[from];
+            bool topLeft = (dy == 0 && dx > 0) || dy < 0;
+
+            triangle.a[edge] = -dy;
+            triangle.b[edge] = dx;
+            triangle.c[edge] = dy * x[from] - dx * y[from] - (topLeft ? 0 : 1);
+        }
+
+        triangle.invArea = 1.0f / static_cast<float>(area);
+
+        int64_t maxX = static_cast<int64_t>(width) - 1;
+        int64_t maxY = static_cast<int64_t>(height) - 1;
+        triangle.minX = static_cast<int>(std::max<int64_t>(std::min({ x[0], x[1], x[2] }) >> SUBPIXEL_BITS, 0));
+        triangle.minY = static_cast<int>(std::max<int64_t>(std::min({ y[0], y[1], y[2] }) >> SUBPIXEL_BITS, 0));
+        triangle.maxX = static_cast<int>(std::min<int64_t>(std::max({ x[0], x[1], x[2] }) >> SUBPIXEL_BITS, maxX));
+        triangle.maxY = static_cast<int>(std::min<int64_t>(std::max({ y[0], y[1], y[2] }) >> SUBPIXEL_BITS, maxY));
+
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+
+        triangles.push_back(triangle);
+    }
+
+    uint32_t ToDepth24(float depth)
+    {
+        depth = std::min(std::max(depth, 0.0f), 1.0f);
+        return std::min(static_cast<uint32_t>(depth * 16777215.0f + 0.5f), 0xFFFFFFu);     //1.0f would round up to 2^24
+    }
+}
+
+void Framebuffer::Resize(unsigned newWidth, unsigned newHeight)
+{
+    width = newWidth;
+    height = newHeight;
+    color.assign(static_cast<size_t>(width) * height, 0);
+    depthStencil.assign(static_cast<size_t>(width) * height, 0);
+}
+
+void SoftwareContext::ClearRenderTargetView(const float* clearColor)
+{
+    Framebuffer& target = *renderTarget;
+    uint32_t packed = PackColor(clearColor);
+    unsigned bands = (target.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    threadPool->ParallelFor(bands, [&](unsigned band)
+    {
+        size_t begin = static_cast<size_t>(band) * TILE_SIZE * target.width;
+        size_t end = std::min(begin + static_cast<size_t>(TILE_SIZE) * target.width, target.color.size());
+        std::fill(target.color.begin() + begin, target.color.begin() + end, packed);
+    });
+}
+
+void SoftwareContext::ClearDepthStencilView(float depth, uint8_t stencil)
+{
+    Framebuffer& target = *renderTarget;
+    uint32_t packed = ToDepth24(depth) | (static_cast<uint32_t>(stencil) << 24);
+    unsigned bands = (target.height + TILE_SIZE - 1) / TILE_SIZE;
+
+    threadPool->ParallelFor(bands, [&](unsigned band)
+    {
+        size_t begin = static_cast<size_t>(band) * TILE_SIZE * target.width;
+        size_t end = std::min(begin + static_cast<size_t>(TILE_SIZE) * target.width, target.depthStencil.size());
+        std::fill(target.depthStencil.begin() + begin, target.depthStencil.begin() + end, packed);
+    });
+}
+
+void SoftwareContext::RasterizeTile(unsigned tileX, unsigned tileY)
+{
+    Framebuffer& target = *renderTarget;
+    const SoftwareTexture& boundTexture = texture ? *texture : defaultTexture;
+    const std::vector<uint32_t>& bin = tileBins[tileY * tilesX + tileX];
+
+    int tileMinX = static_cast<int>(tileX * TILE_SIZE);
+    int tileMinY = static_cast<int>(tileY * TILE_SIZE);
+    int tileMaxX = std::min(tileMinX + static_cast<int>(TILE_SIZE), static_cast<int>(target.width)) - 1;
+    int tileMaxY = std::min(tileMinY + static_cast<int>(TILE_SIZE), static_cast<int>(target.height)) - 1;
+
+    //Fragments are written back in the order they were rasterized, so later triangles still win
+    FragmentBlock fragments;
+    size_t fragmentPixels[FragmentBlock::SIZE];
+    unsigned fragmentCount = 0;
+    auto flushFragments = [&]()
+    {
+        if (fragmentCount == 0)
+            return;
+
+        uint32_t colors[FragmentBlock::SIZE];
+        ShadeFragments(fragments, fragmentCount, lightBuffer, boundTexture, colors);
+        for (unsigned i = 0; i < fragmentCount; ++i)
+            target.color[fragmentPixels[i]] = colors[i];
+        fragmentCount = 0;
+    };
+
+    for (uint32_t index : bin)
+    {
+        const RasterTriangle& triangle = triangles[index];
+        int minX = std::max(triangle.minX, tileMinX);
+        int minY = std::max(triangle.minY, tileMinY);
+        int maxX = std::min(triangle.maxX, tileMaxX);
+        int maxY = std::min(triangle.maxY, tileMaxY);
+
+        int64_t stepX[3];
+        for (int edge = 0; edge < 3; ++edge)
+            stepX[edge] = triangle.a[edge] * SUBPIXEL_ONE;
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            int64_t sampleX = (static_cast<int64_t>(minX) << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+            int64_t sampleY = (static_cast<int64_t>(y) << SUBPIXEL_BITS) + SUBPIXEL_ONE / 2;
+            int64_t w[3];
+            for (int edge = 0; edge < 3; ++edge)
+                w[edge] = triangle.a[edge] * sampleX + triangle.b[edge] * sampleY + triangle.c[edge];
+
+            size_t pixel = static_cast<size_t>(y) * target.width + minX;
+
+            for (int x = minX; x <= maxX; ++x, ++pixel, w[0] += stepX[0], w[1] += stepX[1], w[2] += stepX[2])
+            {
+                if ((w[0] | w[1] | w[2]) < 0)
+                    continue;
+
+                float b1 = static_cast<float>(w[1]) * triangle.invArea;
+                float b2 = static_cast<float>(w[2]) * triangle.invArea;
+
+                //Depth test LESS against D24 (default depth-stencil state)
+                float z = triangle.z[0] + b1 * (triangle.z[1] - triangle.z[0]) + b2 * (triangle.z[2] - triangle.z[0]);
+                uint32_t depth = ToDepth24(z);
+                uint32_t& depthStencil = target.depthStencil[pixel];
+                if (depth >= (depthStencil & 0xFFFFFF))
+                    continue;
+                depthStencil = (depthStencil & 0xFF000000) | depth;
+
+                //Perspective correct attributes, shaded once a block of fragments has been collected
+                float invW = triangle.invW[0] + b1 * (triangle.invW[1] - triangle.invW[0]) + b2 * (triangle.invW[2] - triangle.invW[0]);
+                float wCoord = 1.0f / invW;
+                float attributes[ATTRIBUTE_COUNT];
+                for (int i = 0; i < ATTRIBUTE_COUNT; ++i)
+                {
+                    float a0 = triangle.attributes[0][i];
+                    attributes[i] = (a0 + b1 * (triangle.attributes[1][i] - a0) + b2 * (triangle.attributes[2][i] - a0)) * wCoord;
+                }
+
+                for (int i = 0; i < 3; ++i)
+                    fragments.normal[i][fragmentCount] = attributes[NORMAL + i];
+                for (int i = 0; i < 2; ++i)
+                    fragments.uv[i][fragmentCount] = attributes[UV + i];
+                for (int i = 0; i < 4; ++i)
+                    fragments.worldPosition[i][fragmentCount] = attributes[WORLD_POSITION + i];
+                fragmentPixels[fragmentCount++] = pixel;
+
+                if (fragmentCount == FragmentBlock::SIZE)
+                    flushFragments();
+            }
+        }
+    }
+
+    flushFragments();
+}
+
+void SoftwareContext::Draw(unsigned vertexCount, unsigned startVertex)
+{
+    if (vertexCount < 3)
+        return;
+
+    triangles.clear();
+
+    TransformVertices(vertexBuffer + startVertex, vertexCount, constantBuffer, transformedVertices, threadPool);
+
+    //Triangle strip, odd triangles swap two vertices to keep the winding
+    for (unsigned i = 0; i + 2 < vertexCount; ++i)
+    {
+        ClipVertex triangle[3] =
+        {
+            FetchVertex(transformedVertices, i), FetchVertex(transformedVertices, i + 1), FetchVertex(transformedVertices, i + 2)
+        };
+        if (i % 2 == 1)
+            std::swap(triangle[1], triangle[2]);
+
+        ClipVertex polygon[9];
+        int count = ClipTriangle(triangle, polygon);
+        for (int j = 1; j + 1 < count; ++j)
+        {
+            ClipVertex fan[3] = { polygon[0], polygon[j], polygon[j + 1] };
+            SetupTriangle(fan, renderTarget->width, renderTarget->height, triangles);
+        }
+    }
+
+    //Bin triangles into the tiles their bounding boxes touch
+    tilesX = (renderTarget->width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (renderTarget->height + TILE_SIZE - 1) / TILE_SIZE;
+    tileBins.resize(static_cast<size_t>(tilesX) * tilesY);
+    for (std::vector<uint32_t>& bin : tileBins)
+        bin.clear();
+
+    for (uint32_t index = 0; index < triangles.size(); ++index)
+    {
+        const RasterTriangle& triangle = triangles[index];
+        for (unsigned tileY = triangle.minY / TILE_SIZE; tileY <= triangle.maxY / TILE_SIZE; ++tileY)
+            for (unsigned tileX = triangle.minX / TILE_SIZE; tileX <= triangle.maxX / TILE_SIZE; ++tileX)
+                tileBins[tileY * tilesX + tileX].push_back(index);
+    }
+
+    threadPool->ParallelFor(tilesX * tilesY, [&](unsigned tile)
+    {
+        if (!tileBins[tile].empty())
+            RasterizeTile(tile % tilesX, tile / tilesX);
+    });
+}
+
+void UpdateConstantbuffer(ConstantBuffer& cBuffer, Camera& camera, float angle)
+{
+    const float pivot[3] = { 0.0f, 0.0f, 1.0f };
+    Matrix world = RotationYAround(angle, pivot);       //Rotation around (0, 0, 1), world matrix
+
+    camera.FillConstantBuffer(world, cBuffer);
+}
+
+void Render(float* backgroundColor, SoftwareContext& context, Camera& camera, float angle)
+{
+    UpdateConstantbuffer(context.constantBuffer, camera, angle);
+
+    context.ClearRenderTargetView(backgroundColor);
+    context.ClearDepthStencilView(1, 0);
+
+    context.Draw(4, 0);
+}
+
+bool SaveFramebuffer(const Framebuffer& framebuffer, const std::string& path)
+{
+    std::ofstream writer(path, std::ios::binary);
+
+    if (!writer.is_open())
+    {
+        std::cerr << "Could not open " << path << std::endl;
+        return false;
+    }
+
+    writer << "P6\n" << framebuffer.width << " " << framebuffer.height << "\n255\n";
+
+    std::vector<unsigned char> row(framebuffer.width * 3);
+    for (unsigned y = 0; y < framebuffer.height; ++y)
+    {
+        for (unsigned x = 0; x < framebuffer.width; ++x)
+        {
+            uint32_t texel = framebuffer.color[static_cast<size_t>(y) * framebuffer.width + x];
+            row[x * 3 + 0] = texel & 0xFF;
+            row[x * 3 + 1] = (texel >> 8) & 0xFF;
+            row[x * 3 + 2] = (texel >> 16) & 0xFF;
+        }
+        writer.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+
+    return writer.good();
+}
+
+void RunRasterizerBenchmark()
+{
+    const unsigned resolutions[2][2] = { {1024, 576}, {3840, 2160} };
+    const double secondsPerRun = 1.0;
+
+    //Checkerboard so texture sampling costs the same as with a real image
+    SoftwareTexture checker;
+    checker.width = checker.height = 256;
+    checker.texels.resize(256 * 256);
+    for (unsigned y = 0; y < 256; ++y)
+        for (unsigned x = 0; x < 256; ++x)
+            checker.texels[y * 256 + x] = ((x / 32 + y / 32) % 2) ? 0xFFFFFFFF : 0xFF404040;
+
+    std::array<VertexData, 4> quad = QuadVertices();
+    float backgroundColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+    std::vector<unsigned> threadCounts;
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    for (const unsigned* resolution : resolutions)
+    {
+        Framebuffer framebuffer;
+        framebuffer.Resize(resolution[0], resolution[1]);
+        double singleThreaded = 0;
+
+        Camera camera;
+        camera.SetAspectRatio(static_cast<float>(resolution[0]) / resolution[1]);
+
+        for (unsigned threads : threadCounts)
+        {
+            ThreadPool pool(threads);
+            SoftwareContext context;
+            context.threadPool = &pool;
+            context.renderTarget = &framebuffer;
+            context.vertexBuffer = quad.data();
+            context.texture = &checker;
+
+            Render(backgroundColor, context, camera, 0.0f);
+
+            unsigned frames = 0;
+            auto start = std::chrono::steady_clock::now();
+            double elapsed = 0;
+            while (elapsed < secondsPerRun)
+            {
+                float angle = 0.5f * std::sin(frames * 0.1f);     //Swings while facing the camera so every frame shades the quad
+                Render(backgroundColor, context, camera, angle);
+                ++frames;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+
+            double framesPerSecond = frames / elapsed;
+            if (threads == 1)
+                singleThreaded = framesPerSecond;
+
+            std::printf("%4ux%-4u  threads %3u  %9.1f frames/s  %5.2fx\n", resolution[0], resolution[1], threads,
+                        framesPerSecond, framesPerSecond / singleThreaded);
+        }
+    }
+}
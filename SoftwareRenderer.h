@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "PipelineData.h"
+#include "SoftwareTexture.h"
+#include "ThreadPool.h"
+#include "VertexProcessing.h"
+
+//CPU backend for the frame Render() draws, used on machines without a GPU
+
+struct Framebuffer
+{
+	unsigned width = 0;
+	unsigned height = 0;
+	std::vector<uint32_t> color;			//DXGI_FORMAT_R8G8B8A8_UNORM
+	std::vector<uint32_t> depthStencil;		//DXGI_FORMAT_D24_UNORM_S8_UINT, depth in the low 24 bits
+
+	void Resize(unsigned newWidth, unsigned newHeight);
+};
+
+struct RasterTriangle			//Screen-space triangle after clipping, culling and edge setup
+{
+	static const int ATTRIBUTE_COUNT = 9;	//Normal, uv, world position
+
+	int minX, minY, maxX, maxY;
+	int64_t a[3], b[3], c[3];		//Fixed-point edge functions a * x + b * y + c
+	float invArea;
+	float z[3];
+	float invW[3];
+	float attributes[3][ATTRIBUTE_COUNT];	//Premultiplied by 1/w
+};
+
+struct SoftwareContext
+{
+	static const unsigned TILE_SIZE = 64;
+
+	ThreadPool* threadPool = nullptr;
+	Framebuffer* renderTarget = nullptr;
+
+	//Pipeline bindings, mirroring BindResourcesToPipeline
+	const VertexData* vertexBuffer = nullptr;
+	ConstantBuffer constantBuffer = {};
+	LightMaterialProperties lightBuffer = DefaultLightMaterialProperties();
+	const SoftwareTexture* texture = nullptr;
+
+	void ClearRenderTargetView(const float* color);
+	void ClearDepthStencilView(float depth, uint8_t stencil);
+
+	//Draws a triangle strip, binning triangles into TILE_SIZE tiles that are rasterized in parallel
+	void Draw(unsigned vertexCount, unsigned startVertex);
+
+private:
+	void RasterizeTile(unsigned tileX, unsigned tileY);
+
+	SoftwareTexture defaultTexture;
+	TransformedVertices transformedVertices;
+	std::vector<RasterTriangle> triangles;
+	std::vector<std::vector<uint32_t>> tileBins;
+	unsigned tilesX = 0;
+	unsigned tilesY = 0;
+};
+
+void UpdateConstantbuffer(ConstantBuffer& cBuffer, Camera& camera, float angle);
+
+void Render(float* backgroundColor, SoftwareContext& context, Camera& camera, float angle);
+
+bool SaveFramebuffer(const Framebuffer& framebuffer, const std::string& path);	//Binary PPM
+
+void RunRasterizerBenchmark();
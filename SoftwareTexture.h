@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+template<typename T>
+struct CacheLineAllocator		//64-byte aligned storage, so a Tiled4x4 tile is exactly one cache line
+{
+	typedef T value_type;
+
+	CacheLineAllocator() = default;
+	template<typename U> CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(64))); }
+	void deallocate(T* pointer, size_t) { ::operator delete(pointer, std::align_val_t(64)); }
+
+	template<typename U> bool operator==(const CacheLineAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const CacheLineAllocator<U>&) const { return false; }
+};
+
+//Order of the texels in memory. Swizzled layouts keep a bilinear footprint and its neighbours in few cache lines
+//whichever direction the sampler walks; their rows and columns are padded to whole blocks.
+enum class TexelLayout
+{
+	Linear,			//Row-major
+	Tiled4x4,		//4x4 texel tiles of one 64-byte cache line each, tiles row-major
+	Morton			//Z-order inside 32x32 texel blocks of 4 KB, blocks row-major
+};
+
+struct SoftwareTexture
+{
+	unsigned width = 1;
+	unsigned height = 1;
+	std::vector<uint32_t, CacheLineAllocator<uint32_t>> texels = { 0xFFFFFFFF };		//RGBA8, white until a texture is loaded
+	TexelLayout layout = TexelLayout::Linear;			//Only the shading samplers read other layouts, see TexelLayout.h
+
+	size_t TexelIndex(unsigned x, unsigned y) const
+	{
+		switch (layout)
+		{
+		case TexelLayout::Tiled4x4:
+			return ((size_t(y >> 2) * ((width + 3) >> 2) + (x >> 2)) << 4) | ((y & 3) << 2) | (x & 3);
+		case TexelLayout::Morton:
+			return ((size_t(y >> 5) * ((width + 31) >> 5) + (x >> 5)) << 10) | MortonBits(x & 31) | (MortonBits(y & 31) << 1);
+		default:
+			return size_t(y) * width + x;
+		}
+	}
+
+	static unsigned MortonBits(unsigned v)		//Spreads the 5 low bits of v to the even bit positions
+	{
+		v = (v | (v << 4)) & 0x0F0F;
+		v = (v | (v << 2)) & 0x3333;
+		return (v | (v << 1)) & 0x5555;
+	}
+};
@@ -0,0 +1,466 @@
+#include "StateCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+template<typename T, UINT N>
+void StateCache::SlotState<T, N>::Set(UINT slot, const T& value)
+{
+    if (!(wanted[slot] != value))       //Either already bound or already inside the dirty range
+        return;
+
+    wanted[slot] = value;
+    dirtyBegin = std::min(dirtyBegin, slot);
+    dirtyEnd = std::max(dirtyEnd, slot + 1);
+}
+
+template<typename T, UINT N>
+bool StateCache::SlotState<T, N>::ChangedRange(UINT& begin, UINT& end)
+{
+    begin = dirtyBegin;
+    end = dirtyEnd;
+    dirtyBegin = N;
+    dirtyEnd = 0;
+
+    if (!known)
+        return true;
+
+    while (begin < end && !(wanted[begin] != bound[begin]))
+        ++begin;
+    while (end > begin && !(wanted[end - 1] != bound[end - 1]))
+        --end;
+    return begin < end;
+}
+
+template<typename T, UINT N>
+void StateCache::SlotState<T, N>::Commit(UINT begin, UINT end)
+{
+    std::copy(wanted + begin, wanted + end, bound + begin);
+    known = true;
+}
+
+template<typename T, UINT N>
+void StateCache::SlotState<T, N>::Invalidate()
+{
+    dirtyBegin = 0;
+    dirtyEnd = N;
+    known = false;
+}
+
+StateCache::StateCache(ID3D11DeviceContext1* context)
+    : context(context)
+{
+}
+
+void StateCache::SetContext(ID3D11DeviceContext1* context)
+{
+    this->context = context;
+    Invalidate();
+}
+
+void StateCache::Invalidate()
+{
+    vertexBuffers.Invalidate();
+    shaderResources.Invalidate();
+    samplers.Invalidate();
+    vsConstantBuffers.Invalidate();
+    psConstantBuffers.Invalidate();
+
+    inputLayout.known = false;
+    topology.known = false;
+    vertexShader.known = false;
+    pixelShader.known = false;
+    viewport.known = false;
+}
+
+void StateCache::Requested()
+{
+    ++frameStats.requested;
+    ++totalStats.requested;
+}
+
+void StateCache::Issued()
+{
+    ++frameStats.issued;
+    ++totalStats.issued;
+}
+
+void StateCache::SetVertexBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* vertexBuffers, const UINT* strides, const UINT* offsets)
+{
+    Requested();
+    for (UINT i = 0; i < numBuffers; ++i)
+        this->vertexBuffers.Set(startSlot + i, { vertexBuffers[i], strides[i], offsets[i] });
+}
+
+void StateCache::SetInputLayout(ID3D11InputLayout* inputLayout)
+{
+    Requested();
+    this->inputLayout.wanted = inputLayout;
+}
+
+void StateCache::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    Requested();
+    this->topology.wanted = topology;
+}
+
+void StateCache::SetVertexShader(ID3D11VertexShader* vertexShader)
+{
+    Requested();
+    this->vertexShader.wanted = vertexShader;
+}
+
+void StateCache::SetPixelShader(ID3D11PixelShader* pixelShader)
+{
+    Requested();
+    this->pixelShader.wanted = pixelShader;
+}
+
+void StateCache::SetPSShaderResources(UINT startSlot, UINT numViews, ID3D11ShaderResourceView* const* shaderResourceViews)
+{
+    Requested();
+    for (UINT i = 0; i < numViews; ++i)
+        shaderResources.Set(startSlot + i, shaderResourceViews[i]);
+}
+
+void StateCache::SetPSSamplers(UINT startSlot, UINT numSamplers, ID3D11SamplerState* const* samplers)
+{
+    Requested();
+    for (UINT i = 0; i < numSamplers; ++i)
+        this->samplers.Set(startSlot + i, samplers[i]);
+}
+
+void StateCache::SetVSConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers)
+{
+    Requested();
+    for (UINT i = 0; i < numBuffers; ++i)
+        vsConstantBuffers.Set(startSlot + i, { constantBuffers[i], 0, 0 });
+}
+
+void StateCache::SetPSConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers)
+{
+    Requested();
+    for (UINT i = 0; i < numBuffers; ++i)
+        psConstantBuffers.Set(startSlot + i, { constantBuffers[i], 0, 0 });
+}
+
+void StateCache::SetVSConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers, const UINT* firstConstant, const UINT* numConstants)
+{
+    Requested();
+    for (UINT i = 0; i < numBuffers; ++i)
+        vsConstantBuffers.Set(startSlot + i, { constantBuffers[i], firstConstant[i], numConstants[i] });
+}
+
+void StateCache::SetPSConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers, const UINT* firstConstant, const UINT* numConstants)
+{
+    Requested();
+    for (UINT i = 0; i < numBuffers; ++i)
+        psConstantBuffers.Set(startSlot + i, { constantBuffers[i], firstConstant[i], numConstants[i] });
+}
+
+void StateCache::SetViewport(const D3D11_VIEWPORT& viewport)
+{
+    Requested();
+    this->viewport.wanted = viewport;
+}
+
+void StateCache::FlushConstantBuffers(SlotState<ConstantBufferBinding, MAX_CONSTANT_BUFFERS>& state, bool vertexStage)
+{
+    UINT begin, end;
+    if (!state.ChangedRange(begin, end))
+        return;
+
+    ID3D11Buffer* buffers[MAX_CONSTANT_BUFFERS];
+    UINT firstConstant[MAX_CONSTANT_BUFFERS];
+    UINT numConstants[MAX_CONSTANT_BUFFERS];
+    bool offsetting = false;
+
+    for (UINT slot = begin; slot < end; ++slot)
+    {
+        const ConstantBufferBinding& binding = state.wanted[slot];
+        buffers[slot - begin] = binding.buffer;
+        firstConstant[slot - begin] = binding.firstConstant;
+        numConstants[slot - begin] = binding.numConstants;
+        offsetting |= binding.numConstants != 0;
+
+        if (binding.numConstants == 0 && binding.buffer != nullptr)     //Whole buffer, in case the range also holds offset bindings
+        {
+            D3D11_BUFFER_DESC desc;
+            binding.buffer->GetDesc(&desc);
+            numConstants[slot - begin] = std::min((desc.ByteWidth / 16 + 15) & ~15u, 4096u);
+        }
+    }
+
+    if (offsetting)
+    {
+        if (vertexStage)
+            context->VSSetConstantBuffers1(begin, end - begin, buffers, firstConstant, numConstants);
+        else
+            context->PSSetConstantBuffers1(begin, end - begin, buffers, firstConstant, numConstants);
+    }
+    else if (vertexStage)
+        context->VSSetConstantBuffers(begin, end - begin, buffers);
+    else
+        context->PSSetConstantBuffers(begin, end - begin, buffers);
+
+    state.Commit(begin, end);
+    Issued();
+}
+
+void StateCache::Flush()
+{
+    UINT begin, end;
+
+    if (vertexBuffers.ChangedRange(begin, end))
+    {
+        ID3D11Buffer* buffers[MAX_VERTEX_BUFFERS];
+        UINT strides[MAX_VERTEX_BUFFERS];
+        UINT offsets[MAX_VERTEX_BUFFERS];
+        for (UINT slot = begin; slot < end; ++slot)
+        {
+            buffers[slot - begin] = vertexBuffers.wanted[slot].buffer;
+            strides[slot - begin] = vertexBuffers.wanted[slot].stride;
+            offsets[slot - begin] = vertexBuffers.wanted[slot].offset;
+        }
+
+        context->IASetVertexBuffers(begin, end - begin, buffers, strides, offsets);
+        vertexBuffers.Commit(begin, end);
+        Issued();
+    }
+
+    if (inputLayout.Changed())
+    {
+        context->IASetInputLayout(inputLayout.wanted);
+        inputLayout.Commit();
+        Issued();
+    }
+
+    if (topology.Changed())
+    {
+        context->IASetPrimitiveTopology(topology.wanted);
+        topology.Commit();
+        Issued();
+    }
+
+    if (vertexShader.Changed())
+    {
+        context->VSSetShader(vertexShader.wanted, nullptr, 0);
+        vertexShader.Commit();
+        Issued();
+    }
+
+    FlushConstantBuffers(vsConstantBuffers, true);
+
+    if (viewport.Changed())
+    {
+        context->RSSetViewports(1, &viewport.wanted);
+        viewport.Commit();
+        Issued();
+    }
+
+    if (pixelShader.Changed())
+    {
+        context->PSSetShader(pixelShader.wanted, nullptr, 0);
+        pixelShader.Commit();
+        Issued();
+    }
+
+    if (shaderResources.ChangedRange(begin, end))
+    {
+        context->PSSetShaderResources(begin, end - begin, shaderResources.wanted + begin);
+        shaderResources.Commit(begin, end);
+        Issued();
+    }
+
+    if (samplers.ChangedRange(begin, end))
+    {
+        context->PSSetSamplers(begin, end - begin, samplers.wanted + begin);
+        samplers.Commit(begin, end);
+        Issued();
+    }
+
+    FlushConstantBuffers(psConstantBuffers, false);
+}
+
+void StateCache::Draw(UINT vertexCount, UINT startVertexLocation)
+{
+    Flush();
+    context->Draw(vertexCount, startVertexLocation);
+    ++frameStats.draws;
+    ++totalStats.draws;
+}
+
+void StateCache::DrawInstanced(UINT vertexCountPerInstance, UINT instanceCount, UINT startVertexLocation, UINT startInstanceLocation)
+{
+    Flush();
+    context->DrawInstanced(vertexCountPerInstance, instanceCount, startVertexLocation, startInstanceLocation);
+    ++frameStats.draws;
+    ++totalStats.draws;
+}
+
+void StateCache::BeginFrame()
+{
+    frameStats = StateCacheStats();
+}
+
+#ifndef _WIN32
+
+namespace
+{
+    struct BenchmarkScene       //Stand-in objects, only their addresses matter to the cache and the mock context
+    {
+        std::vector<ID3D11VertexShader*> vertexShaders;
+        std::vector<ID3D11PixelShader*> pixelShaders;
+        std::vector<ID3D11ShaderResourceView*> textures;
+        ID3D11InputLayout* inputLayout;
+        ID3D11SamplerState* sampler;
+        ID3D11Buffer* vBuffer;
+        ID3D11Buffer* cBuffer;
+        ID3D11Buffer* lBuffer;
+        D3D11_VIEWPORT viewPort;
+
+        struct Object { UINT shader, texture; };
+        std::vector<Object> objects;
+    };
+
+    //What BindResourcesToPipeline does, once per object, plus the per-object constants and the draw
+    template<typename Target>
+    void DrawObject(Target& target, BenchmarkScene& scene, const BenchmarkScene::Object& object, UINT index)
+    {
+        UINT stride = sizeof(float) * 8;
+        UINT offset = 0;
+        UINT firstConstant = (index % 256) * 16;
+        UINT numConstants = 16;
+
+        target.SetVertexBuffers(0, 1, &scene.vBuffer, &stride, &offset);
+        target.SetInputLayout(scene.inputLayout);
+        target.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+        target.SetVertexShader(scene.vertexShaders[object.shader]);
+        target.SetPixelShader(scene.pixelShaders[object.shader]);
+        target.SetPSShaderResources(0, 1, &scene.textures[object.texture]);
+        target.SetPSSamplers(0, 1, &scene.sampler);
+        target.SetPSConstantBuffers(0, 1, &scene.lBuffer);
+        target.SetViewport(scene.viewPort);
+        target.SetVSConstantBuffers1(0, 1, &scene.cBuffer, &firstConstant, &numConstants);
+        target.Draw(4, 0);
+    }
+
+    struct DirectTarget         //Same interface as StateCache, every call goes straight to the context
+    {
+        ID3D11DeviceContext1* context;
+
+        void SetVertexBuffers(UINT s, UINT n, ID3D11Buffer* const* b, const UINT* st, const UINT* o) { context->IASetVertexBuffers(s, n, b, st, o); }
+        void SetInputLayout(ID3D11InputLayout* l) { context->IASetInputLayout(l); }
+        void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY t) { context->IASetPrimitiveTopology(t); }
+        void SetVertexShader(ID3D11VertexShader* v) { context->VSSetShader(v, nullptr, 0); }
+        void SetPixelShader(ID3D11PixelShader* p) { context->PSSetShader(p, nullptr, 0); }
+        void SetPSShaderResources(UINT s, UINT n, ID3D11ShaderResourceView* const* v) { context->PSSetShaderResources(s, n, v); }
+        void SetPSSamplers(UINT s, UINT n, ID3D11SamplerState* const* v) { context->PSSetSamplers(s, n, v); }
+        void SetPSConstantBuffers(UINT s, UINT n, ID3D11Buffer* const* b) { context->PSSetConstantBuffers(s, n, b); }
+        void SetVSConstantBuffers1(UINT s, UINT n, ID3D11Buffer* const* b, const UINT* f, const UINT* c) { context->VSSetConstantBuffers1(s, n, b, f, c); }
+        void SetViewport(const D3D11_VIEWPORT& v) { context->RSSetViewports(1, &v); }
+        void Draw(UINT v, UINT s) { context->Draw(v, s); }
+    };
+}
+
+void RunStateCacheBenchmark()
+{
+    const UINT OBJECTS = 10000;
+    const double secondsPerRun = 0.5;
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    BenchmarkScene scene;
+    for (int i = 0; i < 4; ++i)
+    {
+        scene.vertexShaders.push_back(new ID3D11VertexShader());
+        scene.pixelShaders.push_back(new ID3D11PixelShader());
+    }
+    for (int i = 0; i < 64; ++i)
+        scene.textures.push_back(new ID3D11ShaderResourceView());
+    scene.inputLayout = new ID3D11InputLayout();
+    scene.sampler = new ID3D11SamplerState();
+    scene.vBuffer = new ID3D11Buffer();
+    scene.cBuffer = new ID3D11Buffer();
+    scene.lBuffer = new ID3D11Buffer();
+    scene.viewPort = { 0, 0, 1024, 576, 0, 1 };
+
+    std::srand(1);
+    scene.objects.resize(OBJECTS);
+    for (BenchmarkScene::Object& object : scene.objects)
+        object = { static_cast<UINT>(std::rand() % 4), static_cast<UINT>(std::rand() % 64) };
+
+    std::vector<BenchmarkScene::Object> sorted = scene.objects;
+    std::sort(sorted.begin(), sorted.end(), [](const BenchmarkScene::Object& a, const BenchmarkScene::Object& b)
+    {
+        return a.shader != b.shader ? a.shader < b.shader : a.texture < b.texture;
+    });
+
+    struct Run { const char* name; const std::vector<BenchmarkScene::Object>* objects; bool cached; };
+    const Run runs[] =
+    {
+        { "direct, random order", &scene.objects, false },
+        { "cached, random order", &scene.objects, true },
+        { "direct, sorted by state", &sorted, false },
+        { "cached, sorted by state", &sorted, true },
+    };
+
+    DirectTarget direct = { context };
+    StateCache cache(context);
+
+    for (const Run& run : runs)
+    {
+        unsigned frames = 0;
+        UINT64 callsBefore = context->counters.stateCalls;
+        StateCacheStats frame;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+
+        while (elapsed < secondsPerRun)
+        {
+            cache.BeginFrame();
+            for (UINT i = 0; i < OBJECTS; ++i)
+            {
+                if (run.cached)
+                    DrawObject(cache, scene, (*run.objects)[i], i);
+                else
+                    DrawObject(direct, scene, (*run.objects)[i], i);
+            }
+            frame = cache.FrameStats();
+            ++frames;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        double callsPerFrame = static_cast<double>(context->counters.stateCalls - callsBefore) / frames;
+        std::printf("%-24s  %6u draws  %8.0f state calls/frame", run.name, OBJECTS, callsPerFrame);
+        if (run.cached)
+            std::printf("  (%llu filtered of %llu)", static_cast<unsigned long long>(frame.Filtered()), static_cast<unsigned long long>(frame.requested));
+        std::printf("  %7.1f ns/draw\n", elapsed * 1e9 / (static_cast<double>(frames) * OBJECTS));
+    }
+
+    for (ID3D11VertexShader* shader : scene.vertexShaders)
+        shader->Release();
+    for (ID3D11PixelShader* shader : scene.pixelShaders)
+        shader->Release();
+    for (ID3D11ShaderResourceView* texture : scene.textures)
+        texture->Release();
+    scene.inputLayout->Release();
+    scene.sampler->Release();
+    scene.vBuffer->Release();
+    scene.cBuffer->Release();
+    scene.lBuffer->Release();
+    context->Release();
+    device->Release();
+}
+
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "D3D11Compat.h"
+
+//Redundant-state filter between the renderer and the device context. Set* calls only record the wanted state;
+//Flush (and Draw / DrawInstanced, which flush first) compares it with what the context already has bound,
+//drops the calls that would change nothing and merges the changed slots of each stage into one ranged call.
+//Binds made on the context directly are invisible here, call Invalidate() after them.
+
+struct StateCacheStats
+{
+	UINT64 requested = 0;		//Set* calls made on the cache
+	UINT64 issued = 0;			//Set* calls that reached the context
+	UINT64 draws = 0;
+
+	UINT64 Filtered() const { return requested - issued; }
+};
+
+class StateCache
+{
+public:
+	static const UINT MAX_VERTEX_BUFFERS = 4;
+	static const UINT MAX_SHADER_RESOURCES = 8;
+	static const UINT MAX_SAMPLERS = 4;
+	static const UINT MAX_CONSTANT_BUFFERS = 4;
+
+	explicit StateCache(ID3D11DeviceContext1* context = nullptr);
+
+	void SetContext(ID3D11DeviceContext1* context);		//Also invalidates
+	void Invalidate();		//Forget what the context has bound, the next flush sets every recorded state again
+
+	void SetVertexBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* vertexBuffers, const UINT* strides, const UINT* offsets);
+	void SetInputLayout(ID3D11InputLayout* inputLayout);
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void SetVertexShader(ID3D11VertexShader* vertexShader);
+	void SetPixelShader(ID3D11PixelShader* pixelShader);
+	void SetPSShaderResources(UINT startSlot, UINT numViews, ID3D11ShaderResourceView* const* shaderResourceViews);
+	void SetPSSamplers(UINT startSlot, UINT numSamplers, ID3D11SamplerState* const* samplers);
+	void SetVSConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers);
+	void SetPSConstantBuffers(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers);
+	//Offsets in 16-byte constants as for *SetConstantBuffers1, e.g. a ConstantBufferAllocation
+	void SetVSConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers, const UINT* firstConstant, const UINT* numConstants);
+	void SetPSConstantBuffers1(UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers, const UINT* firstConstant, const UINT* numConstants);
+	void SetViewport(const D3D11_VIEWPORT& viewport);
+
+	void Flush();
+	void Draw(UINT vertexCount, UINT startVertexLocation);
+	void DrawInstanced(UINT vertexCountPerInstance, UINT instanceCount, UINT startVertexLocation, UINT startInstanceLocation);
+
+	void BeginFrame();		//Starts a new FrameStats()
+	const StateCacheStats& FrameStats() const { return frameStats; }
+	const StateCacheStats& TotalStats() const { return totalStats; }
+
+private:
+	struct VertexBufferBinding
+	{
+		ID3D11Buffer* buffer;
+		UINT stride;
+		UINT offset;
+
+		bool operator!=(const VertexBufferBinding& other) const { return buffer != other.buffer || stride != other.stride || offset != other.offset; }
+	};
+
+	struct ConstantBufferBinding
+	{
+		ID3D11Buffer* buffer;
+		UINT firstConstant;
+		UINT numConstants;		//0 binds the whole buffer through *SetConstantBuffers
+
+		bool operator!=(const ConstantBufferBinding& other) const { return buffer != other.buffer || firstConstant != other.firstConstant || numConstants != other.numConstants; }
+	};
+
+	template<typename T, UINT N>
+	struct SlotState				//Wanted and bound value per slot, plus the slot range touched since the last flush
+	{
+		T wanted[N] = {};
+		T bound[N] = {};
+		UINT dirtyBegin = N;
+		UINT dirtyEnd = 0;
+		bool known = true;		//Everything starts unbound, as on a fresh context
+
+		void Set(UINT slot, const T& value);
+		bool ChangedRange(UINT& begin, UINT& end);		//Narrows the dirty range to slots that really differ
+		void Commit(UINT begin, UINT end);
+		void Invalidate();
+	};
+
+	template<typename T>
+	struct SingleState
+	{
+		T wanted = {};
+		T bound = {};
+		bool known = false;		//Whether bound reflects the context
+
+		bool Changed() const { return !known || wanted != bound; }
+		void Commit() { bound = wanted; known = true; }
+	};
+
+	void FlushConstantBuffers(SlotState<ConstantBufferBinding, MAX_CONSTANT_BUFFERS>& state, bool vertexStage);
+	void Requested();
+	void Issued();
+
+	ID3D11DeviceContext1* context;
+
+	SlotState<VertexBufferBinding, MAX_VERTEX_BUFFERS> vertexBuffers;
+	SlotState<ID3D11ShaderResourceView*, MAX_SHADER_RESOURCES> shaderResources;
+	SlotState<ID3D11SamplerState*, MAX_SAMPLERS> samplers;
+	SlotState<ConstantBufferBinding, MAX_CONSTANT_BUFFERS> vsConstantBuffers;
+	SlotState<ConstantBufferBinding, MAX_CONSTANT_BUFFERS> psConstantBuffers;
+
+	SingleState<ID3D11InputLayout*> inputLayout;
+	SingleState<D3D11_PRIMITIVE_TOPOLOGY> topology;
+	SingleState<ID3D11VertexShader*> vertexShader;
+	SingleState<ID3D11PixelShader*> pixelShader;
+	SingleState<D3D11_VIEWPORT> viewport;
+
+	StateCacheStats frameStats;
+	StateCacheStats totalStats;
+};
+
+#ifndef _WIN32
+void RunStateCacheBenchmark();
+#endif
@@ -0,0 +1,275 @@
+#include "TexelLayout.h"
+#include "PhongShading.h"
+#include "TextureImage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+const char* TexelLayoutName(TexelLayout layout)
+{
+    switch (layout)
+    {
+    case TexelLayout::Tiled4x4: return "tiled 4x4";
+    case TexelLayout::Morton:   return "morton";
+    default:                    return "linear";
+    }
+}
+
+bool ParseTexelLayout(const char* name, TexelLayout& layout)
+{
+    const TexelLayout layouts[] = { TexelLayout::Linear, TexelLayout::Tiled4x4, TexelLayout::Morton };
+    const char* names[] = { "linear", "tiled", "morton" };
+    for (int i = 0; i < 3; ++i)
+    {
+        if (std::strcmp(name, names[i]) == 0)
+        {
+            layout = layouts[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TexelCount(unsigned width, unsigned height, TexelLayout layout)
+{
+    switch (layout)
+    {
+    case TexelLayout::Tiled4x4: return size_t((width + 3) & ~3u) * ((height + 3) & ~3u);
+    case TexelLayout::Morton:   return size_t((width + 31) & ~31u) * ((height + 31) & ~31u);
+    default:                    return size_t(width) * height;
+    }
+}
+
+SoftwareTexture SwizzleTexture(const SoftwareTexture& texture, TexelLayout layout)
+{
+    SoftwareTexture swizzled;
+    swizzled.width = texture.width;
+    swizzled.height = texture.height;
+    swizzled.layout = layout;
+    swizzled.texels.assign(TexelCount(texture.width, texture.height, layout), 0);
+
+    for (unsigned y = 0; y < texture.height; ++y)
+        for (unsigned x = 0; x < texture.width; ++x)
+            swizzled.texels[swizzled.TexelIndex(x, y)] = texture.texels[texture.TexelIndex(x, y)];
+
+    return swizzled;
+}
+
+bool LoadSoftwareTexture(const char* path, TexelLayout layout, SoftwareTexture& texture)
+{
+    TextureImage image;
+    if (!LoadTextureImage(path, image))
+        return false;
+
+    texture = SwizzleTexture(ExpandTexture(image), layout);
+    return true;
+}
+
+#ifndef _WIN32
+
+namespace
+{
+    //32 KB, 8-way, 64-byte lines with LRU replacement, the L1D of most x86 cores
+    class CacheModel
+    {
+    public:
+        static const unsigned SETS = 64;
+        static const unsigned WAYS = 8;
+
+        void Access(const void* address)
+        {
+            uint64_t line = reinterpret_cast<uintptr_t>(address) >> 6;
+            uint64_t* set = tags[line % SETS];
+            ++clock;
+
+            unsigned victim = 0;
+            for (unsigned way = 0; way < WAYS; ++way)
+            {
+                if (set[way] == line + 1)
+                {
+                    ages[line % SETS][way] = clock;
+                    return;
+                }
+                if (ages[line % SETS][way] < ages[line % SETS][victim])
+                    victim = way;
+            }
+
+            ++misses;
+            set[victim] = line + 1;
+            ages[line % SETS][victim] = clock;
+        }
+
+        uint64_t misses = 0;
+
+    private:
+        uint64_t tags[SETS][WAYS] = {};
+        uint64_t ages[SETS][WAYS] = {};
+        uint64_t clock = 0;
+    };
+
+    //The texture coordinates the rasterizer would hand the pixel shader for a 1x1 quad two units in front of the eye,
+    //turned by angle around its vertical (yaw) or horizontal (pitch, a floor) axis. Pixels come in the renderer's
+    //order: 64x64 tiles, rows inside a tile.
+    void QuadTextureCoordinates(unsigned screenWidth, unsigned screenHeight, float angle, bool pitch, std::vector<float>& us, std::vector<float>& vs)
+    {
+        const unsigned TILE = 64;
+        const float tanHalfFov = std::tan(3.14159265f / 8);
+        const float aspect = static_cast<float>(screenWidth) / screenHeight;
+        const float center[3] = { 0.0f, 0.0f, 2.0f };
+
+        float across[3] = { 1, 0, 0 }, down[3] = { 0, -1, 0 };      //Quad edges along u and v
+        if (pitch)
+        {
+            down[1] = -std::cos(angle);
+            down[2] = std::sin(angle);
+        }
+        else
+        {
+            across[0] = std::cos(angle);
+            across[2] = -std::sin(angle);
+        }
+        float normal[3] = { across[1] * down[2] - across[2] * down[1], across[2] * down[0] - across[0] * down[2], across[0] * down[1] - across[1] * down[0] };
+        float planeDistance = normal[0] * center[0] + normal[1] * center[1] + normal[2] * center[2];
+
+        us.clear();
+        vs.clear();
+        for (unsigned tileY = 0; tileY < screenHeight; tileY += TILE)
+            for (unsigned tileX = 0; tileX < screenWidth; tileX += TILE)
+                for (unsigned y = tileY; y < std::min(tileY + TILE, screenHeight); ++y)
+                    for (unsigned x = tileX; x < std::min(tileX + TILE, screenWidth); ++x)
+                    {
+                        float ray[3] = { ((x + 0.5f) / screenWidth * 2 - 1) * tanHalfFov * aspect, (1 - (y + 0.5f) / screenHeight * 2) * tanHalfFov, 1 };
+                        float facing = normal[0] * ray[0] + normal[1] * ray[1] + normal[2] * ray[2];
+                        if (std::fabs(facing) < 1e-6f)
+                            continue;
+
+                        float t = planeDistance / facing;
+                        float offset[3] = { ray[0] * t - center[0], ray[1] * t - center[1], ray[2] * t - center[2] };
+                        float u = offset[0] * across[0] + offset[1] * across[1] + offset[2] * across[2] + 0.5f;
+                        float v = offset[0] * down[0] + offset[1] * down[1] + offset[2] * down[2] + 0.5f;
+                        if (t > 0 && u >= 0 && u < 1 && v >= 0 && v < 1)
+                        {
+                            us.push_back(u);
+                            vs.push_back(v);
+                        }
+                    }
+    }
+}
+
+void RunTexelLayoutBenchmark()
+{
+    const unsigned SCREEN_WIDTH = 1024;
+    const unsigned SCREEN_HEIGHT = 576;
+    const unsigned sizes[] = { 512, 2048 };
+    const float angles[] = { 0.0f, 1.2f, 1.4f };
+    const TexelLayout layouts[] = { TexelLayout::Linear, TexelLayout::Tiled4x4, TexelLayout::Morton };
+    const double secondsPerRun = 0.3;
+
+    LightMaterialProperties properties = DefaultLightMaterialProperties();
+
+    for (unsigned size : sizes)
+    {
+        SoftwareTexture linear;
+        linear.width = linear.height = size;
+        linear.texels.resize(size_t(size) * size);
+        for (unsigned y = 0; y < size; ++y)
+            for (unsigned x = 0; x < size; ++x)
+                linear.texels[size_t(y) * size + x] = 0xFF000000u | ((x * 7) & 0xFF) | ((y * 5) & 0xFF) << 8 | ((x ^ y) & 0xFF) << 16;
+
+        SoftwareTexture textures[3];
+        for (int l = 0; l < 3; ++l)
+        {
+            auto start = std::chrono::steady_clock::now();
+            textures[l] = SwizzleTexture(linear, layouts[l]);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::printf("%4ux%-4u %-9s  swizzled at load in %7.2f ms, %6.2f MB\n", size, size, TexelLayoutName(layouts[l]), ms,
+                        textures[l].texels.size() * 4 / (1024.0 * 1024.0));
+        }
+
+        for (int pitch = 0; pitch < 2; ++pitch)
+            for (float angle : angles)
+            {
+                std::vector<float> us, vs;
+                QuadTextureCoordinates(SCREEN_WIDTH, SCREEN_HEIGHT, angle, pitch != 0, us, vs);
+                size_t count = us.size();
+
+                std::vector<FragmentBlock> blocks((count + FragmentBlock::SIZE - 1) / FragmentBlock::SIZE);
+                for (size_t i = 0; i < blocks.size() * FragmentBlock::SIZE; ++i)
+                {
+                    FragmentBlock& block = blocks[i / FragmentBlock::SIZE];
+                    unsigned lane = i % FragmentBlock::SIZE;
+                    size_t source = std::min(i, count - 1);
+                    block.uv[0][lane] = us[source];
+                    block.uv[1][lane] = vs[source];
+                    block.normal[0][lane] = block.normal[1][lane] = 0;
+                    block.normal[2][lane] = -1;
+                    block.worldPosition[0][lane] = block.worldPosition[1][lane] = block.worldPosition[2][lane] = block.worldPosition[3][lane] = 0;
+                }
+
+                std::vector<uint32_t> reference(blocks.size() * FragmentBlock::SIZE), colors(reference.size());
+                for (size_t b = 0; b < blocks.size(); ++b)
+                    ShadeFragments(blocks[b], FragmentBlock::SIZE, properties, textures[0], &reference[b * FragmentBlock::SIZE]);
+
+                for (int l = 0; l < 3; ++l)
+                {
+                    const SoftwareTexture& texture = textures[l];
+
+                    //The four taps of every sample, replayed through the cache model in the order the sampler reads them
+                    CacheModel cache;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        float x = us[i] * size - 0.5f, y = vs[i] * size - 0.5f;
+                        int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+                        unsigned wx0 = (x0 + size) % size, wy0 = (y0 + size) % size;
+                        unsigned wx1 = (wx0 + 1) % size, wy1 = (wy0 + 1) % size;
+                        cache.Access(&texture.texels[texture.TexelIndex(wx0, wy0)]);
+                        cache.Access(&texture.texels[texture.TexelIndex(wx1, wy0)]);
+                        cache.Access(&texture.texels[texture.TexelIndex(wx0, wy1)]);
+                        cache.Access(&texture.texels[texture.TexelIndex(wx1, wy1)]);
+                    }
+
+                    unsigned runs = 0;
+                    double checksum = 0;
+                    auto start = std::chrono::steady_clock::now();
+                    double elapsed = 0;
+                    while (elapsed < secondsPerRun)
+                    {
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            float color[4];
+                            SampleBilinearWrap(texture, us[i], vs[i], color);
+                            checksum += color[0];
+                        }
+                        ++runs;
+                        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    }
+                    double scalarRate = runs * double(count) / elapsed;
+                    checksum /= runs;
+
+                    runs = 0;
+                    start = std::chrono::steady_clock::now();
+                    elapsed = 0;
+                    while (elapsed < secondsPerRun)
+                    {
+                        for (size_t b = 0; b < blocks.size(); ++b)
+                            ShadeFragments(blocks[b], FragmentBlock::SIZE, properties, texture, &colors[b * FragmentBlock::SIZE]);
+                        ++runs;
+                        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    }
+                    double shadedRate = runs * double(colors.size()) / elapsed;
+
+                    bool identical = colors == reference;
+                    std::printf("%4ux%-4u %-5s %.1f rad  %-9s  %7zu samples  %6.3f L1 misses/sample  %7.1f Msamples/s scalar  "
+                                "%7.1f Mfragments/s %s%s  (checksum %.0f)\n",
+                                size, size, pitch ? "pitch" : "yaw", angle, TexelLayoutName(layouts[l]), count, cache.misses / double(count),
+                                scalarRate / 1e6, shadedRate / 1e6, ShadingIsaName(BestShadingIsa()), identical ? "" : "  MISMATCH", checksum);
+                }
+            }
+    }
+}
+
+#endif
\ No newline at end of file
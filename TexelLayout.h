@@ -0,0 +1,22 @@
+#pragma once
+
+#include "SoftwareTexture.h"
+
+//Swizzled copies of SoftwareTexture for the CPU sampler. Bilinear taps at grazing angles step across many rows per
+//pixel; in Tiled4x4 or Morton order those rows share cache lines instead of each costing one. MipChain,
+//BlockCompression and the upload paths keep reading Linear textures only.
+
+const char* TexelLayoutName(TexelLayout layout);
+bool ParseTexelLayout(const char* name, TexelLayout& layout);		//"linear", "tiled" or "morton"
+
+size_t TexelCount(unsigned width, unsigned height, TexelLayout layout);		//Including the padding of swizzled layouts
+
+//Reorders texture, in whatever layout it is, into layout; padding texels are 0
+SoftwareTexture SwizzleTexture(const SoftwareTexture& texture, TexelLayout layout);
+
+//stbi_load through LoadTextureImage, expanded to RGBA8 and swizzled once at load
+bool LoadSoftwareTexture(const char* path, TexelLayout layout, SoftwareTexture& texture);
+
+#ifndef _WIN32
+void RunTexelLayoutBenchmark();
+#endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "InstancedQuads.h"
+#include "TextureImage.h"
+#include "TextureStreaming.h"
+#include "ThreadPool.h"
+
+//Packs many small images into a few large pages, so quads that each show a different image still share one SRV bind
+//and one DrawInstanced per page instead of a bind and a draw per image.
+//
+//Placement is skyline bottom-left: a page keeps the top edge of everything placed so far as a list of horizontal
+//segments, and each image goes where its bottom would sit lowest, leftmost on ties. Packing runs once per sort order
+//(height, area, longer side, width), in parallel, and the result with the fewest pages, then the least page area used,
+//is kept. The images are then copied into their pages in parallel.
+//
+//Every image is surrounded by padding texels that repeat its edge, so bilinear taps and the first mip levels never
+//reach a neighbour. Pages are mipped with the box filter: a texel of level n averages an aligned 2^n square of level 0,
+//so it reaches at most 2^n - 1 texels past an image, where a wider filter would take in the next image. Positions are multiples of alignment, which keeps BC blocks from straddling two images.
+
+struct AtlasOptions
+{
+	unsigned pageSize = 2048;			//Width and height of every page
+	unsigned padding = 4;				//Texels on each side of an image; log2(padding) mip levels below level 0 stay free of bleeding
+	unsigned alignment = 4;				//Of image positions and padded sizes, 4 for BC pages
+};
+
+enum class AtlasSort { Height, Area, LongerSide, Width };
+
+const char* AtlasSortName(AtlasSort sort);
+
+struct AtlasEntry
+{
+	unsigned page = 0;
+	unsigned x = 0;						//Top left texel of the image itself, inside its padding
+	unsigned y = 0;
+	unsigned width = 0;
+	unsigned height = 0;
+	float uvRect[4] = { 0.0f, 0.0f, 1.0f, 1.0f };		//Offset u, offset v, scale u, scale v: page uv = uv * scale + offset
+};
+
+struct TextureAtlas
+{
+	std::vector<TextureImage> pages;		//RGBA8, pageSize square, unused texels transparent black
+	std::vector<AtlasEntry> entries;		//One per image, in input order
+	AtlasSort sort = AtlasSort::Height;		//The order that won
+	uint64_t imageTexels = 0;				//Without padding
+
+	double Occupancy() const;				//Image texels over page texels
+};
+
+//false with a message on std::cerr when an image with its padding is larger than a page
+bool PackAtlas(const std::vector<TextureImage>& images, const AtlasOptions& options, TextureAtlas& atlas, ThreadPool* threadPool = nullptr);
+
+//Placement only, one sort order, no texels copied; what PackAtlas runs per order
+bool PlaceAtlasEntries(const std::vector<TextureImage>& images, const AtlasOptions& options, AtlasSort sort, std::vector<AtlasEntry>& entries,
+					   unsigned& pageCount);
+
+//PrepareTextureUpload for a page with box-filtered mips, its mip chain cut after the levels the padding protects
+TextureUpload PrepareAtlasUpload(const TextureImage& page, const AtlasOptions& options, const std::string& cacheDirectory, ThreadPool* threadPool = nullptr);
+
+//Points instance i at image images[i]: writes its atlas rectangle into transforms and appends i to the list of its page,
+//so each page is one DrawInstancedQuads over its list with that page bound
+void MapInstancesToAtlas(const TextureAtlas& atlas, const std::vector<uint32_t>& images, InstanceTransforms& transforms,
+						 std::vector<std::vector<uint32_t>>& pageInstances);
+
+#ifndef _WIN32
+void RunTextureAtlasBenchmark();
+#endif
\ No newline at end of file
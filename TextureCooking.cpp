@@ -0,0 +1,294 @@
+#include "TextureCooking.h"
+#include "MipChain.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+    const uint32_t COOKED_VERSION = 1;
+    const char COOKED_MAGIC[4] = { 'C', 'T', 'E', 'X' };
+
+    struct CookedHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t format;            //DXGI_FORMAT
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+    };
+
+    struct CookedLevel
+    {
+        uint64_t offset;            //From the start of the file, a multiple of COOKED_ALIGNMENT
+        uint64_t size;
+        uint32_t rowPitch;
+        uint32_t reserved;
+    };
+
+    uint64_t AlignUp(uint64_t value)
+    {
+        return (value + COOKED_ALIGNMENT - 1) & ~uint64_t(COOKED_ALIGNMENT - 1);
+    }
+
+    const CookedHeader& Header(const uint8_t* data)
+    {
+        return *reinterpret_cast<const CookedHeader*>(data);
+    }
+
+    const CookedLevel& Level(const uint8_t* data, unsigned level)
+    {
+        return reinterpret_cast<const CookedLevel*>(data + sizeof(CookedHeader))[level];
+    }
+
+    //Rows of texels or 4x4 blocks in a level and the bytes each takes; false for a format WriteCookedTexture never writes
+    bool LevelShape(uint32_t format, unsigned width, unsigned height, uint64_t& rows, uint64_t& rowBytes)
+    {
+        rows = height;
+        switch (format)
+        {
+        case DXGI_FORMAT_R8_UNORM:       rowBytes = uint64_t(width); return true;
+        case DXGI_FORMAT_R8G8_UNORM:     rowBytes = uint64_t(width) * 2; return true;
+        case DXGI_FORMAT_R8G8B8A8_UNORM: rowBytes = uint64_t(width) * 4; return true;
+        case DXGI_FORMAT_BC1_UNORM:      rows = (height + 3) / 4; rowBytes = uint64_t((width + 3) / 4) * 8; return true;
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC7_UNORM:      rows = (height + 3) / 4; rowBytes = uint64_t((width + 3) / 4) * 16; return true;
+        default:                         return false;
+        }
+    }
+}
+
+bool WriteCookedTexture(const TextureUpload& upload, const std::string& path)
+{
+    std::vector<CookedLevel> levels(upload.LevelCount());
+    uint64_t offset = AlignUp(sizeof(CookedHeader) + levels.size() * sizeof(CookedLevel));
+    for (unsigned level = 0; level < upload.LevelCount(); ++level)
+    {
+        uint64_t rows, rowBytes;
+        LevelShape(upload.format, std::max(1u, upload.width >> level), std::max(1u, upload.height >> level), rows, rowBytes);
+        levels[level] = { offset, rows * upload.rowPitches[level], upload.rowPitches[level], 0 };
+        offset = AlignUp(offset + levels[level].size);
+    }
+
+    return WriteFileAtomically(path, [&](std::ostream& file)
+    {
+        CookedHeader header = { { COOKED_MAGIC[0], COOKED_MAGIC[1], COOKED_MAGIC[2], COOKED_MAGIC[3] }, COOKED_VERSION,
+                                static_cast<uint32_t>(upload.format), upload.width, upload.height, upload.LevelCount() };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(CookedLevel));
+
+        const char padding[COOKED_ALIGNMENT] = {};
+        uint64_t written = sizeof(header) + levels.size() * sizeof(CookedLevel);
+        for (unsigned level = 0; level < upload.LevelCount(); ++level)
+        {
+            file.write(padding, levels[level].offset - written);
+            file.write(static_cast<const char*>(upload.LevelData(level)), levels[level].size);
+            written = levels[level].offset + levels[level].size;
+        }
+    });
+}
+
+bool CookTexture(const std::string& sourcePath, const std::string& outputPath, const std::string& cacheDirectory, ThreadPool* threadPool)
+{
+    TextureImage image;
+    if (!LoadTextureImage(sourcePath.c_str(), image))
+        return false;
+
+    return WriteCookedTexture(PrepareTextureUpload(image, cacheDirectory, threadPool), outputPath);
+}
+
+bool IsCookedTexturePath(const std::string& path)
+{
+    size_t length = std::strlen(COOKED_EXTENSION);
+    return path.size() >= length && path.compare(path.size() - length, length, COOKED_EXTENSION) == 0;
+}
+
+bool CookedTexture::Open(const std::string& path)
+{
+    if (!file.Open(path))
+        return false;
+
+    //Every level must lie inside the file, aligned and large enough for what CreateTexture2D reads from it: the rows the
+    //header's size and format give that level, each rowPitch apart
+    const uint8_t* data = file.Data();
+    size_t size = file.Size();
+    uint64_t rows = 0, rowBytes = 0;
+    bool valid = size >= sizeof(CookedHeader) && std::memcmp(Header(data).magic, COOKED_MAGIC, 4) == 0 && Header(data).version == COOKED_VERSION &&
+                 Header(data).width > 0 && Header(data).height > 0 && LevelShape(Header(data).format, 1, 1, rows, rowBytes) &&
+                 Header(data).levelCount > 0 && Header(data).levelCount <= MipLevelCount(Header(data).width, Header(data).height) &&
+                 size >= sizeof(CookedHeader) + Header(data).levelCount * sizeof(CookedLevel);
+    for (unsigned level = 0; valid && level < Header(data).levelCount; ++level)
+    {
+        const CookedLevel& entry = Level(data, level);
+        LevelShape(Header(data).format, std::max(1u, Header(data).width >> level), std::max(1u, Header(data).height >> level), rows, rowBytes);
+        valid = entry.offset % COOKED_ALIGNMENT == 0 && entry.offset <= size && entry.size <= size - entry.offset && entry.rowPitch >= rowBytes &&
+                entry.size / entry.rowPitch >= rows;
+    }
+
+    if (!valid)
+    {
+        std::cerr << path << " is not a cooked texture of version " << COOKED_VERSION << std::endl;
+        file.Close();
+        return false;
+    }
+    return true;
+}
+
+void CookedTexture::Close()
+{
+    file.Close();
+}
+
+DXGI_FORMAT CookedTexture::Format() const
+{
+    return static_cast<DXGI_FORMAT>(Header(file.Data()).format);
+}
+
+unsigned CookedTexture::Width() const
+{
+    return Header(file.Data()).width;
+}
+
+unsigned CookedTexture::Height() const
+{
+    return Header(file.Data()).height;
+}
+
+unsigned CookedTexture::LevelCount() const
+{
+    return file.Data() != nullptr ? Header(file.Data()).levelCount : 0;
+}
+
+const uint8_t* CookedTexture::LevelData(unsigned level) const
+{
+    return file.Data() + Level(file.Data(), level).offset;
+}
+
+UINT CookedTexture::RowPitch(unsigned level) const
+{
+    return Level(file.Data(), level).rowPitch;
+}
+
+TextureUpload UploadFromCookedTexture(std::shared_ptr<const CookedTexture> cooked)
+{
+    TextureUpload upload;
+    upload.format = cooked->Format();
+    upload.width = cooked->Width();
+    upload.height = cooked->Height();
+    for (unsigned level = 0; level < cooked->LevelCount(); ++level)
+        upload.rowPitches.push_back(cooked->RowPitch(level));
+    upload.cooked = std::move(cooked);
+    return upload;
+}
+
+#ifndef _WIN32
+
+void RunTextureCookingBenchmark()
+{
+    const unsigned SIZE = 1024;
+    const unsigned COUNT = 16;
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "cooking-benchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::string cacheDirectory = (directory / "cache").string();
+
+    //Opaque binary PPMs, the cheapest format stb_image decodes, so the stb timings are a lower bound for PNG and JPEG
+    std::vector<std::string> sources;
+    for (unsigned i = 0; i < COUNT; ++i)
+    {
+        std::string path = (directory / ("source" + std::to_string(i) + ".ppm")).string();
+        std::ofstream file(path, std::ios::binary);
+        file << "P6\n" << SIZE << " " << SIZE << "\n255\n";
+        std::srand(i + 1);
+        std::vector<char> texels(size_t(SIZE) * SIZE * 3);
+        for (size_t t = 0; t < texels.size(); ++t)
+            texels[t] = static_cast<char>(((t / 3) % SIZE + i * 17) ^ (std::rand() & 31));
+        file.write(texels.data(), texels.size());
+        sources.push_back(path);
+    }
+
+    ThreadPool pool;
+    const char* variants[] = { "RGBA8", "BC1" };
+    std::vector<std::string> cooked[2];
+    for (int compressed = 0; compressed < 2; ++compressed)
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t bytes = 0;
+        for (unsigned i = 0; i < COUNT; ++i)
+        {
+            std::string path = (directory / (std::string(variants[compressed]) + std::to_string(i) + COOKED_EXTENSION)).string();
+            if (!CookTexture(sources[i], path, compressed ? cacheDirectory : "", &pool))
+                return;
+            bytes += std::filesystem::file_size(path);
+            cooked[compressed].push_back(path);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::printf("cooked %u %ux%u textures to %-5s  %9.2f ms offline  %7.2f MB on disk\n", COUNT, SIZE, SIZE, variants[compressed], ms, bytes / (1024.0 * 1024.0));
+    }
+
+    auto createAndRelease = [device](const TextureUpload& upload)
+    {
+        ID3D11Texture2D* texture;
+        ID3D11ShaderResourceView* srv;
+        if (!CreateTextureFromUpload(device, upload, texture, srv))
+            return false;
+        srv->Release();
+        texture->Release();
+        return true;
+    };
+
+    //Startup as SetupPipeline and the streaming workers do it: everything from file on disk to texture object. Files
+    //are in the page cache after the first pass, so every path is timed warm.
+    for (int compressed = 0; compressed < 2; ++compressed)
+    {
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (const std::string& source : sources)
+            {
+                std::ifstream reader(source, std::ios::binary);
+                std::vector<uint8_t> file((std::istreambuf_iterator<char>(reader)), std::istreambuf_iterator<char>());
+                TextureImage image;
+                if (!LoadTextureImageFromMemory(file.data(), file.size(), image) || !createAndRelease(PrepareTextureUpload(image, compressed ? cacheDirectory : "")))
+                    return;
+            }
+            double stbMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            for (const std::string& path : cooked[compressed])
+            {
+                std::shared_ptr<CookedTexture> mapped = std::make_shared<CookedTexture>();
+                if (!mapped->Open(path) || !createAndRelease(UploadFromCookedTexture(std::move(mapped))))
+                    return;
+            }
+            double cookedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (pass == 1)
+                std::printf("%-5s  %u textures  stb_image + mips%s %9.2f ms  mapped .ctex %8.2f ms  %6.1fx\n", variants[compressed], COUNT,
+                            compressed ? " + BC cache hit" : "               ", stbMs, cookedMs, stbMs / cookedMs);
+        }
+    }
+
+    std::filesystem::remove_all(directory);
+    context->Release();
+    device->Release();
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "D3D11Compat.h"
+#include "MappedFile.h"
+#include "TextureImage.h"
+#include "TextureStreaming.h"
+#include "ThreadPool.h"
+
+//Offline cooking of source images into .ctex containers, so the runtime never decodes or filters at launch. A cooked
+//file is what PrepareTextureUpload produces, laid out for mapping: header, one entry per mip level, then the levels
+//themselves at 64-byte aligned offsets. Loading maps the file and hands pointers into the mapping straight to
+//D3D11_SUBRESOURCE_DATA; nothing is decoded or copied on the CPU side.
+//
+//	CookedHeader	magic "CTEX", version, DXGI_FORMAT, width, height, level count
+//	CookedLevel		offset, size and row pitch of each level, largest first
+//	level data		rows as CreateTexture2D takes them, BC blocks or texels
+
+const unsigned COOKED_ALIGNMENT = 64;
+const char* const COOKED_EXTENSION = ".ctex";
+
+//Writes upload under a temporary name and renames it, as the block compression cache does
+bool WriteCookedTexture(const TextureUpload& upload, const std::string& path);
+
+//stbi_load, the full mip chain and, unless cacheDirectory is empty, BC1 / BC7 through that cache; see PrepareTextureUpload
+bool CookTexture(const std::string& sourcePath, const std::string& outputPath, const std::string& cacheDirectory, ThreadPool* threadPool = nullptr);
+
+bool IsCookedTexturePath(const std::string& path);		//Ends in COOKED_EXTENSION
+
+//A read-only mapping of a .ctex file, checked against its own level table when opened
+class CookedTexture
+{
+public:
+	bool Open(const std::string& path);		//false with a message on std::cerr when the file is missing or malformed
+	void Close();
+
+	DXGI_FORMAT Format() const;
+	unsigned Width() const;
+	unsigned Height() const;
+	unsigned LevelCount() const;
+	const uint8_t* LevelData(unsigned level) const;		//Inside the mapping, valid until Close
+	UINT RowPitch(unsigned level) const;
+	size_t FileSize() const { return file.Size(); }
+
+private:
+	MappedFile file;
+};
+
+//An upload whose levels point into the mapping; the mapping lives as long as the upload does
+TextureUpload UploadFromCookedTexture(std::shared_ptr<const CookedTexture> cooked);
+
+#ifndef _WIN32
+void RunTextureCookingBenchmark();
+#endif
\ No newline at end of file
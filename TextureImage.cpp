@@ -0,0 +1,804 @@
+#include "TextureImage.h"
+#include "CpuFeatures.h"
+#include "JpegEncoder.h"
+#include "PngEncoder.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+const char* TexelFormatName(TexelFormat format)
+{
+    switch (format)
+    {
+    case TexelFormat::R8:    return "R8";
+    case TexelFormat::R8G8:  return "R8G8";
+    case TexelFormat::RGBA8: return "RGBA8";
+    }
+    return "unknown";
+}
+
+unsigned TexelBytes(TexelFormat format)
+{
+    switch (format)
+    {
+    case TexelFormat::R8:   return 1;
+    case TexelFormat::R8G8: return 2;
+    default:                return 4;
+    }
+}
+
+TexelFormat TexelFormatForChannels(int channels)
+{
+    if (channels == 1)
+        return TexelFormat::R8;
+    if (channels == 2)
+        return TexelFormat::R8G8;
+    return TexelFormat::RGBA8;
+}
+
+uint32_t TextureImage::Texel(unsigned x, unsigned y, TextureUsage usage) const
+{
+    const uint8_t* texel = &bytes[size_t(y) * RowPitch() + x * TexelBytes(format)];
+    if (usage == TextureUsage::Colour && format != TexelFormat::RGBA8)
+    {
+        uint32_t alpha = format == TexelFormat::R8G8 ? texel[1] : 0xFF;
+        return texel[0] * 0x010101u | alpha << 24;
+    }
+
+    switch (format)
+    {
+    case TexelFormat::R8:   return texel[0] | 0xFF000000u;
+    case TexelFormat::R8G8: return texel[0] | texel[1] << 8 | 0xFF000000u;
+    default:                return texel[0] | texel[1] << 8 | texel[2] << 16 | static_cast<uint32_t>(texel[3]) << 24;
+    }
+}
+
+namespace
+{
+    //Takes over a buffer from stbi_load*, which was asked for TexelBytes(format) channels
+    bool StoreDecoded(unsigned char* pixels, int width, int height, TexelFormat format, const char* name, TextureImage& image)
+    {
+        if (pixels == nullptr)
+        {
+            std::cerr << "Failed to load " << name << ": " << stbi_failure_reason() << std::endl;
+            return false;
+        }
+
+        image.format = format;
+        image.width = static_cast<unsigned>(width);
+        image.height = static_cast<unsigned>(height);
+        image.bytes.assign(pixels, pixels + size_t(image.RowPitch()) * image.height);
+        stbi_image_free(pixels);
+        return true;
+    }
+
+    //stb_image's parallel-for hook is global, so it runs on the pool of whichever load is decoding on the calling thread
+    thread_local ThreadPool* decodeThreadPool = nullptr;
+
+    void ParallelForDecode(void*, int count, void (*task)(void* data, int index), void* data)
+    {
+        if (decodeThreadPool == nullptr)
+        {
+            for (int i = 0; i < count; ++i)
+                task(data, i);
+            return;
+        }
+        decodeThreadPool->ParallelFor(static_cast<unsigned>(count), [&](unsigned i) { task(data, static_cast<int>(i)); });
+    }
+
+    //Installs the hook on the first load given a pool; later loads without one run the same tasks in order
+    class DecodeThreadPoolScope
+    {
+    public:
+        explicit DecodeThreadPoolScope(ThreadPool* threadPool)
+        {
+            if (threadPool == nullptr)
+                return;
+            static const bool installed = (stbi_set_parallel_for(ParallelForDecode, nullptr), true);
+            (void)installed;
+            decodeThreadPool = threadPool;
+        }
+
+        ~DecodeThreadPoolScope() { decodeThreadPool = nullptr; }
+    };
+}
+
+bool LoadTextureImage(const char* path, TextureImage& image, ThreadPool* threadPool)
+{
+    int width, height, channels;
+    if (!stbi_info(path, &width, &height, &channels))
+    {
+        std::cerr << "Failed to read " << path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    TexelFormat format = TexelFormatForChannels(channels);
+    DecodeThreadPoolScope scope(threadPool);
+    unsigned char* pixels = stbi_load(path, &width, &height, nullptr, static_cast<int>(TexelBytes(format)));
+    return StoreDecoded(pixels, width, height, format, path, image);
+}
+
+bool LoadTextureImageFromMemory(const uint8_t* data, size_t size, TextureImage& image, ThreadPool* threadPool)
+{
+    int width, height, channels;
+    if (!stbi_info_from_memory(data, static_cast<int>(size), &width, &height, &channels))
+    {
+        std::cerr << "Failed to read image from memory: " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    TexelFormat format = TexelFormatForChannels(channels);
+    DecodeThreadPoolScope scope(threadPool);
+    unsigned char* pixels = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, nullptr, static_cast<int>(TexelBytes(format)));
+    return StoreDecoded(pixels, width, height, format, "image from memory", image);
+}
+
+const char* JpegIsaName(JpegIsa isa)
+{
+    switch (isa)
+    {
+    case JpegIsa::SSE2: return "SSE2";
+    case JpegIsa::AVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+bool IsJpegIsaSupported(JpegIsa isa)
+{
+    const CpuFeatures& features = GetCpuFeatures();
+
+    switch (isa)
+    {
+    case JpegIsa::SSE2: return features.sse2;
+    case JpegIsa::AVX2: return features.sse2 && features.avx2;
+    default: return true;
+    }
+}
+
+JpegIsa BestJpegIsa()
+{
+    static const JpegIsa best = IsJpegIsaSupported(JpegIsa::AVX2) ? JpegIsa::AVX2 :
+                                IsJpegIsaSupported(JpegIsa::SSE2) ? JpegIsa::SSE2 : JpegIsa::Scalar;
+    return best;
+}
+
+void SetJpegIsa(JpegIsa isa)
+{
+    stbi_set_jpeg_simd_level(static_cast<int>(isa));       //stb_image skips levels the CPU lacks itself
+}
+
+void SetFastInflate(bool enabled)
+{
+    stbi_set_zlib_fast_inflate(enabled ? 1 : 0);
+}
+
+void SetPngSimd(bool enabled)
+{
+    stbi_set_png_simd_level(enabled ? 1 : 0);       //stb_image falls back to scalar itself without SSE2
+}
+
+SoftwareTexture ExpandTexture(const TextureImage& image, TextureUsage usage)
+{
+    SoftwareTexture texture;
+    texture.width = image.width;
+    texture.height = image.height;
+    texture.texels.resize(size_t(image.width) * image.height);
+
+    if (image.format == TexelFormat::RGBA8)
+        std::memcpy(texture.texels.data(), image.bytes.data(), image.bytes.size());
+    else
+        for (unsigned y = 0; y < image.height; ++y)
+            for (unsigned x = 0; x < image.width; ++x)
+                texture.texels[size_t(y) * image.width + x] = image.Texel(x, y, usage);
+
+    return texture;
+}
+
+TextureImage NarrowTexture(const SoftwareTexture& texture, TexelFormat format)
+{
+    TextureImage image;
+    image.format = format;
+    image.width = texture.width;
+    image.height = texture.height;
+    image.bytes.resize(size_t(image.RowPitch()) * image.height);
+
+    unsigned bytes = TexelBytes(format);
+    for (size_t i = 0; i < texture.texels.size(); ++i)
+        for (unsigned c = 0; c < bytes; ++c)
+            image.bytes[i * bytes + c] = static_cast<uint8_t>(texture.texels[i] >> (c * 8));
+
+    return image;
+}
+
+void SampleBilinearWrap(const TextureImage& image, float u, float v, float* color)
+{
+    float width = static_cast<float>(image.width);
+    float height = static_cast<float>(image.height);
+
+    float x = u * width - 0.5f;
+    float y = v * height - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    //Wrapped in float as in PhongShading.cpp, so huge uvs cannot overflow an int
+    float x0 = fx - width * std::floor(fx / width);
+    float y0 = fy - height * std::floor(fy / height);
+    if (x0 > width - 0.5f) x0 -= width;
+    if (x0 < 0) x0 += width;
+    if (y0 > height - 0.5f) y0 -= height;
+    if (y0 < 0) y0 += height;
+    float x1 = x0 + 1 > width - 0.5f ? 0 : x0 + 1;
+    float y1 = y0 + 1 > height - 0.5f ? 0 : y0 + 1;
+
+    unsigned bytes = TexelBytes(image.format);
+    const uint8_t* row0 = &image.bytes[static_cast<size_t>(y0) * image.RowPitch()];
+    const uint8_t* row1 = &image.bytes[static_cast<size_t>(y1) * image.RowPitch()];
+    const uint8_t* texels[4] =
+    {
+        row0 + static_cast<size_t>(x0) * bytes, row0 + static_cast<size_t>(x1) * bytes,
+        row1 + static_cast<size_t>(x0) * bytes, row1 + static_cast<size_t>(x1) * bytes
+    };
+    float weights[4] = { (1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty };
+
+    for (unsigned c = 0; c < bytes; ++c)
+    {
+        float sum = 0;
+        for (int i = 0; i < 4; ++i)
+            sum += weights[i] * texels[i][c];
+        color[c] = sum * (1.0f / 255.0f);
+    }
+    for (unsigned c = bytes; c < 4; ++c)
+        color[c] = c == 3 ? 1.0f : 0.0f;
+}
+
+#ifndef _WIN32
+
+void RunTextureFormatBenchmark()
+{
+    const unsigned SIZE = 4096;
+    const unsigned SAMPLES = 1 << 22;
+    const double secondsPerRun = 0.5;
+
+    //A roughness-style map as a binary PGM, which stb_image decodes to one channel natively
+    std::string header = "P5\n" + std::to_string(SIZE) + " " + std::to_string(SIZE) + "\n255\n";
+    std::vector<uint8_t> file(header.begin(), header.end());
+    file.resize(header.size() + size_t(SIZE) * SIZE);
+    std::srand(1);
+    for (unsigned y = 0; y < SIZE; ++y)
+        for (unsigned x = 0; x < SIZE; ++x)
+            file[header.size() + size_t(y) * SIZE + x] = static_cast<uint8_t>(((x >> 4) ^ (y >> 4)) * 7 + (std::rand() & 15));
+
+    std::vector<float> uvs(SAMPLES * 2);
+    for (float& uv : uvs)
+        uv = std::rand() / static_cast<float>(RAND_MAX) * 2.0f - 0.5f;
+
+    //Before: every image forced to STBI_rgb_alpha. After: the channel count stbi_info reports.
+    for (int perChannel = 0; perChannel < 2; ++perChannel)
+    {
+        TextureImage image;
+        unsigned runs = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+
+        while (elapsed < secondsPerRun)
+        {
+            if (perChannel)
+                LoadTextureImageFromMemory(file.data(), file.size(), image);
+            else
+            {
+                int width, height;
+                unsigned char* pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, nullptr, STBI_rgb_alpha);
+                StoreDecoded(pixels, width, height, TexelFormat::RGBA8, "PGM", image);
+            }
+            ++runs;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        double decodeMs = elapsed * 1e3 / runs;
+
+        //Random bilinear taps over the whole image, expanded to RGBA as they are read
+        runs = 0;
+        start = std::chrono::steady_clock::now();
+        elapsed = 0;
+        float checksum = 0;
+        while (elapsed < secondsPerRun)
+        {
+            for (unsigned i = 0; i < SAMPLES; ++i)
+            {
+                float color[4];
+                SampleBilinearWrap(image, uvs[i * 2], uvs[i * 2 + 1], color);
+                checksum += color[0];
+            }
+            ++runs;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::printf("%ux%u grayscale  %-16s %-5s  %8.2f ms decode  %7.1f MB  %7.1f Msamples/s  (checksum %.0f)\n",
+                    SIZE, SIZE, perChannel ? "stbi_info" : "STBI_rgb_alpha", TexelFormatName(image.format), decodeMs,
+                    image.bytes.size() / (1024.0 * 1024.0), runs * double(SAMPLES) / elapsed / 1e6, checksum / runs);
+    }
+}
+
+void RunJpegDecodeBenchmark()
+{
+    const int PASSES = 3;
+
+    //Photo-like content: gradients, soft waves and sensor noise, in the layouts cameras and tools write
+    struct Source
+    {
+        unsigned width;
+        unsigned height;
+        TexelFormat format;
+        JpegOptions options;
+        const char* name;
+    };
+    const Source sources[] = {
+        { 1024, 1024, TexelFormat::RGBA8, { 85, true }, "1024x1024 4:2:0 q85" },
+        { 1920, 1080, TexelFormat::RGBA8, { 90, true }, "1920x1080 4:2:0 q90" },
+        { 2048, 1024, TexelFormat::RGBA8, { 92, false }, "2048x1024 4:4:4 q92" },
+        { 1024, 1024, TexelFormat::R8, { 85, true }, "1024x1024 grey q85" },
+    };
+
+    std::vector<std::vector<uint8_t>> files;
+    uint64_t encodedBytes = 0;
+    uint64_t decodedBytes = 0;
+    std::srand(1);
+    for (const Source& source : sources)
+    {
+        for (int copy = 0; copy < 4; ++copy)
+        {
+            TextureImage image;
+            image.format = source.format;
+            image.width = source.width;
+            image.height = source.height;
+            unsigned bpp = TexelBytes(source.format);
+            image.bytes.resize(size_t(image.width) * image.height * bpp);
+            for (unsigned y = 0; y < image.height; ++y)
+            {
+                for (unsigned x = 0; x < image.width; ++x)
+                {
+                    uint8_t* texel = &image.bytes[(size_t(y) * image.width + x) * bpp];
+                    float wave = std::sin(x * 0.013f + copy) * std::cos(y * 0.021f - copy) * 60.0f;
+                    for (unsigned c = 0; c < bpp; ++c)
+                        texel[c] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, 128.0f + wave * (c + 1) / 2.0f + (x * (c + 1) + y * 2) % 97 * 0.5f + (std::rand() % 9))));
+                    if (bpp == 4)
+                        texel[3] = 255;
+                }
+            }
+            files.push_back(EncodeJpeg(image, source.options));
+            encodedBytes += files.back().size();
+            decodedBytes += image.bytes.size();
+        }
+    }
+    std::printf("%zu JPEGs (4 each of %s, %s, %s, %s): %.2f MB encoded, %.2f MB decoded\n", files.size(), sources[0].name, sources[1].name, sources[2].name,
+                sources[3].name, encodedBytes / (1024.0 * 1024.0), decodedBytes / (1024.0 * 1024.0));
+
+    const JpegIsa isas[] = { JpegIsa::Scalar, JpegIsa::SSE2, JpegIsa::AVX2 };
+    std::vector<TextureImage> reference(files.size());
+    double scalarSeconds = 0;
+    for (JpegIsa isa : isas)
+    {
+        if (!IsJpegIsaSupported(isa))
+        {
+            std::printf("%-6s  not supported\n", JpegIsaName(isa));
+            continue;
+        }
+        SetJpegIsa(isa);
+
+        bool identical = true;
+        double best = 1e30;
+        for (int pass = 0; pass < PASSES; ++pass)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                TextureImage image;
+                if (!LoadTextureImageFromMemory(files[i].data(), files[i].size(), image))
+                    return;
+                if (isa == JpegIsa::Scalar)
+                    reference[i] = std::move(image);
+                else
+                    identical = identical && image.bytes == reference[i].bytes;
+            }
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (isa == JpegIsa::Scalar)
+            scalarSeconds = best;
+
+        std::printf("%-6s  %8.2f ms  %7.1f MB/s decoded  %6.1f MB/s encoded  %5.2fx scalar  %s\n", JpegIsaName(isa), best * 1e3,
+                    decodedBytes / best / (1024.0 * 1024.0), encodedBytes / best / (1024.0 * 1024.0), scalarSeconds / best,
+                    isa == JpegIsa::Scalar ? "reference" : identical ? "identical to scalar" : "DIFFERS from scalar");
+    }
+    SetJpegIsa(BestJpegIsa());
+}
+
+void RunJpegParallelBenchmark()
+{
+    const int PASSES = 3;
+
+    //Restart intervals as cameras write them (one per MCU row) and at odd lengths that split rows; one file without any,
+    //which can only run colour conversion in parallel
+    struct Source
+    {
+        unsigned width;
+        unsigned height;
+        TexelFormat format;
+        JpegOptions options;
+        const char* name;
+    };
+    const Source sources[] = {
+        { 7680, 4320, TexelFormat::RGBA8, { 90, true, 480 }, "7680x4320 4:2:0 q90, restart every MCU row" },
+        { 7680, 4320, TexelFormat::RGBA8, { 90, true, 0 }, "7680x4320 4:2:0 q90, no restarts" },
+        { 3840, 2160, TexelFormat::RGBA8, { 92, false, 37 }, "3840x2160 4:4:4 q92, restart every 37 MCUs" },
+        { 3840, 2160, TexelFormat::R8, { 85, true, 101 }, "3840x2160 grey q85, restart every 101 MCUs" },
+    };
+
+    std::vector<unsigned> threadCounts = { 1, 2, 4 };
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (hardwareThreads > threadCounts.back())
+        threadCounts.push_back(hardwareThreads);
+    std::printf("%u hardware threads\n", hardwareThreads);
+
+    std::srand(1);
+    for (const Source& source : sources)
+    {
+        TextureImage image;
+        image.format = source.format;
+        image.width = source.width;
+        image.height = source.height;
+        unsigned bpp = TexelBytes(source.format);
+        image.bytes.resize(size_t(image.width) * image.height * bpp);
+        std::vector<float> columnWaves(image.width);
+        for (unsigned x = 0; x < image.width; ++x)
+            columnWaves[x] = std::sin(x * 0.013f);
+        for (unsigned y = 0; y < image.height; ++y)
+        {
+            float rowWave = std::cos(y * 0.021f) * 60.0f;
+            for (unsigned x = 0; x < image.width; ++x)
+            {
+                uint8_t* texel = &image.bytes[(size_t(y) * image.width + x) * bpp];
+                for (unsigned c = 0; c < bpp; ++c)
+                    texel[c] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, 128.0f + columnWaves[x] * rowWave * (c + 1) / 2.0f + (x * (c + 1) + y * 2) % 97 * 0.5f + (std::rand() % 9))));
+                if (bpp == 4)
+                    texel[3] = 255;
+            }
+        }
+        std::vector<uint8_t> file = EncodeJpeg(image, source.options);
+        std::printf("%s: %.2f MB encoded\n", source.name, file.size() / (1024.0 * 1024.0));
+
+        auto time = [&](ThreadPool* threadPool, TextureImage& decoded)
+        {
+            double best = 1e30;
+            for (int pass = 0; pass < PASSES; ++pass)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (!LoadTextureImageFromMemory(file.data(), file.size(), decoded, threadPool))
+                    return -1.0;
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            return best;
+        };
+
+        TextureImage reference;
+        double serialSeconds = time(nullptr, reference);
+        if (serialSeconds < 0)
+            return;
+        std::printf("  serial       %8.2f ms  reference\n", serialSeconds * 1e3);
+
+        for (unsigned threads : threadCounts)
+        {
+            ThreadPool pool(threads);
+            TextureImage decoded;
+            double seconds = time(&pool, decoded);
+            if (seconds < 0)
+                return;
+            std::printf("  %2u thread%s   %8.2f ms  %5.2fx serial  %s\n", threads, threads == 1 ? " " : "s", seconds * 1e3, serialSeconds / seconds,
+                        decoded.bytes == reference.bytes ? "identical to serial" : "DIFFERS from serial");
+        }
+    }
+}
+
+void RunPngDecodeBenchmark()
+{
+    const int PASSES = 3;
+    const unsigned SIZE = 1024;
+
+    //Photos are mostly literals, flat-coloured art mostly long matches, masks in between
+    struct Source
+    {
+        TexelFormat format;
+        const char* name;
+    };
+    const Source sources[] = {
+        { TexelFormat::RGBA8, "photo RGBA" },
+        { TexelFormat::RGBA8, "flat-colour art RGBA" },
+        { TexelFormat::R8, "grey mask" },
+    };
+
+    std::vector<std::vector<uint8_t>> files;
+    std::vector<std::vector<uint8_t>> streams;      //The IDAT zlib stream of each file
+    std::vector<size_t> streamSizes;                //Inflated: a filter byte and a row of bytes per row
+    uint64_t encodedBytes = 0;
+    uint64_t decodedBytes = 0;
+    uint64_t inflatedBytes = 0;
+    std::srand(1);
+    for (size_t s = 0; s < sizeof(sources) / sizeof(sources[0]); ++s)
+    {
+        for (int copy = 0; copy < 4; ++copy)
+        {
+            TextureImage image;
+            image.format = sources[s].format;
+            image.width = image.height = SIZE;
+            unsigned bpp = TexelBytes(image.format);
+            image.bytes.resize(size_t(SIZE) * SIZE * bpp);
+            for (unsigned y = 0; y < SIZE; ++y)
+            {
+                for (unsigned x = 0; x < SIZE; ++x)
+                {
+                    uint8_t* texel = &image.bytes[(size_t(y) * SIZE + x) * bpp];
+                    for (unsigned c = 0; c < bpp; ++c)
+                    {
+                        if (s == 0)
+                            texel[c] = static_cast<uint8_t>(128 + std::sin(x * 0.011f + c + copy) * std::cos(y * 0.017f - copy) * 90 + (std::rand() % 13));
+                        else if (s == 1)
+                            texel[c] = static_cast<uint8_t>(((x / (24 + copy * 8)) * 37 + (y / 40) * 91 + (((x - 512) * (x - 512) + (y - 512) * (y - 512)) < 90000 ? 120 : 0)) * (c + 1));
+                        else
+                            texel[c] = static_cast<uint8_t>(((x >> 5) ^ (y >> 5)) & 1 ? 200 + (std::rand() & 31) : (x + y + copy * 64) / 8);
+                    }
+                    if (bpp == 4)
+                        texel[3] = 255;
+                }
+            }
+            files.push_back(EncodePng(image));
+            encodedBytes += files.back().size();
+            decodedBytes += image.bytes.size();
+
+            //Signature, IHDR (8 + 13 + 4 bytes), then the one IDAT the encoder writes
+            const uint8_t* idat = files.back().data() + 8 + 25;
+            size_t idatSize = size_t(idat[0]) << 24 | size_t(idat[1]) << 16 | size_t(idat[2]) << 8 | idat[3];
+            streams.emplace_back(idat + 8, idat + 8 + idatSize);
+            streamSizes.push_back((size_t(image.RowPitch()) + 1) * image.height);
+            inflatedBytes += streamSizes.back();
+        }
+    }
+    std::printf("%zu PNGs (4 each of %ux%u %s, %s, %s): %.2f MB encoded, %.2f MB inflated, %.2f MB decoded\n", files.size(), SIZE, SIZE,
+                sources[0].name, sources[1].name, sources[2].name, encodedBytes / (1024.0 * 1024.0), inflatedBytes / (1024.0 * 1024.0),
+                decodedBytes / (1024.0 * 1024.0));
+
+    //Inflate alone, then whole PNG decodes, which add unfiltering and the copy into a TextureImage
+    std::vector<std::vector<uint8_t>> referenceStreams(streams.size());
+    std::vector<TextureImage> referenceImages(files.size());
+    for (int stage = 0; stage < 2; ++stage)
+    {
+        double baselineSeconds = 0;
+        for (int fast = 0; fast < 2; ++fast)
+        {
+            SetFastInflate(fast != 0);
+            bool identical = true;
+            double best = 1e30;
+            for (int pass = 0; pass < PASSES; ++pass)
+            {
+                auto start = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < files.size(); ++i)
+                {
+                    if (stage == 0)
+                    {
+                        std::vector<uint8_t> inflated(streamSizes[i]);
+                        int size = stbi_zlib_decode_buffer(reinterpret_cast<char*>(inflated.data()), static_cast<int>(inflated.size()),
+                                                           reinterpret_cast<const char*>(streams[i].data()), static_cast<int>(streams[i].size()));
+                        if (size != static_cast<int>(inflated.size()))
+                        {
+                            std::printf("inflate failed: %s\n", stbi_failure_reason());
+                            SetFastInflate(true);
+                            return;
+                        }
+                        if (!fast)
+                            referenceStreams[i] = std::move(inflated);
+                        else
+                            identical = identical && inflated == referenceStreams[i];
+                    }
+                    else
+                    {
+                        TextureImage image;
+                        if (!LoadTextureImageFromMemory(files[i].data(), files[i].size(), image))
+                        {
+                            SetFastInflate(true);
+                            return;
+                        }
+                        if (!fast)
+                            referenceImages[i] = std::move(image);
+                        else
+                            identical = identical && image.bytes == referenceImages[i].bytes;
+                    }
+                }
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            if (!fast)
+                baselineSeconds = best;
+
+            uint64_t outputBytes = stage == 0 ? inflatedBytes : decodedBytes;
+            std::printf("%-7s  %-14s  %8.2f ms  %7.1f MB/s out  %6.1f MB/s in  %5.2fx  %s\n", stage == 0 ? "inflate" : "PNG",
+                        fast ? "fast" : "byte at a time", best * 1e3, outputBytes / best / (1024.0 * 1024.0), encodedBytes / best / (1024.0 * 1024.0),
+                        baselineSeconds / best, !fast ? "reference" : identical ? "identical" : "DIFFERS");
+        }
+    }
+    SetFastInflate(true);
+}
+
+void RunPngUnfilterBenchmark()
+{
+    //Random filtered rows and filter bytes in every layout, the SIMD unfiltering checked against the scalar loops. Sizes
+    //run from one pixel, under the 16 byte vectors, and interlaced images add the small rows of the Adam7 passes.
+    struct Layout
+    {
+        unsigned depth;
+        unsigned colourType;
+        unsigned channels;
+    };
+    const Layout layouts[] = {
+        { 8, 2, 3 }, { 8, 6, 4 }, { 16, 2, 3 }, { 16, 6, 4 },       //The SIMD pixel sizes
+        { 8, 0, 1 }, { 8, 4, 2 }, { 16, 0, 1 }, { 16, 4, 2 },       //Scalar in both, byte swap in SIMD
+        { 1, 0, 1 }, { 2, 0, 1 }, { 4, 0, 1 },
+    };
+    const unsigned X_ORIGIN[7] = { 0, 4, 0, 2, 0, 1, 0 };
+    const unsigned Y_ORIGIN[7] = { 0, 0, 4, 0, 2, 0, 1 };
+    const unsigned X_SPACING[7] = { 8, 8, 4, 4, 2, 2, 1 };
+    const unsigned Y_SPACING[7] = { 8, 8, 8, 4, 4, 2, 2 };
+    const int TRIALS = 3000;
+
+    std::srand(7);
+    int decodes = 0;
+    int mismatches = 0;
+    for (int trial = 0; trial < TRIALS; ++trial)
+    {
+        const Layout& layout = layouts[trial % (sizeof(layouts) / sizeof(layouts[0]))];
+        unsigned width = 1 + std::rand() % (trial < TRIALS / 2 ? 12 : 90);
+        unsigned height = 1 + std::rand() % 9;
+        bool interlaced = std::rand() % 4 == 0;
+
+        std::vector<uint8_t> filtered;
+        for (int pass = 0; pass < (interlaced ? 7 : 1); ++pass)
+        {
+            if (width <= X_ORIGIN[pass] || height <= Y_ORIGIN[pass])
+                continue;       //Empty passes have no rows
+            unsigned passWidth = interlaced ? (width - X_ORIGIN[pass] + X_SPACING[pass] - 1) / X_SPACING[pass] : width;
+            unsigned passHeight = interlaced ? (height - Y_ORIGIN[pass] + Y_SPACING[pass] - 1) / Y_SPACING[pass] : height;
+            size_t rowBytes = (size_t(passWidth) * layout.channels * layout.depth + 7) / 8;
+            for (unsigned y = 0; y < passHeight; ++y)
+            {
+                filtered.push_back(static_cast<uint8_t>(std::rand() % 5));
+                for (size_t i = 0; i < rowBytes; ++i)
+                    filtered.push_back(static_cast<uint8_t>(std::rand()));
+            }
+        }
+        std::vector<uint8_t> png = WrapPng(width, height, layout.depth, layout.colourType, interlaced, filtered);
+
+        //As stored, then with alpha added where stb_image pads in the unfiltering pass
+        int requests[2] = { 0, static_cast<int>(layout.channels) + 1 };
+        for (int request : requests)
+        {
+            if (request != 0 && request != 2 && request != 4)
+                continue;
+            std::vector<uint8_t> decoded[2];
+            for (int simd = 0; simd < 2; ++simd)
+            {
+                SetPngSimd(simd != 0);
+                int x, y, channels;
+                int outChannels = request ? request : static_cast<int>(layout.channels);
+                size_t bytes = size_t(width) * height * outChannels * (layout.depth == 16 ? 2 : 1);
+                void* pixels = layout.depth == 16
+                    ? static_cast<void*>(stbi_load_16_from_memory(png.data(), static_cast<int>(png.size()), &x, &y, &channels, request))
+                    : static_cast<void*>(stbi_load_from_memory(png.data(), static_cast<int>(png.size()), &x, &y, &channels, request));
+                if (!pixels)
+                {
+                    std::printf("decode failed: %s\n", stbi_failure_reason());
+                    SetPngSimd(true);
+                    return;
+                }
+                decoded[simd].assign(static_cast<uint8_t*>(pixels), static_cast<uint8_t*>(pixels) + bytes);
+                stbi_image_free(pixels);
+            }
+            ++decodes;
+            if (decoded[0] != decoded[1])
+            {
+                if (++mismatches <= 5)
+                    std::printf("DIFFERS: %u-bit colour type %u, %ux%u%s, %d channels requested\n", layout.depth, layout.colourType, width,
+                                height, interlaced ? " interlaced" : "", request);
+            }
+        }
+    }
+    std::printf("%d random PNGs, %d decodes: SSE2 %s\n\n", TRIALS, decodes,
+                mismatches ? "DIFFERS from scalar" : "identical to scalar");
+
+    //Every row with one filter, so each kernel is timed on its own; the times include inflate, which is the same in both
+    const int PASSES = 3;
+    const unsigned SIZE = 1024;
+    struct Timed
+    {
+        const char* name;
+        unsigned depth;
+        unsigned colourType;
+        unsigned channels;
+        int request;
+    };
+    const Timed timed[] = {
+        { "RGB8", 8, 2, 3, 0 },
+        { "RGB8 -> RGBA", 8, 2, 3, 4 },
+        { "RGBA8", 8, 6, 4, 0 },
+        { "RGB16", 16, 2, 3, 0 },
+        { "RGBA16", 16, 6, 4, 0 },
+    };
+    const char* FILTER_NAMES[5] = { "none", "sub", "up", "average", "Paeth" };
+
+    std::printf("%ux%u images, whole decodes\n", SIZE, SIZE);
+    for (const Timed& t : timed)
+    {
+        unsigned sampleBytes = t.depth / 8;
+        unsigned bpp = t.channels * sampleBytes;
+        std::vector<uint8_t> pixels(size_t(SIZE) * SIZE * bpp);
+        for (unsigned y = 0; y < SIZE; ++y)
+        {
+            for (unsigned x = 0; x < SIZE; ++x)
+            {
+                for (unsigned c = 0; c < t.channels; ++c)
+                {
+                    unsigned value = static_cast<unsigned>((128 + std::sin(x * 0.011f + c) * std::cos(y * 0.017f) * 90) * 256) + std::rand() % 3000;
+                    if (c == 3)
+                        value = 0xFFFF;
+                    uint8_t* sample = &pixels[(size_t(y) * SIZE + x) * bpp + c * sampleBytes];
+                    sample[0] = static_cast<uint8_t>(value >> 8);
+                    if (sampleBytes == 2)
+                        sample[1] = static_cast<uint8_t>(value);
+                }
+            }
+        }
+        uint64_t outputBytes = uint64_t(SIZE) * SIZE * (t.request ? t.request : t.channels) * sampleBytes;
+
+        for (int filter = 0; filter < 5; ++filter)
+        {
+            std::vector<uint8_t> png = WrapPng(SIZE, SIZE, t.depth, t.colourType, false,
+                                               FilterPngRows(pixels.data(), size_t(SIZE) * bpp, SIZE, bpp, filter));
+            double seconds[2];
+            std::vector<uint8_t> decoded[2];
+            for (int simd = 0; simd < 2; ++simd)
+            {
+                SetPngSimd(simd != 0);
+                seconds[simd] = 1e30;
+                for (int pass = 0; pass < PASSES; ++pass)
+                {
+                    int x, y, channels;
+                    auto start = std::chrono::steady_clock::now();
+                    void* out = t.depth == 16
+                        ? static_cast<void*>(stbi_load_16_from_memory(png.data(), static_cast<int>(png.size()), &x, &y, &channels, t.request))
+                        : static_cast<void*>(stbi_load_from_memory(png.data(), static_cast<int>(png.size()), &x, &y, &channels, t.request));
+                    seconds[simd] = std::min(seconds[simd], std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                    if (!out)
+                    {
+                        std::printf("decode failed: %s\n", stbi_failure_reason());
+                        SetPngSimd(true);
+                        return;
+                    }
+                    decoded[simd].assign(static_cast<uint8_t*>(out), static_cast<uint8_t*>(out) + outputBytes);
+                    stbi_image_free(out);
+                }
+            }
+            std::printf("%-12s  %-7s  scalar %7.2f ms  SSE2 %7.2f ms  %7.1f MB/s out  %5.2fx  %s\n", t.name, FILTER_NAMES[filter],
+                        seconds[0] * 1e3, seconds[1] * 1e3, outputBytes / seconds[1] / (1024.0 * 1024.0), seconds[0] / seconds[1],
+                        decoded[0] == decoded[1] ? "identical to scalar" : "DIFFERS from scalar");
+        }
+    }
+    SetPngSimd(true);
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "SoftwareTexture.h"
+
+//A decoded image kept at the channel count the file really has, so masks and roughness maps cost 1 or 2 bytes per texel
+//instead of 4. RGB files are stored as RGBA8, D3D11 has no 24-bit format. Readers expand texels to RGBA8 on the fly,
+//either as the file means them or with the defaults a shader sees for missing channels of R8 / R8G8 textures.
+
+enum class TexelFormat { R8, R8G8, RGBA8 };
+
+//Colour images are sRGB and keep their look: grey goes into red, green and blue, a second channel is alpha. Data images
+//(masks, roughness) are linear and read as R8 / R8G8 textures: green and blue 0, alpha 255.
+enum class TextureUsage { Colour, Data };
+
+const char* TexelFormatName(TexelFormat format);
+unsigned TexelBytes(TexelFormat format);
+TexelFormat TexelFormatForChannels(int channels);		//1 -> R8, 2 -> R8G8, 3 and 4 -> RGBA8
+
+struct TextureImage
+{
+	TexelFormat format = TexelFormat::RGBA8;
+	unsigned width = 0;
+	unsigned height = 0;
+	std::vector<uint8_t> bytes;			//Rows of width * TexelBytes(format) bytes, no padding
+
+	unsigned RowPitch() const { return width * TexelBytes(format); }
+	uint32_t Texel(unsigned x, unsigned y, TextureUsage usage = TextureUsage::Data) const;		//RGBA8
+};
+
+class ThreadPool;
+
+//stbi_info first, then stbi_load with that channel count; false with a message on std::cerr when stb_image fails.
+//With a thread pool a JPEG is spread over its threads: the restart intervals of a file in memory are entropy decoded
+//in parallel, and upsampling and colour conversion run in bands of rows. One load at a time per pool.
+bool LoadTextureImage(const char* path, TextureImage& image, ThreadPool* threadPool = nullptr);
+bool LoadTextureImageFromMemory(const uint8_t* data, size_t size, TextureImage& image, ThreadPool* threadPool = nullptr);
+
+//Instruction sets stb_image's JPEG decoder can use for its IDCT, chroma upsampling and colour conversion. AVX2 runs
+//the IDCT on two horizontally adjacent blocks at once and the other kernels on 16 pixels. All decode the same pixels.
+enum class JpegIsa { Scalar, SSE2, AVX2 };
+
+const char* JpegIsaName(JpegIsa isa);
+bool IsJpegIsaSupported(JpegIsa isa);
+JpegIsa BestJpegIsa();
+void SetJpegIsa(JpegIsa isa);		//Every later decode, on any thread; BestJpegIsa() until called
+
+//stb_image's inflate under PNG decoding: the fast loop refills 64 bits without branches, decodes up to two literals or
+//a match length per table lookup and copies matches 8 bytes at a time; the other decodes one symbol and one byte at a
+//time. Both write the same bytes.
+void SetFastInflate(bool enabled);		//Every later decode, on any thread; on until called
+
+//stb_image's PNG unfiltering of 3, 4, 6 and 8 byte pixels (8- and 16-bit RGB and RGBA) with SSE2, the alpha padding of
+//RGB files and the byte swap of 16-bit samples in the same pass, or its scalar loops. Both decode the same pixels.
+void SetPngSimd(bool enabled);		//Every later decode, on any thread; on until called
+
+SoftwareTexture ExpandTexture(const TextureImage& image, TextureUsage usage = TextureUsage::Colour);
+TextureImage NarrowTexture(const SoftwareTexture& texture, TexelFormat format);		//Drops the channels format does not store
+
+//Bilinear sample with wrap addressing, u and v in texels / size as on the GPU. Only the four texels read are expanded.
+void SampleBilinearWrap(const TextureImage& image, float u, float v, float* color);
+
+#ifndef _WIN32
+void RunTextureFormatBenchmark();
+void RunJpegDecodeBenchmark();
+void RunJpegParallelBenchmark();
+void RunPngDecodeBenchmark();
+void RunPngUnfilterBenchmark();
+#endif
\ No newline at end of file
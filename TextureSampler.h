@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "SoftwareTexture.h"
+
+//CPU counterpart of the sampler state CreateSamplerState builds (D3D11_FILTER_ANISOTROPIC, WRAP on every axis), for
+//headless rendering and for checking what the GPU samples. Works on 2x2 pixel quads: the differences inside a quad
+//are the ddx / ddy the LOD comes from, as on the GPU. The SIMD versions take 4 (SSE2) or 8 (AVX2) coordinates per
+//step and fetch texels with gathers.
+
+enum class SamplerFilter
+{
+	Point,			//D3D11_FILTER_MIN_MAG_MIP_POINT
+	Bilinear,		//D3D11_FILTER_MIN_MAG_LINEAR_MIP_POINT
+	Trilinear,		//D3D11_FILTER_MIN_MAG_MIP_LINEAR
+	Anisotropic		//D3D11_FILTER_ANISOTROPIC: up to maxAnisotropy trilinear taps along the longer derivative
+};
+
+enum class SamplerAddress { Wrap, Clamp, Mirror };
+
+const char* SamplerFilterName(SamplerFilter filter);
+const char* SamplerAddressName(SamplerAddress address);
+
+struct SamplerDesc			//The part of D3D11_SAMPLER_DESC the CPU sampler implements
+{
+	SamplerFilter filter = SamplerFilter::Anisotropic;
+	SamplerAddress addressU = SamplerAddress::Wrap;
+	SamplerAddress addressV = SamplerAddress::Wrap;
+	unsigned maxAnisotropy = 16;		//1 to 16
+	float mipLodBias = 0.0f;
+};
+
+//Every mip level in one allocation, so one gather reaches any level: lanes of a step may sit on different levels
+struct MipmappedTexture
+{
+	static const unsigned MAX_LEVELS = 16;
+
+	unsigned width = 0;
+	unsigned height = 0;
+	unsigned levelCount = 0;
+	std::vector<uint32_t, CacheLineAllocator<uint32_t>> texels;		//RGBA8, each level row-major, largest first
+	uint32_t levelOffsets[MAX_LEVELS] = {};
+	uint32_t levelWidths[MAX_LEVELS] = {};
+	uint32_t levelHeights[MAX_LEVELS] = {};
+};
+
+MipmappedTexture CreateMipmappedTexture(const std::vector<SoftwareTexture>& levels);		//As GenerateMipChain returns them
+
+enum class SamplerIsa { Scalar, SSE2, AVX2 };
+
+const char* SamplerIsaName(SamplerIsa isa);
+bool IsSamplerIsaSupported(SamplerIsa isa);
+SamplerIsa BestSamplerIsa();
+
+//Samples count coordinates, rounded down to whole quads: every 4 in a row are top left, top right, bottom left and
+//bottom right of one 2x2 quad. color[0..3] receive red, green, blue and alpha in [0, 1].
+void SampleQuads(const SamplerDesc& desc, const MipmappedTexture& texture, const float* u, const float* v, unsigned count, float* const* color);
+void SampleQuads(SamplerIsa isa, const SamplerDesc& desc, const MipmappedTexture& texture, const float* u, const float* v, unsigned count,
+				 float* const* color);
+
+#ifndef _WIN32
+void RunTextureSamplerBenchmark();
+#endif
\ No newline at end of file
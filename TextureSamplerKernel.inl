@@ -0,0 +1,153 @@
+//SampleQuads for WIDTH coordinates, WIDTH / 4 quads, at a time. Included once per instruction set by TextureSampler.cpp,
+//inside the namespaces of SimdLanes.h. Follows SampleQuadScalar step by step.
+
+struct Level        //Per lane: where a mip level starts and how large it is
+{
+    Int offset;
+    Int width;
+    Float size[2];
+};
+
+inline Level LoadLevel(const MipmappedTexture& texture, Float level)
+{
+    Int index = FloatToInt(level);
+    Level loaded;
+    loaded.offset = Gather(texture.levelOffsets, index);
+    loaded.width = Gather(texture.levelWidths, index);
+    loaded.size[0] = IntToFloat(loaded.width);
+    loaded.size[1] = IntToFloat(Gather(texture.levelHeights, index));
+    return loaded;
+}
+
+inline Float Address(Float texel, Float size, SamplerAddress mode)      //Whole texel coordinate into [0, size)
+{
+    switch (mode)
+    {
+    case SamplerAddress::Clamp:
+        return Min(Max(texel, Broadcast(0.0f)), size - Broadcast(1.0f));
+    case SamplerAddress::Mirror:
+    {
+        Float period = size + size;
+        Float wrapped = WrapCoordinate(texel, period, Broadcast(1.0f) / period);
+        return Select(wrapped > size - Broadcast(0.5f), period - Broadcast(1.0f) - wrapped, wrapped);
+    }
+    default:
+        return WrapCoordinate(texel, size, Broadcast(1.0f) / size);
+    }
+}
+
+template<int SHIFT>
+inline Float Channel(Int texels)
+{
+    return IntToFloat(ShiftRight<SHIFT>(texels) & IntBroadcast(0xFF));
+}
+
+inline void Accumulate(const MipmappedTexture& texture, const Level& level, Float x, Float y, Float weight, Float* sum)
+{
+    Int texel = Gather(texture.texels.data(), level.offset + MulLo(FloatToInt(y), level.width) + FloatToInt(x));
+    sum[0] = sum[0] + weight * Channel<0>(texel);
+    sum[1] = sum[1] + weight * Channel<8>(texel);
+    sum[2] = sum[2] + weight * Channel<16>(texel);
+    sum[3] = sum[3] + weight * Channel<24>(texel);
+}
+
+inline void SamplePoint(const SamplerDesc& desc, const MipmappedTexture& texture, const Level& level, Float u, Float v, Float weight, Float* sum)
+{
+    Float x = Address(Floor(u * level.size[0]), level.size[0], desc.addressU);
+    Float y = Address(Floor(v * level.size[1]), level.size[1], desc.addressV);
+    Accumulate(texture, level, x, y, weight, sum);
+}
+
+inline void SampleBilinear(const SamplerDesc& desc, const MipmappedTexture& texture, const Level& level, Float u, Float v, Float weight, Float* sum)
+{
+    Float x = u * level.size[0] - Broadcast(0.5f);
+    Float y = v * level.size[1] - Broadcast(0.5f);
+    Float fx = Floor(x);
+    Float fy = Floor(y);
+    Float tx = x - fx;
+    Float ty = y - fy;
+
+    Float one = Broadcast(1.0f);
+    Float x0 = Address(fx, level.size[0], desc.addressU);
+    Float x1 = Address(fx + one, level.size[0], desc.addressU);
+    Float y0 = Address(fy, level.size[1], desc.addressV);
+    Float y1 = Address(fy + one, level.size[1], desc.addressV);
+
+    Accumulate(texture, level, x0, y0, weight * (one - tx) * (one - ty), sum);
+    Accumulate(texture, level, x1, y0, weight * tx * (one - ty), sum);
+    Accumulate(texture, level, x0, y1, weight * (one - tx) * ty, sum);
+    Accumulate(texture, level, x1, y1, weight * tx * ty, sum);
+}
+
+inline void SampleTrilinear(const SamplerDesc& desc, const MipmappedTexture& texture, Float lod, Float maxLevel, Float u, Float v, Float weight, Float* sum)
+{
+    Float level = Floor(lod);
+    Float fraction = lod - level;
+    SampleBilinear(desc, texture, LoadLevel(texture, level), u, v, weight * (Broadcast(1.0f) - fraction), sum);
+    SampleBilinear(desc, texture, LoadLevel(texture, Min(level + Broadcast(1.0f), maxLevel)), u, v, weight * fraction, sum);
+}
+
+void SampleStep(const SamplerDesc& desc, const MipmappedTexture& texture, const float* u, const float* v, float* const* color, unsigned first)
+{
+    Float U = LoadUnaligned(u + first);
+    Float V = LoadUnaligned(v + first);
+
+    //Coarse derivatives: one per quad, from its top left texel
+    Float ddxU = QuadBroadcast<1>(U) - QuadBroadcast<0>(U);
+    Float ddxV = QuadBroadcast<1>(V) - QuadBroadcast<0>(V);
+    Float ddyU = QuadBroadcast<2>(U) - QuadBroadcast<0>(U);
+    Float ddyV = QuadBroadcast<2>(V) - QuadBroadcast<0>(V);
+
+    Float width = Broadcast(static_cast<float>(texture.width));
+    Float height = Broadcast(static_cast<float>(texture.height));
+    Float lengthX = Sqrt(ddxU * width * (ddxU * width) + ddxV * height * (ddxV * height));     //Texels per pixel along x
+    Float lengthY = Sqrt(ddyU * width * (ddyU * width) + ddyV * height * (ddyV * height));
+
+    Float zero = Broadcast(0.0f);
+    Float one = Broadcast(1.0f);
+    Float tiny = Broadcast(1e-20f);
+    Float bias = Broadcast(desc.mipLodBias);
+    Float maxLevel = Broadcast(static_cast<float>(texture.levelCount - 1));
+    Float sum[4] = { zero, zero, zero, zero };
+
+    if (desc.filter == SamplerFilter::Anisotropic)
+    {
+        Float major = Max(lengthX, lengthY);
+        Float minor = Min(lengthX, lengthY);
+        Float taps = Broadcast(0.0f) - Floor(Broadcast(0.0f) - major / Max(minor, tiny));       //ceil
+        taps = Max(Min(taps, Broadcast(static_cast<float>(desc.maxAnisotropy))), one);
+        Float lod = Min(Max(Log2(Max(major / taps, tiny)) + bias, zero), maxLevel);
+
+        //Taps spread evenly along the longer derivative; lanes that need fewer than the most add with weight 0
+        Mask alongX = lengthX > lengthY;
+        Float axisU = Select(alongX, ddxU, ddyU);
+        Float axisV = Select(alongX, ddxV, ddyV);
+        Float weight = one / taps;
+        float mostTaps = ReduceMax(taps);
+        for (float tap = 0; tap < mostTaps; ++tap)
+        {
+            Float index = Broadcast(tap);
+            Float offset = (index + Broadcast(0.5f)) * weight - Broadcast(0.5f);
+            Float tapWeight = Select(index < taps, weight, zero);
+            SampleTrilinear(desc, texture, lod, maxLevel, U + axisU * offset, V + axisV * offset, tapWeight, sum);
+        }
+    }
+    else
+    {
+        Float lod = Log2(Max(Max(lengthX, lengthY), tiny)) + bias;
+        if (desc.filter == SamplerFilter::Trilinear)
+            SampleTrilinear(desc, texture, Min(Max(lod, zero), maxLevel), maxLevel, U, V, one, sum);
+        else
+        {
+            Level level = LoadLevel(texture, Min(Max(Floor(lod + Broadcast(0.5f)), zero), maxLevel));       //Nearest level
+            if (desc.filter == SamplerFilter::Point)
+                SamplePoint(desc, texture, level, U, V, one, sum);
+            else
+                SampleBilinear(desc, texture, level, U, V, one, sum);
+        }
+    }
+
+    Float scale = Broadcast(1.0f / 255.0f);
+    for (int c = 0; c < 4; ++c)
+        Store(color[c] + first, sum[c] * scale);
+}
\ No newline at end of file
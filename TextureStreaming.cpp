@@ -0,0 +1,615 @@
+#include "TextureStreaming.h"
+#include "BlockCompression.h"
+#include "MipChain.h"
+#include "TextureCooking.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+TextureUpload PrepareTextureUpload(const TextureImage& image, const std::string& cacheDirectory, ThreadPool* threadPool, const MipOptions& mipOptions,
+                                   TextureUsage usage)
+{
+    TextureUpload upload;
+    upload.width = image.width;
+    upload.height = image.height;
+
+    SoftwareTexture base = ExpandTexture(image, usage);
+
+    if (usage == TextureUsage::Data && image.format != TexelFormat::RGBA8)
+    {
+        //Masks and roughness: filtered as linear data, the shader reads them through .r / .rg
+        upload.format = image.format == TexelFormat::R8 ? DXGI_FORMAT_R8_UNORM : DXGI_FORMAT_R8G8_UNORM;
+
+        MipOptions linear = mipOptions;
+        linear.sRGB = false;
+        for (const SoftwareTexture& level : GenerateMipChain(base, linear, threadPool))
+        {
+            TextureImage narrow = NarrowTexture(level, image.format);
+            upload.rowPitches.push_back(narrow.RowPitch());
+            upload.levels.push_back(std::move(narrow.bytes));
+        }
+    }
+    else if (!cacheDirectory.empty() && image.width % 4 == 0 && image.height % 4 == 0)
+    {
+        bool opaque = std::all_of(base.texels.begin(), base.texels.end(), [](uint32_t texel) { return (texel >> 24) == 0xFF; });
+        upload.format = opaque ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC7_UNORM;
+
+        std::vector<CompressedTexture> levels = CompressMipChainCached(base, opaque ? BlockFormat::BC1 : BlockFormat::BC7, BlockQuality::Quality,
+                                                                       mipOptions, cacheDirectory, threadPool);
+        for (CompressedTexture& level : levels)
+        {
+            upload.rowPitches.push_back(level.RowPitch());
+            upload.levels.push_back(std::move(level.blocks));
+        }
+    }
+    else
+    {
+        for (const SoftwareTexture& level : GenerateMipChain(base, mipOptions, threadPool))
+        {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(level.texels.data());
+            upload.rowPitches.push_back(level.width * 4);
+            upload.levels.emplace_back(bytes, bytes + level.texels.size() * 4);
+        }
+    }
+
+    return upload;
+}
+
+const void* TextureUpload::LevelData(unsigned level) const
+{
+    return cooked != nullptr ? static_cast<const void*>(cooked->LevelData(level)) : levels[level].data();
+}
+
+bool CreateTextureFromUpload(ID3D11Device* device, const TextureUpload& upload, ID3D11Texture2D*& texture, ID3D11ShaderResourceView*& srv)
+{
+    std::vector<D3D11_SUBRESOURCE_DATA> data(upload.LevelCount());
+    for (unsigned level = 0; level < upload.LevelCount(); ++level)
+        data[level] = { upload.LevelData(level), upload.rowPitches[level], 0 };
+
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = upload.width;
+    textureDesc.Height = upload.height;
+    textureDesc.MipLevels = upload.LevelCount();
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = upload.format;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    if (FAILED(device->CreateTexture2D(&textureDesc, data.data(), &texture)))
+    {
+        std::cerr << "Failed to create Texture2D" << std::endl;
+        return false;
+    }
+
+    if (FAILED(device->CreateShaderResourceView(texture, nullptr, &srv)))
+    {
+        std::cerr << "Failed to create Shader Resource View" << std::endl;
+        texture->Release();
+        texture = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+namespace
+{
+    uint64_t LevelBytes(DXGI_FORMAT format, unsigned width, unsigned height)
+    {
+        uint64_t blocks = uint64_t((width + 3) / 4) * ((height + 3) / 4);
+        switch (format)
+        {
+        case DXGI_FORMAT_R8_UNORM:   return uint64_t(width) * height;
+        case DXGI_FORMAT_R8G8_UNORM: return uint64_t(width) * height * 2;
+        case DXGI_FORMAT_BC1_UNORM:  return blocks * 8;
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC7_UNORM:  return blocks * 16;
+        default:                     return uint64_t(width) * height * 4;
+        }
+    }
+}
+
+unsigned TextureStreamer::DefaultWorkerCount()
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+}
+
+bool TextureStreamer::Create(ID3D11Device* device, ID3D11DeviceContext* context, const std::string& cacheDirectory, unsigned workerCount)
+{
+    this->device = device;
+    this->context = context;
+    this->cacheDirectory = cacheDirectory;
+    if (!cacheDirectory.empty())
+        decodedCache.Create((std::filesystem::path(cacheDirectory) / "decoded").string());
+
+    TextureUpload white;
+    white.width = white.height = 1;
+    white.levels.push_back({ 0xFF, 0xFF, 0xFF, 0xFF });
+    white.rowPitches.push_back(4);
+    if (!CreateTextureFromUpload(device, white, placeholderTexture, placeholder))
+    {
+        std::cerr << "Failed to create placeholder texture" << std::endl;
+        return false;
+    }
+
+    stopping = false;
+    for (unsigned i = 0; i < std::max(1u, workerCount); ++i)
+        workers.emplace_back(&TextureStreamer::WorkerLoop, this);
+
+    return true;
+}
+
+void TextureStreamer::Release()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        jobs.clear();
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+
+    for (Completion* completion = completed.exchange(nullptr); completion != nullptr;)
+    {
+        Completion* next = completion->next;
+        delete completion;
+        completion = next;
+    }
+    for (Completion* completion : ready)
+        delete completion;
+    ready.clear();
+
+    for (Slot& slot : slots)
+    {
+        if (slot.srv != nullptr)
+            slot.srv->Release();
+        if (slot.texture != nullptr)
+            slot.texture->Release();
+    }
+    slots.clear();
+    pending = 0;
+    frame = 0;
+    decodedCache.Release();
+    counters = { counters.budgetBytes };
+
+    if (placeholder != nullptr)
+        placeholder->Release();
+    if (placeholderTexture != nullptr)
+        placeholderTexture->Release();
+    placeholder = nullptr;
+    placeholderTexture = nullptr;
+}
+
+TextureHandle TextureStreamer::Request(const std::string& path, float priority, TextureUsage usage)
+{
+    slots.emplace_back();
+    slots.back().path = path;
+    slots.back().priority = priority;
+    slots.back().usage = usage;
+    slots.back().lastUsedFrame = frame;
+    return Enqueue(static_cast<TextureHandle>(slots.size() - 1));
+}
+
+TextureHandle TextureStreamer::Request(std::shared_ptr<const std::vector<uint8_t>> file, float priority, TextureUsage usage)
+{
+    slots.emplace_back();
+    slots.back().file = std::move(file);
+    slots.back().priority = priority;
+    slots.back().usage = usage;
+    slots.back().lastUsedFrame = frame;
+    return Enqueue(static_cast<TextureHandle>(slots.size() - 1));
+}
+
+TextureHandle TextureStreamer::Enqueue(TextureHandle handle)
+{
+    Slot& slot = slots[handle];
+    slot.queued = true;
+    ++pending;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({ slot.priority, nextSequence++, handle, slot.path, slot.file, slot.usage });
+        std::push_heap(jobs.begin(), jobs.end());
+    }
+    wake.notify_one();
+
+    return handle;
+}
+
+unsigned TextureStreamer::Update(unsigned maxUploads)
+{
+    ++frame;
+
+    //The list comes newest first; reversed, uploads happen in completion order
+    std::vector<Completion*> arrived;
+    for (Completion* completion = completed.exchange(nullptr, std::memory_order_acquire); completion != nullptr; completion = completion->next)
+        arrived.push_back(completion);
+    ready.insert(ready.end(), arrived.rbegin(), arrived.rend());
+
+    unsigned uploads = 0;
+    while (!ready.empty() && uploads < maxUploads)
+    {
+        Completion* completion = ready.front();
+        ready.pop_front();
+
+        Slot& slot = slots[completion->handle];
+        slot.queued = false;
+
+        ID3D11Texture2D* texture = nullptr;
+        ID3D11ShaderResourceView* srv = nullptr;
+        if (completion->succeeded && CreateTextureFromUpload(device, completion->upload, texture, srv))
+        {
+            if (slot.srv != nullptr)            //A trimmed copy, replaced in full
+            {
+                slot.srv->Release();
+                slot.texture->Release();
+                counters.residentBytes -= slot.bytes;
+                --counters.residentTextures;
+            }
+
+            const TextureUpload& upload = completion->upload;
+            slot.texture = texture;
+            slot.srv = srv;
+            slot.droppedMips = 0;
+            slot.bytes = 0;
+            for (unsigned level = 0; level < upload.LevelCount(); ++level)
+                slot.bytes += LevelBytes(upload.format, std::max(1u, upload.width >> level), std::max(1u, upload.height >> level));
+
+            counters.residentBytes += slot.bytes;
+            counters.peakResidentBytes = std::max(counters.peakResidentBytes, counters.residentBytes);
+            ++counters.residentTextures;
+        }
+        else
+        {
+            std::cerr << "Texture " << completion->handle << " stays on the placeholder" << std::endl;
+            slot.failed = true;                 //Not retried on the next View
+        }
+
+        delete completion;
+        --pending;
+        ++uploads;
+    }
+
+    EnforceBudget();
+    return uploads;
+}
+
+ID3D11ShaderResourceView* TextureStreamer::View(TextureHandle handle)
+{
+    if (handle >= slots.size())
+        return placeholder;
+
+    Slot& slot = slots[handle];
+    slot.lastUsedFrame = frame;
+    if ((slot.srv == nullptr || slot.droppedMips > 0) && !slot.queued && !slot.failed)
+    {
+        Enqueue(handle);
+        ++counters.refaults;
+    }
+
+    return slot.srv != nullptr ? slot.srv : placeholder;
+}
+
+void TextureStreamer::EnforceBudget()
+{
+    if (counters.residentBytes <= counters.budgetBytes)
+        return;
+
+    //Anything viewed last frame is likely in the next one and stays untouched
+    std::vector<TextureHandle> candidates;
+    for (TextureHandle handle = 0; handle < slots.size(); ++handle)
+        if (slots[handle].srv != nullptr && slots[handle].lastUsedFrame + 1 < frame)
+            candidates.push_back(handle);
+
+    std::sort(candidates.begin(), candidates.end(), [this](TextureHandle a, TextureHandle b)
+    {
+        const Slot& first = slots[a];
+        const Slot& second = slots[b];
+        return first.priority != second.priority ? first.priority < second.priority : first.lastUsedFrame < second.lastUsedFrame;
+    });
+
+    //Shrinking keeps something sharper than the placeholder on screen, so it goes before any eviction
+    for (TextureHandle handle : candidates)
+        while (counters.residentBytes > counters.budgetBytes && DropTopMip(slots[handle]))
+            ;
+
+    for (TextureHandle handle : candidates)
+    {
+        if (counters.residentBytes <= counters.budgetBytes)
+            return;
+        Evict(slots[handle]);
+    }
+}
+
+bool TextureStreamer::DropTopMip(Slot& slot)
+{
+    D3D11_TEXTURE2D_DESC desc;
+    slot.texture->GetDesc(&desc);
+
+    D3D11_TEXTURE2D_DESC trimmedDesc = desc;
+    trimmedDesc.Width = std::max(1u, desc.Width >> 1);
+    trimmedDesc.Height = std::max(1u, desc.Height >> 1);
+    trimmedDesc.MipLevels = desc.MipLevels - 1;
+    trimmedDesc.Usage = D3D11_USAGE_DEFAULT;        //Immutable textures cannot be copied into
+
+    bool blockCompressed = desc.Format == DXGI_FORMAT_BC1_UNORM || desc.Format == DXGI_FORMAT_BC3_UNORM || desc.Format == DXGI_FORMAT_BC7_UNORM;
+    if (desc.MipLevels < 2 || trimmedDesc.Width < MIN_TRIMMED_SIZE || trimmedDesc.Height < MIN_TRIMMED_SIZE ||
+        (blockCompressed && (trimmedDesc.Width % 4 != 0 || trimmedDesc.Height % 4 != 0)))
+        return false;
+
+    ID3D11Texture2D* trimmed;
+    if (FAILED(device->CreateTexture2D(&trimmedDesc, nullptr, &trimmed)))
+        return false;
+
+    for (UINT level = 0; level < trimmedDesc.MipLevels; ++level)
+        context->CopySubresourceRegion(trimmed, level, 0, 0, 0, slot.texture, level + 1, nullptr);
+
+    ID3D11ShaderResourceView* srv;
+    if (FAILED(device->CreateShaderResourceView(trimmed, nullptr, &srv)))
+    {
+        trimmed->Release();
+        return false;
+    }
+
+    slot.srv->Release();
+    slot.texture->Release();
+    slot.texture = trimmed;
+    slot.srv = srv;
+
+    uint64_t dropped = LevelBytes(desc.Format, desc.Width, desc.Height);
+    slot.bytes -= dropped;
+    counters.residentBytes -= dropped;
+    ++slot.droppedMips;
+    ++counters.mipDrops;
+    return true;
+}
+
+void TextureStreamer::Evict(Slot& slot)
+{
+    slot.srv->Release();
+    slot.texture->Release();
+    slot.srv = nullptr;
+    slot.texture = nullptr;
+
+    counters.residentBytes -= slot.bytes;
+    slot.bytes = 0;
+    slot.droppedMips = 0;
+    --counters.residentTextures;
+    ++counters.evictions;
+}
+
+void TextureStreamer::WorkerLoop()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+
+            std::pop_heap(jobs.begin(), jobs.end());
+            job = std::move(jobs.back());
+            jobs.pop_back();
+        }
+
+        Completion* completion = new Completion{ job.handle, false, {}, nullptr };
+
+        //Cooked files are only mapped, the upload points into the mapping
+        if (IsCookedTexturePath(job.path))
+        {
+            std::shared_ptr<CookedTexture> cooked = std::make_shared<CookedTexture>();
+            if (cooked->Open(job.path))
+            {
+                completion->upload = UploadFromCookedTexture(std::move(cooked));
+                completion->succeeded = true;
+            }
+            Publish(completion);
+            continue;
+        }
+
+        std::vector<uint8_t> read;
+        const std::vector<uint8_t>* file = job.file.get();
+        if (!job.path.empty())
+        {
+            std::ifstream reader(job.path, std::ios::binary);
+            read.assign(std::istreambuf_iterator<char>(reader), std::istreambuf_iterator<char>());
+            file = reader.is_open() ? &read : nullptr;
+            if (file == nullptr)
+                std::cerr << "Could not open " << job.path << std::endl;
+        }
+
+        TextureImage image;
+        bool decoded = file != nullptr && (decodedCache.IsCreated() ? decodedCache.Load(file->data(), file->size(), image)
+                                                                    : LoadTextureImageFromMemory(file->data(), file->size(), image));
+        if (decoded)
+        {
+            read = std::vector<uint8_t>();          //The encoded bytes are not needed past decode
+            completion->upload = PrepareTextureUpload(image, cacheDirectory, nullptr, MipOptions(), job.usage);
+            completion->succeeded = true;
+        }
+
+        Publish(completion);
+    }
+}
+
+void TextureStreamer::Publish(Completion* completion)
+{
+    Completion* head = completed.load(std::memory_order_relaxed);
+    do
+        completion->next = head;
+    while (!completed.compare_exchange_weak(head, completion, std::memory_order_release, std::memory_order_relaxed));
+}
+
+#ifndef _WIN32
+
+namespace
+{
+    //Distinct binary PPMs, so every texture really decodes and filters
+    std::vector<uint8_t> MakeBenchmarkImage(unsigned size, unsigned seed)
+    {
+        std::string header = "P6\n" + std::to_string(size) + " " + std::to_string(size) + "\n255\n";
+        std::vector<uint8_t> file(header.begin(), header.end());
+        std::srand(seed);
+        for (unsigned i = 0; i < size * size * 3; ++i)
+            file.push_back(static_cast<uint8_t>(((i / 3) % size + seed * 17) ^ (std::rand() & 31)));
+        return file;
+    }
+}
+
+void RunTextureStreamingBenchmark()
+{
+    const unsigned SIZE = 256;
+    const unsigned UPLOADS_PER_FRAME = 2;       //Update's cap, so decodes that finish early cannot stall a frame
+    const unsigned textureCounts[] = { 16, 64, 256 };
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    for (unsigned count : textureCounts)
+    {
+        std::vector<std::shared_ptr<const std::vector<uint8_t>>> files;
+        for (unsigned i = 0; i < count; ++i)
+            files.push_back(std::make_shared<const std::vector<uint8_t>>(MakeBenchmarkImage(SIZE, i + 1)));
+
+        //Before: SetupPipeline decoded and created every texture ahead of the first frame
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& file : files)
+        {
+            TextureImage image;
+            ID3D11Texture2D* texture;
+            ID3D11ShaderResourceView* srv;
+            if (LoadTextureImageFromMemory(file->data(), file->size(), image) && CreateTextureFromUpload(device, PrepareTextureUpload(image, ""), texture, srv))
+            {
+                srv->Release();
+                texture->Release();
+            }
+        }
+        double synchronousMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        //After: the first frame only needs the requests queued, sharing the files, and one Update that creates at most
+        //UPLOADS_PER_FRAME textures however many decodes have finished
+        TextureStreamer streamer;
+        start = std::chrono::steady_clock::now();
+        streamer.Create(device, context, "");
+        std::vector<TextureHandle> handles;
+        for (unsigned i = 0; i < count; ++i)
+            handles.push_back(streamer.Request(files[i], static_cast<float>(i % 4)));
+        streamer.Update(UPLOADS_PER_FRAME);
+        for (TextureHandle handle : handles)
+            streamer.View(handle);
+        double firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        unsigned frames = 1;
+        while (streamer.PendingCount() > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            streamer.Update(UPLOADS_PER_FRAME);
+            ++frames;
+        }
+        double residentMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        unsigned resident = 0;
+        for (TextureHandle handle : handles)
+            resident += streamer.IsResident(handle) ? 1 : 0;
+
+        std::printf("%4u textures %ux%u  synchronous first frame %9.2f ms  streamed first frame %7.3f ms  all resident %9.2f ms after %u updates (%u/%u, %u workers)\n",
+                    count, SIZE, SIZE, synchronousMs, firstFrameMs, residentMs, frames, resident, count, TextureStreamer::DefaultWorkerCount());
+        streamer.Release();
+    }
+
+    context->Release();
+    device->Release();
+}
+
+void RunTextureResidencyBenchmark()
+{
+    const unsigned SIZE = 256;
+    const unsigned TEXTURES = 48;
+    const unsigned WINDOW = 8;              //Textures viewed per frame
+    const unsigned FRAMES_PER_STEP = 4;     //The window moves on by one texture this often
+    const unsigned FRAMES = TEXTURES * FRAMES_PER_STEP * 2;
+    const uint64_t MB = 1 << 20;
+    const uint64_t budgets[] = { TextureStreamer::UNLIMITED, 8 * MB, 4 * MB, 2 * MB };
+
+    ID3D11Device* device;
+    ID3D11DeviceContext1* context;
+    if (FAILED(CreateHeadlessDevice(&device, &context)))
+    {
+        std::cerr << "Could not create stand-in device" << std::endl;
+        return;
+    }
+
+    std::vector<std::shared_ptr<const std::vector<uint8_t>>> files;
+    for (unsigned i = 0; i < TEXTURES; ++i)
+        files.push_back(std::make_shared<const std::vector<uint8_t>>(MakeBenchmarkImage(SIZE, i + 1)));
+
+    //A camera walking past a ring of textures: a sliding window of them is on screen, the rest only comes back later
+    for (uint64_t budget : budgets)
+    {
+        TextureStreamer streamer;
+        streamer.Create(device, context, "");
+        streamer.SetBudget(budget);
+
+        std::vector<TextureHandle> handles;
+        for (unsigned i = 0; i < TEXTURES; ++i)
+            handles.push_back(streamer.Request(files[i]));
+        while (streamer.PendingCount() > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            streamer.Update();
+        }
+
+        double updateMs = 0;
+        unsigned views = 0, placeholderViews = 0;
+        for (unsigned frame = 0; frame < FRAMES; ++frame)
+        {
+            auto start = std::chrono::steady_clock::now();
+            streamer.Update();
+            updateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            for (unsigned i = 0; i < WINDOW; ++i)
+            {
+                TextureHandle handle = handles[(frame / FRAMES_PER_STEP + i) % TEXTURES];
+                placeholderViews += streamer.IsResident(handle) ? 0 : 1;
+                streamer.View(handle);
+                ++views;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));      //The rest of the frame, time the workers get
+        }
+
+        const ResidencyCounters& counters = streamer.Counters();
+        char budgetText[32];
+        if (budget == TextureStreamer::UNLIMITED)
+            std::snprintf(budgetText, sizeof(budgetText), "unlimited");
+        else
+            std::snprintf(budgetText, sizeof(budgetText), "%.0f MB", budget / double(MB));
+
+        std::printf("budget %-9s  resident %6.2f MB (peak %6.2f) in %2u textures  %4u evictions  %4u mip drops  %4u refaults  "
+                    "%5.1f%% placeholder views  %.3f ms/Update\n",
+                    budgetText, counters.residentBytes / double(MB), counters.peakResidentBytes / double(MB), counters.residentTextures,
+                    counters.evictions, counters.mipDrops, counters.refaults, 100.0 * placeholderViews / views, updateMs / FRAMES);
+        streamer.Release();
+    }
+
+    context->Release();
+    device->Release();
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "D3D11Compat.h"
+#include "DecodedImageCache.h"
+#include "MipChain.h"
+#include "TextureImage.h"
+#include "ThreadPool.h"
+
+class CookedTexture;
+
+//Everything CreateTexture2D needs for one texture, built without touching the device so it can run on any thread:
+//the format that suits the image and every mip level, largest first.
+struct TextureUpload
+{
+	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	unsigned width = 0;
+	unsigned height = 0;
+	std::vector<std::vector<uint8_t>> levels;			//Empty when cooked holds the levels
+	std::vector<UINT> rowPitches;
+	std::shared_ptr<const CookedTexture> cooked;		//A mapped .ctex file, see TextureCooking.h
+
+	unsigned LevelCount() const { return static_cast<unsigned>(rowPitches.size()); }
+	const void* LevelData(unsigned level) const;
+};
+
+//Full mip chain filtered with mipOptions; BC1 (opaque) or BC7 through the disk cache in cacheDirectory when the size is
+//a multiple of 4, RGBA8 otherwise. An empty cacheDirectory skips block compression. Narrow colour images are expanded
+//to RGBA first, so they look the same as their RGBA files; narrow data images stay R8 / R8G8, filtered as linear data.
+TextureUpload PrepareTextureUpload(const TextureImage& image, const std::string& cacheDirectory, ThreadPool* threadPool = nullptr,
+	const MipOptions& mipOptions = MipOptions(), TextureUsage usage = TextureUsage::Colour);
+bool CreateTextureFromUpload(ID3D11Device* device, const TextureUpload& upload, ID3D11Texture2D*& texture, ID3D11ShaderResourceView*& srv);
+
+typedef uint32_t TextureHandle;
+
+//Texture memory as the streamer accounts it: the bytes of every resident mip level, placeholder excluded
+struct ResidencyCounters
+{
+	uint64_t budgetBytes = 0;
+	uint64_t residentBytes = 0;
+	uint64_t peakResidentBytes = 0;
+	unsigned residentTextures = 0;
+	unsigned evictions = 0;			//Textures released entirely, back on the placeholder
+	unsigned mipDrops = 0;			//Top mip levels released from textures that stayed resident
+	unsigned refaults = 0;			//Evicted or trimmed textures requested again because they were used
+};
+
+//Loads textures in the background. Requests go into a priority queue that worker threads drain: read the file,
+//stbi_load_from_memory, PrepareTextureUpload; paths ending in .ctex are only mapped (TextureCooking.h). With a cache
+//directory the decoded pixels are kept in its "decoded" subdirectory (DecodedImageCache.h) and reused for any file
+//with the same bytes. Finished uploads come back to the render thread through a lock-free list and become real
+//textures in Update(); until then View() returns a 1x1 white placeholder, so the first frame does not wait for any
+//texture. Everything except the workers runs on the render thread.
+//
+//Resident textures are kept under a memory budget. Each has a size, the frame it was last viewed in and its request
+//priority. When Update() finds the total over budget it trims textures that were not viewed last frame, lowest
+//priority and least recently used first: their top mip levels are dropped down to MIN_TRIMMED_SIZE, then whole
+//textures are evicted. Viewing a trimmed or evicted texture loads it again in full (a refault).
+class TextureStreamer
+{
+public:
+	static const uint64_t UNLIMITED = ~0ull;
+	static const unsigned MIN_TRIMMED_SIZE = 64;		//Mip drops stop once the top level would be narrower or shorter
+
+	TextureStreamer() = default;
+	~TextureStreamer() { Release(); }
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	static unsigned DefaultWorkerCount();		//One thread per core, less the render thread's
+
+	//context copies the surviving levels when top mips are dropped
+	bool Create(ID3D11Device* device, ID3D11DeviceContext* context, const std::string& cacheDirectory, unsigned workerCount = DefaultWorkerCount());
+	void Release();		//Abandons queued requests, waits for running decodes, releases every texture
+
+	void SetBudget(uint64_t bytes) { counters.budgetBytes = bytes; }		//Enforced from the next Update()
+
+	//Higher priority is decoded first, equal priorities in request order, and is trimmed last. TextureUsage::Data only
+	//for textures the shader reads through .r / .rg, see PrepareTextureUpload.
+	TextureHandle Request(const std::string& path, float priority = 0.0f, TextureUsage usage = TextureUsage::Colour);
+	//An image file already in memory, shared rather than copied and kept for refaults
+	TextureHandle Request(std::shared_ptr<const std::vector<uint8_t>> file, float priority = 0.0f, TextureUsage usage = TextureUsage::Colour);
+
+	//Starts a frame: creates the textures of finished decodes, at most maxUploads of them so a burst cannot stall one
+	//frame, then trims back under the budget
+	unsigned Update(unsigned maxUploads = ~0u);
+
+	//Marks the texture used this frame. The placeholder until resident, or if loading failed.
+	ID3D11ShaderResourceView* View(TextureHandle handle);
+	bool IsResident(TextureHandle handle) const { return slots[handle].srv != nullptr; }
+	unsigned PendingCount() const { return pending; }		//Requested, neither resident nor failed yet
+	const ResidencyCounters& Counters() const { return counters; }
+
+private:
+	struct Job
+	{
+		float priority;
+		uint64_t sequence;
+		TextureHandle handle;
+		std::string path;				//Empty when file holds the data
+		std::shared_ptr<const std::vector<uint8_t>> file;
+		TextureUsage usage;
+
+		bool operator<(const Job& other) const { return priority != other.priority ? priority < other.priority : sequence > other.sequence; }
+	};
+
+	struct Completion
+	{
+		TextureHandle handle;
+		bool succeeded;
+		TextureUpload upload;
+		Completion* next;
+	};
+
+	struct Slot
+	{
+		ID3D11Texture2D* texture = nullptr;
+		ID3D11ShaderResourceView* srv = nullptr;
+		uint64_t bytes = 0;					//Resident levels only
+		uint64_t lastUsedFrame = 0;
+		float priority = 0.0f;
+		unsigned droppedMips = 0;
+		bool queued = false;				//A decode is in flight, at most one per slot
+		bool failed = false;
+		std::string path;					//Where the data comes from again on a refault
+		std::shared_ptr<const std::vector<uint8_t>> file;
+		TextureUsage usage = TextureUsage::Colour;
+	};
+
+	TextureHandle Enqueue(TextureHandle handle);
+	void WorkerLoop();
+	void Publish(Completion* completion);		//Lock-free push from any worker
+	void EnforceBudget();
+	bool DropTopMip(Slot& slot);
+	void Evict(Slot& slot);
+
+	ID3D11Device* device = nullptr;
+	ID3D11DeviceContext* context = nullptr;
+	std::string cacheDirectory;
+	DecodedImageCache decodedCache;				//Not created without a cacheDirectory
+	ID3D11Texture2D* placeholderTexture = nullptr;
+	ID3D11ShaderResourceView* placeholder = nullptr;
+
+	std::vector<Slot> slots;					//Render thread only
+	std::deque<Completion*> ready;				//Taken from the list, not uploaded yet
+	unsigned pending = 0;
+	uint64_t frame = 0;
+	ResidencyCounters counters = { UNLIMITED };
+
+	std::vector<Job> jobs;						//Max-heap on priority, guarded by mutex
+	uint64_t nextSequence = 0;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::vector<std::thread> workers;
+
+	std::atomic<Completion*> completed{ nullptr };		//Newest first
+};
+
+#ifndef _WIN32
+void RunTextureStreamingBenchmark();
+void RunTextureResidencyBenchmark();
+#endif
\ No newline at end of file
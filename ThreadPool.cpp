@@ -0,0 +1,81 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (threadCount == 0)
+        threadCount = 1;
+
+    for (unsigned i = 1; i < threadCount; ++i)      //The calling thread is the last worker
+        workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::RunJobs()
+{
+    for (unsigned i = nextIndex.fetch_add(1); i < jobCount; i = nextIndex.fetch_add(1))
+        (*currentJob)(i);
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned seenGeneration = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+
+            if (stopping)
+                return;
+
+            seenGeneration = generation;
+        }
+
+        RunJobs();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0)
+            done.notify_one();
+    }
+}
+
+void ThreadPool::ParallelFor(unsigned count, const std::function<void(unsigned)>& job)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty() || count == 1)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            job(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentJob = &job;
+        jobCount = count;
+        nextIndex = 0;
+        busyWorkers = static_cast<unsigned>(workers.size());
+        ++generation;
+    }
+    wake.notify_all();
+
+    RunJobs();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return busyWorkers == 0; });
+    currentJob = nullptr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Persistent worker threads that split index ranges between themselves and the calling thread
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned ThreadCount() const { return static_cast<unsigned>(workers.size()) + 1; }		//Workers + calling thread
+
+	//Runs job(i) for every i in [0, count), returns when all calls have finished
+	void ParallelFor(unsigned count, const std::function<void(unsigned)>& job);
+
+private:
+	void WorkerLoop();
+	void RunJobs();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const std::function<void(unsigned)>* currentJob = nullptr;
+	unsigned jobCount = 0;
+	std::atomic<unsigned> nextIndex{ 0 };
+	unsigned busyWorkers = 0;
+	unsigned generation = 0;
+	bool stopping = false;
+};
@@ -0,0 +1,320 @@
+#include "VertexProcessing.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(VertexData) == 32, "The SIMD paths load one vertex per 256-bit register");
+
+void TransformedVertices::Resize(size_t newCount)
+{
+    count = newCount;
+    for (std::vector<float>& stream : position) stream.resize(newCount);
+    for (std::vector<float>& stream : normal) stream.resize(newCount);
+    for (std::vector<float>& stream : uv) stream.resize(newCount);
+    for (std::vector<float>& stream : worldPosition) stream.resize(newCount);
+}
+
+namespace
+{
+    void TransformScalar(const VertexData* vertices, size_t first, size_t count, const ConstantBuffer& cb, TransformedVertices& output)
+    {
+        for (size_t v = first; v < first + count; ++v)
+        {
+            const VertexData& input = vertices[v];
+
+            //The constant buffer holds transposed matrices, so mul(v, M) is a dot product with each stored row
+            for (int i = 0; i < 4; ++i)
+            {
+                const float* row = cb.worldViewPerspective[i];
+                output.position[i][v] = row[0] * input.pos[0] + row[1] * input.pos[1] + row[2] * input.pos[2] + row[3];
+            }
+
+            float normal[3];
+            for (int i = 0; i < 3; ++i)
+                normal[i] = cb.world[i][0] * input.nor[0] + cb.world[i][1] * input.nor[1] + cb.world[i][2] * input.nor[2];
+            float invLength = 1.0f / std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            for (int i = 0; i < 3; ++i)
+                output.normal[i][v] = normal[i] * invLength;
+
+            output.uv[0][v] = input.uv[0];
+            output.uv[1][v] = input.uv[1];
+
+            //mul(float3, float4x4) only uses the upper three rows, so no translation
+            for (int i = 0; i < 4; ++i)
+                output.worldPosition[i][v] = cb.world[i][0] * input.pos[0] + cb.world[i][1] * input.pos[1] + cb.world[i][2] * input.pos[2];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+
+namespace
+{
+    void TransformSse2(const VertexData* vertices, size_t first, size_t count, const ConstantBuffer& cb, TransformedVertices& output)
+    {
+        const float* base = reinterpret_cast<const float*>(vertices);
+        size_t end = first + (count & ~size_t(3));
+
+        for (size_t v = first; v < end; v += 4)
+        {
+            //Two 4x4 transposes: (pos, nor.x) and (nor.yz, uv)
+            const float* in = base + v * 8;
+            __m128 px = _mm_loadu_ps(in), py = _mm_loadu_ps(in + 8), pz = _mm_loadu_ps(in + 16), nx = _mm_loadu_ps(in + 24);
+            __m128 ny = _mm_loadu_ps(in + 4), nz = _mm_loadu_ps(in + 12), u = _mm_loadu_ps(in + 20), uvV = _mm_loadu_ps(in + 28);
+            _MM_TRANSPOSE4_PS(px, py, pz, nx);
+            _MM_TRANSPOSE4_PS(ny, nz, u, uvV);
+
+            for (int i = 0; i < 4; ++i)
+            {
+                const float* row = cb.worldViewPerspective[i];
+                __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), px), _mm_mul_ps(_mm_set1_ps(row[1]), py)),
+                                           _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[2]), pz), _mm_set1_ps(row[3])));
+                _mm_storeu_ps(&output.position[i][v], result);
+            }
+
+            __m128 normal[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                const float* row = cb.world[i];
+                normal[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), nx), _mm_mul_ps(_mm_set1_ps(row[1]), ny)), _mm_mul_ps(_mm_set1_ps(row[2]), nz));
+            }
+            __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normal[0], normal[0]), _mm_mul_ps(normal[1], normal[1])), _mm_mul_ps(normal[2], normal[2]));
+            __m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+            for (int i = 0; i < 3; ++i)
+                _mm_storeu_ps(&output.normal[i][v], _mm_mul_ps(normal[i], invLength));
+
+            _mm_storeu_ps(&output.uv[0][v], u);
+            _mm_storeu_ps(&output.uv[1][v], uvV);
+
+            for (int i = 0; i < 4; ++i)
+            {
+                const float* row = cb.world[i];
+                __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), px), _mm_mul_ps(_mm_set1_ps(row[1]), py)), _mm_mul_ps(_mm_set1_ps(row[2]), pz));
+                _mm_storeu_ps(&output.worldPosition[i][v], result);
+            }
+        }
+
+        TransformScalar(vertices, end, first + count - end, cb, output);
+    }
+}
+
+SIMD_BEGIN_TARGET_AVX2
+namespace
+{
+    void TransformAvx2(const VertexData* vertices, size_t first, size_t count, const ConstantBuffer& cb, TransformedVertices& output)
+    {
+        const float* base = reinterpret_cast<const float*>(vertices);
+        size_t end = first + (count & ~size_t(7));
+
+        __m256 wvp[4][4], world[4][3];
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+                wvp[i][j] = _mm256_set1_ps(cb.worldViewPerspective[i][j]);
+            for (int j = 0; j < 3; ++j)
+                world[i][j] = _mm256_set1_ps(cb.world[i][j]);
+        }
+
+        for (size_t v = first; v < end; v += 8)
+        {
+            //One vertex per register, an 8x8 transpose turns them into one register per component
+            const float* in = base + v * 8;
+            __m256 r0 = _mm256_loadu_ps(in), r1 = _mm256_loadu_ps(in + 8), r2 = _mm256_loadu_ps(in + 16), r3 = _mm256_loadu_ps(in + 24);
+            __m256 r4 = _mm256_loadu_ps(in + 32), r5 = _mm256_loadu_ps(in + 40), r6 = _mm256_loadu_ps(in + 48), r7 = _mm256_loadu_ps(in + 56);
+
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+            __m256 t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5);
+            __m256 t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+
+            __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+            __m256 px = _mm256_permute2f128_ps(s0, s4, 0x20), py = _mm256_permute2f128_ps(s1, s5, 0x20);
+            __m256 pz = _mm256_permute2f128_ps(s2, s6, 0x20), nx = _mm256_permute2f128_ps(s3, s7, 0x20);
+            __m256 ny = _mm256_permute2f128_ps(s0, s4, 0x31), nz = _mm256_permute2f128_ps(s1, s5, 0x31);
+            __m256 u = _mm256_permute2f128_ps(s2, s6, 0x31), uvV = _mm256_permute2f128_ps(s3, s7, 0x31);
+
+            for (int i = 0; i < 4; ++i)
+            {
+                __m256 result = _mm256_fmadd_ps(wvp[i][0], px, _mm256_fmadd_ps(wvp[i][1], py, _mm256_fmadd_ps(wvp[i][2], pz, wvp[i][3])));
+                _mm256_storeu_ps(&output.position[i][v], result);
+            }
+
+            __m256 normal[3];
+            for (int i = 0; i < 3; ++i)
+                normal[i] = _mm256_fmadd_ps(world[i][0], nx, _mm256_fmadd_ps(world[i][1], ny, _mm256_mul_ps(world[i][2], nz)));
+            __m256 lengthSquared = _mm256_fmadd_ps(normal[0], normal[0], _mm256_fmadd_ps(normal[1], normal[1], _mm256_mul_ps(normal[2], normal[2])));
+            __m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lengthSquared));
+            for (int i = 0; i < 3; ++i)
+                _mm256_storeu_ps(&output.normal[i][v], _mm256_mul_ps(normal[i], invLength));
+
+            _mm256_storeu_ps(&output.uv[0][v], u);
+            _mm256_storeu_ps(&output.uv[1][v], uvV);
+
+            for (int i = 0; i < 4; ++i)
+            {
+                __m256 result = _mm256_fmadd_ps(world[i][0], px, _mm256_fmadd_ps(world[i][1], py, _mm256_mul_ps(world[i][2], pz)));
+                _mm256_storeu_ps(&output.worldPosition[i][v], result);
+            }
+        }
+
+        TransformScalar(vertices, end, first + count - end, cb, output);
+    }
+}
+SIMD_END_TARGET
+
+#endif
+
+const char* VertexIsaName(VertexIsa isa)
+{
+    switch (isa)
+    {
+    case VertexIsa::SSE2: return "SSE2";
+    case VertexIsa::AVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+bool IsVertexIsaSupported(VertexIsa isa)
+{
+    switch (isa)
+    {
+    case VertexIsa::SSE2: return GetCpuFeatures().sse2;
+    case VertexIsa::AVX2: return GetCpuFeatures().avx2;
+    default: return true;
+    }
+}
+
+VertexIsa BestVertexIsa()
+{
+    static const VertexIsa best = IsVertexIsaSupported(VertexIsa::AVX2) ? VertexIsa::AVX2 :
+                                  IsVertexIsaSupported(VertexIsa::SSE2) ? VertexIsa::SSE2 : VertexIsa::Scalar;
+    return best;
+}
+
+void TransformVertices(VertexIsa isa, const VertexData* vertices, size_t first, size_t count, const ConstantBuffer& cb, TransformedVertices& output)
+{
+    switch (isa)
+    {
+#ifdef SIMD_X86
+    case VertexIsa::AVX2: TransformAvx2(vertices, first, count, cb, output); break;
+    case VertexIsa::SSE2: TransformSse2(vertices, first, count, cb, output); break;
+#endif
+    default: TransformScalar(vertices, first, count, cb, output); break;
+    }
+}
+
+void TransformVertices(const VertexData* vertices, size_t count, const ConstantBuffer& cb, TransformedVertices& output, ThreadPool* threadPool)
+{
+    const size_t CHUNK_SIZE = 16384;        //Multiple of 8, large enough to amortize the dispatch
+
+    output.Resize(count);
+    VertexIsa isa = BestVertexIsa();
+
+    if (threadPool == nullptr || count <= CHUNK_SIZE)
+    {
+        TransformVertices(isa, vertices, 0, count, cb, output);
+        return;
+    }
+
+    unsigned chunks = static_cast<unsigned>((count + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    threadPool->ParallelFor(chunks, [&](unsigned chunk)
+    {
+        size_t first = chunk * CHUNK_SIZE;
+        TransformVertices(isa, vertices, first, std::min(CHUNK_SIZE, count - first), cb, output);
+    });
+}
+
+void RunVertexBenchmark()
+{
+    const size_t VERTEX_COUNT = 2000000;
+    const double secondsPerRun = 1.0;
+    const size_t bytesPerVertex = sizeof(VertexData) + 13 * sizeof(float);     //Read AoS, write SoA
+
+    std::vector<VertexData> vertices(VERTEX_COUNT);
+    std::srand(1);
+    for (VertexData& vertex : vertices)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            vertex.pos[i] = std::rand() / static_cast<float>(RAND_MAX) - 0.5f;
+            vertex.nor[i] = std::rand() / static_cast<float>(RAND_MAX) - 0.5f;
+        }
+        vertex.nor[2] -= 1.0f;
+        vertex.uv[0] = std::rand() / static_cast<float>(RAND_MAX);
+        vertex.uv[1] = std::rand() / static_cast<float>(RAND_MAX);
+    }
+
+    //Same matrices as the rotating quad at an angle of 0.5 radians
+    ConstantBuffer cb =
+    {
+        { {1.172f, 0, 0.615f, -0.615f}, {0, 2.414f, 0, 0}, {-0.457f, 0, 0.886f, 1.786f}, {-0.479f, 0, 0.878f, 2.122f} },
+        { {0.878f, 0, 0.479f, -0.479f}, {0, 1, 0, 0}, {-0.479f, 0, 0.878f, 0.122f}, {0, 0, 0, 1} }
+    };
+
+    TransformedVertices reference;
+    reference.Resize(VERTEX_COUNT);
+    TransformVertices(VertexIsa::Scalar, vertices.data(), 0, VERTEX_COUNT, cb, reference);
+
+    auto report = [&](const char* name, const TransformedVertices& output, unsigned passes, double elapsed)
+    {
+        float maxError = 0;
+        for (size_t v = 0; v < VERTEX_COUNT; ++v)
+            for (int i = 0; i < 4; ++i)
+                maxError = std::max(maxError, std::abs(output.position[i][v] - reference.position[i][v]));
+
+        double verticesPerSecond = passes * static_cast<double>(VERTEX_COUNT) / elapsed;
+        std::printf("%-16s  %8.1f Mvertices/s  %6.2f GB/s  max clip error %g\n", name, verticesPerSecond / 1e6,
+                    verticesPerSecond * bytesPerVertex / 1e9, maxError);
+    };
+
+    TransformedVertices output;
+    output.Resize(VERTEX_COUNT);
+
+    const VertexIsa isas[] = { VertexIsa::Scalar, VertexIsa::SSE2, VertexIsa::AVX2 };
+    for (VertexIsa isa : isas)
+    {
+        if (!IsVertexIsaSupported(isa))
+        {
+            std::printf("%-16s  not supported\n", VertexIsaName(isa));
+            continue;
+        }
+
+        unsigned passes = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0;
+        while (elapsed < secondsPerRun)
+        {
+            TransformVertices(isa, vertices.data(), 0, VERTEX_COUNT, cb, output);
+            ++passes;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        report(VertexIsaName(isa), output, passes, elapsed);
+    }
+
+    ThreadPool threadPool;
+    unsigned passes = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < secondsPerRun)
+    {
+        TransformVertices(vertices.data(), VERTEX_COUNT, cb, output, &threadPool);
+        ++passes;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%s x%u threads", VertexIsaName(BestVertexIsa()), threadPool.ThreadCount());
+    report(name, output, passes, elapsed);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "PipelineData.h"
+#include "ThreadPool.h"
+
+//VertexShader.hlsl on the CPU: AoS VertexData is transposed into SoA and transformed 8 vertices at a time
+
+struct TransformedVertices		//Vertex shader outputs in SoA form
+{
+	size_t count = 0;
+	std::vector<float> position[4];			//SV_POSITION
+	std::vector<float> normal[3];
+	std::vector<float> uv[2];
+	std::vector<float> worldPosition[4];
+
+	void Resize(size_t newCount);
+};
+
+enum class VertexIsa { Scalar, SSE2, AVX2 };
+
+const char* VertexIsaName(VertexIsa isa);
+bool IsVertexIsaSupported(VertexIsa isa);
+VertexIsa BestVertexIsa();
+
+//Transforms vertices [first, first + count) into the same range of output, output must already hold that many vertices
+void TransformVertices(VertexIsa isa, const VertexData* vertices, size_t first, size_t count, const ConstantBuffer& cb, TransformedVertices& output);
+
+//Resizes output and splits large streams across the pool
+void TransformVertices(const VertexData* vertices, size_t count, const ConstantBuffer& cb, TransformedVertices& output, ThreadPool* threadPool = nullptr);
+
+void RunVertexBenchmark();
@@ -1,11 +1,15 @@
 #include <Windows.h>
 #include <iostream>
-#include <d3d11.h>
+#include <d3d11_1.h>
 #include <chrono>
+#include <cwchar>
 
 #include "WindowHelper.h"
 #include "D3D11Handler.h"
+#include "CommandBuffer.h"
 #include "PipelineHelper.h"
+#include "TextureStreaming.h"
+#include "ThreadPool.h"
 
 struct Timer
 {
@@ -23,25 +27,71 @@ struct Timer
 	}
 };
 
-void Render(float* backgroundColor, ID3D11DeviceContext* context, ID3D11RenderTargetView* rtv, 
-	ID3D11DepthStencilView* dsView, ID3D11Buffer* cBuffer, float angle)
+void Render(float* backgroundColor, ID3D11DeviceContext1* context, StateCache& stateCache, CommandQueue& commandQueue,
+	const DrawCommand& quad, ID3D11RenderTargetView* rtv, ID3D11DepthStencilView* dsView, ConstantBufferRing& cBufferRing,
+	Camera& camera, float angle)
 {
-	UpdateConstantbuffer(cBuffer, context, angle);
+	cBufferRing.BeginFrame();
+	stateCache.BeginFrame();
+
+	ConstantBufferAllocation constants = UpdateConstantbuffer(cBufferRing, camera, angle);
+
+	context->ClearRenderTargetView(rtv, backgroundColor);
+	context->ClearDepthStencilView(dsView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1, 0);
+
+	context->OMSetRenderTargets(1, &rtv, dsView);
+
+	DrawCommand command = quad;
+	command.constants = constants;
+
+	commandQueue.Reset();
+	commandQueue.List(0).Record(MakeSortKey(0, 0, 0.0f), command);		//More objects would be recorded from worker jobs into their own lists
+	commandQueue.Sort();
+	commandQueue.Submit(stateCache);		//Key order, only the binds that changed since the last draw reach the context
+
+	cBufferRing.EndFrame();
+}
+
+void RenderInstanced(float* backgroundColor, ID3D11DeviceContext1* context, StateCache& stateCache, ID3D11RenderTargetView* rtv,
+	ID3D11DepthStencilView* dsView, ConstantBufferRing& cBufferRing, Camera& camera, ID3D11Buffer* vBuffer,
+	ID3D11Buffer* instanceBuffer, const InstanceTransforms& transforms, const BoundingSpheres& bounds,
+	std::vector<uint32_t>& visible, ThreadPool& threadPool, float angle)
+{
+	cBufferRing.BeginFrame();
+	stateCache.BeginFrame();
+
+	ConstantBufferAllocation constants = UpdateInstancedConstantbuffer(cBufferRing, camera);
 
 	context->ClearRenderTargetView(rtv, backgroundColor);
 	context->ClearDepthStencilView(dsView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1, 0);
 
-	context->VSSetConstantBuffers(0, 1, &cBuffer);
+	stateCache.SetVSConstantBuffers1(0, 1, &constants.buffer, &constants.firstConstant, &constants.numConstants);
 
 	context->OMSetRenderTargets(1, &rtv, dsView);
 
-	context->Draw(4, 0);
+	Frustum frustum = ExtractFrustum(camera.ViewProjection());
+	size_t visibleCount = CullSpheres(frustum, bounds, visible, &threadPool);		//Only quads inside the frustum reach the instance buffer
+
+	UpdateInstanceBuffer(context, instanceBuffer, transforms, visible.data(), visibleCount, angle, &threadPool);	//Built in parallel
+
+	ID3D11Buffer* buffers[2] = { vBuffer, instanceBuffer };
+	UINT strides[2] = { sizeof(VertexData), sizeof(InstanceData) };
+	UINT offsets[2] = { 0, 0 };
+	stateCache.SetVertexBuffers(0, 2, buffers, strides, offsets);
+
+	if (visibleCount > 0)
+		stateCache.DrawInstanced(4, static_cast<UINT>(visibleCount), 0, 0);		//One draw for all visible quads
+
+	cBufferRing.EndFrame();
 }
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow)
 {
 	const UINT WIDTH = 1024;
 	const UINT HEIGHT = 576;
+	const std::string TEXTURE_PATH = "";		//An image, or a .ctex cooked with HelloTriangle --cook, which is mapped instead of decoded
+	const uint64_t TEXTURE_BUDGET_BYTES = 256ull << 20;		//Least recently used textures are trimmed and evicted above this
+	const std::string TEXTURE_CACHE_DIRECTORY = "TextureCache";		//Encoded mip chains, relative to the working directory and safe to delete
 
 	float backgroundColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 
@@ -50,7 +100,7 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
 	HWND window;
 
 	ID3D11Device* device;			//Creates resources
-	ID3D11DeviceContext* context;	//Contains the bindings to pipeline & rendering commands
+	ID3D11DeviceContext1* context;	//Contains the bindings to pipeline & rendering commands
 	IDXGISwapChain* swapChain;		//implements surfaces for storing rendered data before presenting
 	ID3D11RenderTargetView* rtv;	//identifies render-target subresources during rendering
 	ID3D11Texture2D* dsTexture;		//depth-stencil texture, used by depthStencilView to decide culling
@@ -60,11 +110,27 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
 	ID3D11PixelShader* pShader;		//per-fragment
 	ID3D11InputLayout* inputLayout;	//how IA-stage will read vertex data
 	ID3D11Buffer* vBuffer;			//vertex data
-	ID3D11Buffer* cBuffer;			//cbuffer data (to vertex shader)
-	ID3D11Texture2D* texture;		//image texture
-	ID3D11ShaderResourceView* srv;	//specifies the subreasources the pixel shader can access
+	ConstantBufferRing cBufferRing;	//cbuffer data (to vertex shader), sub-allocated per draw
+	TextureStreamer textureStreamer;	//decodes on worker threads, a placeholder is bound until the texture is resident
+	TextureHandle diffuseTexture;
 	ID3D11SamplerState* sampler;	//needed to be able to sample from texture (in pixel shader)
 	ID3D11Buffer* lBuffer;			//cbuffer data (to pixel shader)
+	Camera camera;					//view & projection, rebuilt only when changed
+	ID3D11VertexShader* instancedVShader = nullptr;		//"--instances N": per-instance world matrix from slot 1
+	ID3D11InputLayout* instancedLayout = nullptr;
+	ID3D11Buffer* instanceBuffer = nullptr;		//InstanceData, rewritten every frame
+	InstanceTransforms instances;
+	BoundingSpheres instanceBounds;	//culled against the camera frustum every frame
+	std::vector<uint32_t> visibleInstances;
+	ThreadPool threadPool;
+	StateCache stateCache;			//drops binds that would not change anything
+	CommandQueue commandQueue;		//draws recorded as sort key + payload, replayed in state order
+	DrawCommand quad = {};			//payload of the textured quad, constants filled in per frame
+
+	unsigned instanceCount = 0;
+	const wchar_t* instancesArg = wcsstr(lpCmdLine, L"--instances");
+	if (instancesArg != nullptr && swscanf_s(instancesArg, L"--instances %u", &instanceCount) != 1)
+		instanceCount = 0;
 	
 	if (!SetupWindow(hInstance, WIDTH, HEIGHT, nCmdShow, window)) 
 	{
@@ -78,13 +144,39 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
 		return -1;
 	}
 
-	if (!SetupPipeline(device, vBuffer, vShader, pShader, inputLayout, cBuffer, texture, srv, sampler, lBuffer))
+	if (!SetupPipeline(device, context, vBuffer, vShader, pShader, inputLayout, cBufferRing, sampler, lBuffer))
 	{
 		std::cerr << "Could not setup Pipeline" << std::endl;
 		return -1;
 	}
 
-	BindResourcesToPipeline(context, viewPort, pShader, vShader, inputLayout, srv, sampler, vBuffer, lBuffer);
+	if (!textureStreamer.Create(device, context, TEXTURE_CACHE_DIRECTORY))
+	{
+		std::cerr << "Could not setup texture streaming" << std::endl;
+		return -1;
+	}
+	textureStreamer.SetBudget(TEXTURE_BUDGET_BYTES);
+	diffuseTexture = textureStreamer.Request(TEXTURE_PATH, 1.0f);
+
+	camera.SetAspectRatio(static_cast<float>(WIDTH) / HEIGHT);
+
+	stateCache.SetContext(context);
+	quad = { vShader, pShader, textureStreamer.View(diffuseTexture), {}, 4, 0 };
+	BindResourcesToPipeline(stateCache, viewPort, pShader, vShader, inputLayout, quad.texture, sampler, vBuffer, lBuffer);
+
+	if (instanceCount > 0)
+	{
+		if (!SetupInstancing(device, instanceCount, instancedVShader, instancedLayout, instanceBuffer))
+		{
+			std::cerr << "Could not setup instancing" << std::endl;
+			return -1;
+		}
+
+		instances = ScatterInstances(instanceCount);
+		InstanceBounds(instances, instanceBounds);
+		stateCache.SetVertexShader(instancedVShader);
+		stateCache.SetInputLayout(instancedLayout);
+	}
 
 	MSG msg = {};
 	float angle = 0;
@@ -100,19 +192,32 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
 
 		timer.startTimer();
 
-		Render(backgroundColor, context, rtv, dsView, cBuffer, angle);
+		textureStreamer.Update();		//Swaps the placeholder for the real texture once its decode has finished
+		quad.texture = textureStreamer.View(diffuseTexture);
+		stateCache.SetPSShaderResources(0, 1, &quad.texture);
+
+		if (instanceCount > 0)
+			RenderInstanced(backgroundColor, context, stateCache, rtv, dsView, cBufferRing, camera, vBuffer, instanceBuffer, instances, instanceBounds,
+				visibleInstances, threadPool, angle);
+		else
+			Render(backgroundColor, context, stateCache, commandQueue, quad, rtv, dsView, cBufferRing, camera, angle);
 		swapChain->Present(0, 0);
 
 		angle += float(rotation * timer.deltaTime());
-		if (angle >= DirectX::XM_2PI)
+		if (angle >= 2 * PI)
 			angle = 0;
 	}
 	
+	if (instanceCount > 0)
+	{
+		instanceBuffer->Release();
+		instancedLayout->Release();
+		instancedVShader->Release();
+	}
 	lBuffer->Release();
 	sampler->Release();
-	srv->Release();
-	texture->Release();
-	cBuffer->Release();
+	textureStreamer.Release();
+	cBufferRing.Release();
 	vBuffer->Release();
 	inputLayout->Release();
 	pShader->Release();
@@ -233,7 +233,12 @@ RECENT REVISION HISTORY:
 // code.)
 //
 // On x86, SSE2 will automatically be used when available based on a run-time
-// test; if not, the generic C versions are used as a fall-back. On ARM targets,
+// test; if not, the generic C versions are used as a fall-back. AVX2 kernels
+// (IDCT of two blocks at once, 16-pixel upsampling and color conversion) are
+// compiled with target attributes and chosen at run time as well; define
+// STBI_NO_AVX2 to leave them out. stbi_set_jpeg_simd_level caps what is used,
+// for benchmarks and testing. The PNG decoder unfilters RGB and RGBA rows with
+// SSE2 the same way; stbi_set_png_simd_level switches it off. On ARM targets,
 // the typical path is to have separate builds for NEON and non-NEON devices
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
@@ -491,8 +496,35 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// highest JPEG SIMD level to use: 0 = generic C, 1 = SSE2 or NEON, 2 = AVX2
+// (the default). levels the CPU lacks are skipped; every level decodes the same
+// pixels. applies to decodes started after the call, on all threads
+STBIDEF void stbi_set_jpeg_simd_level(int level);
+
+// lets the JPEG decoder spread one image over threads. fn must call task(data, i)
+// for every i in [0, count), in any order and on any threads, and return once all
+// of them have finished. scans with restart intervals in images decoded from memory
+// are entropy decoded one group of intervals per task, and color conversion runs
+// in bands of rows; the pixels are the same as a decode on one thread. NULL (the
+// default) keeps all work on the calling thread. applies to all threads; the hook
+// isn't synchronized, so set it before any decode starts and not while one runs
+typedef void stbi_parallel_for_func(void *user, int count, void (*task)(void *data, int index), void *data);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *fn, void *user);
+
+// highest PNG SIMD level to use: 0 = generic C, 1 = SSE2 (the default), which
+// unfilters rows of 3, 4, 6 and 8 byte pixels and swaps 16-bit samples to native
+// order. both levels decode the same pixels. applies to decodes started after the
+// call, on all threads
+STBIDEF void stbi_set_png_simd_level(int level);
+
 // ZLIB client - used by PNG, available for other purposes
 
+// inflate with 64-bit refills, a table lookup that decodes up to two literals or
+// a match length at once, and 8-byte match copies (the default), or one symbol
+// and one byte at a time; both write the same bytes. for benchmarks and testing;
+// applies to decodes started after the call, on all threads
+STBIDEF void stbi_set_zlib_fast_inflate(int flag_true_if_fast);
+
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
 STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header);
 STBIDEF char *stbi_zlib_decode_malloc(const char *buffer, int len, int *outlen);
@@ -610,12 +642,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -717,7 +751,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -728,7 +762,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -741,6 +775,33 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// AVX2, only for the JPEG kernels, and only when the run-time check passes. GCC
+// and Clang need the target attribute to accept the intrinsics without -mavx2.
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG) && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1700))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+   return __builtin_cpu_supports("avx2");
+}
+#else
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info, 1);
+   // AVX and OSXSAVE, then the OS saves the ymm registers, then AVX2 itself
+   if ((info[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28) || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info, 7, 0);
+   return (info[1] >> 5) & 1;
+}
+#endif
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -1080,6 +1141,15 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static stbi_parallel_for_func *stbi__parallel_for = NULL;
+static void *stbi__parallel_for_user = NULL;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *fn, void *user)
+{
+   stbi__parallel_for = fn;
+   stbi__parallel_for_user = user;
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1935,6 +2005,7 @@ typedef struct
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_block2_kernel)(stbi_uc *out, int out_stride, short data[128]); // two blocks side by side
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
@@ -2449,6 +2520,13 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// two horizontally adjacent blocks: data[0..63] goes to out, data[64..127] to out+8
+static void stbi__idct_block2(stbi_uc *out, int out_stride, short data[128])
+{
+   stbi__idct_block(out, out_stride, data);
+   stbi__idct_block(out + 8, out_stride, data + 64);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2838,6 +2916,189 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_NEON
 
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+static void stbi__idct_simd2(stbi_uc *out, int out_stride, short data[128])
+{
+   stbi__idct_simd(out, out_stride, data);
+   stbi__idct_simd(out + 8, out_stride, data + 64);
+}
+#endif
+
+#ifdef STBI_AVX2
+// avx2 integer IDCT of two blocks, the sse2 one with the first block in the low
+// 128-bit lane and the second in the high lane. every step of the sse2 version
+// stays within a lane, so this is two copies of it side by side, and produces
+// the same bits.
+STBI__AVX2_TARGET static void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[128])
+{
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
+
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // rows r and r+1 of both blocks, first block in the low lane
+   #define dct_load(r0, r1, offset) \
+      { \
+         __m256i first = _mm256_loadu_si256((const __m256i *) (data + (offset))); \
+         __m256i second = _mm256_loadu_si256((const __m256i *) (data + 64 + (offset))); \
+         r0 = _mm256_permute2x128_si256(first, second, 0x20); \
+         r1 = _mm256_permute2x128_si256(first, second, 0x31); \
+      }
+
+   // p holds two output rows of each block; put each row's halves together
+   #define dct_store2(p) \
+      p = _mm256_permute4x64_epi64(p, 0xd8); \
+      _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(p)); out += out_stride; \
+      _mm_storeu_si128((__m128i *) out, _mm256_extracti128_si256(p, 1)); out += out_stride
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   dct_load(row0, row1, 0*8);
+   dct_load(row2, row3, 2*8);
+   dct_load(row4, row5, 4*8);
+   dct_load(row6, row7, 6*8);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose of each lane
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m256i p0 = _mm256_packus_epi16(row0, row1);
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose of each lane
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
+
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      // store rows 0-1, 2-3, 4-5, 6-7
+      dct_store2(p0);
+      dct_store2(p2);
+      dct_store2(p1);
+      dct_store2(p3);
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+#undef dct_store2
+}
+#endif // STBI_AVX2
+
 #define STBI__MARKER_none  0xff
 // if there's a pending marker from the entropy stream, return that
 // otherwise, fetch from the stream and get a marker. if there's no
@@ -2872,67 +3133,190 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
-{
-   stbi__jpeg_reset(z);
-   if (!z->progressive) {
-      if (z->scan_n == 1) {
-         int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
-         int n = z->order[0];
-         // non-interleaved data, we just need to process one block at a time,
-         // in trivial scanline order
-         // number of blocks to do just depends on how many actual "pixels" this
-         // component has, independent of interleaved MCU blocking and such
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-               // every data block is an MCU, so countdown the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  // if it's NOT a restart, then just bail, so we get corrupt data
-                  // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
+// decode mcus [first, last) of a non-progressive scan in scanline order; in a
+// single component scan every block is an mcu. blocks go through the IDCT in
+// pairs with their right neighbor: the next block of the mcu when the component
+// has several across, otherwise the same block of the next mcu. an even one
+// waits for its neighbor, unless that falls outside the range
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int last)
+{
+   int m,k,x,y;
+   STBI_SIMD_ALIGN(short, data[4][128]);
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      // non-interleaved data, we just need to process one block at a time,
+      // in trivial scanline order
+      // number of blocks to do just depends on how many actual "pixels" this
+      // component has, independent of interleaved MCU blocking and such
+      int w = (z->img_comp[n].x+7) >> 3;
+      int ha = z->img_comp[n].ha;
+      for (m=first; m < last; ++m) {
+         int i = m % w, j = m / w;
+         stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8;
+         if (!stbi__jpeg_decode_block(z, data[0] + 64*(i&1), z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         if (i & 1) {
+            if (m > first)
+               z->idct_block2_kernel(out - 8, z->img_comp[n].w2, data[0]);
+            else
+               z->idct_block_kernel(out, z->img_comp[n].w2, data[0] + 64);
+         } else if (i+1 == w || m+1 == last)
+            z->idct_block_kernel(out, z->img_comp[n].w2, data[0]);
+         // every data block is an MCU, so countdown the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            // if it's NOT a restart, then just bail, so we get corrupt data
+            // rather than no data
+            if (!STBI__RESTART(z->marker)) {
+               if (!(i & 1) && i+1 < w && m+1 < last) z->idct_block_kernel(out, z->img_comp[n].w2, data[0]);
+               return 1;
+            }
+            stbi__jpeg_reset(z);
+         }
+      }
+      return 1;
+   } else { // interleaved
+      for (m=first; m < last; ++m) {
+         int i = m % z->img_mcu_x, j = m / z->img_mcu_x;
+         // scan an interleaved mcu... process scan_n components in order
+         for (k=0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            int single = z->img_comp[n].h == 1 && z->img_comp[n].v == 1;
+            // scan out an mcu's worth of this component; that's just determined
+            // by the basic H and V specified for the component
+            for (y=0; y < z->img_comp[n].v; ++y) {
+               for (x=0; x < z->img_comp[n].h; ++x) {
+                  int x2 = (i*z->img_comp[n].h + x)*8;
+                  int y2 = (j*z->img_comp[n].v + y)*8;
+                  int ha = z->img_comp[n].ha;
+                  int across = single ? i : x;
+                  int count = single ? z->img_mcu_x : z->img_comp[n].h;
+                  stbi_uc *out = z->img_comp[n].data+z->img_comp[n].w2*y2+x2;
+                  if (!stbi__jpeg_decode_block(z, data[k] + 64*(across&1), z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  if (across & 1) {
+                     if (!single || m > first)
+                        z->idct_block2_kernel(out - 8, z->img_comp[n].w2, data[k]);
+                     else
+                        z->idct_block_kernel(out, z->img_comp[n].w2, data[k] + 64);
+                  } else if (across+1 == count || (single && m+1 == last))
+                     z->idct_block_kernel(out, z->img_comp[n].w2, data[k]);
                }
             }
          }
-         return 1;
-      } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
-         for (j=0; j < z->img_mcu_y; ++j) {
-            for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
+         // after all interleaved components, that's an interleaved MCU,
+         // so now count down the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            if (!STBI__RESTART(z->marker)) {
+               // blocks still waiting for the next mcu go through alone
+               if (!(i & 1) && i+1 < z->img_mcu_x && m+1 < last) {
+                  for (k=0; k < z->scan_n; ++k) {
+                     int n = z->order[k];
+                     if (z->img_comp[n].h == 1 && z->img_comp[n].v == 1)
+                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data[k]);
                   }
                }
-               // after all interleaved components, that's an interleaved MCU,
-               // so now count down the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
+               return 1;
             }
+            stbi__jpeg_reset(z);
          }
-         return 1;
       }
+      return 1;
+   }
+}
+
+// restart intervals are byte aligned and start with fresh dc predictions, so
+// they can be entropy decoded independently
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **segment; // segment i is [segment[i], segment[i+1]), ending with its marker
+   int segment_count;
+   int tasks;
+   int total;         // mcus in the scan
+   const char *failed[64]; // per task, so no two threads write one flag: NULL, or why it failed
+} stbi__jpeg_segment_job;
+
+static void stbi__jpeg_decode_segment_task(void *data, int index)
+{
+   stbi__jpeg_segment_job *job = (stbi__jpeg_segment_job *) data;
+   stbi__jpeg *j = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   stbi__context s;
+   int seg, first = job->segment_count * index / job->tasks;
+   int last = job->segment_count * (index+1) / job->tasks;
+   job->failed[index] = NULL;
+   if (!j) { job->failed[index] = "outofmem"; return; }
+   memcpy(j, job->z, sizeof(stbi__jpeg));
+   j->s = &s;
+   for (seg=first; seg < last; ++seg) {
+      int mcu0 = seg * j->restart_interval;
+      int mcu1 = mcu0 + j->restart_interval < job->total ? mcu0 + j->restart_interval : job->total;
+      stbi__start_mem(&s, job->segment[seg], (int) (job->segment[seg+1] - job->segment[seg]));
+      stbi__jpeg_reset(j);
+      if (!stbi__jpeg_decode_mcus(j, mcu0, mcu1)) {
+         // the failure reason is per thread; hand it back to the caller's
+         job->failed[index] = stbi__g_failure_reason ? stbi__g_failure_reason : "corrupt jpeg";
+         break;
+      }
+   }
+   STBI_FREE(j);
+}
+
+// returns -1 when the scan can't be split, for the serial decode to handle it
+static int stbi__jpeg_decode_segments(stbi__jpeg *z, int total)
+{
+   stbi__jpeg_segment_job job;
+   stbi_uc *p = z->s->img_buffer, *end = z->s->img_buffer_end, *marker = NULL;
+   stbi_parallel_for_func *parallel_for = stbi__parallel_for;
+   int expected, i;
+   if (!parallel_for || z->s->read_from_callbacks || z->restart_interval <= 0)
+      return -1;
+   expected = (total + z->restart_interval - 1) / z->restart_interval;
+   if (expected < 2) return -1;
+   job.segment = (stbi_uc **) stbi__malloc_mad2(expected + 1, sizeof(stbi_uc *), 0);
+   if (!job.segment) return -1;
+   job.segment[0] = p;
+   job.segment_count = 1;
+   // find the rst markers in sequence, skipping stuffed 0x00 and fill 0xff bytes;
+   // any other marker ends the scan
+   for (;;) {
+      p = (stbi_uc *) memchr(p, 0xff, end - p);
+      if (!p) break;
+      marker = p + 1;
+      while (marker < end && *marker == 0xff) ++marker;
+      if (marker == end) { p = NULL; break; }
+      if (*marker == 0) { p = marker + 1; continue; }
+      if (*marker != 0xd0 + ((job.segment_count-1) & 7)) break;
+      if (job.segment_count == expected) { p = NULL; break; }
+      job.segment[job.segment_count++] = p = marker + 1;
+   }
+   if (!p || job.segment_count != expected) { STBI_FREE(job.segment); return -1; }
+   job.segment[expected] = marker + 1;
+   job.z = z;
+   job.tasks = expected < 64 ? expected : 64;
+   job.total = total;
+   parallel_for(stbi__parallel_for_user, job.tasks, stbi__jpeg_decode_segment_task, &job);
+   STBI_FREE(job.segment);
+   for (i=0; i < job.tasks; ++i)
+      if (job.failed[i]) { stbi__g_failure_reason = job.failed[i]; return 0; }
+   // carry on after the scan as if the serial decode had read up to its marker
+   z->s->img_buffer = marker + 1;
+   z->marker = *marker;
+   return 1;
+}
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+   stbi__jpeg_reset(z);
+   if (!z->progressive) {
+      int total, parallel;
+      if (z->scan_n == 1) {
+         int n = z->order[0];
+         total = ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+      } else
+         total = z->img_mcu_x * z->img_mcu_y;
+      parallel = stbi__jpeg_decode_segments(z, total);
+      if (parallel >= 0) return parallel;
+      return stbi__jpeg_decode_mcus(z, 0, total);
    } else {
       if (z->scan_n == 1) {
          int i,j;
@@ -3015,7 +3399,13 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               // coefficients of neighbors are adjacent, so pairs go through the IDCT together
+               if (i+1 < w) {
+                  stbi__jpeg_dequantize(data + 64, z->dequant[z->img_comp[n].tq]);
+                  z->idct_block2_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+                  ++i;
+               } else
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
             }
          }
       }
@@ -3542,6 +3932,70 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// stbi__resample_row_hv_2_simd 16 pixels at a time. the shifts by one pixel
+// cross the 128-bit lanes, so they borrow from the neighboring lane first
+STBI__AVX2_TARGET static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff);
+
+      // "prev" and "next" are curr shifted by one pixel, with t1 and the first
+      // pixel of the next group shifted in
+      __m256i lowlane  = _mm256_permute2x128_si256(curr, curr, 0x08); // 0 | low
+      __m256i highlane = _mm256_permute2x128_si256(curr, curr, 0x81); // high | 0
+      __m256i prev = _mm256_insert_epi16(_mm256_alignr_epi8(curr, lowlane, 14), t1, 0);
+      __m256i next = _mm256_insert_epi16(_mm256_alignr_epi8(highlane, curr, 2), 3*in_near[i+16] + in_far[i+16], 15);
+
+      // horizontal pass, polyphase as in the sse2 version
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave, undo scaling; each lane packs to its own 16 output bytes in order
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i outv = _mm256_packus_epi16(_mm256_srli_epi16(int0, 4), _mm256_srli_epi16(int1, 4));
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3716,25 +4170,106 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// 16 pixels at a time, the rest through the sse2 version
+STBI__AVX2_TARGET static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load
+         __m128i y_bytes = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcr+i)), signflip); // -128
+         __m128i cb_biased = _mm_xor_si128(_mm_loadu_si128((__m128i *) (pcb+i)), signflip); // -128
+
+         // widen to short, y to (y << 8) + 128 and cr, cb to their value << 8, as the sse2 unpacks do
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cr_biased), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepu8_epi16(cb_biased), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, interleave channels; each lane holds pixels 0-3 / 4-7 of its half
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1); // pixels 0-3 | 8-11
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1); // pixels 4-7 | 12-15
+
+         // store
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
+static int stbi__jpeg_simd_level = 2;
+
+STBIDEF void stbi_set_jpeg_simd_level(int level)
+{
+   stbi__jpeg_simd_level = level;
+}
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_block2_kernel = stbi__idct_block2;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
-   if (stbi__sse2_available()) {
+   if (stbi__jpeg_simd_level >= 1 && stbi__sse2_available()) {
       j->idct_block_kernel = stbi__idct_simd;
+      j->idct_block2_kernel = stbi__idct_simd2;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__jpeg_simd_level >= 2 && stbi__sse2_available() && stbi__avx2_available()) {
+      j->idct_block2_kernel = stbi__idct_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
-   j->idct_block_kernel = stbi__idct_simd;
-   j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-   j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   if (stbi__jpeg_simd_level >= 1) {
+      j->idct_block_kernel = stbi__idct_simd;
+      j->idct_block2_kernel = stbi__idct_simd2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+   }
 #endif
 }
 
@@ -3761,6 +4296,150 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// step a component's resampling to the next output row
+static void stbi__resample_advance(stbi__resample *r, int rows, int stride)
+{
+   if (++r->ystep >= r->vs) {
+      r->ystep = 0;
+      r->line0 = r->line1;
+      if (++r->ypos < rows)
+         r->line1 += stride;
+   }
+}
+
+// resample and color-convert output rows [j0, j1); res_comp is at row j0
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi__resample *res_comp, stbi_uc **linebuf, stbi_uc *output,
+                                    int n, int decode_n, int is_rgb, unsigned int j0, unsigned int j1)
+{
+   int k;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (j=j0; j < j1; ++j) {
+      stbi_uc *out = output + n * z->s->img_x * j;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         stbi__resample_advance(r, z->img_comp[k].y, z->img_comp[k].w2);
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+   }
+}
+
+// bands of rows are color-converted in parallel, each with its own resampling
+// state and line buffers
+#define STBI__JPEG_BAND_ROWS 64
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample *res_comp; // at row 0
+   stbi_uc *output;
+   int n, decode_n, is_rgb;
+   stbi_uc *failed; // one flag per band, so no two threads write one
+} stbi__jpeg_convert_job;
+
+static void stbi__jpeg_convert_band(void *data, int index)
+{
+   stbi__jpeg_convert_job *job = (stbi__jpeg_convert_job *) data;
+   stbi__jpeg *z = job->z;
+   stbi__resample res_comp[4];
+   stbi_uc *linebuf[4];
+   unsigned int j, j0 = index * STBI__JPEG_BAND_ROWS;
+   unsigned int j1 = j0 + STBI__JPEG_BAND_ROWS < z->s->img_y ? j0 + STBI__JPEG_BAND_ROWS : z->s->img_y;
+   int k;
+   stbi_uc *buffer = (stbi_uc *) stbi__malloc_mad2(job->decode_n, z->s->img_x + 3, 0);
+   if (!buffer) { job->failed[index] = 1; return; }
+   for (k=0; k < job->decode_n; ++k) {
+      res_comp[k] = job->res_comp[k];
+      linebuf[k] = buffer + k * (z->s->img_x + 3);
+      for (j=0; j < j0; ++j)
+         stbi__resample_advance(&res_comp[k], z->img_comp[k].y, z->img_comp[k].w2);
+   }
+   stbi__jpeg_convert_rows(z, res_comp, linebuf, job->output, job->n, job->decode_n, job->is_rgb, j0, j1);
+   STBI_FREE(buffer);
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3784,10 +4463,10 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // resample and color-convert
    {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+      int k, bands;
+      stbi_uc *output, *failed;
+      stbi_uc *linebuf[4];
+      stbi_parallel_for_func *parallel_for;
 
       stbi__resample res_comp[4];
 
@@ -3818,99 +4497,28 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
+      bands = (z->s->img_y + STBI__JPEG_BAND_ROWS-1) / STBI__JPEG_BAND_ROWS;
+      parallel_for = bands > 1 ? stbi__parallel_for : NULL;
+      failed = parallel_for ? (stbi_uc *) stbi__malloc(bands) : NULL;
+      if (failed) {
+         stbi__jpeg_convert_job job;
+         job.z = z;
+         job.res_comp = res_comp;
+         job.output = output;
+         job.n = n;
+         job.decode_n = decode_n;
+         job.is_rgb = is_rgb;
+         job.failed = failed;
+         memset(failed, 0, bands);
+         parallel_for(stbi__parallel_for_user, bands, stbi__jpeg_convert_band, &job);
+         for (k=0; k < bands; ++k)
+            if (failed[k]) break;
+         STBI_FREE(failed);
+         if (k < bands) { STBI_FREE(output); stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      } else {
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         stbi__jpeg_convert_rows(z, res_comp, linebuf, output, n, decode_n, is_rgb, 0, z->s->img_y);
       }
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
@@ -4056,13 +4664,97 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
    return 1;
 }
 
+// the fast inflate loop looks up codes of up to STBI__ZFAST_LENGTH_BITS bits in
+// one table per alphabet. an entry holds the bits it consumes (0-4), its kind
+// (5-7) and, by kind: one or two literals (8-15, 16-23), or a match length or
+// distance base (16-31) with its extra bit count (8-11). longer codes go the
+// slow way
+#define STBI__ZFAST_LENGTH_BITS    11
+#define STBI__ZFAST_DISTANCE_BITS  10
+
+#define STBI__ZKIND_LITERAL   0
+#define STBI__ZKIND_LITERALS  1 // two
+#define STBI__ZKIND_MATCH     2 // length or distance
+#define STBI__ZKIND_END       3
+#define STBI__ZKIND_SLOW      4
+#define STBI__ZKIND_BAD       5
+
+static const int stbi__zlength_base[31] = {
+   3,4,5,6,7,8,9,10,11,13,
+   15,17,19,23,27,31,35,43,51,59,
+   67,83,99,115,131,163,195,227,258,0,0 };
+
+static const int stbi__zlength_extra[31]=
+{ 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0 };
+
+static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0};
+
+static const int stbi__zdist_extra[32] =
+{ 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+static stbi__uint32 stbi__zfast_entry(int symbol, int distance)
+{
+   if (distance) {
+      if (symbol >= 30) return STBI__ZKIND_BAD << 5;
+      return (STBI__ZKIND_MATCH << 5) | (stbi__zdist_extra[symbol] << 8) | ((stbi__uint32) stbi__zdist_base[symbol] << 16);
+   }
+   if (symbol < 256) return (STBI__ZKIND_LITERAL << 5) | (symbol << 8);
+   if (symbol == 256) return STBI__ZKIND_END << 5;
+   if (symbol >= 286) return STBI__ZKIND_BAD << 5;
+   return (STBI__ZKIND_MATCH << 5) | (stbi__zlength_extra[symbol-257] << 8) | ((stbi__uint32) stbi__zlength_base[symbol-257] << 16);
+}
+
+// sizelist has passed stbi__zbuild_huffman
+static void stbi__zbuild_fast(stbi__uint32 *table, int bits, const stbi_uc *sizelist, int num, int distance)
+{
+   int i, code, next_code[16], sizes[16];
+   memset(sizes, 0, sizeof(sizes));
+   for (i=0; i < num; ++i)
+      ++sizes[sizelist[i]];
+   sizes[0] = 0;
+   code = 0;
+   for (i=1; i < 16; ++i) {
+      code = (code + sizes[i-1]) << 1;
+      next_code[i] = code;
+   }
+   for (i=0; i < (1 << bits); ++i)
+      table[i] = STBI__ZKIND_SLOW << 5;
+   for (i=0; i < num; ++i) {
+      int s = sizelist[i];
+      if (s) {
+         if (s <= bits) {
+            stbi__uint32 entry = stbi__zfast_entry(i, distance) | s;
+            int j;
+            for (j = stbi__bit_reverse(next_code[s], s); j < (1 << bits); j += 1 << s)
+               table[j] = entry;
+         }
+         ++next_code[s];
+      }
+   }
+   if (distance) return;
+   // a literal whose code leaves room for the whole code of another literal
+   // decodes both. going down, the entry for the bits after the first code is
+   // still a single literal
+   for (i=(1 << bits)-1; i >= 0; --i) {
+      stbi__uint32 first = table[i], second;
+      int s, t;
+      if ((first >> 5 & 7) != STBI__ZKIND_LITERAL) continue;
+      s = first & 31;
+      second = table[i >> s];
+      t = second & 31;
+      if ((second >> 5 & 7) == STBI__ZKIND_LITERAL && s + t <= bits)
+         table[i] = (s + t) | (STBI__ZKIND_LITERALS << 5) | (first & 0xff00) | ((second & 0xff00) << 8);
+   }
+}
+
 // zlib-from-memory implementation for PNG reading
-//    because PNG allows splitting the zlib stream arbitrarily,
-//    and it's annoying structurally to have PNG call ZLIB call PNG,
-//    we require PNG read all the IDATs and combine them into a single
-//    memory buffer
+//    because PNG allows splitting the zlib stream arbitrarily, PNG
+//    hands the IDATs to zlib in pieces through the refill hook, and
+//    takes rows of output back through refill and slide as they're
+//    inflated
 
-typedef struct
+typedef struct stbi__zbuf_s
 {
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
@@ -4074,11 +4766,25 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   int fast_inflate;
+   stbi__uint32 fast_length[1 << STBI__ZFAST_LENGTH_BITS];
+   stbi__uint32 fast_distance[1 << STBI__ZFAST_DISTANCE_BITS];
+
+   // input in pieces: when zbuffer reaches zbuffer_end, refill points them at the
+   // next piece and returns 1, or returns 0 at the end of the input. NULL for a
+   // stream in one buffer
+   int (*refill)(struct stbi__zbuf_s *z);
+   void *refill_user;
+
+   // output in a window: when zout reaches zout_end, slide may move output that's
+   // been used out of the buffer, keeping at least the last 32K, before it grows.
+   // returns 0 to stop. NULL to keep all the output
+   int (*slide)(struct stbi__zbuf_s *z);
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
 {
-   return (z->zbuffer >= z->zbuffer_end);
+   return (z->zbuffer >= z->zbuffer_end) && !(z->refill && z->refill(z));
 }
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -4091,6 +4797,7 @@ static void stbi__fill_bits(stbi__zbuf *z)
    do {
       if (z->code_buffer >= (1U << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
+        z->refill = NULL;
         return;
       }
       z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
@@ -4108,12 +4815,13 @@ stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
    return k;
 }
 
-static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
+// symbol of a code longer than STBI__ZFAST_BITS at the bottom of bits, and its size
+static int stbi__zhuffman_decode_long(stbi__zhuffman *z, unsigned int bits, int *size)
 {
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse(bits & 0xffff, 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4122,9 +4830,17 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
    if (b >= sizeof (z->size)) return -1; // some data was corrupt somewhere!
    if (z->size[b] != s) return -1;  // was originally an assert, but report failure instead.
+   *size = s;
+   return z->value[b];
+}
+
+static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
+{
+   int s, b = stbi__zhuffman_decode_long(z, a->code_buffer, &s);
+   if (b < 0) return -1;
    a->code_buffer >>= s;
    a->num_bits -= s;
-   return z->value[b];
+   return b;
 }
 
 stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
@@ -4151,6 +4867,10 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
    char *q;
    unsigned int cur, limit, old_limit;
    z->zout = zout;
+   if (z->slide) {
+      if (!z->slide(z)) return 0;
+      if (z->zout_end - z->zout >= n) return 1;
+   }
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = old_limit = (unsigned) (z->zout_end - z->zout_start);
@@ -4168,25 +4888,170 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
    return 1;
 }
 
-static const int stbi__zlength_base[31] = {
-   3,4,5,6,7,8,9,10,11,13,
-   15,17,19,23,27,31,35,43,51,59,
-   67,83,99,115,131,163,195,227,258,0,0 };
+static int stbi__zfast_inflate = 1;
 
-static const int stbi__zlength_extra[31]=
-{ 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0 };
+STBIDEF void stbi_set_zlib_fast_inflate(int flag_true_if_fast)
+{
+   stbi__zfast_inflate = flag_true_if_fast;
+}
 
-static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
-257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0};
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+   stbi__uint64 v;
+   memcpy(&v, p, 8);
+   return v;
+#else
+   return (stbi__uint64) p[0]       | (stbi__uint64) p[1] <<  8 | (stbi__uint64) p[2] << 16 | (stbi__uint64) p[3] << 24 |
+          (stbi__uint64) p[4] << 32 | (stbi__uint64) p[5] << 40 | (stbi__uint64) p[6] << 48 | (stbi__uint64) p[7] << 56;
+#endif
+}
 
-static const int stbi__zdist_extra[32] =
-{ 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+// decodes symbols while 8 input bytes and a longest match plus 8 bytes of output
+// are left, so one refill covers a symbol with its distance and extra bits, and
+// copies may run 8 bytes at a time past the end of the match. returns 2 when it
+// stops short of the end of the block, for the careful loop to go on
+static int stbi__parse_huffman_fast(stbi__zbuf *a)
+{
+   stbi_uc *in = a->zbuffer;
+   stbi_uc *in_start = in;
+   stbi_uc *in_end = a->zbuffer_end;
+   stbi_uc *zout = (stbi_uc *) a->zout;
+   stbi_uc *zout_start = (stbi_uc *) a->zout_start;
+   stbi_uc *zout_limit = (stbi_uc *) a->zout_end - (258 + 8);
+   stbi__uint64 bits = a->code_buffer;
+   int num_bits = a->num_bits, result = 2, give_back;
+
+   // bits the careful loop buffered past the end of the input aren't bytes to give back
+   if (in_end - in < 8 || zout > zout_limit) return 2;
+
+   while (in_end - in >= 8 && zout <= zout_limit) {
+      stbi__uint32 entry;
+      int len, dist, extra;
+      stbi_uc *p;
+      // branchless refill to 56-63 bits; the bytes past the count are loaded
+      // again, in the same place, next time
+      bits |= stbi__zload64(in) << num_bits;
+      in += (63 - num_bits) >> 3;
+      num_bits |= 56;
+
+      entry = a->fast_length[bits & ((1 << STBI__ZFAST_LENGTH_BITS) - 1)];
+      switch (entry >> 5 & 7) {
+         case STBI__ZKIND_LITERAL:
+         case STBI__ZKIND_LITERALS:
+            zout[0] = (stbi_uc) (entry >> 8);
+            zout[1] = (stbi_uc) (entry >> 16);
+            zout += (entry >> 5 & 7) + 1;
+            bits >>= entry & 31;
+            num_bits -= entry & 31;
+            continue;
+         case STBI__ZKIND_MATCH:
+            bits >>= entry & 31;
+            num_bits -= entry & 31;
+            extra = entry >> 8 & 15;
+            len = (int) (entry >> 16) + (int) (bits & ((1u << extra) - 1));
+            bits >>= extra;
+            num_bits -= extra;
+            break;
+         case STBI__ZKIND_END:
+            bits >>= entry & 31;
+            num_bits -= entry & 31;
+            result = 1;
+            goto done;
+         case STBI__ZKIND_SLOW: {
+            int s = 0, z = stbi__zhuffman_decode_long(&a->z_length, (unsigned int) bits, &s);
+            if (z < 0 || z >= 286) { result = stbi__err("bad huffman code","Corrupt PNG"); goto done; }
+            bits >>= s;
+            num_bits -= s;
+            if (z < 256) {
+               *zout++ = (stbi_uc) z;
+               continue;
+            }
+            if (z == 256) { result = 1; goto done; }
+            z -= 257;
+            len = stbi__zlength_base[z] + (int) (bits & ((1u << stbi__zlength_extra[z]) - 1));
+            bits >>= stbi__zlength_extra[z];
+            num_bits -= stbi__zlength_extra[z];
+            break;
+         }
+         default:
+            result = stbi__err("bad huffman code","Corrupt PNG");
+            goto done;
+      }
+
+      entry = a->fast_distance[bits & ((1 << STBI__ZFAST_DISTANCE_BITS) - 1)];
+      if ((entry >> 5 & 7) == STBI__ZKIND_MATCH) {
+         bits >>= entry & 31;
+         num_bits -= entry & 31;
+         extra = entry >> 8 & 15;
+         dist = (int) (entry >> 16);
+      } else {
+         int s = 0, z = -1;
+         if ((entry >> 5 & 7) == STBI__ZKIND_SLOW) z = stbi__zhuffman_decode_long(&a->z_distance, (unsigned int) bits, &s);
+         if (z < 0 || z >= 30) { result = stbi__err("bad huffman code","Corrupt PNG"); goto done; }
+         bits >>= s;
+         num_bits -= s;
+         extra = stbi__zdist_extra[z];
+         dist = stbi__zdist_base[z];
+      }
+      dist += (int) (bits & ((1u << extra) - 1));
+      bits >>= extra;
+      num_bits -= extra;
+      if (zout - zout_start < dist) { result = stbi__err("bad dist","Corrupt PNG"); goto done; }
+
+      p = zout - dist;
+      if (dist >= 8) {
+         // 8 bytes at a time, each read from output already written
+         stbi_uc *end = zout + len;
+         do {
+            memcpy(zout, p, 8);
+            zout += 8;
+            p += 8;
+         } while (zout < end);
+         zout = end;
+      } else if (dist == 1) {
+         memset(zout, *p, len);
+         zout += len;
+      } else {
+         // a short period: after the bytes of the first periods that span 8, the
+         // output repeats itself with a period of at least 8
+         int step = dist, i;
+         while (step < 8) step += dist;
+         for (i=0; i < step - dist && i < len; ++i)
+            zout[i] = p[i];
+         for (; i < len; i += 8)
+            memcpy(zout + i, zout + i - step, 8);
+         zout += len;
+      }
+   }
+
+done:
+   // give back whole bytes beyond the bit count, but only bytes of this piece of
+   // input: bits the careful loop read from an earlier piece stay buffered
+   give_back = num_bits >> 3;
+   if (give_back > in - in_start) give_back = (int) (in - in_start);
+   in -= give_back;
+   num_bits -= give_back * 8;
+   a->zbuffer = in;
+   a->code_buffer = (stbi__uint32) (bits & (((stbi__uint64) 1 << num_bits) - 1));
+   a->num_bits = num_bits;
+   a->zout = (char *) zout;
+   return result;
+}
 
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      int z;
+      if (a->fast_inflate) {
+         a->zout = zout;
+         z = stbi__parse_huffman_fast(a);
+         if (z != 2) return z;
+         zout = a->zout;
+      }
+      z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4271,6 +5136,10 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    if (n != ntot) return stbi__err("bad codelengths","Corrupt PNG");
    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!stbi__zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   if (a->fast_inflate) {
+      stbi__zbuild_fast(a->fast_length, STBI__ZFAST_LENGTH_BITS, lencodes, hlit, 0);
+      stbi__zbuild_fast(a->fast_distance, STBI__ZFAST_DISTANCE_BITS, lencodes+hlit, hdist, 1);
+   }
    return 1;
 }
 
@@ -4294,12 +5163,19 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
    if (a->zout + len > a->zout_end)
       if (!stbi__zexpand(a, a->zout, len)) return 0;
-   memcpy(a->zout, a->zbuffer, len);
-   a->zbuffer += len;
-   a->zout += len;
+   while (len > 0) {
+      // the block may go on into the next piece of input
+      int n;
+      if (stbi__zeof(a)) return stbi__err("read past buffer","Corrupt PNG");
+      n = (int) (a->zbuffer_end - a->zbuffer);
+      if (n > len) n = len;
+      memcpy(a->zout, a->zbuffer, n);
+      a->zbuffer += n;
+      a->zout += n;
+      len -= n;
+   }
    return 1;
 }
 
@@ -4365,6 +5241,10 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
             // use fixed code lengths
             if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , 288)) return 0;
             if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+            if (a->fast_inflate) {
+               stbi__zbuild_fast(a->fast_length, STBI__ZFAST_LENGTH_BITS, stbi__zdefault_length, 288, 0);
+               stbi__zbuild_fast(a->fast_distance, STBI__ZFAST_DISTANCE_BITS, stbi__zdefault_distance, 32, 1);
+            }
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
@@ -4380,6 +5260,7 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->fast_inflate = stbi__zfast_inflate;
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4391,6 +5272,8 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer + len;
+   a.refill = NULL;
+   a.slide = NULL;
    if (stbi__do_zlib(&a, p, initial_size, 1, 1)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
@@ -4412,6 +5295,8 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer + len;
+   a.refill = NULL;
+   a.slide = NULL;
    if (stbi__do_zlib(&a, p, initial_size, 1, parse_header)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
@@ -4426,6 +5311,8 @@ STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer
    stbi__zbuf a;
    a.zbuffer = (stbi_uc *) ibuffer;
    a.zbuffer_end = (stbi_uc *) ibuffer + ilen;
+   a.refill = NULL;
+   a.slide = NULL;
    if (stbi__do_zlib(&a, obuffer, olen, 0, 1))
       return (int) (a.zout - a.zout_start);
    else
@@ -4439,6 +5326,8 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer+len;
+   a.refill = NULL;
+   a.slide = NULL;
    if (stbi__do_zlib(&a, p, 16384, 1, 0)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
@@ -4453,6 +5342,8 @@ STBIDEF int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char
    stbi__zbuf a;
    a.zbuffer = (stbi_uc *) ibuffer;
    a.zbuffer_end = (stbi_uc *) ibuffer + ilen;
+   a.refill = NULL;
+   a.slide = NULL;
    if (stbi__do_zlib(&a, obuffer, olen, 0, 0))
       return (int) (a.zout - a.zout_start);
    else
@@ -4485,6 +5376,8 @@ static stbi__pngchunk stbi__get_chunk_header(stbi__context *s)
    return c;
 }
 
+#define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
+
 static int stbi__check_png_header(stbi__context *s)
 {
    static const stbi_uc png_sig[8] = { 137,80,78,71,13,10,26,10 };
@@ -4499,6 +5392,12 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+
+   // IDAT chunks are inflated as they're read: the bytes of the current one not
+   // yet handed to zlib, and the header of a chunk after the last one
+   stbi__uint32 idat_left;
+   int idat_ended;
+   stbi__pngchunk next_chunk;
 } stbi__png;
 
 
@@ -4535,38 +5434,365 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+static int stbi__png_simd_level = 1;
+
+STBIDEF void stbi_set_png_simd_level(int level)
+{
+   stbi__png_simd_level = level;
+}
+
+#ifdef STBI_SSE2
+// the row kernel below has to be inlined into each caller to specialize
+#if defined(_MSC_VER)
+#define STBI__FORCE_INLINE __forceinline
+#elif defined(__GNUC__)
+#define STBI__FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define STBI__FORCE_INLINE stbi_inline
+#endif
+
+// one pixel of n = 3, 4, 6 or 8 bytes into the low lanes of a register, the rest
+// zero. wide reads or writes a whole 4 or 8 bytes, for pixels with more of the
+// row after them; the last of a row takes exactly n so nothing past the end of
+// raw or the image is touched
+STBI__FORCE_INLINE static __m128i stbi__png_load_pixel(const stbi_uc *p, int n, int wide)
+{
+   if (n == 8 || (n == 6 && wide)) {
+      __m128i v = _mm_loadl_epi64((const __m128i *) p);
+      return n == 8 ? v : _mm_and_si128(v, _mm_set_epi32(0, 0, 0xffff, -1));
+   } else if (n == 4 || wide) {
+      stbi__uint32 t;
+      memcpy(&t, p, 4);
+      return _mm_cvtsi32_si128((int) (n == 4 ? t : t & 0xffffff));
+   } else if (n == 3) {
+      stbi__uint16 t;
+      memcpy(&t, p, 2);
+      return _mm_cvtsi32_si128(t | p[2] << 16);
+   } else {
+      stbi__uint32 t;
+      stbi__uint16 u;
+      memcpy(&t, p, 4);
+      memcpy(&u, p+4, 2);
+      return _mm_unpacklo_epi32(_mm_cvtsi32_si128((int) t), _mm_cvtsi32_si128(u));
+   }
+}
+
+STBI__FORCE_INLINE static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n, int wide)
+{
+   if (n == 8 || (n == 6 && wide)) {
+      _mm_storel_epi64((__m128i *) p, v);
+   } else if (n == 4 || wide) {
+      int t = _mm_cvtsi128_si32(v);
+      memcpy(p, &t, 4);
+   } else if (n == 3) {
+      int t = _mm_cvtsi128_si32(v);
+      memcpy(p, &t, 2);
+      p[2] = (stbi_uc) (t >> 16);
+   } else {
+      int t = _mm_cvtsi128_si32(v);
+      int u = _mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+      memcpy(p, &t, 4);
+      memcpy(p+4, &u, 2);
+   }
+}
+
+// stbi__paeth on 16-bit lanes: p-a = b-c, p-b = a-c and p-c = (b-c)+(a-c)
+STBI__FORCE_INLINE static __m128i stbi__paeth_sse2(__m128i a, __m128i b, __m128i c)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i bc = _mm_sub_epi16(b, c);
+   __m128i ac = _mm_sub_epi16(a, c);
+   __m128i sum = _mm_add_epi16(bc, ac);
+   __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+   __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+   __m128i pc = _mm_max_epi16(sum, _mm_sub_epi16(zero, sum));
+   __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+   __m128i use_c = _mm_cmpgt_epi16(pb, pc);
+   __m128i b_or_c = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+   return _mm_or_si128(_mm_and_si128(not_a, b_or_c), _mm_andnot_si128(not_a, a));
+}
+
+// one row of fb-byte pixels from raw into ob-byte pixels in cur; ob is fb, or fb
+// plus one alpha sample that is set to 255 as the scalar loops do. sub, avg and
+// paeth depend on the pixel to the left, so they run a pixel at a time with all
+// of its channels in one register; up and unpadded sub go 16 bytes at a time, sub
+// as a prefix sum. fb and ob are constants in every caller so that the loads,
+// stores and shifts specialize
+STBI__FORCE_INLINE static void stbi__png_unfilter_row_sse2(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int filter, stbi__uint32 x, int fb, int ob)
+{
+   __m128i zero = _mm_setzero_si128();
+   stbi__uint64 pixel_bits = ~(stbi__uint64) 0 >> (64 - 8*fb), alpha_bits = (~(stbi__uint64) 0 >> (64 - 8*ob)) & ~pixel_bits;
+   __m128i low = _mm_loadl_epi64((const __m128i *) &pixel_bits);
+   __m128i alpha = _mm_loadl_epi64((const __m128i *) &alpha_bits);
+   __m128i a = zero, b, c = zero; // left and upper left are zero before the first pixel
+   stbi__uint32 i = 0;
+
+   switch (filter) {
+      case STBI__F_none:
+         if (fb == ob) {
+            memcpy(cur, raw, x*fb);
+            return;
+         }
+         for (; i < x; ++i) {
+            int wide = i+1 < x;
+            stbi__png_store_pixel(cur + i*ob, _mm_or_si128(stbi__png_load_pixel(raw + i*fb, fb, wide), alpha), ob, wide);
+         }
+         break;
+
+      case STBI__F_sub:
+      case STBI__F_paeth_first: // stbi__paeth(a,0,0) is a
+         if (fb == ob) {
+            // the pixel to the left goes into the first lanes, then the prefix sum
+            // carries it across; the bytes after the last whole pixel are rewritten
+            // by the next step
+            for (; (x - i)*fb >= 16; i += 16/fb) {
+               __m128i v = _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw + i*fb)), a);
+               switch (fb) {
+                  case 3:
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 3));
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 6));
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 12));
+                     a = _mm_srli_si128(v, 12);
+                     break;
+                  case 4:
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+                     a = _mm_srli_si128(v, 12);
+                     break;
+                  case 6:
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 6));
+                     a = _mm_srli_si128(v, 6);
+                     break;
+                  default:
+                     v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+                     a = _mm_srli_si128(v, 8);
+                     break;
+               }
+               a = _mm_and_si128(a, low);
+               _mm_storeu_si128((__m128i *) (cur + i*fb), v);
+            }
+         }
+         for (; i < x; ++i) {
+            int wide = i+1 < x;
+            a = _mm_or_si128(_mm_add_epi8(stbi__png_load_pixel(raw + i*fb, fb, wide), a), alpha);
+            stbi__png_store_pixel(cur + i*ob, a, ob, wide);
+         }
+         break;
+
+      case STBI__F_up:
+         if (fb == ob) {
+            stbi__uint32 k, n = x*fb;
+            for (k=0; k + 16 <= n; k += 16)
+               _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw + k)), _mm_loadu_si128((const __m128i *) (prior + k))));
+            for (; k < n; ++k)
+               cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+            return;
+         }
+         for (; i < x; ++i) {
+            int wide = i+1 < x;
+            stbi__png_store_pixel(cur + i*ob, _mm_or_si128(_mm_add_epi8(stbi__png_load_pixel(raw + i*fb, fb, wide), stbi__png_load_pixel(prior + i*ob, ob, wide)), alpha), ob, wide);
+         }
+         break;
+
+      case STBI__F_avg:
+      case STBI__F_avg_first: {
+         // _mm_avg_epu8 rounds up; take off the low bit of a^b to round down
+         __m128i ones = _mm_set1_epi8(1);
+         for (; i < x; ++i) {
+            int wide = i+1 < x;
+            __m128i avg;
+            b = filter == STBI__F_avg ? stbi__png_load_pixel(prior + i*ob, ob, wide) : zero;
+            avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), ones));
+            a = _mm_or_si128(_mm_add_epi8(stbi__png_load_pixel(raw + i*fb, fb, wide), avg), alpha);
+            stbi__png_store_pixel(cur + i*ob, a, ob, wide);
+         }
+         break;
+      }
+
+      case STBI__F_paeth: {
+         __m128i bytes = _mm_set1_epi16(0xff);
+         for (; i < x; ++i) {
+            int wide = i+1 < x;
+            __m128i v;
+            b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior + i*ob, ob, wide), zero);
+            v = _mm_add_epi16(_mm_unpacklo_epi8(stbi__png_load_pixel(raw + i*fb, fb, wide), zero), stbi__paeth_sse2(a, b, c));
+            v = _mm_or_si128(_mm_packus_epi16(_mm_and_si128(v, bytes), zero), alpha);
+            stbi__png_store_pixel(cur + i*ob, v, ob, wide);
+            a = _mm_unpacklo_epi8(v, zero);
+            c = b;
+         }
+         break;
+      }
+   }
+}
+
+// returns 0 for pixel sizes left to the scalar loops
+static int stbi__png_unfilter_row_simd(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int filter, stbi__uint32 x, int fb, int ob)
+{
+   if      (fb == 3 && ob == 3) stbi__png_unfilter_row_sse2(cur, prior, raw, filter, x, 3, 3);
+   else if (fb == 3 && ob == 4) stbi__png_unfilter_row_sse2(cur, prior, raw, filter, x, 3, 4);
+   else if (fb == 4 && ob == 4) stbi__png_unfilter_row_sse2(cur, prior, raw, filter, x, 4, 4);
+   else if (fb == 6 && ob == 6) stbi__png_unfilter_row_sse2(cur, prior, raw, filter, x, 6, 6);
+   else if (fb == 6 && ob == 8) stbi__png_unfilter_row_sse2(cur, prior, raw, filter, x, 6, 8);
+   else if (fb == 8 && ob == 8) stbi__png_unfilter_row_sse2(cur, prior, raw, filter, x, 8, 8);
+   else return 0;
+   return 1;
+}
+#endif
+
+// the work after unfiltering a row: 1/2/4-bit samples expanded to bytes, or 16-bit
+// samples from big-endian to platform-native. the filters read the row below
+// unmodified, so this runs two rows behind them, while the row is still in cache
+static void stbi__png_finish_row(stbi__png *a, stbi__uint32 j, int out_n, stbi__uint32 x, int depth, int color, stbi__uint32 img_width_bytes, int simd)
+{
+   int img_n = a->s->img_n;
+   stbi__uint32 i, stride = x*out_n*(depth == 16 ? 2 : 1);
+   int k;
+
+   STBI_NOTUSED(simd);
+   if (depth < 8) {
+      stbi_uc *cur = a->out + stride*j;
+      stbi_uc *in  = a->out + stride*j + x*out_n - img_width_bytes;
+      // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
+      // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
+      stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
+
+      // note that the final byte might overshoot and write more data than desired.
+      // we can allocate enough data that this never writes out of memory, but it
+      // could also overwrite the next scanline. can it overwrite non-empty data
+      // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
+      // so we need to explicitly clamp the final ones
+
+      if (depth == 4) {
+         for (k=x*img_n; k >= 2; k-=2, ++in) {
+            *cur++ = scale * ((*in >> 4)       );
+            *cur++ = scale * ((*in     ) & 0x0f);
+         }
+         if (k > 0) *cur++ = scale * ((*in >> 4)       );
+      } else if (depth == 2) {
+         for (k=x*img_n; k >= 4; k-=4, ++in) {
+            *cur++ = scale * ((*in >> 6)       );
+            *cur++ = scale * ((*in >> 4) & 0x03);
+            *cur++ = scale * ((*in >> 2) & 0x03);
+            *cur++ = scale * ((*in     ) & 0x03);
+         }
+         if (k > 0) *cur++ = scale * ((*in >> 6)       );
+         if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
+         if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
+      } else if (depth == 1) {
+         for (k=x*img_n; k >= 8; k-=8, ++in) {
+            *cur++ = scale * ((*in >> 7)       );
+            *cur++ = scale * ((*in >> 6) & 0x01);
+            *cur++ = scale * ((*in >> 5) & 0x01);
+            *cur++ = scale * ((*in >> 4) & 0x01);
+            *cur++ = scale * ((*in >> 3) & 0x01);
+            *cur++ = scale * ((*in >> 2) & 0x01);
+            *cur++ = scale * ((*in >> 1) & 0x01);
+            *cur++ = scale * ((*in     ) & 0x01);
+         }
+         if (k > 0) *cur++ = scale * ((*in >> 7)       );
+         if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
+         if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
+         if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
+         if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
+         if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
+         if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
+      }
+      if (img_n != out_n) {
+         int q;
+         // insert alpha = 255
+         cur = a->out + stride*j;
+         if (img_n == 1) {
+            for (q=x-1; q >= 0; --q) {
+               cur[q*2+1] = 255;
+               cur[q*2+0] = cur[q];
+            }
+         } else {
+            STBI_ASSERT(img_n == 3);
+            for (q=x-1; q >= 0; --q) {
+               cur[q*4+3] = 255;
+               cur[q*4+2] = cur[q*3+2];
+               cur[q*4+1] = cur[q*3+1];
+               cur[q*4+0] = cur[q*3+0];
+            }
+         }
+      }
+   } else if (depth == 16) {
+      // force the image data from big-endian to platform-native
+      stbi_uc *cur = a->out + stride*j;
+      stbi__uint32 n = x*out_n;
+      i = 0;
+#ifdef STBI_SSE2
+      if (simd) {
+         for (; i + 8 <= n; i += 8, cur += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) cur);
+            _mm_storeu_si128((__m128i *) cur, _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+         }
+      }
+#endif
+      for (; i < n; ++i, cur += 2) {
+         *(stbi__uint16 *) cur = (cur[0] << 8) | cur[1];
+      }
+   }
+}
+
 // create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+// rows of an image or interlace pass, unfiltered as their raw data arrives: a
+// filter byte then img_width_bytes for each
+typedef struct
+{
+   stbi__uint32 x, y, j; // j is the next row to unfilter
+   stbi__uint32 img_width_bytes;
+   int out_n, depth, color, simd;
+} stbi__png_rows;
+
+static int stbi__png_rows_begin(stbi__png *a, stbi__png_rows *r, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
    int bytes = (depth == 16? 2 : 1);
+   int img_n = a->s->img_n;
+
+   STBI_ASSERT(out_n == a->s->img_n || out_n == a->s->img_n+1);
+   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, out_n*bytes, 0); // extra bytes to write off the end into
+   if (!a->out) return stbi__err("outofmem", "Out of memory");
+
+   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   r->img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+   r->x = x;
+   r->y = y;
+   r->j = 0;
+   r->out_n = out_n;
+   r->depth = depth;
+   r->color = color;
+   r->simd = 0;
+#ifdef STBI_SSE2
+   r->simd = stbi__png_simd_level >= 1 && stbi__sse2_available();
+#endif
+   return 1;
+}
+
+// unfilters rows r->j up to end from raw, which holds the data of row r->j on; on
+// an error r->j is left at the bad row
+static int stbi__png_rows_run(stbi__png *a, stbi__png_rows *r, stbi_uc *raw, stbi__uint32 end)
+{
+   int bytes = (r->depth == 16? 2 : 1);
    stbi__context *s = a->s;
-   stbi__uint32 i,j,stride = x*out_n*bytes;
-   stbi__uint32 img_len, img_width_bytes;
+   stbi__uint32 i,j,x = r->x,stride = x*r->out_n*bytes;
+   stbi__uint32 img_width_bytes = r->img_width_bytes;
    int k;
    int img_n = s->img_n; // copy it into a local for later
+   int out_n = r->out_n, depth = r->depth, color = r->color, simd = r->simd;
 
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
 
-   STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
-   if (!a->out) return stbi__err("outofmem", "Out of memory");
-
-   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
-   img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-   img_len = (img_width_bytes + 1) * y;
-
-   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-   // so just check for raw_len < img_len always.
-   if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
-
-   for (j=0; j < y; ++j) {
+   for (j=r->j; j < end; r->j = ++j) {
       stbi_uc *cur = a->out + stride*j;
       stbi_uc *prior;
       int filter = *raw++;
 
+      if (j >= 2) stbi__png_finish_row(a, j-2, out_n, x, depth, color, img_width_bytes, simd);
+
       if (filter > 4)
          return stbi__err("invalid filter","Corrupt PNG");
 
@@ -4581,6 +5807,13 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
+#ifdef STBI_SSE2
+      if (simd && depth >= 8 && stbi__png_unfilter_row_simd(cur, prior, raw, filter, x, filter_bytes, output_bytes)) {
+         raw += x*filter_bytes;
+         continue;
+      }
+#endif
+
       // handle first byte explicitly
       for (k=0; k < filter_bytes; ++k) {
          switch (filter) {
@@ -4660,91 +5893,29 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
    }
 
-   // we make a separate pass to expand bits to pixels; for performance,
-   // this could run two scanlines behind the above code, so it won't
-   // intefere with filtering but will still be in the cache.
-   if (depth < 8) {
-      for (j=0; j < y; ++j) {
-         stbi_uc *cur = a->out + stride*j;
-         stbi_uc *in  = a->out + stride*j + x*out_n - img_width_bytes;
-         // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
-         // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
-         stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
-
-         // note that the final byte might overshoot and write more data than desired.
-         // we can allocate enough data that this never writes out of memory, but it
-         // could also overwrite the next scanline. can it overwrite non-empty data
-         // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
-         // so we need to explicitly clamp the final ones
-
-         if (depth == 4) {
-            for (k=x*img_n; k >= 2; k-=2, ++in) {
-               *cur++ = scale * ((*in >> 4)       );
-               *cur++ = scale * ((*in     ) & 0x0f);
-            }
-            if (k > 0) *cur++ = scale * ((*in >> 4)       );
-         } else if (depth == 2) {
-            for (k=x*img_n; k >= 4; k-=4, ++in) {
-               *cur++ = scale * ((*in >> 6)       );
-               *cur++ = scale * ((*in >> 4) & 0x03);
-               *cur++ = scale * ((*in >> 2) & 0x03);
-               *cur++ = scale * ((*in     ) & 0x03);
-            }
-            if (k > 0) *cur++ = scale * ((*in >> 6)       );
-            if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
-            if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
-         } else if (depth == 1) {
-            for (k=x*img_n; k >= 8; k-=8, ++in) {
-               *cur++ = scale * ((*in >> 7)       );
-               *cur++ = scale * ((*in >> 6) & 0x01);
-               *cur++ = scale * ((*in >> 5) & 0x01);
-               *cur++ = scale * ((*in >> 4) & 0x01);
-               *cur++ = scale * ((*in >> 3) & 0x01);
-               *cur++ = scale * ((*in >> 2) & 0x01);
-               *cur++ = scale * ((*in >> 1) & 0x01);
-               *cur++ = scale * ((*in     ) & 0x01);
-            }
-            if (k > 0) *cur++ = scale * ((*in >> 7)       );
-            if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
-            if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
-            if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
-            if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
-            if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
-            if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
-         }
-         if (img_n != out_n) {
-            int q;
-            // insert alpha = 255
-            cur = a->out + stride*j;
-            if (img_n == 1) {
-               for (q=x-1; q >= 0; --q) {
-                  cur[q*2+1] = 255;
-                  cur[q*2+0] = cur[q];
-               }
-            } else {
-               STBI_ASSERT(img_n == 3);
-               for (q=x-1; q >= 0; --q) {
-                  cur[q*4+3] = 255;
-                  cur[q*4+2] = cur[q*3+2];
-                  cur[q*4+1] = cur[q*3+1];
-                  cur[q*4+0] = cur[q*3+0];
-               }
-            }
-         }
-      }
-   } else if (depth == 16) {
-      // force the image data from big-endian to platform-native.
-      // this is done in a separate pass due to the decoding relying
-      // on the data being untouched, but could probably be done
-      // per-line during decode if care is taken.
-      stbi_uc *cur = a->out;
-      stbi__uint16 *cur16 = (stbi__uint16*)cur;
-
-      for(i=0; i < x*y*out_n; ++i,cur16++,cur+=2) {
-         *cur16 = (cur[0] << 8) | cur[1];
-      }
-   }
+   return 1;
+}
 
+// the last two rows, once all are unfiltered
+static void stbi__png_rows_end(stbi__png *a, stbi__png_rows *r)
+{
+   stbi__uint32 j;
+   for (j = r->y >= 2 ? r->y-2 : 0; j < r->y; ++j)
+      stbi__png_finish_row(a, j, r->out_n, r->x, r->depth, r->color, r->img_width_bytes, r->simd);
+}
+
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+   stbi__png_rows r;
+   if (!stbi__png_rows_begin(a, &r, out_n, x, y, depth, color)) return 0;
+
+   // we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+   // so just check for raw_len < img_len always.
+   if (raw_len < (r.img_width_bytes + 1) * y) return stbi__err("not enough pixels","Corrupt PNG");
+
+   if (!stbi__png_rows_run(a, &r, raw, y)) return 0;
+   stbi__png_rows_end(a, &r);
    return 1;
 }
 
@@ -4792,6 +5963,170 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
+// input pieces are at most this long, so rows are unfiltered while they're still in
+// cache; from a callback the pieces are read into idata
+#define STBI__PNG_PIECE 16384
+// inflate output for images that aren't interlaced goes through a buffer of this
+// plus a row: the 32K zlib window, a partial row, and room for a stored block
+#define STBI__PNG_WINDOW (4*32768)
+
+typedef struct
+{
+   stbi__png *png;
+   stbi__png_rows rows; // for images that aren't interlaced
+   int unfilter, rows_failed;
+   stbi__uint32 dropped; // output slid out of the front of the buffer
+} stbi__png_stream;
+
+// unfilters the rows inflated so far; a bad row stops the inflate, and is found
+// again once zlib gives up
+static void stbi__png_stream_rows(stbi__png_stream *st, stbi__zbuf *zb)
+{
+   stbi__uint32 stride = st->rows.img_width_bytes + 1;
+   stbi__uint32 rows, at;
+   if (!st->unfilter || st->rows_failed || st->rows.j >= st->rows.y) return;
+   rows = (st->dropped + (stbi__uint32) (zb->zout - zb->zout_start)) / stride;
+   if (rows > st->rows.y) rows = st->rows.y;
+   at = st->rows.j * stride - st->dropped;
+   if (!stbi__png_rows_run(st->png, &st->rows, (stbi_uc *) zb->zout_start + at, rows)) st->rows_failed = 1;
+}
+
+static int stbi__png_slide(stbi__zbuf *zb)
+{
+   stbi__png_stream *st = (stbi__png_stream *) zb->refill_user;
+   stbi__uint32 used = (stbi__uint32) (zb->zout - zb->zout_start), keep;
+
+   stbi__png_stream_rows(st, zb);
+   if (st->rows_failed) return 0;
+   // the zlib window, and the row still arriving
+   keep = used < 32768 ? used : 32768;
+   if (st->rows.j < st->rows.y) {
+      stbi__uint32 partial = st->dropped + used - st->rows.j * (st->rows.img_width_bytes + 1);
+      if (partial > keep) keep = partial;
+   }
+   if (keep == used) return 1;
+   if (st->dropped > UINT_MAX - (used - keep)) return stbi__err("too large", "Corrupt PNG");
+   memmove(zb->zout_start, zb->zout - keep, keep);
+   zb->zout = zb->zout_start + keep;
+   st->dropped += used - keep;
+   return 1;
+}
+
+static int stbi__png_refill(stbi__zbuf *zb)
+{
+   stbi__png_stream *st = (stbi__png_stream *) zb->refill_user;
+   stbi__png *z = st->png;
+   stbi__context *s = z->s;
+   stbi__uint32 n;
+
+   stbi__png_stream_rows(st, zb);
+   if (st->rows_failed) return 0;
+
+   while (z->idat_left == 0) {
+      stbi__pngchunk c;
+      if (z->idat_ended) return 0;
+      stbi__get32be(s); // CRC of the IDAT chunk finished
+      c = stbi__get_chunk_header(s);
+      if (c.type != STBI__PNG_TYPE('I','D','A','T')) {
+         z->idat_ended = 1;
+         z->next_chunk = c;
+         return 0;
+      }
+      z->idat_left = c.length;
+   }
+
+   n = z->idat_left < STBI__PNG_PIECE ? z->idat_left : STBI__PNG_PIECE;
+   if (s->io.read == NULL) {
+      // from memory the pieces are the file's own bytes
+      stbi__uint32 avail = (stbi__uint32) (s->img_buffer_end - s->img_buffer);
+      if (n > avail) n = avail;
+      if (n == 0) return 0;
+      zb->zbuffer = s->img_buffer;
+      s->img_buffer += n;
+   } else {
+      if (z->idata == NULL) {
+         z->idata = (stbi_uc *) stbi__malloc(STBI__PNG_PIECE);
+         if (z->idata == NULL) return 0;
+      }
+      if (!stbi__getn(s, z->idata, n)) return 0;
+      zb->zbuffer = z->idata;
+   }
+   zb->zbuffer_end = zb->zbuffer + n;
+   z->idat_left -= n;
+   return 1;
+}
+
+// inflates the zlib stream of the IDAT chunk whose header was just read and the
+// ones straight after it. rows of images that aren't interlaced are unfiltered
+// between pieces of input and slid out of a small buffer once used; interlaced
+// images are inflated whole into a buffer sized from the header. afterwards the
+// stream is positioned at the CRC of the last IDAT chunk read, or idat_ended is
+// set and next_chunk holds the header after it
+static int stbi__png_decode_idat(stbi__png *z, stbi__uint32 length, int out_n, int color, int interlace, int parse_header)
+{
+   stbi__context *s = z->s;
+   stbi__png_stream st;
+   stbi__zbuf zb;
+   stbi__uint32 raw_len = 0, width_bytes, olen;
+   int p, ok;
+
+   // raw data size: a filter byte and a row of bytes for every row of every pass
+   if (!stbi__mad3sizes_valid(s->img_n, s->img_x, z->depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   for (p=0; p < (interlace ? 7 : 1); ++p) {
+      static const int xorig[] = { 0,4,0,2,0,1,0 };
+      static const int yorig[] = { 0,0,4,0,2,0,1 };
+      static const int xspc[]  = { 8,8,4,4,2,2,1 };
+      static const int yspc[]  = { 8,8,8,4,4,2,2 };
+      stbi__uint32 x = interlace ? (s->img_x - xorig[p] + xspc[p]-1) / xspc[p] : s->img_x;
+      stbi__uint32 y = interlace ? (s->img_y - yorig[p] + yspc[p]-1) / yspc[p] : s->img_y;
+      if (x && y) {
+         width_bytes = ((s->img_n * x * z->depth) + 7) >> 3;
+         if (!stbi__mad2sizes_valid(width_bytes + 1, y, raw_len)) return stbi__err("too large", "Corrupt PNG");
+         raw_len += (width_bytes + 1) * y;
+      }
+   }
+
+   st.png = z;
+   st.unfilter = !interlace;
+   st.rows_failed = 0;
+   st.dropped = 0;
+   olen = raw_len;
+   if (st.unfilter) {
+      if (!stbi__png_rows_begin(z, &st.rows, out_n, s->img_x, s->img_y, z->depth, color)) return 0;
+      if (raw_len - st.rows.img_width_bytes - 1 > STBI__PNG_WINDOW) olen = st.rows.img_width_bytes + 1 + STBI__PNG_WINDOW;
+   }
+
+   z->idat_left = length;
+   z->idat_ended = 0;
+   zb.zbuffer = zb.zbuffer_end = NULL;
+   zb.refill = stbi__png_refill;
+   zb.refill_user = &st;
+   zb.slide = st.unfilter ? stbi__png_slide : NULL;
+   z->expanded = (stbi_uc *) stbi__malloc(olen ? olen : 1);
+   if (z->expanded == NULL) return stbi__err("outofmem", "Out of memory");
+   // data past the image (issue #276) is still inflated: through the window, or
+   // growing the buffer of an interlaced image
+   ok = stbi__do_zlib(&zb, (char *) z->expanded, olen, 1, parse_header);
+   z->expanded = (stbi_uc *) zb.zout_start;
+   if (!ok && !st.rows_failed) return 0; // zlib should set error
+   STBI_FREE(z->idata); z->idata = NULL;
+
+   if (st.unfilter) {
+      st.rows_failed = 0;
+      stbi__png_stream_rows(&st, &zb);
+      if (st.rows_failed) return 0;
+      if (st.rows.j < st.rows.y) return stbi__err("not enough pixels","Corrupt PNG");
+      stbi__png_rows_end(z, &st.rows);
+   } else {
+      if (!stbi__create_png_image(z, z->expanded, (stbi__uint32) (zb.zout - zb.zout_start), out_n, z->depth, color, interlace)) return 0;
+   }
+   STBI_FREE(z->expanded); z->expanded = NULL;
+
+   // the rest of the last chunk read, after the end of the zlib stream
+   if (!z->idat_ended) stbi__skip(s, z->idat_left);
+   return 1;
+}
+
 static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
 {
    stbi__context *s = z->s;
@@ -4935,27 +6270,33 @@ static void stbi__de_iphone(stbi__png *z)
    }
 }
 
-#define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
-
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
    stbi_uc palette[1024], pal_img_n=0;
    stbi_uc has_trans=0, tc[3]={0};
    stbi__uint16 tc16[3];
-   stbi__uint32 ioff=0, idata_limit=0, i, pal_len=0;
+   stbi__uint32 i, pal_len=0;
    int first=1,k,interlace=0, color=0, is_iphone=0;
    stbi__context *s = z->s;
 
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->idat_ended = 0;
 
    if (!stbi__check_png_header(s)) return 0;
 
    if (scan == STBI__SCAN_type) return 1;
 
    for (;;) {
-      stbi__pngchunk c = stbi__get_chunk_header(s);
+      stbi__pngchunk c;
+      if (z->idat_ended) {
+         // the IDAT decode read this header, and the CRC before it
+         c = z->next_chunk;
+         z->idat_ended = 0;
+      } else {
+         c = stbi__get_chunk_header(s);
+      }
       switch (c.type) {
          case STBI__PNG_TYPE('C','g','B','I'):
             is_iphone = 1;
@@ -5008,7 +6349,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 
          case STBI__PNG_TYPE('t','R','N','S'): {
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if (z->idata) return stbi__err("tRNS after IDAT","Corrupt PNG");
+            if (z->out) return stbi__err("tRNS after IDAT","Corrupt PNG");
             if (pal_img_n) {
                if (scan == STBI__SCAN_header) { s->img_n = 4; return 1; }
                if (pal_len == 0) return stbi__err("tRNS before PLTE","Corrupt PNG");
@@ -5033,38 +6374,24 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (pal_img_n && !pal_len) return stbi__err("no PLTE","Corrupt PNG");
             if (scan == STBI__SCAN_header) { s->img_n = pal_img_n; return 1; }
-            if ((int)(ioff + c.length) < (int)ioff) return 0;
-            if (ioff + c.length > idata_limit) {
-               stbi__uint32 idata_limit_old = idata_limit;
-               stbi_uc *p;
-               if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
-               while (ioff + c.length > idata_limit)
-                  idata_limit *= 2;
-               STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
-               z->idata = p;
+            if (z->out) {
+               // IDAT after the end of the zlib stream
+               stbi__skip(s, c.length);
+               break;
             }
-            if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
-            ioff += c.length;
+            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+               s->img_out_n = s->img_n+1;
+            else
+               s->img_out_n = s->img_n;
+            if (!stbi__png_decode_idat(z, c.length, s->img_out_n, color, interlace, !is_iphone)) return 0;
+            if (z->idat_ended) continue;
             break;
          }
 
          case STBI__PNG_TYPE('I','E','N','D'): {
-            stbi__uint32 raw_len, bpl;
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
-            if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
-            // initial guess for decoded data size to avoid unnecessary reallocs
-            bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-            raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
-               s->img_out_n = s->img_n+1;
-            else
-               s->img_out_n = s->img_n;
-            if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            if (z->out == NULL) return stbi__err("no IDAT","Corrupt PNG");
             if (has_trans) {
                if (z->depth == 16) {
                   if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
@@ -5085,7 +6412,6 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
             // end of PNG chunk, read and skip CRC
             stbi__get32be(s);
             return 1;